@@ -0,0 +1,636 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * batch.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "mkfs.h"
+#include "util.h"
+
+typedef struct {
+	/* copy of the global options, with the pack and output file set */
+	options_t opt;
+	sqfs_writer_t sqfs;
+	char *outfile;
+	char *infile;
+	bool initialized;
+} image_t;
+
+/*
+  An input file is identified by device and inode number, so that different
+  paths to the same file are only read once. Where inode numbers are not
+  available, the path is used instead.
+
+  If several images pack a file the same way, its data blocks are only
+  compressed for the first one and then copied over to the others.
+ */
+typedef struct input_t {
+	char *path;
+	sqfs_u64 dev;
+	sqfs_u64 ino;
+	size_t image;
+	file_info_t *fi;
+
+	/* if set, the data blocks are copied from the image of this input */
+	struct input_t *source;
+
+	/* checksums of the uncompressed data blocks, for deduplication */
+	sqfs_u32 *checksums;
+
+	/* the tail end of a file with copied blocks, packed on its own */
+	sqfs_inode_generic_t *tail;
+} input_t;
+
+static char *next_token(char **line)
+{
+	char *start = *line, *end;
+
+	while (isspace(*start))
+		++start;
+
+	end = start;
+	while (*end != '\0' && !isspace(*end))
+		++end;
+
+	*line = end;
+	return end == start ? NULL : strndup(start, end - start);
+}
+
+static int read_manifest(const char *filename, image_t **out, size_t *count)
+{
+	size_t n = 0, lineno = 0, num = 0, max = 0;
+	image_t *list = NULL, *new;
+	char *line = NULL, *ptr;
+	ssize_t ret;
+	FILE *fp;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL) {
+		perror(filename);
+		return -1;
+	}
+
+	for (;;) {
+		errno = 0;
+		ret = getline(&line, &n, fp);
+		++lineno;
+
+		if (ret < 0) {
+			if (errno == 0)
+				break;
+			perror(filename);
+			goto fail;
+		}
+
+		ptr = line;
+		while (isspace(*ptr))
+			++ptr;
+
+		if (*ptr == '\0' || *ptr == '#')
+			continue;
+
+		if (num == max) {
+			max = max ? max * 2 : 8;
+			new = realloc(list, sizeof(list[0]) * max);
+			if (new == NULL) {
+				perror(filename);
+				goto fail;
+			}
+			list = new;
+		}
+
+		memset(list + num, 0, sizeof(list[0]));
+		list[num].outfile = next_token(&ptr);
+		list[num].infile = next_token(&ptr);
+		++num;
+
+		while (isspace(*ptr))
+			++ptr;
+
+		if (list[num - 1].infile == NULL || *ptr != '\0') {
+			fprintf(stderr, "%s: %lu: expected an output image "
+				"and a pack file\n", filename,
+				(unsigned long)lineno);
+			goto fail;
+		}
+	}
+
+	if (num == 0) {
+		fprintf(stderr, "%s: no images specified\n", filename);
+		goto fail;
+	}
+
+	free(line);
+	fclose(fp);
+	*out = list;
+	*count = num;
+	return 0;
+fail:
+	while (num--) {
+		free(list[num].outfile);
+		free(list[num].infile);
+	}
+	free(list);
+	free(line);
+	fclose(fp);
+	return -1;
+}
+
+static int init_image(image_t *img, const options_t *opt,
+		      sqfs_executor_t *pool, sqfs_buffer_pool_t *buffers,
+		      void *selinux_handle)
+{
+	img->opt = *opt;
+	img->opt.infile = img->infile;
+	img->opt.cfg.filename = img->outfile;
+	img->opt.cfg.exec = pool;
+	img->opt.cfg.pool = buffers;
+
+	if (sqfs_writer_init(&img->sqfs, &img->opt.cfg))
+		return -1;
+
+	img->initialized = true;
+
+	if (read_fstree(&img->sqfs.fs, &img->opt, img->sqfs.xwr,
+			selinux_handle, pool)) {
+		return -1;
+	}
+
+	if (opt->force_uid || opt->force_gid)
+		override_owner_dfs(&img->opt, img->sqfs.fs.root);
+
+	if (fstree_post_process(&img->sqfs.fs))
+		return -1;
+
+	if (apply_pack_hints(&img->sqfs.fs, &img->opt))
+		return -1;
+
+	return reserve_tail_ends(&img->sqfs);
+}
+
+/*
+  Input paths are relative to the pack directory if one is set, or to the
+  directory of the pack file otherwise. Since every image can have a
+  different pack file, input paths are resolved up front instead of
+  changing the working directory.
+ */
+static char *resolve_input(const image_t *img, file_info_t *fi)
+{
+	const char *base = img->opt.packdir, *path, *sep;
+	char *node_path = NULL, *out;
+	size_t baselen;
+	int ret;
+
+	if (fi->input_file == NULL) {
+		node_path = fstree_get_path(container_of(fi, tree_node_t,
+							 data.file));
+		if (node_path == NULL)
+			return NULL;
+
+		ret = canonicalize_name(node_path);
+		assert(ret == 0);
+		path = node_path;
+	} else {
+		path = fi->input_file;
+	}
+
+	if (path[0] == '/') {
+		baselen = 0;
+	} else if (base != NULL) {
+		baselen = strlen(base);
+	} else {
+		base = img->infile;
+		sep = strrchr(base, '/');
+		baselen = sep == NULL ? 0 : (size_t)(sep - base);
+	}
+
+	out = malloc(baselen + strlen(path) + 2);
+	if (out != NULL) {
+		if (baselen > 0) {
+			memcpy(out, base, baselen);
+			out[baselen] = '/';
+			strcpy(out + baselen + 1, path);
+		} else {
+			strcpy(out, path);
+		}
+	}
+
+	free(node_path);
+	return out;
+}
+
+static int compare_file(const input_t *l, const input_t *r)
+{
+	if (l->dev != r->dev)
+		return l->dev < r->dev ? -1 : 1;
+
+	if (l->ino != r->ino)
+		return l->ino < r->ino ? -1 : 1;
+
+	return l->ino == 0 ? strcmp(l->path, r->path) : 0;
+}
+
+static int input_compare(const void *lhs, const void *rhs)
+{
+	const input_t *l = lhs, *r = rhs;
+	int ret = compare_file(l, r);
+
+	if (ret == 0)
+		ret = l->image < r->image ? -1 : (l->image > r->image ? 1 : 0);
+
+	return ret;
+}
+
+static int collect_inputs(image_t *images, size_t num_images,
+			  input_t **out, size_t *count)
+{
+	size_t i, num = 0, max = 0;
+	input_t *list = NULL, *new;
+	file_info_t *fi;
+	struct stat sb;
+
+	for (i = 0; i < num_images; ++i) {
+		for (fi = images[i].sqfs.fs.files; fi != NULL; fi = fi->next) {
+			if (num == max) {
+				max = max ? max * 2 : 128;
+				new = realloc(list, sizeof(list[0]) * max);
+				if (new == NULL)
+					goto fail_errno;
+				list = new;
+			}
+
+			memset(list + num, 0, sizeof(list[0]));
+			list[num].image = i;
+			list[num].fi = fi;
+			list[num].path = resolve_input(images + i, fi);
+			if (list[num].path == NULL)
+				goto fail_errno;
+			++num;
+
+			if (stat(list[num - 1].path, &sb) != 0) {
+				perror(list[num - 1].path);
+				goto fail;
+			}
+
+			list[num - 1].dev = sb.st_dev;
+			list[num - 1].ino = sb.st_ino;
+		}
+	}
+
+	if (num > 0)
+		qsort(list, num, sizeof(list[0]), input_compare);
+
+	*out = list;
+	*count = num;
+	return 0;
+fail_errno:
+	perror("collecting input files");
+fail:
+	while (num--)
+		free(list[num].path);
+	free(list);
+	return -1;
+}
+
+/*
+  Pack the tail end of a file that has its data blocks copied from another
+  image, as a file of its own that consists of nothing but a fragment.
+ */
+static int pack_tail_end(sqfs_block_processor_t *data, input_t *in,
+			 const sqfs_u8 *buffer, size_t size, int flags)
+{
+	int ret;
+
+	ret = sqfs_block_processor_begin_file(data, &in->tail, flags);
+	if (ret)
+		return ret;
+
+	ret = sqfs_block_processor_append(data, buffer, size);
+	if (ret)
+		return ret;
+
+	return sqfs_block_processor_end_file(data);
+}
+
+/*
+  Read an input file once and feed it to the block processors of all images
+  in the given list. The list must not contain the same image twice.
+
+  The data blocks are only compressed for the first image in the list and
+  for images that pack the file differently. The other images merely get
+  the tail end, their data blocks are filled in later by copy_blocks.
+ */
+static int pack_shared_file(image_t *images, input_t *list, size_t count,
+			    sqfs_u8 *buffer, size_t bufsz,
+			    const options_t *opt)
+{
+	const char *path = list[0].path;
+	sqfs_u64 filesize, offset, index, num_blocks;
+	sqfs_inode_generic_t **inode;
+	sqfs_block_processor_t *data;
+	int flags, pack_flags, ret;
+	bool have_copies = false;
+	sqfs_file_t *file;
+	size_t i, diff;
+
+	if (!opt->cfg.quiet)
+		printf("packing %s\n", path);
+
+	file = sqfs_open_file(path, SQFS_FILE_OPEN_READ_ONLY);
+	if (file == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	filesize = file->get_size(file);
+	flags = get_pack_flags(list[0].fi, filesize, opt);
+
+	num_blocks = filesize / bufsz;
+	if ((filesize % bufsz) != 0 && (flags & SQFS_BLK_DONT_FRAGMENT))
+		num_blocks += 1;
+
+	for (i = 1; num_blocks > 0 && i < count; ++i) {
+		if (get_pack_flags(list[i].fi, filesize, opt) == flags) {
+			list[i].source = list;
+			have_copies = true;
+		}
+	}
+
+	if (have_copies) {
+		list[0].checksums = calloc(num_blocks, sizeof(sqfs_u32));
+		if (list[0].checksums == NULL) {
+			perror(path);
+			goto fail;
+		}
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (list[i].source != NULL)
+			continue;
+
+		data = images[list[i].image].sqfs.data;
+		inode = (sqfs_inode_generic_t **)&list[i].fi->user_ptr;
+		pack_flags = get_pack_flags(list[i].fi, filesize, opt);
+
+		ret = sqfs_block_processor_begin_file(data, inode, pack_flags);
+		if (ret) {
+			sqfs_perror(path, "beginning file data blocks", ret);
+			goto fail;
+		}
+	}
+
+	for (offset = 0; offset < filesize; offset += diff) {
+		diff = bufsz;
+		if (diff > filesize - offset)
+			diff = filesize - offset;
+
+		ret = file->read_at(file, offset, buffer, diff);
+		if (ret) {
+			sqfs_perror(path, "reading file range", ret);
+			goto fail;
+		}
+
+		index = offset / bufsz;
+		if (have_copies && index < num_blocks)
+			list[0].checksums[index] = xxh32(buffer, diff);
+
+		for (i = 0; i < count; ++i) {
+			data = images[list[i].image].sqfs.data;
+
+			if (list[i].source == NULL) {
+				ret = sqfs_block_processor_append(data, buffer,
+								  diff);
+			} else if (index >= num_blocks) {
+				ret = pack_tail_end(data, list + i, buffer,
+						    diff, flags);
+			} else {
+				ret = 0;
+			}
+
+			if (ret) {
+				sqfs_perror(path, "packing file data", ret);
+				goto fail;
+			}
+		}
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (list[i].source != NULL)
+			continue;
+
+		data = images[list[i].image].sqfs.data;
+
+		ret = sqfs_block_processor_end_file(data);
+		if (ret) {
+			sqfs_perror(path, "finishing file data", ret);
+			goto fail;
+		}
+	}
+
+	sqfs_destroy(file);
+	return 0;
+fail:
+	sqfs_destroy(file);
+	return -1;
+}
+
+/*
+  Copy the already compressed data blocks of an input over from the image
+  they were packed into and create the inode from the one of that image.
+  The block processors of both images must have been synced before.
+ */
+static int copy_blocks(image_t *images, input_t *in, sqfs_u8 *buffer,
+		       const options_t *opt)
+{
+	const input_t *src = in->source;
+	sqfs_file_t *infile = images[src->image].sqfs.outfile;
+	sqfs_block_writer_t *wr = images[in->image].sqfs.blkwr;
+	sqfs_inode_generic_t *srcinode = src->fi->user_ptr, *inode;
+	sqfs_u32 size, flags, frag_idx, frag_offset;
+	sqfs_u64 filesize, offset, location = 0;
+	int pack_flags, ret;
+	size_t i, count;
+
+	sqfs_inode_get_file_size(srcinode, &filesize);
+	sqfs_inode_get_file_block_start(srcinode, &offset);
+	count = sqfs_inode_get_file_block_count(srcinode);
+	pack_flags = get_pack_flags(in->fi, filesize, opt);
+
+	for (i = 0; i < count; ++i) {
+		size = SQFS_ON_DISK_BLOCK_SIZE(srcinode->extra[i]);
+
+		flags = pack_flags;
+		if (i == 0)
+			flags |= SQFS_BLK_FIRST_BLOCK;
+		if (i == count - 1)
+			flags |= SQFS_BLK_LAST_BLOCK;
+
+		if (size == 0) {
+			flags |= SQFS_BLK_IS_SPARSE;
+		} else {
+			if (SQFS_IS_BLOCK_COMPRESSED(srcinode->extra[i]))
+				flags |= SQFS_BLK_IS_COMPRESSED;
+
+			ret = infile->read_at(infile, offset, buffer, size);
+			if (ret) {
+				sqfs_perror(in->path, "reading packed data",
+					    ret);
+				return -1;
+			}
+
+			offset += size;
+		}
+
+		ret = sqfs_block_writer_write(wr, size, src->checksums[i],
+					      flags, buffer, &location);
+		if (ret) {
+			sqfs_perror(in->path, "writing copied data", ret);
+			return -1;
+		}
+	}
+
+	inode = malloc(sizeof(*inode) + srcinode->payload_bytes_used);
+	if (inode == NULL) {
+		perror(in->path);
+		return -1;
+	}
+
+	memcpy(inode, srcinode, sizeof(*inode) + srcinode->payload_bytes_used);
+	inode->payload_bytes_available = srcinode->payload_bytes_used;
+	sqfs_inode_set_file_block_start(inode, location);
+
+	/* a sparse tail end is part of the block list, not a fragment */
+	frag_idx = 0xFFFFFFFF;
+	frag_offset = 0xFFFFFFFF;
+
+	if (in->tail != NULL) {
+		sqfs_inode_get_frag_location(in->tail, &frag_idx,
+					     &frag_offset);
+		free(in->tail);
+		in->tail = NULL;
+	}
+
+	sqfs_inode_set_frag_location(inode, frag_idx, frag_offset);
+	in->fi->user_ptr = inode;
+	return 0;
+}
+
+static int pack_inputs(image_t *images, size_t num_images,
+		       input_t *list, size_t count, const options_t *opt)
+{
+	size_t i, j, bufsz = opt->cfg.block_size;
+	sqfs_u8 *buffer;
+	int ret = 0;
+
+	buffer = malloc(bufsz);
+	if (buffer == NULL) {
+		perror("allocating input buffer");
+		return -1;
+	}
+
+	/* runs of the same input file, with at most one entry per image */
+	for (i = 0; ret == 0 && i < count; i = j) {
+		for (j = i + 1; j < count; ++j) {
+			if (compare_file(list + j, list + i) != 0)
+				break;
+			if (list[j].image == list[j - 1].image)
+				break;
+		}
+
+		ret = pack_shared_file(images, list + i, j - i,
+				       buffer, bufsz, opt);
+	}
+
+	/*
+	  All blocks must be on disk before they can be copied. The file done
+	  callback of the block processor would report the source files
+	  earlier, but the block writer of the target image could then still
+	  be in the middle of writing the blocks of one of its own files.
+	 */
+	for (i = 0; ret == 0 && i < num_images; ++i) {
+		ret = sqfs_block_processor_sync(images[i].sqfs.data);
+		if (ret) {
+			sqfs_perror(images[i].outfile, "packing file data",
+				    ret);
+			ret = -1;
+		}
+	}
+
+	for (i = 0; ret == 0 && i < count; ++i) {
+		if (list[i].source != NULL)
+			ret = copy_blocks(images, list + i, buffer, opt);
+	}
+
+	free(buffer);
+	return ret;
+}
+
+int build_batch(const options_t *opt, void *selinux_handle)
+{
+	size_t i, num_images, num_inputs = 0;
+	sqfs_buffer_pool_t *buffers = NULL;
+	image_t *images = NULL;
+	input_t *inputs = NULL;
+	sqfs_executor_t *pool;
+	int status = -1;
+
+	if (read_manifest(opt->batch, &images, &num_images))
+		return -1;
+
+	pool = thread_pool_create(opt->cfg.num_jobs);
+	if (pool == NULL)
+		goto out_images;
+
+	/* all images share one set of huge page backed buffers */
+	if (opt->cfg.huge_pages) {
+		buffers = sqfs_buffer_pool_create(opt->cfg.block_size,
+						  SQFS_BUFFER_POOL_HUGE_PAGES);
+		if (buffers == NULL) {
+			perror("creating buffer pool");
+			goto out;
+		}
+	}
+
+	for (i = 0; i < num_images; ++i) {
+		if (init_image(images + i, opt, pool, buffers, selinux_handle))
+			goto out;
+	}
+
+	if (collect_inputs(images, num_images, &inputs, &num_inputs))
+		goto out;
+
+	if (pack_inputs(images, num_images, inputs, num_inputs, opt))
+		goto out;
+
+	for (i = 0; i < num_images; ++i) {
+		if (sqfs_writer_finish(&images[i].sqfs, &images[i].opt.cfg))
+			goto out;
+	}
+
+	status = 0;
+out:
+	for (i = 0; i < num_images; ++i) {
+		if (images[i].initialized) {
+			sqfs_writer_cleanup(&images[i].sqfs,
+					    status == 0 ? EXIT_SUCCESS :
+					    EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < num_inputs; ++i) {
+		free(inputs[i].path);
+		free(inputs[i].checksums);
+		free(inputs[i].tail);
+	}
+	free(inputs);
+	if (buffers != NULL)
+		sqfs_destroy(buffers);
+	thread_pool_destroy(pool);
+out_images:
+	for (i = 0; i < num_images; ++i) {
+		free(images[i].outfile);
+		free(images[i].infile);
+	}
+	free(images);
+	return status;
+}
@@ -6,6 +6,10 @@
  */
 #include "mkfs.h"
 
+#ifdef HAVE_FNMATCH_H
+#include <fnmatch.h>
+#endif
+
 static int set_working_dir(options_t *opt)
 {
 	const char *ptr;
@@ -39,8 +43,7 @@ static int set_working_dir(options_t *opt)
 	return 0;
 }
 
-static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
-		      options_t *opt)
+static int pack_files(sqfs_writer_t *sqfs, options_t *opt)
 {
 	sqfs_inode_generic_t **inode_ptr;
 	sqfs_u64 filesize;
@@ -49,13 +52,17 @@ static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
 	const char *path;
 	char *node_path;
 	file_info_t *fi;
+	struct stat sb;
 	int flags;
 	int ret;
 
 	if (set_working_dir(opt))
 		return -1;
 
-	for (fi = fs->files; fi != NULL; fi = fi->next) {
+	if (opt->read_order != READ_ORDER_TREE)
+		return pack_files_ordered(sqfs, opt);
+
+	for (fi = sqfs->fs.files; fi != NULL; fi = fi->next) {
 		if (fi->input_file == NULL) {
 			node = container_of(fi, tree_node_t, data.file);
 
@@ -74,6 +81,26 @@ static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
 			path = fi->input_file;
 		}
 
+		inode_ptr = (sqfs_inode_generic_t **)&fi->user_ptr;
+
+		/* only needed to match the input against a checkpoint */
+		if (sqfs->ckpt != NULL) {
+			if (stat(path, &sb) != 0) {
+				perror(path);
+				free(node_path);
+				return -1;
+			}
+
+			ret = sqfs_writer_resume_file(sqfs, path, sb.st_size,
+						      sb.st_mtime, inode_ptr);
+			if (ret != 0) {
+				free(node_path);
+				if (ret < 0)
+					return -1;
+				continue;
+			}
+		}
+
 		if (!opt->cfg.quiet)
 			printf("packing %s\n", path);
 
@@ -84,16 +111,17 @@ static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
 			return -1;
 		}
 
-		flags = 0;
 		filesize = file->get_size(file);
+		flags = get_pack_flags(fi, filesize, opt);
 
-		if (opt->no_tail_packing && filesize > opt->cfg.block_size)
-			flags |= SQFS_BLK_DONT_FRAGMENT;
+		ret = write_data_from_file(path, sqfs->data, inode_ptr,
+					   file, flags);
+		sqfs_destroy(file);
 
-		inode_ptr = (sqfs_inode_generic_t **)&fi->user_ptr;
+		if (ret == 0 && sqfs->ckpt != NULL)
+			ret = sqfs_writer_file_done(sqfs, path, sb.st_size,
+						    sb.st_mtime, inode_ptr);
 
-		ret = write_data_from_file(path, data, inode_ptr, file, flags);
-		sqfs_destroy(file);
 		free(node_path);
 
 		if (ret)
@@ -103,49 +131,8 @@ static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
 	return 0;
 }
 
-static int relabel_tree_dfs(const char *filename, sqfs_xattr_writer_t *xwr,
-			    tree_node_t *n, void *selinux_handle)
-{
-	char *path = fstree_get_path(n);
-	int ret;
-
-	if (path == NULL) {
-		perror("getting absolute node path for SELinux relabeling");
-		return -1;
-	}
-
-	ret = sqfs_xattr_writer_begin(xwr);
-	if (ret) {
-		sqfs_perror(filename, "recording xattr key-value pairs", ret);
-		return -1;
-	}
-
-	if (selinux_relable_node(selinux_handle, xwr, n, path)) {
-		free(path);
-		return -1;
-	}
-
-	ret = sqfs_xattr_writer_end(xwr, &n->xattr_idx);
-	if (ret) {
-		sqfs_perror(filename, "flushing completed key-value pairs",
-			    ret);
-		return -1;
-	}
-
-	free(path);
-
-	if (S_ISDIR(n->mode)) {
-		for (n = n->data.dir.children; n != NULL; n = n->next) {
-			if (relabel_tree_dfs(filename, xwr, n, selinux_handle))
-				return -1;
-		}
-	}
-
-	return 0;
-}
-
-static int read_fstree(fstree_t *fs, options_t *opt, sqfs_xattr_writer_t *xwr,
-		       void *selinux_handle)
+int read_fstree(fstree_t *fs, options_t *opt, sqfs_xattr_writer_t *xwr,
+		void *selinux_handle, sqfs_executor_t *exec)
 {
 	FILE *fp;
 	int ret;
@@ -160,13 +147,13 @@ static int read_fstree(fstree_t *fs, options_t *opt, sqfs_xattr_writer_t *xwr,
 	fclose(fp);
 
 	if (ret == 0 && selinux_handle != NULL)
-		ret = relabel_tree_dfs(opt->cfg.filename, xwr,
-				       fs->root, selinux_handle);
+		ret = relabel_tree(opt->cfg.filename, xwr, fs->root,
+				   selinux_handle, exec);
 
 	return ret;
 }
 
-static void override_owner_dfs(const options_t *opt, tree_node_t *n)
+void override_owner_dfs(const options_t *opt, tree_node_t *n)
 {
 	if (opt->force_uid)
 		n->uid = opt->force_uid_value;
@@ -180,17 +167,99 @@ static void override_owner_dfs(const options_t *opt, tree_node_t *n)
 	}
 }
 
+int reserve_tail_ends(sqfs_writer_t *sqfs)
+{
+	size_t count = 0;
+	file_info_t *fi;
+	int ret;
+
+	for (fi = sqfs->fs.files; fi != NULL; fi = fi->next)
+		++count;
+
+	ret = sqfs_frag_table_reserve(sqfs->fragtbl, count);
+	if (ret) {
+		sqfs_perror(NULL, "reserving fragment dedup index", ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+static bool hint_matches(const pack_hint_t *hint, const char *path)
+{
+#ifdef HAVE_FNMATCH_H
+	return fnmatch(hint->glob, path, 0) == 0;
+#else
+	return strcmp(hint->glob, path) == 0;
+#endif
+}
+
+int apply_pack_hints(fstree_t *fs, const options_t *opt)
+{
+	file_info_t *fi;
+	size_t i;
+	char *path;
+
+	if (opt->num_hints == 0)
+		return 0;
+
+	for (fi = fs->files; fi != NULL; fi = fi->next) {
+		path = fstree_get_path(container_of(fi, tree_node_t,
+						    data.file));
+		if (path == NULL) {
+			perror("applying packing hints");
+			return -1;
+		}
+
+		for (i = 0; i < opt->num_hints; ++i) {
+			if (hint_matches(opt->hints + i, path))
+				fi->flags |= opt->hints[i].flags;
+		}
+
+		free(path);
+	}
+
+	return 0;
+}
+
+int get_pack_flags(const file_info_t *fi, sqfs_u64 size,
+		   const options_t *opt)
+{
+	int flags = fi->flags;
+
+	if (opt->no_tail_packing && size > opt->cfg.block_size)
+		flags |= SQFS_BLK_DONT_FRAGMENT;
+
+	return flags;
+}
+
 int main(int argc, char **argv)
 {
-	int status = EXIT_FAILURE;
+	int ret, status = EXIT_FAILURE;
+	sqfs_executor_t *pool = NULL;
 	void *sehnd = NULL;
 	sqfs_writer_t sqfs;
 	options_t opt;
 
 	process_command_line(&opt, argc, argv);
 
+	if (opt.batch != NULL) {
+		if (opt.selinux != NULL) {
+			sehnd = selinux_open_context_file(opt.selinux);
+			if (sehnd == NULL)
+				goto out_hints;
+		}
+
+		if (build_batch(&opt, sehnd) == 0)
+			status = EXIT_SUCCESS;
+
+		if (sehnd != NULL)
+			selinux_close_context_file(sehnd);
+		goto out_hints;
+	}
+
 	if (sqfs_writer_init(&sqfs, &opt.cfg))
-		return EXIT_FAILURE;
+		goto out_hints;
 
 	if (opt.selinux != NULL) {
 		sehnd = selinux_open_context_file(opt.selinux);
@@ -202,7 +271,19 @@ int main(int argc, char **argv)
 		if (fstree_from_dir(&sqfs.fs, opt.packdir, opt.dirscan_flags))
 			goto out;
 	} else {
-		if (read_fstree(&sqfs.fs, &opt, sqfs.xwr, sehnd))
+		/* the SELinux relabeling pass looks up contexts in parallel */
+		if (sehnd != NULL && opt.cfg.num_jobs > 1) {
+			pool = thread_pool_create(opt.cfg.num_jobs);
+			if (pool == NULL)
+				goto out;
+		}
+
+		ret = read_fstree(&sqfs.fs, &opt, sqfs.xwr, sehnd, pool);
+
+		if (pool != NULL)
+			thread_pool_destroy(pool);
+
+		if (ret)
 			goto out;
 	}
 
@@ -212,6 +293,9 @@ int main(int argc, char **argv)
 	if (fstree_post_process(&sqfs.fs))
 		goto out;
 
+	if (apply_pack_hints(&sqfs.fs, &opt))
+		goto out;
+
 	if (opt.infile == NULL) {
 		if (xattrs_from_dir(&sqfs.fs, opt.packdir, sehnd,
 				    sqfs.xwr, opt.dirscan_flags)) {
@@ -219,7 +303,10 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (pack_files(sqfs.data, &sqfs.fs, &opt))
+	if (reserve_tail_ends(&sqfs))
+		goto out;
+
+	if (pack_files(&sqfs, &opt))
 		goto out;
 
 	if (sqfs_writer_finish(&sqfs, &opt.cfg))
@@ -230,5 +317,7 @@ out:
 	sqfs_writer_cleanup(&sqfs, status);
 	if (sehnd != NULL)
 		selinux_close_context_file(sehnd);
+out_hints:
+	free(opt.hints);
 	return status;
 }
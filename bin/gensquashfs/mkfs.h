@@ -39,18 +39,29 @@
 #include <errno.h>
 #include <ctype.h>
 
+/* packing hints for all files with an image path matching a glob pattern */
+typedef struct {
+	const char *glob;
+	int flags;
+} pack_hint_t;
+
 typedef struct {
 	sqfs_writer_cfg_t cfg;
 	unsigned int dirscan_flags;
 	const char *infile;
 	const char *packdir;
 	const char *selinux;
+	const char *batch;
 	bool no_tail_packing;
+	int read_order;
+	bool data_in_read_order;
 
 	unsigned int force_uid_value;
 	unsigned int force_gid_value;
 	bool force_uid;
 	bool force_gid;
+	pack_hint_t *hints;
+	size_t num_hints;
 } options_t;
 
 enum {
@@ -61,6 +72,14 @@ enum {
 	DIR_SCAN_READ_XATTR = 0x04,
 };
 
+enum {
+	READ_ORDER_TREE = 0,
+
+	READ_ORDER_INODE,
+
+	READ_ORDER_EXTENT,
+};
+
 void process_command_line(options_t *opt, int argc, char **argv);
 
 int fstree_from_dir(fstree_t *fs, const char *path, unsigned int flags);
@@ -73,6 +92,58 @@ void *selinux_open_context_file(const char *filename);
 int selinux_relable_node(void *sehnd, sqfs_xattr_writer_t *xwr,
 			 tree_node_t *node, const char *path);
 
+/*
+  Look up the SELinux context for a path. Safe to call from several threads
+  at once. Returns a string that has to be freed, or NULL on failure.
+ */
+char *selinux_get_context(void *sehnd, const char *path, unsigned int mode);
+
+/* Add a context looked up earlier to the current xattr set of a node. */
+int selinux_add_context(sqfs_xattr_writer_t *xwr, const tree_node_t *node,
+			const char *context);
+
+/*
+  Label every node in a tree, looking up the contexts on the given thread
+  pool (if not NULL) and reusing the xattr index for contexts that were
+  seen before.
+ */
+int relabel_tree(const char *filename, sqfs_xattr_writer_t *xwr,
+		 tree_node_t *root, void *selinux_handle,
+		 sqfs_executor_t *exec);
+
 void selinux_close_context_file(void *sehnd);
 
+int read_fstree(fstree_t *fs, options_t *opt, sqfs_xattr_writer_t *xwr,
+		void *selinux_handle, sqfs_executor_t *exec);
+
+void override_owner_dfs(const options_t *opt, tree_node_t *n);
+
+int reserve_tail_ends(sqfs_writer_t *sqfs);
+
+/*
+  Add the flags of all --pack-hint patterns matching the image path of a
+  file to its packing flags. Must be called after fstree_post_process.
+ */
+int apply_pack_hints(fstree_t *fs, const options_t *opt);
+
+/* Get the block processor flags for packing a file of the given size. */
+int get_pack_flags(const file_info_t *fi, sqfs_u64 size,
+		   const options_t *opt);
+
+/*
+  Pack the data of all files, reading them in the order given by
+  opt->read_order. Unless opt->data_in_read_order is set, the data is still
+  packed in tree order, using a bounded in-memory reordering buffer.
+  Input paths are relative to the current working directory. Files packed
+  before a checkpoint that is resumed are skipped.
+ */
+int pack_files_ordered(sqfs_writer_t *sqfs, const options_t *opt);
+
+/*
+  Build all images listed in the batch manifest, sharing one thread pool and
+  reading every input file only once. Returns 0 on success, prints errors to
+  stderr on failure.
+ */
+int build_batch(const options_t *opt, void *selinux_handle);
+
 #endif /* MKFS_H */
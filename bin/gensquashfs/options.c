@@ -8,6 +8,15 @@
 
 enum {
 	ALL_ROOT_OPTION = 1,
+	HUGE_PAGES_OPTION,
+	READ_ORDER_OPTION,
+	DATA_IN_READ_ORDER_OPTION,
+	PACK_HINT_OPTION,
+	META_COMP_EXTRA_OPTION,
+	UNCOMPRESSED_META_OPTION,
+	CHECKPOINT_OPTION,
+	CHECKPOINT_INTERVAL_OPTION,
+	RESUME_OPTION,
 };
 
 static struct option long_opts[] = {
@@ -19,10 +28,22 @@ static struct option long_opts[] = {
 	{ "dev-block-size", required_argument, NULL, 'B' },
 	{ "defaults", required_argument, NULL, 'd' },
 	{ "comp-extra", required_argument, NULL, 'X' },
+	{ "meta-comp-extra", required_argument, NULL, META_COMP_EXTRA_OPTION },
+	{ "uncompressed-meta", no_argument, NULL, UNCOMPRESSED_META_OPTION },
 	{ "pack-file", required_argument, NULL, 'F' },
 	{ "pack-dir", required_argument, NULL, 'D' },
+	{ "batch", required_argument, NULL, 'M' },
 	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "queue-backlog", required_argument, NULL, 'Q' },
+	{ "cpu-list", required_argument, NULL, 'C' },
+	{ "huge-pages", no_argument, NULL, HUGE_PAGES_OPTION },
+	{ "read-order", required_argument, NULL, READ_ORDER_OPTION },
+	{ "data-in-read-order", no_argument, NULL, DATA_IN_READ_ORDER_OPTION },
+	{ "pack-hint", required_argument, NULL, PACK_HINT_OPTION },
+	{ "checkpoint", required_argument, NULL, CHECKPOINT_OPTION },
+	{ "checkpoint-interval", required_argument, NULL,
+	  CHECKPOINT_INTERVAL_OPTION },
+	{ "resume", no_argument, NULL, RESUME_OPTION },
 	{ "keep-time", no_argument, NULL, 'k' },
 #ifdef HAVE_SYS_XATTR_H
 	{ "keep-xattr", no_argument, NULL, 'x' },
@@ -40,7 +61,7 @@ static struct option long_opts[] = {
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *short_opts = "F:D:X:c:b:B:d:u:g:j:Q:kxoefqThV"
+static const char *short_opts = "F:D:M:X:c:b:B:d:u:g:j:Q:C:kxoefqThV"
 #ifdef WITH_SELINUX
 "s:"
 #endif
@@ -51,6 +72,7 @@ static const char *short_opts = "F:D:X:c:b:B:d:u:g:j:Q:kxoefqThV"
 
 static const char *help_string =
 "Usage: gensquashfs [OPTIONS...] <squashfs-file>\n"
+"       gensquashfs [OPTIONS...] --batch <manifest>\n"
 "\n"
 "Possible options:\n"
 "\n"
@@ -66,6 +88,19 @@ static const char *help_string =
 "                              given directory into a SquashFS image. The\n"
 "                              directory becomes the root of the file\n"
 "                              system.\n"
+"  --batch, -M <manifest>      Build several images at once, see below.\n"
+"  --read-order <order>        Order in which to read input files. Either\n"
+"                              'tree' (default), 'inode' or 'extent'. The\n"
+"                              data is still packed in tree order, unless\n"
+"                              --data-in-read-order is set.\n"
+"  --data-in-read-order        Pack the file data in the order it is read.\n"
+"                              Implies '--read-order inode' if no read\n"
+"                              order is set.\n"
+"  --pack-hint <hints>:<glob>  Apply a comma separated list of packing hints\n"
+"                              to all files with an image path matching the\n"
+"                              glob pattern, e.g. 'nocompress:/boot/*'. See\n"
+"                              below for the possible hints. Can be used\n"
+"                              more than once.\n"
 "\n"
 "  --compressor, -c <name>     Select the compressor to use.\n"
 "                              A list of available compressors is below.\n"
@@ -73,10 +108,15 @@ static const char *help_string =
 "                              the selected compressor. Specify 'help' to\n"
 "                              get a list of available options.\n"
 "  --num-jobs, -j <count>      Number of compressor jobs to create.\n"
+"                              Use 'auto' to adjust the number at runtime.\n"
+"  --cpu-list, -C <list>       Pin the compressor jobs to a comma separated\n"
+"                              list of CPU numbers and ranges, e.g. 0-3,8.\n"
 "  --queue-backlog, -Q <count> Maximum number of data blocks in the thread\n"
 "                              worker queue before the packer starts waiting\n"
 "                              for the block processors to catch up.\n"
 "                              Defaults to 10 times the number of jobs.\n"
+"  --huge-pages                Allocate data block buffers from huge pages,\n"
+"                              if the system supports it.\n"
 "  --block-size, -b <size>     Block size to use for Squashfs image.\n"
 "                              Defaults to %u.\n"
 "  --dev-block-size, -B <size> Device block size to padd the image to.\n"
@@ -97,7 +137,9 @@ static const char *help_string =
 "                              this value, no matter what the pack file or\n"
 "                              directory entries actually specify.\n"
 "  --all-root                  A short hand for `--set-uid 0 --set-gid 0`.\n"
-"\n"
+"\n";
+
+static const char *help_flags =
 #ifdef WITH_SELINUX
 "  --selinux, -s <file>        Specify an SELinux label file to get context\n"
 "                              attributes from.\n"
@@ -112,6 +154,19 @@ static const char *help_string =
 "  --exportable, -e            Generate an export table for NFS support.\n"
 "  --no-tail-packing, -T       Do not perform tail end packing on files that\n"
 "                              are larger than block size.\n"
+"  --meta-comp-extra <options> Extra compressor options for the meta data,\n"
+"                              e.g. a different compression level. If not\n"
+"                              set, the options for the data are used.\n"
+"  --uncompressed-meta         Store inodes, directories and all tables\n"
+"                              uncompressed, for faster lookups.\n"
+"  --checkpoint <file>         Periodically flush all data packed so far and\n"
+"                              save the state of the build to the given\n"
+"                              file, so it can be resumed after a crash.\n"
+"  --checkpoint-interval <sec> Seconds between two checkpoints. Defaults\n"
+"                              to 600.\n"
+"  --resume                    Continue the build from the --checkpoint file,\n"
+"                              using the partially written output image.\n"
+"                              The input must be the same as before.\n"
 "  --force, -f                 Overwrite the output file if it exists.\n"
 "  --quiet, -q                 Do not print out progress reports.\n"
 "  --help, -h                  Print help text and exit.\n"
@@ -124,7 +179,7 @@ const char *help_details =
 "SquashFS image. The following entry types can be specified:\n"
 "\n"
 "# a comment\n"
-"file <path> <mode> <uid> <gid> [<location>]\n"
+"file[<hints>] <path> <mode> <uid> <gid> [<location>]\n"
 "dir <path> <mode> <uid> <gid>\n"
 "nod <path> <mode> <uid> <gid> <dev_type> <maj> <min>\n"
 "slink <path> <mode> <uid> <gid> <target>\n"
@@ -144,6 +199,15 @@ const char *help_details =
 "<dev_type>   Device type (b=block, c=character).\n"
 "<maj>        Major number of a device special file.\n"
 "<min>        Minor number of a device special file.\n"
+"<hints>      Optional, comma separated list of packing hints in brackets,\n"
+"             attached directly to the file keyword.\n"
+"\n"
+"The following packing hints can be used for a file:\n"
+"\n"
+"  nocompress   Store the data blocks without compression.\n"
+"  nofragment   Do not pack the tail end into a fragment block.\n"
+"  align        Align the data to the device block size.\n"
+"  nodedup      Do not deduplicate the data against other files.\n"
 "\n"
 "Example:\n"
 "    # A simple squashfs image\n"
@@ -159,10 +223,45 @@ const char *help_details =
 "    # Implicitly create /bin.\n"
 "    file /bin/bash 0755 0 0\n"
 "    \n"
+"    # Store the kernel uncompressed and aligned, so it can be mapped.\n"
+"    file[nocompress,nofragment,align] /boot/vmlinuz 0644 0 0\n"
+"    \n"
 "    # file name with a space in it.\n"
 "    file \"/opt/my app/\\\"special\\\"/data\" 0600 0 0\n"
+"\n"
+"In batch mode, each line of the manifest contains an output image name and\n"
+"a pack file, separated by white space. Input files are read only once, even\n"
+"if several images contain them, and all images share one pool of compressor\n"
+"jobs. Data blocks of shared files are only compressed once, unless the\n"
+"images use different packing hints for them. All other options apply to\n"
+"every image.\n"
 "\n\n";
 
+static int add_pack_hint(options_t *opt, const char *arg)
+{
+	const char *sep = strchr(arg, ':');
+	pack_hint_t *new;
+	int flags = 0;
+
+	if (sep == NULL || sep[1] == '\0' ||
+	    fstree_parse_file_hints(arg, sep - arg, &flags) != 0) {
+		fprintf(stderr, "Invalid packing hint '%s'.\n", arg);
+		return -1;
+	}
+
+	new = realloc(opt->hints, sizeof(opt->hints[0]) * (opt->num_hints + 1));
+	if (new == NULL) {
+		perror("adding packing hint");
+		return -1;
+	}
+
+	opt->hints = new;
+	opt->hints[opt->num_hints].glob = sep + 1;
+	opt->hints[opt->num_hints].flags = flags;
+	opt->num_hints += 1;
+	return 0;
+}
+
 void process_command_line(options_t *opt, int argc, char **argv)
 {
 	bool have_compressor;
@@ -183,6 +282,29 @@ void process_command_line(options_t *opt, int argc, char **argv)
 			opt->force_uid = true;
 			opt->force_gid = true;
 			break;
+		case HUGE_PAGES_OPTION:
+			opt->cfg.huge_pages = true;
+			break;
+		case READ_ORDER_OPTION:
+			if (strcmp(optarg, "tree") == 0) {
+				opt->read_order = READ_ORDER_TREE;
+			} else if (strcmp(optarg, "inode") == 0) {
+				opt->read_order = READ_ORDER_INODE;
+			} else if (strcmp(optarg, "extent") == 0) {
+				opt->read_order = READ_ORDER_EXTENT;
+			} else {
+				fprintf(stderr, "Unknown read order '%s'.\n",
+					optarg);
+				goto fail_arg;
+			}
+			break;
+		case DATA_IN_READ_ORDER_OPTION:
+			opt->data_in_read_order = true;
+			break;
+		case PACK_HINT_OPTION:
+			if (add_pack_hint(opt, optarg))
+				goto fail_arg;
+			break;
 		case 'u':
 			opt->force_uid_value = strtol(optarg, NULL, 0);
 			opt->force_uid = true;
@@ -221,11 +343,18 @@ void process_command_line(options_t *opt, int argc, char **argv)
 			}
 			break;
 		case 'j':
-			opt->cfg.num_jobs = strtol(optarg, NULL, 0);
+			if (strcmp(optarg, "auto") == 0) {
+				opt->cfg.auto_tune = true;
+			} else {
+				opt->cfg.num_jobs = strtol(optarg, NULL, 0);
+			}
 			break;
 		case 'Q':
 			opt->cfg.max_backlog = strtol(optarg, NULL, 0);
 			break;
+		case 'C':
+			opt->cfg.cpu_list = optarg;
+			break;
 		case 'B':
 			if (parse_size("Device block size",
 				       &opt->cfg.devblksize, optarg, 0)) {
@@ -263,12 +392,30 @@ void process_command_line(options_t *opt, int argc, char **argv)
 		case 'X':
 			opt->cfg.comp_extra = optarg;
 			break;
+		case META_COMP_EXTRA_OPTION:
+			opt->cfg.meta_comp_extra = optarg;
+			break;
+		case UNCOMPRESSED_META_OPTION:
+			opt->cfg.uncompressed_meta = true;
+			break;
+		case CHECKPOINT_OPTION:
+			opt->cfg.checkpoint = optarg;
+			break;
+		case CHECKPOINT_INTERVAL_OPTION:
+			opt->cfg.checkpoint_interval = strtoul(optarg, NULL, 0);
+			break;
+		case RESUME_OPTION:
+			opt->cfg.resume = true;
+			break;
 		case 'F':
 			opt->infile = optarg;
 			break;
 		case 'D':
 			opt->packdir = optarg;
 			break;
+		case 'M':
+			opt->batch = optarg;
+			break;
 #ifdef WITH_SELINUX
 		case 's':
 			opt->selinux = optarg;
@@ -277,6 +424,7 @@ void process_command_line(options_t *opt, int argc, char **argv)
 		case 'h':
 			printf(help_string,
 			       SQFS_DEFAULT_BLOCK_SIZE, SQFS_DEVBLK_SIZE);
+			fputs(help_flags, stdout);
 			fputs(help_details, stdout);
 			compressor_print_available();
 			exit(EXIT_SUCCESS);
@@ -300,6 +448,46 @@ void process_command_line(options_t *opt, int argc, char **argv)
 		exit(EXIT_SUCCESS);
 	}
 
+	if (opt->data_in_read_order && opt->read_order == READ_ORDER_TREE)
+		opt->read_order = READ_ORDER_INODE;
+
+	if (opt->cfg.resume && opt->cfg.checkpoint == NULL) {
+		fputs("--resume requires a --checkpoint file.\n", stderr);
+		goto fail_arg;
+	}
+
+	if (opt->batch != NULL) {
+		if (opt->infile != NULL) {
+			fputs("A pack file cannot be used together with "
+			      "--batch.\n", stderr);
+			goto fail_arg;
+		}
+
+		if (opt->cfg.cpu_list != NULL) {
+			fputs("A CPU list cannot be used together with "
+			      "--batch.\n", stderr);
+			goto fail_arg;
+		}
+
+		if (opt->read_order != READ_ORDER_TREE) {
+			fputs("A read order cannot be used together with "
+			      "--batch.\n", stderr);
+			goto fail_arg;
+		}
+
+		if (opt->cfg.checkpoint != NULL) {
+			fputs("Checkpoints cannot be used together with "
+			      "--batch.\n", stderr);
+			goto fail_arg;
+		}
+
+		if (optind < argc) {
+			fputs("Unknown extra arguments specified.\n", stderr);
+			goto fail_arg;
+		}
+		return;
+	}
+
 	if (opt->infile == NULL && opt->packdir == NULL) {
 		fputs("No input file or directory specified.\n", stderr);
 		goto fail_arg;
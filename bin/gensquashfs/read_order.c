@@ -0,0 +1,396 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * read_order.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "mkfs.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_FIEMAP_H
+#include <sys/ioctl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#endif
+
+/*
+  Upper bounds for the reordering buffer. The files in a window are read in
+  physical order into memory and then packed in tree order. Files that are
+  larger than the window on their own are read and packed directly.
+ */
+#define WINDOW_BYTES (64 * 1024 * 1024)
+#define WINDOW_FILES (4096)
+
+typedef struct {
+	file_info_t *fi;
+	char *path;
+	sqfs_u64 size;
+	sqfs_s64 mtime;
+
+	/* files with a known physical location sort first */
+	bool no_extent;
+	sqfs_u64 key;
+
+	size_t offset;
+} input_file_t;
+
+static char *get_input_path(file_info_t *fi)
+{
+	char *path;
+	int ret;
+
+	if (fi->input_file != NULL)
+		return strdup(fi->input_file);
+
+	path = fstree_get_path(container_of(fi, tree_node_t, data.file));
+	if (path != NULL) {
+		ret = canonicalize_name(path);
+		assert(ret == 0);
+	}
+
+	return path;
+}
+
+#ifdef HAVE_LINUX_FIEMAP_H
+static int get_first_extent(int fd, sqfs_u64 *out)
+{
+	union {
+		struct fiemap map;
+		sqfs_u8 raw[sizeof(struct fiemap) +
+			    sizeof(struct fiemap_extent)];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.map.fm_length = FIEMAP_MAX_OFFSET;
+	req.map.fm_extent_count = 1;
+
+	if (ioctl(fd, FS_IOC_FIEMAP, &req.map) != 0)
+		return -1;
+
+	if (req.map.fm_mapped_extents < 1)
+		return -1;
+
+	if (req.map.fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN |
+					      FIEMAP_EXTENT_DATA_INLINE)) {
+		return -1;
+	}
+
+	*out = req.map.fm_extents[0].fe_physical;
+	return 0;
+}
+#endif
+
+static int get_read_key(input_file_t *in, int order)
+{
+	struct stat sb;
+	int fd;
+
+	fd = open(in->path, O_RDONLY);
+	if (fd < 0)
+		goto fail;
+
+	if (fstat(fd, &sb) != 0) {
+		close(fd);
+		goto fail;
+	}
+
+	in->size = sb.st_size;
+	in->mtime = sb.st_mtime;
+	in->key = sb.st_ino;
+	in->no_extent = true;
+
+#ifdef HAVE_LINUX_FIEMAP_H
+	if (order == READ_ORDER_EXTENT && get_first_extent(fd, &in->key) == 0)
+		in->no_extent = false;
+#else
+	(void)order;
+#endif
+	close(fd);
+	return 0;
+fail:
+	perror(in->path);
+	return -1;
+}
+
+static int compare_read_key(const void *lhs, const void *rhs)
+{
+	const input_file_t *l = *((input_file_t *const *)lhs);
+	const input_file_t *r = *((input_file_t *const *)rhs);
+
+	if (l->no_extent != r->no_extent)
+		return l->no_extent ? 1 : -1;
+
+	if (l->key != r->key)
+		return l->key < r->key ? -1 : 1;
+
+	return 0;
+}
+
+static int get_flags(const input_file_t *in, const options_t *opt)
+{
+	return get_pack_flags(in->fi, in->size, opt);
+}
+
+static sqfs_inode_generic_t **get_inode_ptr(const input_file_t *in)
+{
+	return (sqfs_inode_generic_t **)&in->fi->user_ptr;
+}
+
+static int pack_file(sqfs_writer_t *sqfs, const input_file_t *in,
+		     const options_t *opt)
+{
+	sqfs_file_t *file;
+	int ret;
+
+	ret = sqfs_writer_resume_file(sqfs, in->path, in->size, in->mtime,
+				      get_inode_ptr(in));
+	if (ret != 0)
+		return ret < 0 ? -1 : 0;
+
+	if (!opt->cfg.quiet)
+		printf("packing %s\n", in->path);
+
+	file = sqfs_open_file(in->path, SQFS_FILE_OPEN_READ_ONLY);
+	if (file == NULL) {
+		perror(in->path);
+		return -1;
+	}
+
+	ret = write_data_from_file(in->path, sqfs->data, get_inode_ptr(in),
+				   file, get_flags(in, opt));
+	sqfs_destroy(file);
+
+	if (ret)
+		return -1;
+
+	return sqfs_writer_file_done(sqfs, in->path, in->size, in->mtime,
+				     get_inode_ptr(in));
+}
+
+static int read_file(const input_file_t *in, sqfs_u8 *buffer)
+{
+	sqfs_file_t *file;
+	int ret;
+
+	file = sqfs_open_file(in->path, SQFS_FILE_OPEN_READ_ONLY);
+	if (file == NULL) {
+		perror(in->path);
+		return -1;
+	}
+
+	if (file->get_size(file) != in->size) {
+		fprintf(stderr, "%s: file size changed while packing\n",
+			in->path);
+		sqfs_destroy(file);
+		return -1;
+	}
+
+	ret = file->read_at(file, 0, buffer + in->offset, in->size);
+	sqfs_destroy(file);
+
+	if (ret) {
+		sqfs_perror(in->path, "reading file", ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int pack_buffered(sqfs_writer_t *sqfs, const input_file_t *in,
+			 const sqfs_u8 *buffer, const options_t *opt)
+{
+	sqfs_block_processor_t *data = sqfs->data;
+	int ret;
+
+	if (!opt->cfg.quiet)
+		printf("packing %s\n", in->path);
+
+	ret = sqfs_block_processor_begin_file(data, get_inode_ptr(in),
+					      get_flags(in, opt));
+	if (ret) {
+		sqfs_perror(in->path, "beginning file data blocks", ret);
+		return -1;
+	}
+
+	ret = sqfs_block_processor_append(data, buffer + in->offset, in->size);
+	if (ret) {
+		sqfs_perror(in->path, "packing file data", ret);
+		return -1;
+	}
+
+	ret = sqfs_block_processor_end_file(data);
+	if (ret) {
+		sqfs_perror(in->path, "finishing file data", ret);
+		return -1;
+	}
+
+	return sqfs_writer_file_done(sqfs, in->path, in->size, in->mtime,
+				     get_inode_ptr(in));
+}
+
+/* read a window of files in physical order, pack them in tree order */
+static int pack_window(sqfs_writer_t *sqfs, input_file_t *list,
+		       input_file_t **sorted, size_t count,
+		       sqfs_u8 *buffer, const options_t *opt)
+{
+	size_t i, offset = 0;
+
+	for (i = 0; i < count; ++i) {
+		list[i].offset = offset;
+		offset += list[i].size;
+		sorted[i] = list + i;
+	}
+
+	qsort(sorted, count, sizeof(sorted[0]), compare_read_key);
+
+	for (i = 0; i < count; ++i) {
+		if (read_file(sorted[i], buffer))
+			return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (pack_buffered(sqfs, list + i, buffer, opt))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int pack_reordered(sqfs_writer_t *sqfs, input_file_t *list,
+			  size_t count, const options_t *opt)
+{
+	size_t i, j, bytes, window, max_files;
+	input_file_t **sorted;
+	sqfs_u8 *buffer;
+	sqfs_u64 total;
+	int ret = 0;
+
+	/* files packed before the checkpoint are a prefix of the list */
+	for (i = 0; i < count; ++i) {
+		ret = sqfs_writer_resume_file(sqfs, list[i].path,
+					      list[i].size, list[i].mtime,
+					      get_inode_ptr(list + i));
+		if (ret <= 0)
+			break;
+	}
+
+	if (ret < 0)
+		return -1;
+
+	list += i;
+	count -= i;
+	ret = 0;
+
+	/* do not allocate more than the input can fill */
+	total = 0;
+	for (i = 0; i < count && total < WINDOW_BYTES; ++i)
+		total += list[i].size;
+
+	window = total < WINDOW_BYTES ? total : WINDOW_BYTES;
+	max_files = count < WINDOW_FILES ? count : WINDOW_FILES;
+
+	sorted = calloc(max_files > 0 ? max_files : 1, sizeof(sorted[0]));
+	buffer = malloc(window > 0 ? window : 1);
+
+	if (sorted == NULL || buffer == NULL) {
+		perror("allocating read reordering buffer");
+		ret = -1;
+		goto out;
+	}
+
+	for (i = 0; ret == 0 && i < count; i = j) {
+		bytes = 0;
+
+		for (j = i; j < count && (j - i) < max_files; ++j) {
+			if (list[j].size > window - bytes)
+				break;
+			bytes += list[j].size;
+		}
+
+		if (j == i) {
+			ret = pack_file(sqfs, list + i, opt);
+			j = i + 1;
+		} else {
+			ret = pack_window(sqfs, list + i, sorted, j - i,
+					  buffer, opt);
+		}
+	}
+out:
+	free(buffer);
+	free(sorted);
+	return ret;
+}
+
+static int pack_in_read_order(sqfs_writer_t *sqfs,
+			      input_file_t *list, size_t count,
+			      const options_t *opt)
+{
+	input_file_t **sorted;
+	size_t i;
+	int ret = 0;
+
+	sorted = calloc(count, sizeof(sorted[0]));
+	if (sorted == NULL) {
+		perror("sorting input files");
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i)
+		sorted[i] = list + i;
+
+	qsort(sorted, count, sizeof(sorted[0]), compare_read_key);
+
+	for (i = 0; ret == 0 && i < count; ++i)
+		ret = pack_file(sqfs, sorted[i], opt);
+
+	free(sorted);
+	return ret;
+}
+
+int pack_files_ordered(sqfs_writer_t *sqfs, const options_t *opt)
+{
+	fstree_t *fs = &sqfs->fs;
+	size_t i, count = 0;
+	input_file_t *list;
+	file_info_t *fi;
+	int ret = -1;
+
+	for (fi = fs->files; fi != NULL; fi = fi->next)
+		++count;
+
+	if (count == 0)
+		return 0;
+
+	list = calloc(count, sizeof(list[0]));
+	if (list == NULL) {
+		perror("collecting input files");
+		return -1;
+	}
+
+	for (i = 0, fi = fs->files; fi != NULL; fi = fi->next, ++i) {
+		list[i].fi = fi;
+		list[i].path = get_input_path(fi);
+
+		if (list[i].path == NULL) {
+			perror("reconstructing file path");
+			goto out;
+		}
+
+		if (get_read_key(list + i, opt->read_order))
+			goto out;
+	}
+
+	if (opt->data_in_read_order) {
+		ret = pack_in_read_order(sqfs, list, count, opt);
+	} else {
+		ret = pack_reordered(sqfs, list, count, opt);
+	}
+out:
+	for (i = 0; i < count; ++i)
+		free(list[i].path);
+	free(list);
+	return ret;
+}
@@ -0,0 +1,358 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * relabel.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "mkfs.h"
+
+/*
+  Nodes are collected in tree order in batches. The contexts of a batch are
+  looked up in parallel, then added to the xattr writer in order, so the
+  result is the same as labeling the nodes one by one.
+
+  This relies on selabel_lookup being safe to call from several threads on
+  the same handle, which libselinux guarantees since version 2.6.
+ */
+#define RELABEL_BATCH (4096)
+
+typedef struct {
+	tree_node_t *node;
+	size_t path;
+	char *context;
+
+	/* errno of the worker if the lookup failed */
+	int error;
+} relabel_item_t;
+
+typedef struct {
+	char *context;
+	sqfs_u32 xattr_idx;
+} label_memo_t;
+
+typedef struct relabel_t relabel_t;
+
+typedef struct {
+	relabel_t *rl;
+	size_t start;
+	size_t count;
+} relabel_task_t;
+
+struct relabel_t {
+	const char *filename;
+	sqfs_xattr_writer_t *xwr;
+	void *sehnd;
+	sqfs_executor_t *exec;
+
+	/* path of the current node, built up while walking the tree */
+	char *path;
+	size_t path_len;
+	size_t path_max;
+
+	/* the current batch, with all paths in one buffer */
+	relabel_item_t *items;
+	size_t count;
+	char *paths;
+	size_t paths_used;
+	size_t paths_max;
+
+	relabel_task_t *tasks;
+	unsigned int num_tasks;
+
+	/* open addressed map from context string to xattr index */
+	label_memo_t *memo;
+	size_t memo_size;
+	size_t memo_count;
+};
+
+static int grow_buffer(char **buffer, size_t *max, size_t needed)
+{
+	size_t size = *max ? *max : 256;
+	char *new;
+
+	while (size < needed)
+		size *= 2;
+
+	if (size == *max)
+		return 0;
+
+	new = realloc(*buffer, size);
+	if (new == NULL) {
+		perror("building SELinux relabeling path");
+		return -1;
+	}
+
+	*buffer = new;
+	*max = size;
+	return 0;
+}
+
+static sqfs_u32 context_hash(const char *str)
+{
+	sqfs_u32 hash = 2166136261U;
+
+	while (*str != '\0')
+		hash = (hash ^ (unsigned char)*(str++)) * 16777619U;
+
+	return hash;
+}
+
+static label_memo_t *memo_find(relabel_t *rl, const char *context)
+{
+	size_t i, mask = rl->memo_size - 1;
+
+	if (rl->memo_size == 0)
+		return NULL;
+
+	i = context_hash(context) & mask;
+
+	while (rl->memo[i].context != NULL) {
+		if (strcmp(rl->memo[i].context, context) == 0)
+			return rl->memo + i;
+
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+/* takes ownership of the context string */
+static int memo_insert(relabel_t *rl, char *context, sqfs_u32 xattr_idx)
+{
+	size_t i, j, size = rl->memo_size;
+	label_memo_t *memo;
+
+	if ((rl->memo_count + 1) * 2 > size) {
+		size = size ? size * 2 : 64;
+
+		memo = calloc(size, sizeof(memo[0]));
+		if (memo == NULL) {
+			perror("caching SELinux labels");
+			free(context);
+			return -1;
+		}
+
+		for (i = 0; i < rl->memo_size; ++i) {
+			if (rl->memo[i].context == NULL)
+				continue;
+
+			j = context_hash(rl->memo[i].context) & (size - 1);
+			while (memo[j].context != NULL)
+				j = (j + 1) & (size - 1);
+
+			memo[j] = rl->memo[i];
+		}
+
+		free(rl->memo);
+		rl->memo = memo;
+		rl->memo_size = size;
+	}
+
+	i = context_hash(context) & (rl->memo_size - 1);
+	while (rl->memo[i].context != NULL)
+		i = (i + 1) & (rl->memo_size - 1);
+
+	rl->memo[i].context = context;
+	rl->memo[i].xattr_idx = xattr_idx;
+	rl->memo_count += 1;
+	return 0;
+}
+
+static void lookup_task(void *arg)
+{
+	relabel_task_t *task = arg;
+	relabel_t *rl = task->rl;
+	relabel_item_t *it;
+	size_t i;
+
+	for (i = 0; i < task->count; ++i) {
+		it = rl->items + task->start + i;
+
+		it->context = selinux_get_context(rl->sehnd,
+						  rl->paths + it->path,
+						  it->node->mode);
+		if (it->context == NULL)
+			it->error = errno;
+	}
+}
+
+static int store_label(relabel_t *rl, relabel_item_t *it)
+{
+	label_memo_t *memo;
+	sqfs_u32 index;
+	int ret;
+
+	memo = memo_find(rl, it->context);
+	if (memo != NULL) {
+		it->node->xattr_idx = memo->xattr_idx;
+		return 0;
+	}
+
+	ret = sqfs_xattr_writer_begin(rl->xwr);
+	if (ret) {
+		sqfs_perror(rl->filename, "recording xattr key-value pairs",
+			    ret);
+		return -1;
+	}
+
+	if (selinux_add_context(rl->xwr, it->node, it->context))
+		return -1;
+
+	ret = sqfs_xattr_writer_end(rl->xwr, &index);
+	if (ret) {
+		sqfs_perror(rl->filename, "flushing completed key-value pairs",
+			    ret);
+		return -1;
+	}
+
+	it->node->xattr_idx = index;
+
+	ret = memo_insert(rl, it->context, index);
+	it->context = NULL;
+	return ret;
+}
+
+static int flush_batch(relabel_t *rl)
+{
+	size_t i, start, per_task;
+	unsigned int num_tasks;
+	int ret = 0;
+
+	if (rl->count == 0)
+		return 0;
+
+	num_tasks = rl->exec == NULL ? 1 : rl->num_tasks;
+	per_task = (rl->count + num_tasks - 1) / num_tasks;
+
+	for (i = 0, start = 0; start < rl->count; ++i, start += per_task) {
+		rl->tasks[i].rl = rl;
+		rl->tasks[i].start = start;
+		rl->tasks[i].count = rl->count - start;
+
+		if (rl->tasks[i].count > per_task)
+			rl->tasks[i].count = per_task;
+
+		if (rl->exec == NULL ||
+		    rl->exec->submit(rl->exec, lookup_task, rl->tasks + i)) {
+			lookup_task(rl->tasks + i);
+		}
+	}
+
+	if (rl->exec != NULL)
+		thread_pool_wait(rl->exec);
+
+	for (i = 0; i < rl->count; ++i) {
+		if (ret == 0) {
+			if (rl->items[i].context == NULL) {
+				fprintf(stderr, "relabeling %s: %s\n",
+					rl->paths + rl->items[i].path,
+					strerror(rl->items[i].error));
+				ret = -1;
+			} else {
+				ret = store_label(rl, rl->items + i);
+			}
+		}
+
+		free(rl->items[i].context);
+	}
+
+	rl->count = 0;
+	rl->paths_used = 0;
+	return ret;
+}
+
+static int add_to_batch(relabel_t *rl, tree_node_t *n)
+{
+	const char *path = rl->path_len > 0 ? rl->path : "/";
+	size_t len = rl->path_len > 0 ? rl->path_len : 1;
+
+	if (grow_buffer(&rl->paths, &rl->paths_max, rl->paths_used + len + 1))
+		return -1;
+
+	memcpy(rl->paths + rl->paths_used, path, len);
+	rl->paths[rl->paths_used + len] = '\0';
+
+	rl->items[rl->count].node = n;
+	rl->items[rl->count].path = rl->paths_used;
+	rl->items[rl->count].context = NULL;
+	rl->items[rl->count].error = 0;
+
+	rl->paths_used += len + 1;
+	rl->count += 1;
+
+	return rl->count == RELABEL_BATCH ? flush_batch(rl) : 0;
+}
+
+static int relabel_dfs(relabel_t *rl, tree_node_t *n)
+{
+	size_t old_len = rl->path_len, len;
+	int ret = 0;
+
+	if (n->parent != NULL) {
+		len = strlen(n->name);
+
+		if (grow_buffer(&rl->path, &rl->path_max, old_len + len + 2))
+			return -1;
+
+		rl->path[rl->path_len++] = '/';
+		memcpy(rl->path + rl->path_len, n->name, len);
+		rl->path_len += len;
+		rl->path[rl->path_len] = '\0';
+	}
+
+	if (add_to_batch(rl, n))
+		return -1;
+
+	if (S_ISDIR(n->mode)) {
+		for (n = n->data.dir.children; n != NULL; n = n->next) {
+			ret = relabel_dfs(rl, n);
+			if (ret)
+				break;
+		}
+	}
+
+	rl->path_len = old_len;
+	return ret;
+}
+
+int relabel_tree(const char *filename, sqfs_xattr_writer_t *xwr,
+		 tree_node_t *root, void *selinux_handle,
+		 sqfs_executor_t *exec)
+{
+	relabel_t rl;
+	size_t i;
+	int ret;
+
+	memset(&rl, 0, sizeof(rl));
+	rl.filename = filename;
+	rl.xwr = xwr;
+	rl.sehnd = selinux_handle;
+	rl.exec = exec;
+	rl.num_tasks = exec == NULL ? 1 : exec->concurrency;
+
+	if (rl.num_tasks < 1)
+		rl.num_tasks = 1;
+
+	rl.items = calloc(RELABEL_BATCH, sizeof(rl.items[0]));
+	rl.tasks = calloc(rl.num_tasks, sizeof(rl.tasks[0]));
+
+	if (rl.items == NULL || rl.tasks == NULL) {
+		perror("relabeling files");
+		ret = -1;
+		goto out;
+	}
+
+	ret = relabel_dfs(&rl, root);
+	if (ret == 0)
+		ret = flush_batch(&rl);
+out:
+	for (i = 0; i < rl.memo_size; ++i)
+		free(rl.memo[i].context);
+
+	free(rl.memo);
+	free(rl.tasks);
+	free(rl.paths);
+	free(rl.path);
+	free(rl.items);
+	return ret;
+}
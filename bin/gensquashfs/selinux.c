@@ -9,27 +9,43 @@
 #define XATTR_NAME_SELINUX "security.selinux"
 #define XATTR_VALUE_SELINUX "system_u:object_r:unlabeled_t:s0"
 
-#ifdef WITH_SELINUX
-int selinux_relable_node(void *sehnd, sqfs_xattr_writer_t *xwr,
-			 tree_node_t *node, const char *path)
+int selinux_add_context(sqfs_xattr_writer_t *xwr, const tree_node_t *node,
+			const char *context)
 {
-	char *context = NULL;
 	int ret;
 
-	if (selabel_lookup(sehnd, &context, path, node->mode) < 0) {
-		context = strdup(XATTR_VALUE_SELINUX);
-		if (context == NULL)
-			goto fail;
-	}
-
 	ret = sqfs_xattr_writer_add(xwr, XATTR_NAME_SELINUX,
 				    context, strlen(context));
-	free(context);
-
 	if (ret)
 		sqfs_perror(node->name, "storing SELinux xattr", ret);
 
 	return ret;
+}
+
+#ifdef WITH_SELINUX
+char *selinux_get_context(void *sehnd, const char *path, unsigned int mode)
+{
+	char *context = NULL;
+
+	if (selabel_lookup(sehnd, &context, path, mode) < 0)
+		context = strdup(XATTR_VALUE_SELINUX);
+
+	return context;
+}
+
+int selinux_relable_node(void *sehnd, sqfs_xattr_writer_t *xwr,
+			 tree_node_t *node, const char *path)
+{
+	char *context;
+	int ret;
+
+	context = selinux_get_context(sehnd, path, node->mode);
+	if (context == NULL)
+		goto fail;
+
+	ret = selinux_add_context(xwr, node, context);
+	free(context);
+	return ret;
 fail:
 	perror("relabeling files");
 	return -1;
@@ -54,6 +70,13 @@ void selinux_close_context_file(void *sehnd)
 	selabel_close(sehnd);
 }
 #else
+char *selinux_get_context(void *sehnd, const char *path, unsigned int mode)
+{
+	(void)sehnd; (void)path; (void)mode;
+	errno = ENOTSUP;
+	return NULL;
+}
+
 int selinux_relable_node(void *sehnd, sqfs_xattr_writer_t *xwr,
 			 tree_node_t *node, const char *path)
 {
@@ -63,11 +63,10 @@ static bool is_printable(const sqfs_u8 *value, size_t len)
 
 int dump_xattrs(sqfs_xattr_reader_t *xattr, const sqfs_inode_generic_t *inode)
 {
-	sqfs_xattr_value_t *value;
-	sqfs_xattr_entry_t *key;
-	sqfs_xattr_id_t desc;
-	sqfs_u32 index;
-	size_t i;
+	const sqfs_xattr_set_t *set;
+	const sqfs_xattr_pair_t *kv;
+	sqfs_u32 index, i;
+	size_t len;
 
 	if (xattr == NULL)
 		return 0;
@@ -77,43 +76,27 @@ int dump_xattrs(sqfs_xattr_reader_t *xattr, const sqfs_inode_generic_t *inode)
 	if (index == 0xFFFFFFFF)
 		return 0;
 
-	if (sqfs_xattr_reader_get_desc(xattr, index, &desc)) {
-		fputs("Error resolving xattr index\n", stderr);
+	if (sqfs_xattr_reader_get_set(xattr, index, &set)) {
+		fputs("Error reading xattr key-value pairs\n", stderr);
 		return -1;
 	}
 
-	if (sqfs_xattr_reader_seek_kv(xattr, &desc)) {
-		fputs("Error locating xattr key-value pairs\n", stderr);
-		return -1;
-	}
-
-	for (i = 0; i < desc.count; ++i) {
-		if (sqfs_xattr_reader_read_key(xattr, &key)) {
-			fputs("Error reading xattr key\n", stderr);
-			return -1;
-		}
+	for (i = 0; i < set->count; ++i) {
+		kv = set->pairs + i;
+		len = strlen(kv->key);
 
-		if (sqfs_xattr_reader_read_value(xattr, key, &value)) {
-			fputs("Error reading xattr value\n", stderr);
-			free(key);
-			return -1;
-		}
-
-		if (is_printable(key->key, key->size)) {
-			printf("%s=", key->key);
+		if (is_printable((const sqfs_u8 *)kv->key, len)) {
+			printf("%s=", kv->key);
 		} else {
-			print_hex(key->key, key->size);
+			print_hex((const sqfs_u8 *)kv->key, len);
 		}
 
-		if (is_printable(value->value, value->size)) {
-			printf("%s\n", value->value);
+		if (is_printable(kv->value, kv->value_size)) {
+			printf("%s\n", kv->value);
 		} else {
-			print_hex(value->value, value->size);
+			print_hex(kv->value, kv->value_size);
 			printf("\n");
 		}
-
-		free(key);
-		free(value);
 	}
 
 	return 0;
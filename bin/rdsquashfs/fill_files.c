@@ -133,7 +133,8 @@ static int gen_file_list_dfs(const sqfs_tree_node_t *n)
 	return 0;
 }
 
-static int fill_files(sqfs_data_reader_t *data, int flags)
+#ifdef _WIN32
+static int fill_files(sqfs_data_reader_t *data, int image_fd, int flags)
 {
 	size_t i;
 	FILE *fp;
@@ -150,7 +151,7 @@ static int fill_files(sqfs_data_reader_t *data, int flags)
 			printf("unpacking %s\n", files[i].path);
 
 		if (sqfs_data_reader_dump(files[i].path, data, files[i].inode,
-					  fp, block_size,
+					  image_fd, fp, block_size,
 					  (flags & UNPACK_NO_SPARSE) == 0)) {
 			fclose(fp);
 			return -1;
@@ -162,9 +163,189 @@ static int fill_files(sqfs_data_reader_t *data, int flags)
 
 	return 0;
 }
+#else
+static int write_range(int fd, const sqfs_u8 *data, size_t size,
+		       sqfs_u64 offset)
+{
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = pwrite(fd, data, size, offset);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (ret == 0) {
+			errno = EIO;
+			return -1;
+		}
+
+		data += ret;
+		size -= ret;
+		offset += ret;
+	}
+
+	return 0;
+}
+
+static bool has_sparse_blocks(const sqfs_inode_generic_t *inode)
+{
+	size_t i, count = sqfs_inode_get_file_block_count(inode);
+
+	for (i = 0; i < count; ++i) {
+		if (SQFS_IS_SPARSE_BLOCK(inode->extra[i]))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+  Allocate the entire file up front, so the file system can place it in one
+  piece. If that is not supported, or the file is to be unpacked sparse,
+  only set the size and leave the regions that are never written as holes.
+ */
+static int preallocate(int fd, sqfs_u64 size, bool sparse)
+{
+	if (size == 0)
+		return 0;
+
+#ifdef HAVE_FALLOCATE
+	if (!sparse) {
+		if (fallocate(fd, 0, 0, size) == 0)
+			return 0;
+
+		if (errno != EOPNOTSUPP && errno != ENOSYS)
+			return -1;
+	}
+#else
+	(void)sparse;
+#endif
+	return ftruncate(fd, size);
+}
+
+static int fill_file(const struct file_ent *ent, sqfs_data_reader_t *data,
+		     int image_fd, int flags)
+{
+	bool allow_sparse = (flags & UNPACK_NO_SPARSE) == 0;
+	sqfs_u64 filesz, offset, location, run_size;
+	size_t i, diff, count, run, chunk_size;
+	const char *path = ent->path;
+	sqfs_u8 *chunk;
+	int fd, err;
+
+	sqfs_inode_get_file_size(ent->inode, &filesz);
+	sqfs_inode_get_file_block_start(ent->inode, &location);
+	count = sqfs_inode_get_file_block_count(ent->inode);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		goto fail_errno;
+
+	if (preallocate(fd, filesz,
+			allow_sparse && has_sparse_blocks(ent->inode))) {
+		goto fail_errno;
+	}
+
+	offset = 0;
+
+	for (i = 0; i < count && offset < filesz; ++i) {
+		diff = (filesz - offset) < block_size ?
+			(filesz - offset) : block_size;
+
+		if (SQFS_IS_SPARSE_BLOCK(ent->inode->extra[i]) &&
+		    allow_sparse) {
+			offset += diff;
+			continue;
+		}
+
+		run = image_fd < 0 ? 0 :
+			get_stored_run(ent->inode, i, filesz - offset,
+				       block_size, &run_size);
+
+		if (run > 0) {
+			err = copy_image_range(image_fd, location, fd,
+					       &offset, run_size);
+			if (err < 0)
+				goto fail;
+
+			if (err == 0) {
+				location += run_size;
+				i += run - 1;
+				continue;
+			}
+
+			/* the kernel refused, read the blocks instead */
+			image_fd = -1;
+		}
+
+		err = sqfs_data_reader_get_block(data, ent->inode, i,
+						 &chunk_size, &chunk);
+		if (err) {
+			sqfs_perror(path, "reading data block", err);
+			goto fail;
+		}
+
+		err = write_range(fd, chunk, chunk_size, offset);
+		free(chunk);
+
+		if (err)
+			goto fail_errno;
+
+		location += SQFS_ON_DISK_BLOCK_SIZE(ent->inode->extra[i]);
+		offset += diff;
+	}
+
+	if (offset < filesz) {
+		err = sqfs_data_reader_get_fragment(data, ent->inode,
+						    &chunk_size, &chunk);
+		if (err) {
+			sqfs_perror(path, "reading fragment block", err);
+			goto fail;
+		}
+
+		err = write_range(fd, chunk, chunk_size, offset);
+		free(chunk);
+
+		if (err)
+			goto fail_errno;
+	}
+
+	if (close(fd)) {
+		fd = -1;
+		goto fail_errno;
+	}
+
+	return 0;
+fail_errno:
+	fprintf(stderr, "unpacking %s: %s\n", path, strerror(errno));
+fail:
+	if (fd >= 0)
+		close(fd);
+	return -1;
+}
+
+static int fill_files(sqfs_data_reader_t *data, int image_fd, int flags)
+{
+	size_t i;
+
+	for (i = 0; i < num_files; ++i) {
+		if (!(flags & UNPACK_QUIET))
+			printf("unpacking %s\n", files[i].path);
+
+		if (fill_file(files + i, data, image_fd, flags))
+			return -1;
+	}
+
+	return 0;
+}
+#endif
 
 int fill_unpacked_files(size_t blk_sz, const sqfs_tree_node_t *root,
-			sqfs_data_reader_t *data, int flags)
+			sqfs_data_reader_t *data, int image_fd, int flags)
 {
 	int status;
 
@@ -177,7 +358,7 @@ int fill_unpacked_files(size_t blk_sz, const sqfs_tree_node_t *root,
 
 	qsort(files, num_files, sizeof(files[0]), compare_files);
 
-	status = fill_files(data, flags);
+	status = fill_files(data, image_fd, flags);
 	clear_file_list();
 	return status;
 }
@@ -19,7 +19,7 @@ int main(int argc, char **argv)
 	sqfs_super_t super;
 	sqfs_file_t *file;
 	options_t opt;
-	int ret;
+	int ret, image_fd;
 
 	process_command_line(&opt, argc, argv);
 
@@ -29,6 +29,8 @@ int main(int argc, char **argv)
 		goto out_cmd;
 	}
 
+	image_fd = open_image_fd(opt.image_name);
+
 	ret = sqfs_super_read(&super, file);
 	if (ret) {
 		sqfs_perror(opt.image_name, "reading super block", ret);
@@ -119,7 +121,8 @@ int main(int argc, char **argv)
 		}
 
 		if (sqfs_data_reader_dump(opt.cmdpath, data, n->inode,
-					  stdout, super.block_size, false)) {
+					  image_fd, stdout, super.block_size,
+					  false)) {
 			goto out;
 		}
 		break;
@@ -137,7 +140,8 @@ int main(int argc, char **argv)
 		if (restore_fstree(n, opt.flags))
 			goto out;
 
-		if (fill_unpacked_files(super.block_size, n, data, opt.flags))
+		if (fill_unpacked_files(super.block_size, n, data, image_fd,
+					opt.flags))
 			goto out;
 
 		if (update_tree_attribs(xattr, n, opt.flags))
@@ -168,6 +172,8 @@ out_xr:
 out_cmp:
 	sqfs_destroy(cmp);
 out_file:
+	if (image_fd >= 0)
+		close(image_fd);
 	sqfs_destroy(file);
 out_cmd:
 	free(opt.cmdpath);
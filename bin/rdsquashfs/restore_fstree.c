@@ -156,11 +156,9 @@ static int create_node_dfs(const sqfs_tree_node_t *n, int flags)
 static int set_xattr(const char *path, sqfs_xattr_reader_t *xattr,
 		     const sqfs_tree_node_t *n)
 {
-	sqfs_xattr_value_t *value;
-	sqfs_xattr_entry_t *key;
-	sqfs_xattr_id_t desc;
-	sqfs_u32 index;
-	size_t i;
+	const sqfs_xattr_set_t *set;
+	const sqfs_xattr_pair_t *kv;
+	sqfs_u32 index, i;
 	int ret;
 
 	sqfs_inode_get_xattr_index(n->inode, &index);
@@ -168,39 +166,20 @@ static int set_xattr(const char *path, sqfs_xattr_reader_t *xattr,
 	if (index == 0xFFFFFFFF)
 		return 0;
 
-	if (sqfs_xattr_reader_get_desc(xattr, index, &desc)) {
-		fputs("Error resolving xattr index\n", stderr);
+	if (sqfs_xattr_reader_get_set(xattr, index, &set)) {
+		fputs("Error reading xattr key-value pairs\n", stderr);
 		return -1;
 	}
 
-	if (sqfs_xattr_reader_seek_kv(xattr, &desc)) {
-		fputs("Error locating xattr key-value pairs\n", stderr);
-		return -1;
-	}
-
-	for (i = 0; i < desc.count; ++i) {
-		if (sqfs_xattr_reader_read_key(xattr, &key)) {
-			fputs("Error reading xattr key\n", stderr);
-			return -1;
-		}
+	for (i = 0; i < set->count; ++i) {
+		kv = set->pairs + i;
 
-		if (sqfs_xattr_reader_read_value(xattr, key, &value)) {
-			fputs("Error reading xattr value\n", stderr);
-			free(key);
-			return -1;
-		}
-
-		ret = lsetxattr(path, (const char *)key->key,
-				value->value, value->size, 0);
+		ret = lsetxattr(path, kv->key, kv->value, kv->value_size, 0);
 		if (ret) {
 			fprintf(stderr, "setting xattr '%s' on %s: %s\n",
-				key->key, path, strerror(errno));
-		}
-
-		free(key);
-		free(value);
-		if (ret)
+				kv->key, path, strerror(errno));
 			return -1;
+		}
 	}
 
 	return 0;
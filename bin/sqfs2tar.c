@@ -88,12 +88,15 @@ static size_t num_subdirs = 0;
 static size_t max_subdirs = 0;
 
 static sqfs_xattr_reader_t *xr;
+static tar_xattr_t *xattr_scratch = NULL;
+static size_t xattr_scratch_max = 0;
 static sqfs_data_reader_t *data;
 static sqfs_file_t *file;
 static sqfs_super_t super;
 static sqfs_hard_link_t *links = NULL;
 
 static FILE *out_file = NULL;
+static int image_fd = -1;
 
 static void process_args(int argc, char **argv)
 {
@@ -222,12 +225,9 @@ static int terminate_archive(void)
 static int get_xattrs(const char *name, const sqfs_inode_generic_t *inode,
 		      tar_xattr_t **out)
 {
-	tar_xattr_t *list = NULL, *ent;
-	sqfs_xattr_value_t *value;
-	sqfs_xattr_entry_t *key;
-	sqfs_xattr_id_t desc;
-	sqfs_u32 index;
-	size_t i;
+	const sqfs_xattr_set_t *set;
+	tar_xattr_t *list, *ent;
+	sqfs_u32 index, i;
 	int ret;
 
 	if (xr == NULL)
@@ -238,64 +238,40 @@ static int get_xattrs(const char *name, const sqfs_inode_generic_t *inode,
 	if (index == 0xFFFFFFFF)
 		return 0;
 
-	ret = sqfs_xattr_reader_get_desc(xr, index, &desc);
-	if (ret) {
-		sqfs_perror(name, "resolving xattr index", ret);
-		return -1;
-	}
-
-	ret = sqfs_xattr_reader_seek_kv(xr, &desc);
+	ret = sqfs_xattr_reader_get_set(xr, index, &set);
 	if (ret) {
-		sqfs_perror(name, "locating xattr key-value pairs", ret);
+		sqfs_perror(name, "reading xattr key-value pairs", ret);
 		return -1;
 	}
 
-	for (i = 0; i < desc.count; ++i) {
-		ret = sqfs_xattr_reader_read_key(xr, &key);
-		if (ret) {
-			sqfs_perror(name, "reading xattr key", ret);
-			goto fail;
-		}
-
-		ret = sqfs_xattr_reader_read_value(xr, key, &value);
-		if (ret) {
-			sqfs_perror(name, "reading xattr value", ret);
-			free(key);
-			goto fail;
-		}
-
-		ent = calloc(1, sizeof(*ent) + strlen((const char *)key->key) +
-			     value->size + 2);
-		if (ent == NULL) {
-			perror("creating xattr entry");
-			free(key);
-			free(value);
-			goto fail;
+	if (set->count > xattr_scratch_max) {
+		list = calloc(set->count, sizeof(*list));
+		if (list == NULL) {
+			perror("creating xattr entries");
+			return -1;
 		}
 
-		ent->key = ent->data;
-		strcpy(ent->key, (const char *)key->key);
+		free(xattr_scratch);
+		xattr_scratch = list;
+		xattr_scratch_max = set->count;
+	}
 
-		ent->value = (sqfs_u8 *)ent->key + strlen(ent->key) + 1;
-		memcpy(ent->value, value->value, value->size + 1);
+	/* the entries point into the set, which the reader keeps
+	   alive until the next lookup, i.e. long enough to write
+	   the header */
+	list = NULL;
 
-		ent->value_len = value->size;
+	for (i = 0; i < set->count; ++i) {
+		ent = xattr_scratch + i;
+		ent->key = (char *)set->pairs[i].key;
+		ent->value = (sqfs_u8 *)set->pairs[i].value;
+		ent->value_len = set->pairs[i].value_size;
 		ent->next = list;
 		list = ent;
-
-		free(key);
-		free(value);
 	}
 
 	*out = list;
 	return 0;
-fail:
-	while (list != NULL) {
-		ent = list;
-		list = list->next;
-		free(ent);
-	}
-	return -1;
 }
 
 static char *assemble_tar_path(char *name, bool is_dir)
@@ -344,7 +320,7 @@ static char *assemble_tar_path(char *name, bool is_dir)
 
 static int write_tree_dfs(const sqfs_tree_node_t *n)
 {
-	tar_xattr_t *xattr = NULL, *xit;
+	tar_xattr_t *xattr = NULL;
 	sqfs_hard_link_t *lnk = NULL;
 	char *name, *target;
 	struct stat sb;
@@ -419,12 +395,6 @@ static int write_tree_dfs(const sqfs_tree_node_t *n)
 	ret = write_tar_header(out_file, &sb, name, target, xattr,
 			       record_counter++);
 
-	while (xattr != NULL) {
-		xit = xattr;
-		xattr = xattr->next;
-		free(xit);
-	}
-
 	if (ret > 0)
 		goto out_skip;
 
@@ -434,8 +404,8 @@ static int write_tree_dfs(const sqfs_tree_node_t *n)
 	}
 
 	if (S_ISREG(sb.st_mode)) {
-		if (sqfs_data_reader_dump(name, data, n->inode, out_file,
-					  super.block_size, false)) {
+		if (sqfs_data_reader_dump(name, data, n->inode, image_fd,
+					  out_file, super.block_size, false)) {
 			free(name);
 			return -1;
 		}
@@ -535,6 +505,8 @@ int main(int argc, char **argv)
 		goto out_dirs;
 	}
 
+	image_fd = open_image_fd(filename);
+
 	ret = sqfs_super_read(&super, file);
 	if (ret) {
 		sqfs_perror(filename, "reading super block", ret);
@@ -669,6 +641,7 @@ out_tree:
 out_xr:
 	if (xr != NULL)
 		sqfs_destroy(xr);
+	free(xattr_scratch);
 out_dr:
 	sqfs_destroy(dr);
 out_data:
@@ -678,6 +651,8 @@ out_id:
 out_cmp:
 	sqfs_destroy(cmp);
 out_fd:
+	if (image_fd >= 0)
+		close(image_fd);
 	sqfs_destroy(file);
 out_dirs:
 	for (i = 0; i < num_subdirs; ++i)
@@ -27,7 +27,8 @@ static int extract(sqfs_data_reader_t *data, const sqfs_inode_generic_t *inode,
 		return -1;
 	}
 
-	if (sqfs_data_reader_dump(path, data, inode, fp, block_size, true)) {
+	if (sqfs_data_reader_dump(path, data, inode, -1, fp, block_size,
+				  true)) {
 		fclose(fp);
 		return -1;
 	}
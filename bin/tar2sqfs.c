@@ -14,11 +14,26 @@
 #include <string.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <errno.h>
 
 #ifdef _WIN32
 #include <io.h>
 #endif
 
+#define INPUT_BUFFER_SIZE (1024 * 1024)
+
+#define WHITEOUT_PREFIX ".wh."
+#define WHITEOUT_OPAQUE ".wh..wh..opq"
+
+enum {
+	HUGE_PAGES_OPTION = 1,
+	META_COMP_EXTRA_OPTION,
+	UNCOMPRESSED_META_OPTION,
+	CHECKPOINT_OPTION,
+	CHECKPOINT_INTERVAL_OPTION,
+	RESUME_OPTION,
+};
+
 static struct option long_opts[] = {
 	{ "root-becomes", required_argument, NULL, 'r' },
 	{ "compressor", required_argument, NULL, 'c' },
@@ -27,12 +42,20 @@ static struct option long_opts[] = {
 	{ "defaults", required_argument, NULL, 'd' },
 	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "queue-backlog", required_argument, NULL, 'Q' },
+	{ "cpu-list", required_argument, NULL, 'C' },
+	{ "huge-pages", no_argument, NULL, HUGE_PAGES_OPTION },
 	{ "comp-extra", required_argument, NULL, 'X' },
+	{ "meta-comp-extra", required_argument, NULL, META_COMP_EXTRA_OPTION },
+	{ "uncompressed-meta", no_argument, NULL, UNCOMPRESSED_META_OPTION },
 	{ "no-skip", no_argument, NULL, 's' },
 	{ "no-xattr", no_argument, NULL, 'x' },
 	{ "no-keep-time", no_argument, NULL, 'k' },
 	{ "exportable", no_argument, NULL, 'e' },
 	{ "no-tail-packing", no_argument, NULL, 'T' },
+	{ "checkpoint", required_argument, NULL, CHECKPOINT_OPTION },
+	{ "checkpoint-interval", required_argument, NULL,
+	  CHECKPOINT_INTERVAL_OPTION },
+	{ "resume", no_argument, NULL, RESUME_OPTION },
 	{ "force", no_argument, NULL, 'f' },
 	{ "quiet", no_argument, NULL, 'q' },
 	{ "help", no_argument, NULL, 'h' },
@@ -40,14 +63,19 @@ static struct option long_opts[] = {
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *short_opts = "r:c:b:B:d:X:j:Q:sxekfqThV";
+static const char *short_opts = "r:c:b:B:d:X:j:Q:C:sxekfqThV";
 
 static const char *usagestr =
-"Usage: tar2sqfs [OPTIONS...] <sqfsfile>\n"
+"Usage: tar2sqfs [OPTIONS...] <sqfsfile> [<layer>...]\n"
 "\n"
 "Read an uncompressed tar archive from stdin and turn it into a squashfs\n"
 "filesystem image.\n"
 "\n"
+"If one or more tar files are specified after the image name, they are\n"
+"read instead of stdin and treated as a stack of OCI image layers, with\n"
+"the last one on top. Whiteout entries are applied while merging and data\n"
+"of files that are replaced by a higher layer is never packed.\n"
+"\n"
 "Possible options:\n"
 "\n"
 "  --root-becomes, -r <dir>    The specified directory becomes the root.\n"
@@ -62,11 +90,21 @@ static const char *usagestr =
 "  --comp-extra, -X <options>  A comma separated list of extra options for\n"
 "                              the selected compressor. Specify 'help' to\n"
 "                              get a list of available options.\n"
+"  --meta-comp-extra <options> Extra compressor options for the meta data,\n"
+"                              e.g. a different compression level. If not\n"
+"                              set, the options for the data are used.\n"
+"  --uncompressed-meta         Store inodes, directories and all tables\n"
+"                              uncompressed, for faster lookups.\n"
 "  --num-jobs, -j <count>      Number of compressor jobs to create.\n"
+"                              Use 'auto' to adjust the number at runtime.\n"
+"  --cpu-list, -C <list>       Pin the compressor jobs to a comma separated\n"
+"                              list of CPU numbers and ranges, e.g. 0-3,8.\n"
 "  --queue-backlog, -Q <count> Maximum number of data blocks in the thread\n"
 "                              worker queue before the packer starts waiting\n"
 "                              for the block processors to catch up.\n"
 "                              Defaults to 10 times the number of jobs.\n"
+"  --huge-pages                Allocate data block buffers from huge pages,\n"
+"                              if the system supports it.\n"
 "  --block-size, -b <size>     Block size to use for Squashfs image.\n"
 "                              Defaults to %u.\n"
 "  --dev-block-size, -B <size> Device block size to padd the image to.\n"
@@ -79,7 +117,9 @@ static const char *usagestr =
 "                                 gid=<value>    0 if not set.\n"
 "                                 mode=<value>   0755 if not set.\n"
 "                                 mtime=<value>  0 if not set.\n"
-"\n"
+"\n";
+
+static const char *flagstr =
 "  --no-skip, -s               Abort if a tar record cannot be read instead\n"
 "                              of skipping it.\n"
 "  --no-xattr, -x              Do not copy extended attributes from archive.\n"
@@ -88,16 +128,29 @@ static const char *usagestr =
 "  --exportable, -e            Generate an export table for NFS support.\n"
 "  --no-tail-packing, -T       Do not perform tail end packing on files that\n"
 "                              are larger than block size.\n"
+"  --checkpoint <file>         Periodically flush all data packed so far and\n"
+"                              save the state of the build to the given\n"
+"                              file, so it can be resumed after a crash.\n"
+"  --checkpoint-interval <sec> Seconds between two checkpoints. Defaults\n"
+"                              to 600.\n"
+"  --resume                    Continue the build from the --checkpoint file,\n"
+"                              using the partially written output image.\n"
+"                              The same input must be fed in again from the\n"
+"                              start, data that is already packed is\n"
+"                              skipped.\n"
 "  --force, -f                 Overwrite the output file if it exists.\n"
 "  --quiet, -q                 Do not print out progress reports.\n"
 "  --help, -h                  Print help text and exit.\n"
 "  --version, -V               Print version information and exit.\n"
-"\n"
+"\n";
+
+static const char *examplestr =
 "Examples:\n"
 "\n"
 "\ttar2sqfs rootfs.sqfs < rootfs.tar\n"
 "\tzcat rootfs.tar.gz | tar2sqfs rootfs.sqfs\n"
 "\txzcat rootfs.tar.xz | tar2sqfs rootfs.sqfs\n"
+"\ttar2sqfs rootfs.sqfs base.tar layer1.tar layer2.tar\n"
 "\n";
 
 static bool dont_skip = false;
@@ -107,6 +160,20 @@ static sqfs_writer_cfg_t cfg;
 static sqfs_writer_t sqfs;
 static FILE *input_file = NULL;
 static char *root_becomes = NULL;
+static char **layers = NULL;
+static sqfs_u32 num_layers = 0;
+static sqfs_u32 cur_layer = 0;
+static bool have_root_attribs = false;
+
+typedef struct {
+	char *name;
+	char *link_path;
+	fpos_t pos;
+} hidden_entry_t;
+
+static hidden_entry_t *hidden = NULL;
+static size_t num_hidden = 0;
+static size_t max_hidden = 0;
 
 static void process_args(int argc, char **argv)
 {
@@ -162,14 +229,39 @@ static void process_args(int argc, char **argv)
 			cfg.comp_id = ret;
 			break;
 		case 'j':
-			cfg.num_jobs = strtol(optarg, NULL, 0);
+			if (strcmp(optarg, "auto") == 0) {
+				cfg.auto_tune = true;
+			} else {
+				cfg.num_jobs = strtol(optarg, NULL, 0);
+			}
 			break;
 		case 'Q':
 			cfg.max_backlog = strtol(optarg, NULL, 0);
 			break;
+		case 'C':
+			cfg.cpu_list = optarg;
+			break;
+		case HUGE_PAGES_OPTION:
+			cfg.huge_pages = true;
+			break;
 		case 'X':
 			cfg.comp_extra = optarg;
 			break;
+		case META_COMP_EXTRA_OPTION:
+			cfg.meta_comp_extra = optarg;
+			break;
+		case UNCOMPRESSED_META_OPTION:
+			cfg.uncompressed_meta = true;
+			break;
+		case CHECKPOINT_OPTION:
+			cfg.checkpoint = optarg;
+			break;
+		case CHECKPOINT_INTERVAL_OPTION:
+			cfg.checkpoint_interval = strtoul(optarg, NULL, 0);
+			break;
+		case RESUME_OPTION:
+			cfg.resume = true;
+			break;
 		case 'd':
 			cfg.fs_defaults = optarg;
 			break;
@@ -210,6 +302,8 @@ static void process_args(int argc, char **argv)
 		case 'h':
 			printf(usagestr, SQFS_DEFAULT_BLOCK_SIZE,
 			       SQFS_DEVBLK_SIZE);
+			fputs(flagstr, stdout);
+			fputs(examplestr, stdout);
 			compressor_print_available();
 			exit(EXIT_SUCCESS);
 		case 'V':
@@ -231,6 +325,11 @@ static void process_args(int argc, char **argv)
 		exit(EXIT_SUCCESS);
 	}
 
+	if (cfg.resume && cfg.checkpoint == NULL) {
+		fputs("--resume requires a --checkpoint file.\n", stderr);
+		goto fail_arg;
+	}
+
 	if (optind >= argc) {
 		fputs("Missing argument: squashfs image\n", stderr);
 		goto fail_arg;
@@ -239,8 +338,8 @@ static void process_args(int argc, char **argv)
 	cfg.filename = argv[optind++];
 
 	if (optind < argc) {
-		fputs("Unknown extra arguments specified.\n", stderr);
-		goto fail_arg;
+		layers = argv + optind;
+		num_layers = argc - optind;
 	}
 	return;
 fail_arg:
@@ -251,10 +350,19 @@ fail_arg:
 static int write_file(tar_header_decoded_t *hdr, file_info_t *fi,
 		      sqfs_u64 filesize)
 {
+	sqfs_inode_generic_t **inode = (sqfs_inode_generic_t **)&fi->user_ptr;
 	sqfs_file_t *file;
 	int flags;
 	int ret;
 
+	ret = sqfs_writer_resume_file(&sqfs, hdr->name, filesize,
+				      hdr->mtime, inode);
+	if (ret < 0)
+		return -1;
+
+	if (ret > 0)
+		return skip_entry(input_file, hdr->record_size);
+
 	file = sqfs_get_stdin_file(input_file, hdr->sparse, filesize);
 	if (file == NULL) {
 		perror("packing files");
@@ -265,16 +373,20 @@ static int write_file(tar_header_decoded_t *hdr, file_info_t *fi,
 	if (no_tail_pack && filesize > cfg.block_size)
 		flags |= SQFS_BLK_DONT_FRAGMENT;
 
-	ret = write_data_from_file(hdr->name, sqfs.data,
-				   (sqfs_inode_generic_t **)&fi->user_ptr,
-				   file, flags);
+	ret = write_data_from_file_condensed(hdr->name, sqfs.data, inode,
+					     file, hdr->sparse, flags);
 	sqfs_destroy(file);
 
 	if (ret)
 		return -1;
 
-	return skip_padding(input_file, hdr->sparse == NULL ?
-			    filesize : hdr->record_size);
+	if (skip_padding(input_file, hdr->sparse == NULL ?
+			 filesize : hdr->record_size)) {
+		return -1;
+	}
+
+	return sqfs_writer_file_done(&sqfs, hdr->name, filesize,
+				     hdr->mtime, inode);
 }
 
 static int copy_xattr(tree_node_t *node, const tar_header_decoded_t *hdr)
@@ -370,6 +482,7 @@ static int set_root_attribs(const tar_header_decoded_t *hdr)
 		return -1;
 	}
 
+	have_root_attribs = true;
 	sqfs.fs.root->uid = hdr->sb.st_uid;
 	sqfs.fs.root->gid = hdr->sb.st_gid;
 	sqfs.fs.root->mode = hdr->sb.st_mode;
@@ -385,6 +498,363 @@ static int set_root_attribs(const tar_header_decoded_t *hdr)
 	return 0;
 }
 
+/*
+  Layers are processed from the top down, so the first entry seen for a path
+  is the one that ends up in the image. An entry from the current layer is
+  hidden if a higher layer already provides it, replaced one of its parent
+  directories with something else, removed it through a whiteout, or marked a
+  parent directory as opaque. A whiteout only applies to the layers below
+  the one it is in.
+ */
+static bool layer_is_hidden(const char *path, bool is_dir)
+{
+	tree_node_t *n = sqfs.fs.root;
+	const char *end;
+	size_t len;
+
+	for (;;) {
+		if (n->mode == FSTREE_MODE_WHITEOUT)
+			return cur_layer < n->data.whiteout_layer;
+
+		if (!S_ISDIR(n->mode))
+			return true;
+
+		if (cur_layer < n->data.dir.opaque_layer)
+			return true;
+
+		end = strchr(path, '/');
+		len = end == NULL ? strlen(path) : (size_t)(end - path);
+
+		n = n->data.dir.children;
+		while (n != NULL) {
+			if (strncmp(n->name, path, len) == 0 &&
+			    n->name[len] == '\0')
+				break;
+			n = n->next;
+		}
+
+		if (n == NULL)
+			return false;
+
+		if (end == NULL)
+			break;
+
+		path = end + 1;
+	}
+
+	if (n->mode == FSTREE_MODE_WHITEOUT)
+		return cur_layer < n->data.whiteout_layer;
+
+	return !is_dir || !S_ISDIR(n->mode) || !n->data.dir.created_implicitly;
+}
+
+/*
+  If the layer that contains a whiteout also has an entry at the same path,
+  or below it, the place holder is replaced. A directory that takes its
+  place hides the lower layer contents, like one that a higher layer
+  re-creates.
+ */
+static void replace_whiteouts(const char *path, bool is_dir)
+{
+	tree_node_t *n = sqfs.fs.root, **it;
+	const char *end;
+	size_t len;
+
+	for (;;) {
+		end = strchr(path, '/');
+		len = end == NULL ? strlen(path) : (size_t)(end - path);
+
+		for (it = &n->data.dir.children; *it != NULL;
+		     it = &(*it)->next) {
+			if (strncmp((*it)->name, path, len) == 0 &&
+			    (*it)->name[len] == '\0')
+				break;
+		}
+
+		n = *it;
+		if (n == NULL)
+			return;
+
+		if (n->mode == FSTREE_MODE_WHITEOUT) {
+			if (end == NULL && !is_dir) {
+				*it = n->next;
+				n->parent->link_count -= 1;
+				free(n);
+				return;
+			}
+
+			n->uid = sqfs.fs.defaults.st_uid;
+			n->gid = sqfs.fs.defaults.st_gid;
+			n->mode = sqfs.fs.defaults.st_mode;
+			n->mod_time = sqfs.fs.defaults.st_mtime;
+			n->link_count = 2;
+
+			memset(&n->data, 0, sizeof(n->data));
+			n->data.dir.created_implicitly = true;
+			n->data.dir.opaque_layer = cur_layer;
+		}
+
+		if (end == NULL || !S_ISDIR(n->mode))
+			return;
+
+		path = end + 1;
+	}
+}
+
+static bool is_whiteout(const char *path)
+{
+	const char *name = strrchr(path, '/');
+
+	name = (name == NULL) ? path : (name + 1);
+
+	return strncmp(name, WHITEOUT_PREFIX, strlen(WHITEOUT_PREFIX)) == 0;
+}
+
+static int apply_whiteout(tar_header_decoded_t *hdr)
+{
+	const char *path = hdr->name;
+	char *base, *name;
+	tree_node_t *node;
+	struct stat sb;
+
+	base = strrchr(hdr->name, '/');
+	if (base == NULL) {
+		base = hdr->name;
+		path = "";
+	} else {
+		*(base++) = '\0';
+	}
+
+	name = base;
+
+	if (strcmp(name, WHITEOUT_OPAQUE) == 0) {
+		node = fstree_get_node_by_path(&sqfs.fs, sqfs.fs.root, path,
+					       true, false);
+		if (node == NULL)
+			goto fail_errno;
+
+		if (node->data.dir.opaque_layer < cur_layer)
+			node->data.dir.opaque_layer = cur_layer;
+		return 0;
+	}
+
+	/* other .wh..wh. names are reserved for aufs internals */
+	name += strlen(WHITEOUT_PREFIX);
+	if (*name == '\0' || strncmp(name, WHITEOUT_PREFIX,
+				     strlen(WHITEOUT_PREFIX)) == 0) {
+		return 0;
+	}
+
+	if (base != hdr->name)
+		base[-1] = '/';
+
+	memmove(base, name, strlen(name) + 1);
+
+	node = fstree_get_node_by_path(&sqfs.fs, sqfs.fs.root, hdr->name,
+				       false, false);
+	if (node != NULL) {
+		/* a higher layer re-created it, hide lower layer contents */
+		if (S_ISDIR(node->mode)) {
+			node->data.dir.created_implicitly = false;
+			if (node->data.dir.opaque_layer < cur_layer)
+				node->data.dir.opaque_layer = cur_layer;
+		}
+		return 0;
+	}
+
+	memset(&sb, 0, sizeof(sb));
+	sb.st_mode = S_IFCHR;
+
+	node = fstree_add_generic(&sqfs.fs, hdr->name, &sb, NULL);
+	if (node == NULL)
+		goto fail_errno;
+
+	node->mode = FSTREE_MODE_WHITEOUT;
+	node->data.whiteout_layer = cur_layer;
+	return 0;
+fail_errno:
+	perror(hdr->name);
+	return -1;
+}
+
+/*
+  Remove whiteout place holders, as well as implicitly created directories
+  that only existed to hold them.
+ */
+static void remove_whiteouts(tree_node_t *root)
+{
+	tree_node_t **it = &root->data.dir.children;
+	tree_node_t *n;
+
+	while (*it != NULL) {
+		n = *it;
+
+		if (S_ISDIR(n->mode))
+			remove_whiteouts(n);
+
+		if (n->mode == FSTREE_MODE_WHITEOUT ||
+		    (S_ISDIR(n->mode) && n->data.dir.created_implicitly &&
+		     n->data.dir.opaque_layer == 0 &&
+		     n->data.dir.children == NULL)) {
+			*it = n->next;
+			root->link_count -= 1;
+			free(n);
+		} else {
+			it = &n->next;
+		}
+	}
+}
+
+/*
+  Entries of the current layer that are hidden by a higher layer are not
+  packed, but a hard link in the same layer can still refer to one. The
+  position of the header is remembered, so the data can be fetched again.
+ */
+static int record_hidden(const char *name, const fpos_t *pos)
+{
+	size_t new_sz;
+	void *new;
+
+	if (num_hidden == max_hidden) {
+		new_sz = max_hidden ? max_hidden * 2 : 16;
+		new = realloc(hidden, sizeof(hidden[0]) * new_sz);
+		if (new == NULL)
+			goto fail_errno;
+
+		hidden = new;
+		max_hidden = new_sz;
+	}
+
+	hidden[num_hidden].name = strdup(name);
+	if (hidden[num_hidden].name == NULL)
+		goto fail_errno;
+
+	hidden[num_hidden].link_path = NULL;
+	hidden[num_hidden].pos = *pos;
+	num_hidden += 1;
+	return 0;
+fail_errno:
+	perror(name);
+	return -1;
+}
+
+static void clear_hidden(void)
+{
+	size_t i;
+
+	for (i = 0; i < num_hidden; ++i) {
+		free(hidden[i].name);
+		free(hidden[i].link_path);
+	}
+
+	num_hidden = 0;
+}
+
+static int link_to_node(const char *name, const char *target)
+{
+	tree_node_t *node, *tgt;
+
+	node = fstree_add_hard_link(&sqfs.fs, name, target);
+	if (node == NULL) {
+		perror(name);
+		return -1;
+	}
+
+	tgt = fstree_get_node_by_path(&sqfs.fs, sqfs.fs.root,
+				      node->data.target, false, false);
+	if (tgt == NULL || tgt->mode == FSTREE_MODE_WHITEOUT) {
+		errno = ENOENT;
+		goto fail_link;
+	}
+
+	if (fstree_resolve_hard_link(&sqfs.fs, node))
+		goto fail_link;
+
+	if (!cfg.quiet)
+		printf("Hard link %s -> %s\n", name, target);
+	return 0;
+fail_link:
+	fprintf(stderr, "Resolving hard link '%s' -> '%s': %s\n",
+		name, target, strerror(errno));
+	return -1;
+}
+
+/*
+  A hard link in a layer is resolved right away, before lower layers are
+  merged in. If the link target of the same layer is hidden, the link takes
+  its place and receives a copy of the hidden entry instead. Only entries
+  before the first `limit` hidden ones are considered, which breaks chains
+  of links.
+ */
+static int add_layer_hard_link(const char *name, char *target, size_t limit)
+{
+	tar_header_decoded_t hdr;
+	hidden_entry_t *ent;
+	fpos_t pos;
+	int ret;
+
+	if (canonicalize_name(target) != 0) {
+		fprintf(stderr, "%s: invalid hard link target '%s'\n",
+			name, target);
+		return -1;
+	}
+
+	while (limit > 0 && strcmp(hidden[limit - 1].name, target) != 0)
+		--limit;
+
+	if (limit == 0)
+		return link_to_node(name, target);
+
+	ent = hidden + limit - 1;
+	if (ent->link_path != NULL)
+		return link_to_node(name, ent->link_path);
+
+	if (fgetpos(input_file, &pos) != 0 ||
+	    fsetpos(input_file, &ent->pos) != 0) {
+		perror(name);
+		return -1;
+	}
+
+	ret = read_header(input_file, &hdr);
+	if (ret > 0) {
+		fprintf(stderr, "%s: reading hard link target '%s': "
+			"unexpected end of archive\n", name, target);
+	}
+	if (ret != 0)
+		return -1;
+
+	if (hdr.is_hard_link) {
+		ret = add_layer_hard_link(name, hdr.link_target, limit - 1);
+	} else {
+		if (hdr.mtime < 0)
+			hdr.mtime = 0;
+
+		if ((sqfs_u64)hdr.mtime > 0x0FFFFFFFFUL)
+			hdr.mtime = 0x0FFFFFFFFUL;
+
+		hdr.sb.st_mtime = hdr.mtime;
+		hdr.name = (char *)name;
+		ret = create_node_and_repack_data(&hdr);
+	}
+
+	clear_header(&hdr);
+
+	if (ret == 0 && fsetpos(input_file, &pos) != 0) {
+		perror(name);
+		ret = -1;
+	}
+
+	if (ret == 0) {
+		ent->link_path = strdup(name);
+		if (ent->link_path == NULL) {
+			perror(name);
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
 static int process_tar_ball(void)
 {
 	bool skip, is_root, is_prefixed;
@@ -392,11 +862,17 @@ static int process_tar_ball(void)
 	sqfs_u64 offset, count;
 	sparse_map_t *m;
 	size_t rootlen;
+	fpos_t pos;
 	int ret;
 
 	rootlen = root_becomes == NULL ? 0 : strlen(root_becomes);
 
 	for (;;) {
+		if (cur_layer > 0 && fgetpos(input_file, &pos) != 0) {
+			perror(layers[cur_layer - 1]);
+			return -1;
+		}
+
 		ret = read_header(input_file, &hdr);
 		if (ret > 0)
 			break;
@@ -452,8 +928,10 @@ static int process_tar_ball(void)
 		}
 
 		if (is_root) {
-			if (set_root_attribs(&hdr))
+			if ((cur_layer == 0 || !have_root_attribs) &&
+			    set_root_attribs(&hdr)) {
 				goto fail;
+			}
 			clear_header(&hdr);
 			continue;
 		}
@@ -488,15 +966,45 @@ static int process_tar_ball(void)
 		if (skip) {
 			if (dont_skip)
 				goto fail;
-			if (skip_entry(input_file, hdr.sb.st_size))
+			if (skip_entry(input_file, hdr.record_size))
 				goto fail;
 
 			clear_header(&hdr);
 			continue;
 		}
 
-		if (create_node_and_repack_data(&hdr))
+		if (cur_layer > 0) {
+			if (layer_is_hidden(hdr.name, !hdr.is_hard_link &&
+					    S_ISDIR(hdr.sb.st_mode))) {
+				if (record_hidden(hdr.name, &pos))
+					goto fail;
+				skip = true;
+			} else if (is_whiteout(hdr.name)) {
+				if (apply_whiteout(&hdr))
+					goto fail;
+				skip = true;
+			} else {
+				replace_whiteouts(hdr.name, !hdr.is_hard_link &&
+						  S_ISDIR(hdr.sb.st_mode));
+			}
+
+			if (skip) {
+				if (skip_entry(input_file, hdr.record_size))
+					goto fail;
+
+				clear_header(&hdr);
+				continue;
+			}
+		}
+
+		if (cur_layer > 0 && hdr.is_hard_link) {
+			if (add_layer_hard_link(hdr.name, hdr.link_target,
+						num_hidden)) {
+				goto fail;
+			}
+		} else if (create_node_and_repack_data(&hdr)) {
 			goto fail;
+		}
 
 		clear_header(&hdr);
 	}
@@ -507,28 +1015,72 @@ fail:
 	return -1;
 }
 
+static int process_layers(void)
+{
+	int ret;
+
+	for (cur_layer = num_layers; cur_layer > 0; --cur_layer) {
+		input_file = fopen(layers[cur_layer - 1], "rb");
+		if (input_file == NULL) {
+			perror(layers[cur_layer - 1]);
+			return -1;
+		}
+
+		if (setvbuf(input_file, NULL, _IOFBF, INPUT_BUFFER_SIZE) != 0) {
+			perror("setting up input buffer");
+			fclose(input_file);
+			return -1;
+		}
+
+		ret = process_tar_ball();
+		fclose(input_file);
+		clear_hidden();
+
+		if (ret) {
+			free(hidden);
+			return -1;
+		}
+	}
+
+	free(hidden);
+	remove_whiteouts(sqfs.fs.root);
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	int status = EXIT_FAILURE;
+	int ret;
 
 	process_args(argc, argv);
 
+	if (num_layers == 0) {
 #ifdef _WIN32
-	_setmode(_fileno(stdin), _O_BINARY);
-	input_file = stdin;
+		_setmode(_fileno(stdin), _O_BINARY);
+		input_file = stdin;
 #else
-	input_file = freopen(NULL, "rb", stdin);
+		input_file = freopen(NULL, "rb", stdin);
 #endif
 
-	if (input_file == NULL) {
-		perror("changing stdin to binary mode");
-		return EXIT_FAILURE;
+		if (input_file == NULL) {
+			perror("changing stdin to binary mode");
+			return EXIT_FAILURE;
+		}
+
+		/* fetch the input in large chunks, headers are decoded
+		   in place */
+		if (setvbuf(input_file, NULL, _IOFBF,
+			    INPUT_BUFFER_SIZE) != 0) {
+			perror("setting up input buffer");
+			return EXIT_FAILURE;
+		}
 	}
 
 	if (sqfs_writer_init(&sqfs, &cfg))
 		return EXIT_FAILURE;
 
-	if (process_tar_ball())
+	ret = num_layers > 0 ? process_layers() : process_tar_ball();
+	if (ret)
 		goto out;
 
 	if (fstree_post_process(&sqfs.fs))
@@ -1,6 +1,7 @@
 #include "sqfs/data_reader.h"
 #include "sqfs/compressor.h"
 #include "sqfs/dir_reader.h"
+#include "sqfs/inode_cache.h"
 #include "sqfs/id_table.h"
 #include "sqfs/inode.h"
 #include "sqfs/super.h"
@@ -18,6 +19,7 @@
 #include <readline/readline.h>
 #include <readline/history.h>
 
+static sqfs_inode_cache_t *icache;
 static sqfs_dir_reader_t *dr;
 static sqfs_super_t super;
 static sqfs_inode_generic_t *working_dir;
@@ -525,14 +527,23 @@ int main(int argc, char **argv)
 		goto out_id;
 	}
 
-	/* create a directory reader and get the root inode */
+	/* create a directory reader that caches the inodes it has seen
+	   and get the root inode */
+	icache = sqfs_inode_cache_create(4096);
+	if (icache == NULL) {
+		fputs("Error creating inode cache.\n", stderr);
+		goto out_id;
+	}
+
 	dr = sqfs_dir_reader_create(&super, cmp, file);
 	if (dr == NULL) {
 		fprintf(stderr, "%s: error creating directory reader.\n",
 			argv[1]);
-		goto out_id;
+		goto out_icache;
 	}
 
+	sqfs_dir_reader_set_inode_cache(dr, icache);
+
 	if (sqfs_dir_reader_get_root_inode(dr, &working_dir)) {
 		fprintf(stderr, "%s: error reading root inode.\n", argv[1]);
 		goto out_dir;
@@ -599,6 +610,8 @@ out_dir:
 	if (working_dir != NULL)
 		free(working_dir);
 	sqfs_destroy(dr);
+out_icache:
+	sqfs_destroy(icache);
 out_id:
 	sqfs_destroy(idtbl);
 out_cmp:
@@ -22,6 +22,9 @@
 #include "sqfs/block_writer.h"
 #include "sqfs/frag_table.h"
 #include "sqfs/dir_writer.h"
+#include "sqfs/executor.h"
+#include "sqfs/buffer_pool.h"
+#include "sqfs/inode_cache.h"
 #include "sqfs/dir_reader.h"
 #include "sqfs/block.h"
 #include "sqfs/xattr.h"
@@ -34,6 +37,9 @@
 
 #include <stddef.h>
 
+/* see checkpoint.c */
+typedef struct checkpoint_t checkpoint_t;
+
 typedef struct {
 	const char *filename;
 	sqfs_block_writer_t *blkwr;
@@ -43,28 +49,69 @@ typedef struct {
 	sqfs_meta_writer_t *dm;
 	sqfs_meta_writer_t *im;
 	sqfs_compressor_t *cmp;
+	/* used for meta data and tables, see meta_compressor_create */
+	sqfs_compressor_t *meta_cmp;
 	sqfs_id_table_t *idtbl;
 	sqfs_file_t *outfile;
 	sqfs_super_t super;
 	fstree_t fs;
 	sqfs_xattr_writer_t *xwr;
+
+	/* buffer pool used by the block processor, if any */
+	sqfs_buffer_pool_t *pool;
+	/* set if the pool was created by the writer and has to be destroyed */
+	sqfs_buffer_pool_t *own_pool;
+
+	/* set if the build is checkpointed, see sqfs_writer_file_done */
+	checkpoint_t *ckpt;
 } sqfs_writer_t;
 
 typedef struct {
 	const char *filename;
 	char *fs_defaults;
 	char *comp_extra;
+	/* If set, extra compressor options for the meta data only, e.g. a
+	   different compression level. Otherwise comp_extra is used. */
+	char *meta_comp_extra;
 	size_t block_size;
 	size_t devblksize;
 	size_t max_backlog;
 	size_t num_jobs;
 
+	/* If set, the block processor submits work to this executor
+	   instead of creating num_jobs worker threads. */
+	sqfs_executor_t *exec;
+
 	int outmode;
 	SQFS_COMPRESSOR comp_id;
 
 	bool exportable;
 	bool no_xattr;
 	bool quiet;
+
+	/* Store inodes, directories and all tables uncompressed. */
+	bool uncompressed_meta;
+
+	/* Let the block processor scale the number of active workers and
+	   the backlog, using num_jobs and max_backlog as upper limits. */
+	bool auto_tune;
+
+	/* If set, a CPU list (see parse_cpu_list) to pin the block processor
+	   workers to. Not supported together with an executor. */
+	const char *cpu_list;
+
+	/* If set, the block processor takes its buffers from this pool. If not
+	   set and huge_pages is true, a huge page backed pool is created. */
+	sqfs_buffer_pool_t *pool;
+	bool huge_pages;
+
+	/* If set, the state of the build is saved to this file every
+	   checkpoint_interval seconds, so it can be resumed after a crash.
+	   If resume is set, the build continues from the checkpoint in
+	   this file, using the partially written output image. */
+	const char *checkpoint;
+	unsigned int checkpoint_interval;
+	bool resume;
 } sqfs_writer_cfg_t;
 
 typedef struct sqfs_hard_link_t {
@@ -95,6 +142,13 @@ void sqfs_print_statistics(const sqfs_super_t *super,
 			   const sqfs_block_processor_t *blk,
 			   const sqfs_block_writer_t *wr);
 
+/* Print the operating point the block processor tuned itself to */
+void sqfs_print_tuning_statistics(const sqfs_block_processor_t *blk);
+
+void sqfs_print_pool_statistics(const sqfs_buffer_pool_t *pool);
+
+void sqfs_print_meta_statistics(const sqfs_compressor_t *meta_cmp);
+
 void compressor_print_available(void);
 
 SQFS_COMPRESSOR compressor_get_default(void);
@@ -109,10 +163,41 @@ int inode_stat(const sqfs_tree_node_t *node, struct stat *sb);
 
 char *sqfs_tree_node_get_path(const sqfs_tree_node_t *node);
 
+/*
+  Write the contents of a file to fp. If image_fd is not -1, it must refer
+  to the image the data reader reads from. Runs of uncompressed blocks are
+  then copied from it to the output by the kernel where possible.
+ */
 int sqfs_data_reader_dump(const char *name, sqfs_data_reader_t *data,
-			  const sqfs_inode_generic_t *inode,
+			  const sqfs_inode_generic_t *inode, int image_fd,
 			  FILE *fp, size_t block_size, bool allow_sparse);
 
+/*
+  Copy a range of the image to out_fd without passing it through user
+  space. If out_off is not NULL, out_fd is a regular file written at that
+  offset, which is advanced. Otherwise, out_fd must be a pipe.
+
+  Returns 0 on success, -1 on failure or a positive value if the kernel
+  cannot copy between the two files and nothing has been written.
+ */
+int copy_image_range(int image_fd, sqfs_u64 offset, int out_fd,
+		     sqfs_u64 *out_off, sqfs_u64 size);
+
+/*
+  Get the number of consecutive uncompressed data blocks of a file, starting
+  at the given block index, that copy_image_range can copy verbatim.
+  remaining is the number of file bytes from the start of that block on.
+  The number of bytes the blocks hold is returned in size.
+ */
+size_t get_stored_run(const sqfs_inode_generic_t *inode, size_t index,
+		      sqfs_u64 remaining, size_t block_size, sqfs_u64 *size);
+
+/*
+  Open a raw descriptor of an image for copy_image_range. Returns -1 if
+  the image cannot be opened or the system has no way of copying ranges.
+ */
+int open_image_fd(const char *path);
+
 sqfs_file_t *sqfs_get_stdin_file(FILE *fp, const sparse_map_t *map,
 				 sqfs_u64 size);
 
@@ -120,6 +205,20 @@ int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
 			 sqfs_inode_generic_t **inode,
 			 sqfs_file_t *file, int flags);
 
+/*
+  Same as write_data_from_file, but if a sparse map is given, the holes in
+  between the mapped data regions are passed to the block processor as such,
+  without reading them from the file or scanning them for zero bytes.
+
+  The file is expected to return the expanded contents, e.g. a file created
+  using sqfs_get_stdin_file with the same sparse map.
+ */
+int write_data_from_file_condensed(const char *filename,
+				   sqfs_block_processor_t *data,
+				   sqfs_inode_generic_t **inode,
+				   sqfs_file_t *file, const sparse_map_t *map,
+				   int flags);
+
 void sqfs_writer_cfg_init(sqfs_writer_cfg_t *cfg);
 
 int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg);
@@ -128,6 +227,55 @@ int sqfs_writer_finish(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *cfg);
 
 void sqfs_writer_cleanup(sqfs_writer_t *sqfs, int status);
 
+/*
+  If the build is resumed from a checkpoint and the next file that was
+  packed before the checkpoint was taken has the given path, set its inode
+  and return 1. The data of the file does not have to be packed again.
+
+  Files must be presented in the same order in which they were packed
+  originally. Returns 0 if the file has to be packed and -1 (after printing
+  an error message) if the input does not match the checkpoint, or if the
+  size or modification time of the input file differs from when it was
+  packed.
+ */
+int sqfs_writer_resume_file(sqfs_writer_t *sqfs, const char *path,
+			    sqfs_u64 size, sqfs_s64 mtime,
+			    sqfs_inode_generic_t **inode);
+
+/*
+  Report that the data of a file has been submitted to the block processor.
+  The size and modification time must be those of the input file, as later
+  passed to sqfs_writer_resume_file when resuming the build. If checkpoints
+  are enabled and the interval has elapsed, all data is flushed to disk and
+  a new checkpoint is written. Returns 0 on success,
+  -1 on failure after printing an error message.
+ */
+int sqfs_writer_file_done(sqfs_writer_t *sqfs, const char *path,
+			  sqfs_u64 size, sqfs_s64 mtime,
+			  sqfs_inode_generic_t **inode);
+
+/* Used by sqfs_writer_init, sqfs_writer_finish and sqfs_writer_cleanup. */
+checkpoint_t *checkpoint_create(const sqfs_writer_cfg_t *cfg);
+
+/*
+  Read the checkpoint to resume from and check that it was created with
+  the same settings. Must be called before anything is written.
+ */
+int checkpoint_load(checkpoint_t *ckpt, sqfs_compressor_t *cmp);
+
+/* Restore the block writer and fragment table state of the checkpoint. */
+int checkpoint_restore(checkpoint_t *ckpt, sqfs_block_writer_t *wr,
+		       sqfs_frag_table_t *tbl);
+
+/* Check that all files in the checkpoint have been resumed. */
+int checkpoint_finish(checkpoint_t *ckpt);
+
+/*
+  Remove the checkpoint file if the build was successful. Returns true if
+  the build failed and the output has to be kept for resuming it.
+ */
+bool checkpoint_destroy(checkpoint_t *ckpt, bool success);
+
 void sqfs_perror(const char *file, const char *action, int error_code);
 
 int sqfs_tree_find_hard_links(const sqfs_tree_node_t *root,
@@ -152,6 +300,25 @@ void print_version(const char *progname);
 int lzo_compressor_create(const sqfs_compressor_config_t *cfg,
 			  sqfs_compressor_t **out);
 
+typedef struct {
+	sqfs_u64 block_count;
+	sqfs_u64 uncompressed_count;
+	sqfs_u64 bytes_in;
+	sqfs_u64 bytes_out;
+} meta_compressor_stats_t;
+
+/*
+  Create a compressor for meta data blocks and tables, that forwards to the
+  given compressor and counts the bytes that go in and come out. If cmp is
+  NULL, every block is stored uncompressed. If own_cmp is set, cmp is
+  destroyed along with the wrapper. The wrapper cannot uncompress anything.
+ */
+int meta_compressor_create(sqfs_compressor_t *cmp, bool own_cmp,
+			   sqfs_compressor_t **out);
+
+const meta_compressor_stats_t *
+meta_compressor_get_stats(const sqfs_compressor_t *cmp);
+
 /*
   Parse a number optionally followed by a KMG suffix (case insensitive). Prints
   an error message to stderr and returns -1 on failure, 0 on success.
@@ -166,4 +333,31 @@ int parse_size(const char *what, size_t *out, const char *str,
 
 void print_size(sqfs_u64 size, char *buffer, bool round_to_int);
 
+/*
+  Parse a comma separated list of CPU numbers and ranges (e.g. "0-3,8,10-11")
+  into a newly allocated array. Prints an error message to stderr and returns
+  -1 on failure, 0 on success.
+ */
+int parse_cpu_list(const char *str, unsigned int **out, size_t *count);
+
+/*
+  Create a fixed size pool of worker threads that implements the executor
+  interface, e.g. to share a set of threads between several block processors.
+  If built without thread support, tasks are simply run by the submitting
+  thread.
+
+  Returns NULL on failure and prints an error message to stderr.
+ */
+sqfs_executor_t *thread_pool_create(unsigned int num_threads);
+
+/*
+  Run all tasks that are still queued and then stop the worker threads.
+ */
+void thread_pool_destroy(sqfs_executor_t *pool);
+
+/*
+  Wait until every task submitted so far has run to completion.
+ */
+void thread_pool_wait(sqfs_executor_t *pool);
+
 #endif /* COMMON_H */
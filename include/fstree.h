@@ -19,6 +19,7 @@
 
 #define FSTREE_MODE_HARD_LINK (0)
 #define FSTREE_MODE_HARD_LINK_RESOLVED (1)
+#define FSTREE_MODE_WHITEOUT (2)
 
 typedef struct tree_node_t tree_node_t;
 typedef struct file_info_t file_info_t;
@@ -33,6 +34,9 @@ struct file_info_t {
 	/* Path to the input file. */
 	char *input_file;
 
+	/* SQFS_BLK_* flags to pack the file data with, set from hints. */
+	int flags;
+
 	void *user_ptr;
 };
 
@@ -46,6 +50,10 @@ struct dir_info_t {
 
 	/* Used by recursive tree walking code to avoid hard link loops */
 	bool visited;
+
+	/* When merging layered archives, entries below this directory that
+	   come from a layer with a lower index than this are hidden. */
+	sqfs_u32 opaque_layer;
 };
 
 /* A node in a file system tree */
@@ -81,6 +89,9 @@ struct tree_node_t {
 		char *target;
 		sqfs_u64 devno;
 		tree_node_t *target_node;
+
+		/* For FSTREE_MODE_WHITEOUT, the layer the whiteout is from. */
+		sqfs_u32 whiteout_layer;
 	} data;
 
 	sqfs_u8 payload[];
@@ -163,6 +174,15 @@ tree_node_t *fstree_add_generic(fstree_t *fs, const char *path,
  */
 int fstree_from_file(fstree_t *fs, const char *filename, FILE *fp);
 
+/*
+  Parse a comma separated list of packing hints for a regular file (e.g.
+  "nocompress,align") of the given length and add the corresponding
+  SQFS_BLK_* flags to the flags argument.
+
+  Returns 0 on success, -1 if the list contains an unknown hint.
+ */
+int fstree_parse_file_hints(const char *str, size_t len, int *flags);
+
 /*
   This function performs all the necessary post processing steps on the file
   system tree, i.e. recursively sorting all directory entries by name,
@@ -99,6 +99,43 @@ struct sqfs_block_processor_stats_t {
 	 * eliminated by deduplication.
 	 */
 	sqfs_u64 actual_frag_count;
+
+	/**
+	 * @brief Number of times a worker ran out of blocks to compress.
+	 *
+	 * If this is high, the compressor workers are waiting for input and
+	 * fewer of them would do just as well.
+	 */
+	sqfs_u64 worker_idle_count;
+
+	/**
+	 * @brief Number of times the front end API had to wait for the
+	 *        workers, because the backlog was full.
+	 *
+	 * If this is high, compression is the bottleneck.
+	 */
+	sqfs_u64 frontend_stall_count;
+
+	/**
+	 * @brief The maximum number of blocks in flight at the end.
+	 *
+	 * Unless auto tuning is enabled, this is the backlog that the block
+	 * processor was created with.
+	 */
+	sqfs_u64 backlog_limit;
+
+	/**
+	 * @brief The number of workers available to the block processor.
+	 */
+	sqfs_u32 worker_count;
+
+	/**
+	 * @brief The number of workers that were processing blocks at the end.
+	 *
+	 * Unless auto tuning is enabled, this is the same as the
+	 * @ref worker_count.
+	 */
+	sqfs_u32 active_worker_count;
 };
 
 #ifdef __cplusplus
@@ -134,6 +171,159 @@ sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
 						    sqfs_block_writer_t *wr,
 						    sqfs_frag_table_t *tbl);
 
+/**
+ * @brief Create a data block writer that uses an application supplied
+ *        executor instead of its own worker threads.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * This works exactly like @ref sqfs_block_processor_create, except that no
+ * threads are created. Instead, up to the number of tasks given by the
+ * concurrency hint of the executor are submitted to it while there are
+ * blocks waiting to be compressed. Each task processes queued blocks until
+ * the queue runs dry and then returns.
+ *
+ * The executor must stay valid until the block processor is destroyed.
+ * Destroying the block processor waits for all tasks that it submitted.
+ *
+ * If libsquashfs was compiled without support for parallel compression,
+ * the executor is not used and this behaves like the regular, serial
+ * block processor.
+ *
+ * @param max_block_size The maximum size of a data block.
+ * @param cmp A pointer to a compressor. For every task that may run
+ *            concurrently, a deep copy of the compressor is created.
+ * @param exec A pointer to an executor.
+ * @param max_backlog The maximum number of blocks currently in flight.
+ * @param wr A block writer to send to finished blocks to.
+ * @param tbl A fragment table to use for storing fragment and fragment block
+ *            locations.
+ *
+ * @return A pointer to a data writer object on success, NULL on allocation
+ *         failure or if the executor structure size does not match.
+ */
+SQFS_API sqfs_block_processor_t
+*sqfs_block_processor_create_exec(size_t max_block_size,
+				  sqfs_compressor_t *cmp,
+				  sqfs_executor_t *exec,
+				  size_t max_backlog,
+				  sqfs_block_writer_t *wr,
+				  sqfs_frag_table_t *tbl);
+
+/**
+ * @brief Enable or disable automatic tuning of the number of workers.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * If enabled, the block processor periodically looks at how often its
+ * workers run out of blocks and how often the front end has to wait for
+ * the workers. If the front end keeps waiting, another worker is put to
+ * work. If the workers keep running dry and the front end never has to
+ * wait, a worker is parked. The backlog is scaled down in proportion to
+ * the number of active workers.
+ *
+ * The number of workers and the backlog the block processor was created with
+ * act as upper limits. The operating point that was settled on can be
+ * read from the statistics.
+ *
+ * For the serial block processor, this does nothing.
+ *
+ * @param proc A pointer to a block processor object.
+ * @param enable True to enable auto tuning, false to go back to using all
+ *               workers and the full backlog.
+ */
+SQFS_API void sqfs_block_processor_set_auto_tune(sqfs_block_processor_t *proc,
+						 bool enable);
+
+/**
+ * @brief Pin the worker threads of a block processor to a set of CPUs.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * The workers are assigned to the given CPUs in a round robin fashion, i.e.
+ * worker i is pinned to cpus[i % count].
+ *
+ * Each worker allocates its scratch buffer the first time it compresses a
+ * block. If this is called before any data is added to the block processor,
+ * the operating system can therefore place the scratch buffers in memory
+ * that is local to the CPU the worker runs on. Data blocks are filled by the
+ * thread calling the front end API, so their placement depends on where that
+ * thread runs.
+ *
+ * This is not supported by the serial block processor, for a block processor
+ * that uses an executor, or if libsquashfs was compiled for a system where
+ * it does not know how to set the affinity of a thread.
+ *
+ * @param proc A pointer to a block processor object.
+ * @param cpus An array of CPU numbers.
+ * @param count The number of entries in the array.
+ *
+ * @return Zero on success, @ref SQFS_ERROR_UNSUPPORTED if this is not
+ *         supported, @ref SQFS_ERROR_ARG_INVALID if the list is empty or
+ *         some other @ref SQFS_ERROR value if setting the affinity failed.
+ */
+SQFS_API
+int sqfs_block_processor_set_cpu_affinity(sqfs_block_processor_t *proc,
+					  const unsigned int *cpus,
+					  size_t count);
+
+/**
+ * @brief Make a block processor get its buffers from a buffer pool.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * If set, the data blocks and the scratch buffers of the worker threads are
+ * taken from the pool instead of being allocated individually. This has to
+ * be done before any data is added to the block processor. The pool has to
+ * outlive the block processor.
+ *
+ * @param proc A pointer to a block processor object.
+ * @param pool A pointer to a buffer pool.
+ *
+ * @return Zero on success, @ref SQFS_ERROR_SEQUENCE if the block processor
+ *         already allocated blocks, @ref SQFS_ERROR_ARG_INVALID if the
+ *         buffers in the pool are too small for the block size.
+ */
+SQFS_API
+int sqfs_block_processor_set_buffer_pool(sqfs_block_processor_t *proc,
+					 sqfs_buffer_pool_t *pool);
+
+/**
+ * @brief Register a callback that is called when a file is completed.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * A file is completed once the locations of its data blocks and of its
+ * fragment (if it has one) are known, i.e. the block processor will not touch
+ * its inode again. The callback is then called with the inode pointer that was
+ * passed to @ref sqfs_block_processor_begin_file. It is free to serialize the
+ * inode, take ownership of it and release any other resources that were kept
+ * around for the file.
+ *
+ * The callback is always called on the thread that uses the block processor,
+ * from within one of the functions that add data to it or wait for it.
+ * Files are reported in the order in which they were started. Once
+ * @ref sqfs_block_processor_sync or @ref sqfs_block_processor_finish returned
+ * successfully, every file that was ended before has been reported.
+ *
+ * Only files that are started after setting the callback are reported.
+ *
+ * @param proc A pointer to a block processor object.
+ * @param user A user pointer passed on to the callback.
+ * @param file_done The callback, or NULL to disable it. If it returns a
+ *                  non-zero value, processing is aborted and the value is
+ *                  passed back to the caller of the block processor function.
+ *
+ * @return Zero on success, @ref SQFS_ERROR_SEQUENCE if called between
+ *         @ref sqfs_block_processor_begin_file and
+ *         @ref sqfs_block_processor_end_file.
+ */
+SQFS_API int
+sqfs_block_processor_set_file_done_callback(sqfs_block_processor_t *proc,
+					    void *user,
+					    int (*file_done)(void *user,
+						sqfs_inode_generic_t **inode));
+
 /**
  * @brief Start writing a file.
  *
@@ -153,7 +343,8 @@ sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
  * data in the inode and the value of the pointer may still change. The only
  * point at which the data writer is guaranteed to not touch them anymore is
  * after @ref sqfs_block_processor_sync or @ref sqfs_block_processor_finish has
- * returned.
+ * returned, or when the file is reported as done through the callback set
+ * with @ref sqfs_block_processor_set_file_done_callback.
  *
  * @param proc A pointer to a data writer object.
  * @param inode A pointer to a pointer to an inode. The block processor creates
@@ -185,6 +376,27 @@ SQFS_API int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
 SQFS_API int sqfs_block_processor_append(sqfs_block_processor_t *proc,
 					 const void *data, size_t size);
 
+/**
+ * @brief Append a hole to the current file.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * This does the same as calling @ref sqfs_block_processor_append with a
+ * buffer full of zero bytes, except that data blocks entirely covered by the
+ * hole are directly marked as sparse, without filling them with zero bytes or
+ * scanning them.
+ *
+ * This is intended for callers that already know the layout of a sparse
+ * input file, e.g. from a sparse map in a tar archive.
+ *
+ * @param proc A pointer to a data writer object.
+ * @param size The number of zero bytes to append.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_block_processor_append_sparse(sqfs_block_processor_t *proc,
+						sqfs_u64 size);
+
 /**
  * @brief Stop writing the current file and flush everything that is
  *        buffered internally.
@@ -226,6 +438,11 @@ SQFS_API int sqfs_block_processor_sync(sqfs_block_processor_t *proc);
  * syncing, it also flushes the current fragment block, even if it isn't full
  * yet and waits for it to be completed as well.
  *
+ * If called in between files, more files can be added afterwards, with the
+ * next tail end starting a new fragment block. This can be used to get all
+ * data submitted so far onto disk, e.g. to checkpoint a long running image
+ * build (see @ref sqfs_block_writer_save_state).
+ *
  * @param proc A pointer to a block processor object.
  *
  * @return Zero on success, an @ref SQFS_ERROR value on failure. The failure
@@ -234,6 +234,58 @@ SQFS_API int sqfs_block_writer_write(sqfs_block_writer_t *wr,
 SQFS_API const sqfs_block_writer_stats_t
 *sqfs_block_writer_get_stats(const sqfs_block_writer_t *wr);
 
+/**
+ * @brief Serialize the state of a block writer.
+ *
+ * @memberof sqfs_block_writer_t
+ *
+ * The state contains the locations and hashes of all blocks written so far
+ * (i.e. everything needed for deduplication), the run time statistics and
+ * the current size of the output file. Together with the output file, it
+ * can be used to resume writing data blocks later on with a new block
+ * writer, see @ref sqfs_block_writer_restore_state.
+ *
+ * This should only be done in between files, i.e. after all blocks of a
+ * file have been submitted, and after making sure that no other blocks are
+ * still in flight (see @ref sqfs_block_processor_finish).
+ *
+ * The format of the state is internal to libsquashfs and may change between
+ * versions.
+ *
+ * @param wr A pointer to a block writer.
+ * @param out Returns a pointer to the serialized state that has to be
+ *            released with free().
+ * @param size Returns the size of the serialized state in bytes.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR error on failure.
+ */
+SQFS_API int sqfs_block_writer_save_state(const sqfs_block_writer_t *wr,
+					  void **out, size_t *size);
+
+/**
+ * @brief Restore the state of a block writer saved earlier.
+ *
+ * @memberof sqfs_block_writer_t
+ *
+ * This must be called on a newly created block writer, before any blocks
+ * are written. The underlying file must be the one the state was saved
+ * from. It is truncated to the size it had when the state was saved,
+ * discarding anything that was written afterwards.
+ *
+ * @param wr A pointer to a block writer.
+ * @param data A pointer to a state returned by
+ *             @ref sqfs_block_writer_save_state.
+ * @param size The size of the state in bytes.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR error on failure.
+ *         @ref SQFS_ERROR_SEQUENCE if blocks have already been written,
+ *         @ref SQFS_ERROR_CORRUPTED if the state is malformed and
+ *         @ref SQFS_ERROR_OUT_OF_BOUNDS if the file is smaller than it
+ *         was when the state was saved.
+ */
+SQFS_API int sqfs_block_writer_restore_state(sqfs_block_writer_t *wr,
+					     const void *data, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
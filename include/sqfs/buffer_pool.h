@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * buffer_pool.h - This file is part of libsquashfs
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SQFS_BUFFER_POOL_H
+#define SQFS_BUFFER_POOL_H
+
+#include "sqfs/predef.h"
+
+/**
+ * @file buffer_pool.h
+ *
+ * @brief Contains declarations for the @ref sqfs_buffer_pool_t data structure.
+ */
+
+/**
+ * @struct sqfs_buffer_pool_t
+ *
+ * @implements sqfs_object_t
+ *
+ * @brief A thread safe pool of equally sized buffers for data blocks.
+ *
+ * Block processors and data readers allocate a number of buffers that are
+ * large enough to hold an entire data block. Instead of getting them from
+ * the regular heap, they can be pointed to a buffer pool that carves them
+ * out of large slabs, which can optionally be backed by huge pages to
+ * reduce TLB pressure when working with large blocks.
+ *
+ * A pool can be shared between any number of objects, possibly in
+ * different threads. Buffers are recycled within the pool, the memory is
+ * only released when the pool is destroyed, which must happen after all
+ * objects using it have been destroyed.
+ */
+
+/**
+ * @enum SQFS_BUFFER_POOL_FLAGS
+ *
+ * @brief Flags that can be passed to @ref sqfs_buffer_pool_create
+ */
+typedef enum {
+	/**
+	 * @brief Try to back the pool with huge pages.
+	 *
+	 * On Linux, the slabs are first allocated with MAP_HUGETLB. If that
+	 * fails (e.g. because no huge pages are reserved), regular memory
+	 * is mapped and transparent huge pages are requested for it using
+	 * madvise. On other systems, this flag is ignored.
+	 */
+	SQFS_BUFFER_POOL_HUGE_PAGES = 0x01,
+
+	SQFS_BUFFER_POOL_ALL_FLAGS = 0x01,
+} SQFS_BUFFER_POOL_FLAGS;
+
+/**
+ * @struct sqfs_buffer_pool_stats_t
+ *
+ * @brief Runtime statistics of a @ref sqfs_buffer_pool_t.
+ */
+struct sqfs_buffer_pool_stats_t {
+	/**
+	 * @brief Holds the size of the structure.
+	 *
+	 * If a later version of libsquashfs expands this structure, the value
+	 * of this field can be used to check at runtime whether the newer
+	 * fields are avaialable or not.
+	 */
+	size_t size;
+
+	/**
+	 * @brief The actual size of a single buffer in the pool.
+	 */
+	sqfs_u64 buffer_size;
+
+	/**
+	 * @brief Total number of bytes allocated for slabs.
+	 */
+	sqfs_u64 bytes_allocated;
+
+	/**
+	 * @brief Number of slab bytes that are mapped with explicit huge pages.
+	 */
+	sqfs_u64 huge_page_bytes;
+
+	/**
+	 * @brief Number of slab bytes for which transparent huge pages
+	 *        were requested.
+	 */
+	sqfs_u64 thp_advised_bytes;
+
+	/**
+	 * @brief Total number of buffers carved out of the slabs.
+	 */
+	sqfs_u64 buffer_count;
+
+	/**
+	 * @brief Number of buffers currently handed out.
+	 */
+	sqfs_u64 buffers_in_use;
+
+	/**
+	 * @brief Highest number of buffers that were handed out at once.
+	 */
+	sqfs_u64 peak_buffers_in_use;
+
+	/**
+	 * @brief Total number of buffer requests served by the pool.
+	 */
+	sqfs_u64 request_count;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Create a buffer pool.
+ *
+ * @memberof sqfs_buffer_pool_t
+ *
+ * @param max_block_size The largest data block size that objects using the
+ *                       pool work with. The buffers in the pool are slightly
+ *                       larger, to leave room for internal book keeping.
+ * @param flags A combination of @ref SQFS_BUFFER_POOL_FLAGS.
+ *
+ * @return A pointer to a new buffer pool on success, NULL on allocation
+ *         failure or if unknown flags are set.
+ */
+SQFS_API sqfs_buffer_pool_t *sqfs_buffer_pool_create(size_t max_block_size,
+						     sqfs_u32 flags);
+
+/**
+ * @brief Get runtime statistics from a buffer pool.
+ *
+ * @memberof sqfs_buffer_pool_t
+ *
+ * The statistics are updated by all objects using the pool, so they are only
+ * consistent while none of them is doing any work.
+ *
+ * @param pool A pointer to a buffer pool.
+ *
+ * @return A pointer to a @ref sqfs_buffer_pool_stats_t structure.
+ */
+SQFS_API const sqfs_buffer_pool_stats_t
+*sqfs_buffer_pool_get_stats(const sqfs_buffer_pool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SQFS_BUFFER_POOL_H */
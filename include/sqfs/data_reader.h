@@ -70,6 +70,27 @@ SQFS_API sqfs_data_reader_t *sqfs_data_reader_create(sqfs_file_t *file,
 						     size_t block_size,
 						     sqfs_compressor_t *cmp);
 
+/**
+ * @brief Make a data reader get its block cache buffers from a buffer pool.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * The data reader keeps the most recently used data block and fragment
+ * block in memory. If a buffer pool is set, the buffers for them are taken
+ * from the pool. Copies of the data reader use the same pool. The pool has
+ * to outlive the data reader and all of its copies.
+ *
+ * Setting a pool drops the currently cached blocks.
+ *
+ * @param data A pointer to a data reader object.
+ * @param pool A pointer to a buffer pool.
+ *
+ * @return Zero on success, @ref SQFS_ERROR_ARG_INVALID if the buffers in
+ *         the pool are smaller than the block size.
+ */
+SQFS_API int sqfs_data_reader_set_buffer_pool(sqfs_data_reader_t *data,
+					      sqfs_buffer_pool_t *pool);
+
 /**
  * @brief Read and decode the fragment table from disk.
  *
@@ -105,6 +126,11 @@ SQFS_API int sqfs_data_reader_get_fragment(sqfs_data_reader_t *data,
  *
  * @memberof sqfs_data_reader_t
  *
+ * If the following blocks of the file are stored directly after the
+ * requested one, a few of them are read from the image along with it, so
+ * that sequentially walking the block list only issues one read for a
+ * range of blocks.
+ *
  * @param data A pointer to a data reader object.
  * @param inode A pointer to the inode describing the file.
  * @param index The block index in the inodes block list.
@@ -126,7 +152,8 @@ SQFS_API int sqfs_data_reader_get_block(sqfs_data_reader_t *data,
  *
  * This function acts like the read system call in a Unix-like OS. It takes
  * care of reading accross data blocks and fragment internally, using a
- * data and fragment block cache.
+ * data and fragment block cache. The on-disk data of consecutive blocks
+ * touched by a single request is read from the image in one go.
  *
  * @param data A pointer to a data reader object.
  * @param inode A pointer to the inode describing the file.
@@ -235,6 +235,26 @@ SQFS_API int sqfs_dir_reader_find(sqfs_dir_reader_t *rd, const char *name);
 SQFS_API int sqfs_dir_reader_read(sqfs_dir_reader_t *rd,
 				  sqfs_dir_entry_t **out);
 
+/**
+ * @brief Get the next directory entry without allocating a copy of it.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * This works like @ref sqfs_dir_reader_read, but the returned entry is stored
+ * in a buffer owned by the directory reader. It remains valid until the next
+ * call to a function that reads from the directory, i.e. this function,
+ * @ref sqfs_dir_reader_read, @ref sqfs_dir_reader_find or
+ * @ref sqfs_dir_reader_find_by_path, or until the reader is destroyed.
+ *
+ * @param rd A pointer to a directory reader.
+ * @param out Returns a pointer to the directory entry on success.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure, a positive
+ *         number if the end of the current directory listing has been reached.
+ */
+SQFS_API int sqfs_dir_reader_next(sqfs_dir_reader_t *rd,
+				  const sqfs_dir_entry_t **out);
+
 /**
  * @brief Read the inode that the current directory entry points to.
  *
@@ -249,6 +269,25 @@ SQFS_API int sqfs_dir_reader_read(sqfs_dir_reader_t *rd,
 SQFS_API int sqfs_dir_reader_get_inode(sqfs_dir_reader_t *rd,
 				       sqfs_inode_generic_t **inode);
 
+/**
+ * @brief Read the inode that the current directory entry points to into an
+ *        existing inode structure.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * See @ref sqfs_meta_reader_read_inode_into for how the inode is reused.
+ *
+ * @param rd A pointer to a directory reader.
+ * @param inode A pointer to an inode allocated with malloc(), or a pointer
+ *              to NULL. Updated if the inode has to be grown. The inode has
+ *              to be released with free() by the caller, even if the
+ *              function fails.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_dir_reader_get_inode_into(sqfs_dir_reader_t *rd,
+					    sqfs_inode_generic_t **inode);
+
 /**
  * @brief Read the root inode using the location given by the super block.
  *
@@ -263,6 +302,22 @@ SQFS_API int sqfs_dir_reader_get_inode(sqfs_dir_reader_t *rd,
 SQFS_API int sqfs_dir_reader_get_root_inode(sqfs_dir_reader_t *rd,
 					    sqfs_inode_generic_t **inode);
 
+/**
+ * @brief Make a directory reader keep recently used inodes in an inode cache.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * If a cache is set, all functions of the directory reader that return an
+ * inode first look it up in the cache and only decode it from the inode
+ * table on a miss. Copies of the directory reader use the same cache. The
+ * cache has to outlive the directory reader and all of its copies.
+ *
+ * @param rd A pointer to a directory reader.
+ * @param cache A pointer to an inode cache, or NULL to stop using a cache.
+ */
+SQFS_API void sqfs_dir_reader_set_inode_cache(sqfs_dir_reader_t *rd,
+					      sqfs_inode_cache_t *cache);
+
 /**
  * @brief Find an inode through path traversal starting from the root or a
  *        given node downwards.
@@ -59,6 +59,11 @@
  * generates an index that it can, on request, write to another meta data
  * writer used for inodes.
  *
+ * Entries are written to the meta data writer as soon as a header is
+ * complete, so only the pending header and the index are kept in memory.
+ * Between @ref sqfs_dir_writer_begin and @ref sqfs_dir_writer_end, nothing
+ * else may be written to the same meta data writer.
+ *
  * This object is not copyable, i.e. @ref sqfs_copy will always return NULL.
  */
 
@@ -105,6 +110,24 @@ extern "C" {
 SQFS_API sqfs_dir_writer_t *sqfs_dir_writer_create(sqfs_meta_writer_t *dm,
 						   sqfs_u32 flags);
 
+/**
+ * @brief Pre-allocate the export table for a known number of inodes.
+ *
+ * @memberof sqfs_dir_writer_t
+ *
+ * If the writer was created with @ref SQFS_DIR_WRITER_CREATE_EXPORT_TABLE,
+ * the export table is grown on demand while adding entries. If the number
+ * of inodes is known up front, this function can be used to allocate the
+ * table once instead. It is a noop if the writer has no export table.
+ *
+ * @param writer A pointer to a directory writer object.
+ * @param inode_count The total number of inodes in the file system.
+ *
+ * @return Zero on success, a @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_dir_writer_reserve_export_table(sqfs_dir_writer_t *writer,
+						  size_t inode_count);
+
 /**
  * @brief Begin writing a directory, i.e. reset and initialize all internal
  *        state neccessary.
@@ -140,8 +163,8 @@ SQFS_API int sqfs_dir_writer_add_entry(sqfs_dir_writer_t *writer,
 				       sqfs_u16 mode);
 
 /**
- * @brief Finish writing a directory listing and write everything out to the
- *        meta data writer.
+ * @brief Finish writing a directory listing and write the remaining entries
+ *        out to the meta data writer.
  *
  * @memberof sqfs_dir_writer_t
  *
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * executor.h - This file is part of libsquashfs
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SQFS_EXECUTOR_H
+#define SQFS_EXECUTOR_H
+
+#include "sqfs/predef.h"
+
+/**
+ * @file executor.h
+ *
+ * @brief Contains the @ref sqfs_executor_t interface for handing work off
+ *        to an application supplied thread pool.
+ */
+
+/**
+ * @interface sqfs_executor_t
+ *
+ * @brief Abstracts an application supplied thread pool.
+ *
+ * By default, the parallel parts of libsquashfs (e.g. the threaded block
+ * processor) create and manage their own worker threads. If an application
+ * runs several of those at once, or does other CPU heavy work in parallel,
+ * this can easily oversubscribe the available cores.
+ *
+ * Instead, an application can implement this interface and pass it to the
+ * objects that support it, which then submit short lived tasks to the
+ * executor instead of creating threads. Several objects can share the same
+ * executor.
+ *
+ * A task submitted by libsquashfs never waits for another task to complete,
+ * so a bounded pool shared by any number of objects cannot deadlock. However,
+ * every task that has been successfully submitted must eventually be run
+ * exactly once, or the object that submitted it cannot be destroyed.
+ *
+ * Implementations would typically embed this structure in their own and
+ * use the pointer passed to the callback to get back to it.
+ */
+struct sqfs_executor_t {
+	/**
+	 * @brief Set this to the size of the struct.
+	 *
+	 * This is required for future expandabillity while maintaining ABI
+	 * compatibillity. At the current time, libsquashfs rejects any
+	 * executor where this isn't the exact size.
+	 */
+	size_t size;
+
+	/**
+	 * @brief The maximum number of tasks that an object should have in
+	 *        flight at the same time.
+	 *
+	 * This is only a hint that objects use to size their internal state,
+	 * e.g. the block processor creates this many compressor instances and
+	 * scratch buffers. It should not exceed the number of threads in the
+	 * pool. A value of 0 is treated as 1.
+	 */
+	unsigned int concurrency;
+
+	/**
+	 * @brief Run a task asynchronously.
+	 *
+	 * The task can be run on any thread, including the one calling this
+	 * function, i.e. a trivial implementation can simply call the task
+	 * function directly.
+	 *
+	 * @param exec A pointer to the executor.
+	 * @param task The task function to run.
+	 * @param arg An argument to pass to the task function.
+	 *
+	 * @return Zero on success, non-zero if the task could not be queued.
+	 *         In the later case, the caller runs the task itself.
+	 */
+	int (*submit)(sqfs_executor_t *exec, void (*task)(void *arg),
+		      void *arg);
+};
+
+#endif /* SQFS_EXECUTOR_H */
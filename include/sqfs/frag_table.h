@@ -146,6 +146,25 @@ SQFS_API int sqfs_frag_table_set(sqfs_frag_table_t *tbl, sqfs_u32 index,
  */
 SQFS_API size_t sqfs_frag_table_get_size(sqfs_frag_table_t *tbl);
 
+/**
+ * @brief Pre-allocate space for remembering tail end chunks.
+ *
+ * @memberof sqfs_frag_table_t
+ *
+ * The tail ends memorized by @ref sqfs_frag_table_add_tail_end are kept in a
+ * flat, open addressed hash table that is grown on demand. Each unique tail
+ * end costs 16 bytes of storage, plus slack to keep the load factor below
+ * 3/4, i.e. roughly 21 to 43 bytes in total. If the number of tail ends can
+ * be estimated up front (e.g. from the number of files), this function can
+ * be used to size the table once and avoid rehashing while packing.
+ *
+ * @param tbl A pointer to the fragmen table object.
+ * @param count The expected number of tail ends.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR on faiure.
+ */
+SQFS_API int sqfs_frag_table_reserve(sqfs_frag_table_t *tbl, size_t count);
+
 /**
  * @brief Remember a specific tail end chunk within a fragment block.
  *
@@ -188,6 +207,43 @@ SQFS_API int sqfs_frag_table_find_tail_end(sqfs_frag_table_t *tbl,
 					   sqfs_u32 hash, sqfs_u32 size,
 					   sqfs_u32 *index, sqfs_u32 *offset);
 
+/**
+ * @brief Serialize the entries and memorized tail ends of a fragment table.
+ *
+ * @memberof sqfs_frag_table_t
+ *
+ * Together with @ref sqfs_block_writer_save_state, this can be used to
+ * checkpoint an image that is being built and resume packing data later on.
+ *
+ * The format of the state is internal to libsquashfs and may change between
+ * versions.
+ *
+ * @param tbl A pointer to the fragmen table object.
+ * @param out Returns a pointer to the serialized state that has to be
+ *            released with free().
+ * @param size Returns the size of the serialized state in bytes.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR on faiure.
+ */
+SQFS_API int sqfs_frag_table_save_state(const sqfs_frag_table_t *tbl,
+					void **out, size_t *size);
+
+/**
+ * @brief Replace the contents of a fragment table with a saved state.
+ *
+ * @memberof sqfs_frag_table_t
+ *
+ * @param tbl A pointer to the fragmen table object.
+ * @param data A pointer to a state returned by
+ *             @ref sqfs_frag_table_save_state.
+ * @param size The size of the state in bytes.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR on faiure,
+ *         @ref SQFS_ERROR_CORRUPTED if the state is malformed.
+ */
+SQFS_API int sqfs_frag_table_restore_state(sqfs_frag_table_t *tbl,
+					   const void *data, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
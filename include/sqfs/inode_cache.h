@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * inode_cache.h - This file is part of libsquashfs
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SQFS_INODE_CACHE_H
+#define SQFS_INODE_CACHE_H
+
+#include "sqfs/predef.h"
+
+/**
+ * @file inode_cache.h
+ *
+ * @brief Contains declarations for the @ref sqfs_inode_cache_t data structure.
+ */
+
+/**
+ * @struct sqfs_inode_cache_t
+ *
+ * @implements sqfs_object_t
+ *
+ * @brief A thread safe, bounded cache of decoded inodes.
+ *
+ * Looking up an inode through a @ref sqfs_dir_reader_t seeks to the meta data
+ * block that contains it and decodes it again every time. If a directory
+ * reader is pointed to an inode cache, recently used inodes are kept in
+ * decoded form, keyed by their inode reference (i.e. the 48 bit meta data
+ * block position and offset), and copied out of the cache on the next
+ * lookup.
+ *
+ * Since a SquashFS image never changes, cached inodes are never invalidated.
+ * If the cache is full, the least recently used inode is dropped.
+ *
+ * A cache can be shared between any number of directory readers for the
+ * same image, possibly in different threads. It must be destroyed after all
+ * readers using it.
+ */
+
+/**
+ * @struct sqfs_inode_cache_stats_t
+ *
+ * @brief Runtime statistics of a @ref sqfs_inode_cache_t.
+ */
+struct sqfs_inode_cache_stats_t {
+	/**
+	 * @brief Holds the size of the structure.
+	 *
+	 * If a later version of libsquashfs expands this structure, the value
+	 * of this field can be used to check at runtime whether the newer
+	 * fields are avaialable or not.
+	 */
+	size_t size;
+
+	/**
+	 * @brief Maximum number of inodes kept in the cache.
+	 */
+	sqfs_u64 max_inodes;
+
+	/**
+	 * @brief Number of inodes currently in the cache.
+	 */
+	sqfs_u64 inode_count;
+
+	/**
+	 * @brief Number of lookups that were served from the cache.
+	 */
+	sqfs_u64 hit_count;
+
+	/**
+	 * @brief Number of lookups that had to decode the inode.
+	 */
+	sqfs_u64 miss_count;
+
+	/**
+	 * @brief Number of inodes dropped to make room for others.
+	 */
+	sqfs_u64 evict_count;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Create an inode cache.
+ *
+ * @memberof sqfs_inode_cache_t
+ *
+ * @param max_inodes The maximum number of inodes to keep in the cache.
+ *
+ * @return A pointer to a new inode cache on success, NULL on allocation
+ *         failure or if max_inodes is zero.
+ */
+SQFS_API sqfs_inode_cache_t *sqfs_inode_cache_create(size_t max_inodes);
+
+/**
+ * @brief Get runtime statistics from an inode cache.
+ *
+ * @memberof sqfs_inode_cache_t
+ *
+ * The statistics are updated by all readers using the cache. They are
+ * copied out while holding the lock of the cache, so the result is a
+ * consistent snapshot even if other threads are using it.
+ *
+ * @param cache A pointer to an inode cache.
+ * @param out A pointer to a @ref sqfs_inode_cache_stats_t structure to
+ *            copy the statistics into.
+ */
+SQFS_API void sqfs_inode_cache_get_stats(sqfs_inode_cache_t *cache,
+					 sqfs_inode_cache_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SQFS_INODE_CACHE_H */
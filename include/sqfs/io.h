@@ -41,7 +41,8 @@ typedef enum {
 	 * which can be grown with successive writes to end of the file.
 	 *
 	 * Opening an existing file with this flag cleared results in failure,
-	 * unless the @ref SQFS_FILE_OPEN_OVERWRITE flag is also set.
+	 * unless the @ref SQFS_FILE_OPEN_OVERWRITE or
+	 * @ref SQFS_FILE_OPEN_EXISTING flag is also set.
 	 */
 	SQFS_FILE_OPEN_READ_ONLY = 0x01,
 
@@ -54,9 +55,36 @@ typedef enum {
 	 */
 	SQFS_FILE_OPEN_OVERWRITE = 0x02,
 
-	SQFS_FILE_OPEN_ALL_FLAGS = 0x03,
+	/**
+	 * @brief If the read only flag is not set, open an existing file
+	 *        for reading and writing without truncating it.
+	 *
+	 * Opening a file that does not exist fails. This can be used to
+	 * continue writing a partially written image. Can not be combined
+	 * with @ref SQFS_FILE_OPEN_OVERWRITE.
+	 */
+	SQFS_FILE_OPEN_EXISTING = 0x04,
+
+	SQFS_FILE_OPEN_ALL_FLAGS = 0x07,
 } SQFS_FILE_OPEN_FLAGS;
 
+/**
+ * @struct sqfs_iovec_t
+ *
+ * @brief A buffer for vectored I/O on a @ref sqfs_file_t.
+ */
+struct sqfs_iovec_t {
+	/**
+	 * @brief A pointer to the buffer to read into or write from.
+	 */
+	void *data;
+
+	/**
+	 * @brief The size of the buffer in bytes.
+	 */
+	size_t size;
+};
+
 /**
  * @interface sqfs_file_t
  *
@@ -120,6 +148,46 @@ struct sqfs_file_t {
 	 *         directly to the caller.
 	 */
 	int (*truncate)(sqfs_file_t *file, sqfs_u64 size);
+
+	/**
+	 * @brief Optional: Read a consecutive range of data from an absolute
+	 *        position into a list of buffers.
+	 *
+	 * This works like preadv, except that it either fills all buffers
+	 * or fails. Implementations that do not support this set it to NULL.
+	 * Users should not call it directly, but rather use
+	 * @ref sqfs_file_read_at_v, which falls back to calling read_at on
+	 * every buffer.
+	 *
+	 * @param file A pointer to the file object.
+	 * @param offset An absolute offset to read data from.
+	 * @param vec An array of buffers to fill in order.
+	 * @param count The number of entries in the array.
+	 *
+	 * @return Zero on success, an @ref SQFS_ERROR identifier on failure.
+	 */
+	int (*read_at_v)(sqfs_file_t *file, sqfs_u64 offset,
+			 const sqfs_iovec_t *vec, size_t count);
+
+	/**
+	 * @brief Optional: Write a list of buffers to a consecutive range,
+	 *        starting at an absolute position.
+	 *
+	 * This works like pwritev, except that it either writes all buffers
+	 * or fails. Implementations that do not support this set it to NULL.
+	 * Users should not call it directly, but rather use
+	 * @ref sqfs_file_write_at_v, which falls back to calling write_at on
+	 * every buffer.
+	 *
+	 * @param file A pointer to the file object.
+	 * @param offset An absolute offset to write data to.
+	 * @param vec An array of buffers to write in order.
+	 * @param count The number of entries in the array.
+	 *
+	 * @return Zero on success, an @ref SQFS_ERROR identifier on failure.
+	 */
+	int (*write_at_v)(sqfs_file_t *file, sqfs_u64 offset,
+			  const sqfs_iovec_t *vec, size_t count);
 };
 
 #ifdef __cplusplus
@@ -144,6 +212,38 @@ extern "C" {
  */
 SQFS_API sqfs_file_t *sqfs_open_file(const char *filename, sqfs_u32 flags);
 
+/**
+ * @brief Read a consecutive range of a file into a list of buffers.
+ *
+ * If the file implements the read_at_v callback, this is done with a single
+ * call to it. Otherwise, read_at is called for every buffer in turn.
+ *
+ * @param file A pointer to the file object.
+ * @param offset An absolute offset to read data from.
+ * @param vec An array of buffers to fill in order.
+ * @param count The number of entries in the array.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR identifier on failure.
+ */
+SQFS_API int sqfs_file_read_at_v(sqfs_file_t *file, sqfs_u64 offset,
+				 const sqfs_iovec_t *vec, size_t count);
+
+/**
+ * @brief Write a list of buffers to a consecutive range of a file.
+ *
+ * If the file implements the write_at_v callback, this is done with a single
+ * call to it. Otherwise, write_at is called for every buffer in turn.
+ *
+ * @param file A pointer to the file object.
+ * @param offset An absolute offset to write data to.
+ * @param vec An array of buffers to write in order.
+ * @param count The number of entries in the array.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR identifier on failure.
+ */
+SQFS_API int sqfs_file_write_at_v(sqfs_file_t *file, sqfs_u64 offset,
+				  const sqfs_iovec_t *vec, size_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -152,6 +152,30 @@ SQFS_API int sqfs_meta_reader_read_dir_header(sqfs_meta_reader_t *m,
 SQFS_API int sqfs_meta_reader_read_dir_ent(sqfs_meta_reader_t *m,
 					   sqfs_dir_entry_t **ent);
 
+/**
+ * @brief Read and decode a directory entry into an existing buffer.
+ *
+ * @memberof sqfs_meta_reader_t
+ *
+ * This works like @ref sqfs_meta_reader_read_dir_ent, but instead of
+ * allocating a new entry every time, the buffer pointed to by ent is reused.
+ * It is only grown using realloc() if the entry does not fit, so iterating
+ * over a directory with the same buffer needs very few allocations.
+ *
+ * @param m A pointer to a meta data reader.
+ * @param ent A pointer to a buffer allocated with malloc(), or a pointer to
+ *            NULL. Updated if the buffer has to be grown. The buffer is owned
+ *            by the caller and has to be released with free(), even if
+ *            the function fails.
+ * @param max A pointer to the size of the buffer in bytes. Updated if the
+ *            buffer has to be grown.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_meta_reader_read_dir_ent_into(sqfs_meta_reader_t *m,
+						sqfs_dir_entry_t **ent,
+						size_t *max);
+
 /**
  * @brief Read and decode an inode from a meta data reader.
  *
@@ -177,6 +201,36 @@ int sqfs_meta_reader_read_inode(sqfs_meta_reader_t *ir,
 				sqfs_u64 block_start, size_t offset,
 				sqfs_inode_generic_t **out);
 
+/**
+ * @brief Read and decode an inode into an existing inode structure.
+ *
+ * @memberof sqfs_meta_reader_t
+ *
+ * This works like @ref sqfs_meta_reader_read_inode, but reuses the inode
+ * pointed to by out if its payload area is large enough (see
+ * @ref sqfs_inode_generic_t::payload_bytes_available). Otherwise, it is grown
+ * using realloc(). When looking up many inodes one after another, this needs
+ * only a few allocations instead of one per inode.
+ *
+ * @param ir A pointer to a meta data reader.
+ * @param super A pointer to the super block, required for figuring out the
+ *              size of file inodes.
+ * @param block_start The meta data block to seek to for reading the inode.
+ * @param offset A byte offset within the uncompressed block where the
+ *               inode is.
+ * @param out A pointer to an inode allocated with malloc(), or a pointer
+ *            to NULL. Updated if the inode has to be grown. The inode is
+ *            owned by the caller and has to be released with free(), even
+ *            if the function fails.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API
+int sqfs_meta_reader_read_inode_into(sqfs_meta_reader_t *ir,
+				     const sqfs_super_t *super,
+				     sqfs_u64 block_start, size_t offset,
+				     sqfs_inode_generic_t **out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -83,6 +83,7 @@ typedef struct sqfs_meta_reader_t sqfs_meta_reader_t;
 typedef struct sqfs_meta_writer_t sqfs_meta_writer_t;
 typedef struct sqfs_xattr_reader_t sqfs_xattr_reader_t;
 typedef struct sqfs_file_t sqfs_file_t;
+typedef struct sqfs_iovec_t sqfs_iovec_t;
 typedef struct sqfs_tree_node_t sqfs_tree_node_t;
 typedef struct sqfs_data_reader_t sqfs_data_reader_t;
 typedef struct sqfs_block_hooks_t sqfs_block_hooks_t;
@@ -91,6 +92,11 @@ typedef struct sqfs_frag_table_t sqfs_frag_table_t;
 typedef struct sqfs_block_writer_t sqfs_block_writer_t;
 typedef struct sqfs_block_writer_stats_t sqfs_block_writer_stats_t;
 typedef struct sqfs_block_processor_stats_t sqfs_block_processor_stats_t;
+typedef struct sqfs_executor_t sqfs_executor_t;
+typedef struct sqfs_buffer_pool_t sqfs_buffer_pool_t;
+typedef struct sqfs_buffer_pool_stats_t sqfs_buffer_pool_stats_t;
+typedef struct sqfs_inode_cache_t sqfs_inode_cache_t;
+typedef struct sqfs_inode_cache_stats_t sqfs_inode_cache_stats_t;
 
 typedef struct sqfs_fragment_t sqfs_fragment_t;
 typedef struct sqfs_dir_header_t sqfs_dir_header_t;
@@ -113,6 +119,8 @@ typedef struct sqfs_xattr_entry_t sqfs_xattr_entry_t;
 typedef struct sqfs_xattr_value_t sqfs_xattr_value_t;
 typedef struct sqfs_xattr_id_t sqfs_xattr_id_t;
 typedef struct sqfs_xattr_id_table_t sqfs_xattr_id_table_t;
+typedef struct sqfs_xattr_pair_t sqfs_xattr_pair_t;
+typedef struct sqfs_xattr_set_t sqfs_xattr_set_t;
 
 /**
  * @interface sqfs_object_t
@@ -62,6 +62,9 @@ SQFS_API int sqfs_write_table(sqfs_file_t *file, sqfs_compressor_t *cmp,
  * respective array chunk.
  *
  * The entire data encoded in that way is read and uncompressed into memory.
+ * If the blocks are stored back to back in front of the location list, as
+ * written by @ref sqfs_write_table, they are read with a single read and
+ * uncompressed directly into the output buffer.
  *
  * @param file An input file to read from.
  * @param cmp A compressor to use for uncompressing the meta data block.
@@ -82,6 +85,38 @@ SQFS_API int sqfs_read_table(sqfs_file_t *file, sqfs_compressor_t *cmp,
 			     sqfs_u64 lower_limit, sqfs_u64 upper_limit,
 			     void **out);
 
+/**
+ * @brief Read a table from a SquashFS filesystem, uncompressing the meta data
+ *        blocks in parallel.
+ *
+ * This does the same as @ref sqfs_read_table, but if the table is large
+ * enough, the meta data blocks are split up into up to as many ranges as
+ * the concurrency hint of the executor and each range is uncompressed by a
+ * task submitted to it, using a copy of the compressor. The function returns
+ * once all tasks have completed.
+ *
+ * If libsquashfs was compiled without thread support, the executor is
+ * not used.
+ *
+ * @param file An input file to read from.
+ * @param cmp A compressor to use for uncompressing the meta data block.
+ * @param table_size The size of the entire array in bytes.
+ * @param location The absolute position of the location list.
+ * @param lower_limit The lowest "sane" position at which to expect a meta
+ *                    data block.
+ * @param upper_limit The highest "sane" position at which to expect a meta
+ *                    data block.
+ * @param exec A pointer to an executor or NULL to uncompress everything
+ *             on the calling thread.
+ * @param out Returns a pointer to the table in memory.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_read_table_exec(sqfs_file_t *file, sqfs_compressor_t *cmp,
+				  size_t table_size, sqfs_u64 location,
+				  sqfs_u64 lower_limit, sqfs_u64 upper_limit,
+				  sqfs_executor_t *exec, void **out);
+
 #ifdef __cplusplus
 }
 #endif
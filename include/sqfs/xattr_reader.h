@@ -61,7 +61,70 @@
  * to point the reader to the start of the key-value pairs and the call
  * @ref sqfs_xattr_reader_read_key and @ref sqfs_xattr_reader_read_value
  * consecutively to read and decode each key-value pair.
+ *
+ * Alternatively, @ref sqfs_xattr_reader_get_set can be used to resolve an
+ * index directly to the fully decoded set of key-value pairs. The reader
+ * keeps a small, bounded cache of recently decoded sets, so inodes that share
+ * the same set (e.g. identical SELinux labels) do not repeatedly re-read and
+ * re-decompress the same meta data blocks.
+ */
+
+/**
+ * @struct sqfs_xattr_pair_t
+ *
+ * @brief A decoded extended attribute key-value pair
+ *
+ * Instances of this are only handed out as part of a @ref sqfs_xattr_set_t,
+ * see @ref sqfs_xattr_reader_get_set.
+ */
+struct sqfs_xattr_pair_t {
+	/**
+	 * @brief The full, null-terminated key, including the prefix.
+	 */
+	const char *key;
+
+	/**
+	 * @brief The raw value. For convenience, an additional null-byte
+	 *        is appended that is not included in the size.
+	 */
+	const sqfs_u8 *value;
+
+	/**
+	 * @brief The size of the value in bytes.
+	 */
+	sqfs_u32 value_size;
+
+	/**
+	 * @brief The @ref SQFS_XATTR_TYPE of the key, without the
+	 *        @ref SQFS_XATTR_FLAG_OOL flag.
+	 */
+	sqfs_u16 type;
+};
+
+/**
+ * @struct sqfs_xattr_set_t
+ *
+ * @brief A decoded, immutable set of extended attributes
+ *
+ * Returned by @ref sqfs_xattr_reader_get_set. The set and all the keys and
+ * values it points to are owned by the xattr reader.
  */
+struct sqfs_xattr_set_t {
+	/**
+	 * @brief The xattr index that this set was resolved from.
+	 */
+	sqfs_u32 index;
+
+	/**
+	 * @brief The number of key-value pairs in the set.
+	 */
+	sqfs_u32 count;
+
+	/**
+	 * @brief The decoded key-value pairs, in on-disk order.
+	 */
+	sqfs_xattr_pair_t pairs[];
+};
 
 #ifdef __cplusplus
 extern "C" {
@@ -190,6 +253,33 @@ int sqfs_xattr_reader_read_value(sqfs_xattr_reader_t *xr,
 				 const sqfs_xattr_entry_t *key,
 				 sqfs_xattr_value_t **val_out);
 
+/**
+ * @brief Resolve an xattr index to a decoded set of key-value pairs
+ *
+ * @memberof sqfs_xattr_reader_t
+ *
+ * This is a convenience function that combines
+ * @ref sqfs_xattr_reader_get_desc, @ref sqfs_xattr_reader_seek_kv,
+ * @ref sqfs_xattr_reader_read_key and @ref sqfs_xattr_reader_read_value.
+ *
+ * The decoded set is stored in a bounded cache inside the reader and only a
+ * pointer to it is returned. The caller must not modify or free it. The
+ * pointer remains valid until the next call to this function on the same
+ * reader, until the reader is re-loaded or until it is destroyed.
+ *
+ * Copies of a reader created through @ref sqfs_copy do not share the cache.
+ *
+ * @param xr A pointer to an xattr reader instance.
+ * @param idx The xattr index to resolve.
+ * @param out Returns a pointer to the decoded set. If the index is
+ *            0xFFFFFFFF, i.e. the inode has no extended attributes,
+ *            NULL is returned.
+ *
+ * @return Zero on success, a negative @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_xattr_reader_get_set(sqfs_xattr_reader_t *xr, sqfs_u32 idx,
+				       const sqfs_xattr_set_t **out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -76,6 +76,20 @@ typedef struct tar_xattr_t {
 	char data[];
 } tar_xattr_t;
 
+/*
+  Size of the storage area embedded in a decoded header. Names, link targets,
+  PAX records, xattrs and sparse maps of an entry are carved out of it and
+  only if they don't fit, additional blocks are allocated on the heap.
+ */
+#define TAR_HEADER_INLINE_STORAGE (4096)
+
+typedef struct tar_storage_block_t {
+	struct tar_storage_block_t *next;
+	size_t size;
+	size_t used;
+	sqfs_u64 data[];
+} tar_storage_block_t;
+
 typedef struct {
 	struct stat sb;
 	char *name;
@@ -90,6 +104,12 @@ typedef struct {
 	/* broken out since struct stat could contain
 	   32 bit values on 32 bit systems. */
 	sqfs_s64 mtime;
+
+	/* Backing storage for all of the pointers above. The data in here is
+	   only valid until clear_header or the next read_header call. */
+	tar_storage_block_t *storage;
+	size_t inline_used;
+	sqfs_u64 inline_storage[TAR_HEADER_INLINE_STORAGE / sizeof(sqfs_u64)];
 } tar_header_decoded_t;
 
 #define TAR_TYPE_FILE '0'
@@ -135,6 +155,15 @@ int skip_padding(FILE *fp, sqfs_u64 size);
 /* round up to block size and skip the entire entry */
 int skip_entry(FILE *fp, sqfs_u64 size);
 
+/*
+  Read and decode the next entry header. Returns 0 on success, > 0 at the end
+  of the archive and < 0 on failure. Prints error messages to stderr.
+
+  The variable sized parts (name, link target, xattrs, sparse map) are parsed
+  in place and stored in the header itself, so typical entries do not need
+  any allocations at all. The decoded header must not be copied around and
+  must be released with clear_header before reading the next one.
+ */
 int read_header(FILE *fp, tar_header_decoded_t *out);
 
 void clear_header(tar_header_decoded_t *hdr);
@@ -0,0 +1,643 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * checkpoint.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "common.h"
+#include "util.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define CHECKPOINT_MAGIC "SQFSCKPT"
+#define CHECKPOINT_VERSION (3)
+
+/*
+  A checkpoint is only ever read back on the machine that wrote it, so
+  everything is stored in native byte order. The header is followed by the
+  block writer state, the fragment table state and a record for every file
+  packed so far, in packing order, each followed by the path and the inode
+  of the file.
+
+  The data of a file is identified by its path. The size and modification
+  time are only used to detect input that changed in between.
+ */
+typedef struct {
+	char magic[8];
+	sqfs_u32 version;
+	sqfs_u32 inode_size;
+	sqfs_u64 devblksize;
+	sqfs_compressor_config_t comp;
+	sqfs_u64 file_count;
+	sqfs_u64 blkwr_size;
+	sqfs_u64 frag_size;
+} checkpoint_header_t;
+
+typedef struct {
+	sqfs_u64 size;
+	sqfs_s64 mtime;
+} file_id_t;
+
+typedef struct {
+	file_id_t id;
+	sqfs_u32 path_len;
+	sqfs_u32 payload_size;
+} checkpoint_record_t;
+
+typedef struct {
+	sqfs_inode_generic_t **inode;
+	char *path;
+	file_id_t id;
+} packed_file_t;
+
+typedef struct {
+	sqfs_inode_generic_t *inode;
+	char *path;
+	file_id_t id;
+} resumed_file_t;
+
+struct checkpoint_t {
+	/* absolute, gensquashfs changes the working directory */
+	char *filename;
+	char *outfile;
+	char *tmpname;
+	size_t devblksize;
+	unsigned int interval;
+	time_t last;
+	bool quiet;
+
+	/* set once the checkpoint file matches the output image */
+	bool have_checkpoint;
+
+	/* every file packed so far, in packing order */
+	packed_file_t *files;
+	size_t num_files;
+	size_t max_files;
+
+	/* read from the checkpoint that is resumed from */
+	void *blkwr_state;
+	size_t blkwr_size;
+	void *frag_state;
+	size_t frag_size;
+
+	resumed_file_t *resumed;
+	size_t num_resumed;
+	size_t next_resumed;
+};
+
+static char *get_absolute_path(const char *path)
+{
+#if defined(_WIN32) || defined(__WINDOWS__)
+	return _fullpath(NULL, path, 0);
+#else
+	char *cwd, *out;
+
+	if (path[0] == '/')
+		return strdup(path);
+
+	cwd = getcwd(NULL, 0);
+	if (cwd == NULL)
+		return NULL;
+
+	out = malloc(strlen(cwd) + strlen(path) + 2);
+	if (out != NULL)
+		sprintf(out, "%s/%s", cwd, path);
+
+	free(cwd);
+	return out;
+#endif
+}
+
+static void get_file_id(file_id_t *id, sqfs_u64 size, sqfs_s64 mtime)
+{
+	/* cleared, so the padding written to the checkpoint is defined */
+	memset(id, 0, sizeof(*id));
+	id->size = size;
+	id->mtime = mtime;
+}
+
+static void fill_header(const checkpoint_t *ckpt, sqfs_compressor_t *cmp,
+			checkpoint_header_t *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, CHECKPOINT_MAGIC, sizeof(hdr->magic));
+	hdr->version = CHECKPOINT_VERSION;
+	hdr->inode_size = sizeof(sqfs_inode_generic_t);
+	hdr->devblksize = ckpt->devblksize;
+
+	cmp->get_configuration(cmp, &hdr->comp);
+}
+
+static int add_file(checkpoint_t *ckpt, sqfs_inode_generic_t **inode,
+		    const char *path, const file_id_t *id)
+{
+	size_t new_sz;
+	void *new;
+
+	if (ckpt->num_files == ckpt->max_files) {
+		new_sz = ckpt->max_files ? ckpt->max_files * 2 : 1024;
+		new = realloc(ckpt->files, sizeof(ckpt->files[0]) * new_sz);
+
+		if (new == NULL)
+			goto fail_errno;
+
+		ckpt->files = new;
+		ckpt->max_files = new_sz;
+	}
+
+	ckpt->files[ckpt->num_files].path = strdup(path);
+	if (ckpt->files[ckpt->num_files].path == NULL)
+		goto fail_errno;
+
+	ckpt->files[ckpt->num_files].inode = inode;
+	ckpt->files[ckpt->num_files].id = *id;
+	ckpt->num_files += 1;
+	return 0;
+fail_errno:
+	perror("recording packed files for checkpoint");
+	return -1;
+}
+
+static int read_data(const checkpoint_t *ckpt, FILE *fp,
+		     void *data, size_t size)
+{
+	if (size == 0 || fread(data, size, 1, fp) == 1)
+		return 0;
+
+	if (ferror(fp)) {
+		perror(ckpt->filename);
+	} else {
+		fprintf(stderr, "%s: checkpoint is truncated\n",
+			ckpt->filename);
+	}
+	return -1;
+}
+
+static int read_file_record(checkpoint_t *ckpt, FILE *fp)
+{
+	sqfs_inode_generic_t *inode = NULL;
+	checkpoint_record_t rec;
+	char *path = NULL;
+
+	if (read_data(ckpt, fp, &rec, sizeof(rec)))
+		return -1;
+
+	path = malloc((size_t)rec.path_len + 1);
+	inode = alloc_flex(sizeof(*inode), 1, rec.payload_size);
+	if (path == NULL || inode == NULL) {
+		perror(ckpt->filename);
+		goto fail;
+	}
+
+	if (read_data(ckpt, fp, path, rec.path_len))
+		goto fail;
+
+	if (read_data(ckpt, fp, inode, sizeof(*inode) + rec.payload_size))
+		goto fail;
+
+	path[rec.path_len] = '\0';
+
+	if (rec.path_len == 0 || strlen(path) != rec.path_len ||
+	    (inode->base.type != SQFS_INODE_FILE &&
+	     inode->base.type != SQFS_INODE_EXT_FILE) ||
+	    inode->payload_bytes_used != rec.payload_size) {
+		fprintf(stderr, "%s: checkpoint is corrupted\n",
+			ckpt->filename);
+		goto fail;
+	}
+
+	inode->payload_bytes_available = rec.payload_size;
+
+	ckpt->resumed[ckpt->num_resumed].inode = inode;
+	ckpt->resumed[ckpt->num_resumed].path = path;
+	ckpt->resumed[ckpt->num_resumed].id = rec.id;
+	ckpt->num_resumed += 1;
+	return 0;
+fail:
+	free(inode);
+	free(path);
+	return -1;
+}
+
+/* make sure the data of the image is on disk before the checkpoint is */
+static int sync_file(const char *filename, int fd)
+{
+#if defined(_WIN32) || defined(__WINDOWS__)
+	HANDLE hnd;
+	BOOL ret;
+
+	if (fd >= 0) {
+		hnd = (HANDLE)_get_osfhandle(fd);
+		if (hnd == INVALID_HANDLE_VALUE)
+			return -1;
+
+		return FlushFileBuffers(hnd) ? 0 : -1;
+	}
+
+	hnd = CreateFileA(filename, GENERIC_WRITE,
+			  FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+			  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hnd == INVALID_HANDLE_VALUE) {
+		fprintf(stderr, "%s: cannot open file for flushing\n",
+			filename);
+		return -1;
+	}
+
+	ret = FlushFileBuffers(hnd);
+	if (!ret)
+		fprintf(stderr, "%s: flushing file failed\n", filename);
+
+	CloseHandle(hnd);
+	return ret ? 0 : -1;
+#else
+	int ret;
+
+	if (fd >= 0)
+		return fsync(fd);
+
+	fd = open(filename, O_RDWR);
+	if (fd < 0) {
+		perror(filename);
+		return -1;
+	}
+
+	ret = fsync(fd);
+	if (ret != 0)
+		perror(filename);
+
+	close(fd);
+	return ret;
+#endif
+}
+
+static int replace_file(const char *src, const char *dst)
+{
+#if defined(_WIN32) || defined(__WINDOWS__)
+	if (!MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING)) {
+		fprintf(stderr, "%s: replacing checkpoint failed\n", dst);
+		return -1;
+	}
+#else
+	if (rename(src, dst) != 0) {
+		perror(dst);
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+static int write_checkpoint_file(checkpoint_t *ckpt, sqfs_compressor_t *cmp,
+				 const void *blkwr_state, size_t blkwr_size,
+				 const void *frag_state, size_t frag_size)
+{
+	const sqfs_inode_generic_t *inode;
+	checkpoint_header_t hdr;
+	checkpoint_record_t rec;
+	size_t i;
+	FILE *fp;
+
+	memset(&rec, 0, sizeof(rec));
+	fill_header(ckpt, cmp, &hdr);
+	hdr.file_count = ckpt->num_files;
+	hdr.blkwr_size = blkwr_size;
+	hdr.frag_size = frag_size;
+
+	fp = fopen(ckpt->tmpname, "wb");
+	if (fp == NULL) {
+		perror(ckpt->tmpname);
+		return -1;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    fwrite(blkwr_state, blkwr_size, 1, fp) != 1 ||
+	    fwrite(frag_state, frag_size, 1, fp) != 1) {
+		goto fail;
+	}
+
+	for (i = 0; i < ckpt->num_files; ++i) {
+		inode = *(ckpt->files[i].inode);
+
+		rec.id = ckpt->files[i].id;
+		rec.path_len = strlen(ckpt->files[i].path);
+		rec.payload_size = inode->payload_bytes_used;
+
+		if (fwrite(&rec, sizeof(rec), 1, fp) != 1 ||
+		    fwrite(ckpt->files[i].path, rec.path_len, 1, fp) != 1) {
+			goto fail;
+		}
+
+		if (fwrite(inode, sizeof(*inode) + rec.payload_size,
+			   1, fp) != 1) {
+			goto fail;
+		}
+	}
+
+	if (fflush(fp) != 0 || sync_file(ckpt->tmpname, fileno(fp)) != 0)
+		goto fail;
+
+	if (fclose(fp) != 0) {
+		perror(ckpt->tmpname);
+		goto fail_remove;
+	}
+
+	if (replace_file(ckpt->tmpname, ckpt->filename))
+		goto fail_remove;
+
+	return 0;
+fail:
+	perror(ckpt->tmpname);
+	fclose(fp);
+fail_remove:
+	remove(ckpt->tmpname);
+	return -1;
+}
+
+static int write_checkpoint(sqfs_writer_t *sqfs)
+{
+	checkpoint_t *ckpt = sqfs->ckpt;
+	void *blkwr_state = NULL, *frag_state = NULL;
+	size_t blkwr_size, frag_size;
+	int ret, status = -1;
+
+	if (!ckpt->quiet)
+		fputs("Writing checkpoint...\n", stdout);
+
+	/* get everything packed so far into the image */
+	ret = sqfs_block_processor_finish(sqfs->data);
+	if (ret) {
+		sqfs_perror(sqfs->filename, "flushing data blocks", ret);
+		return -1;
+	}
+
+	if (sync_file(ckpt->outfile, -1))
+		return -1;
+
+	ret = sqfs_block_writer_save_state(sqfs->blkwr, &blkwr_state,
+					   &blkwr_size);
+	if (ret) {
+		sqfs_perror(ckpt->filename, "saving block writer state", ret);
+		goto out;
+	}
+
+	ret = sqfs_frag_table_save_state(sqfs->fragtbl, &frag_state,
+					 &frag_size);
+	if (ret) {
+		sqfs_perror(ckpt->filename, "saving fragment table", ret);
+		goto out;
+	}
+
+	if (write_checkpoint_file(ckpt, sqfs->cmp, blkwr_state, blkwr_size,
+				  frag_state, frag_size)) {
+		goto out;
+	}
+
+	ckpt->have_checkpoint = true;
+	ckpt->last = time(NULL);
+	status = 0;
+out:
+	free(frag_state);
+	free(blkwr_state);
+	return status;
+}
+
+checkpoint_t *checkpoint_create(const sqfs_writer_cfg_t *cfg)
+{
+	checkpoint_t *ckpt = calloc(1, sizeof(*ckpt));
+
+	if (ckpt == NULL)
+		goto fail;
+
+	ckpt->filename = get_absolute_path(cfg->checkpoint);
+	ckpt->outfile = get_absolute_path(cfg->filename);
+	if (ckpt->filename == NULL || ckpt->outfile == NULL)
+		goto fail_free;
+
+	ckpt->tmpname = malloc(strlen(ckpt->filename) + 5);
+	if (ckpt->tmpname == NULL)
+		goto fail_free;
+
+	sprintf(ckpt->tmpname, "%s.tmp", ckpt->filename);
+
+	ckpt->devblksize = cfg->devblksize;
+	ckpt->interval = cfg->checkpoint_interval;
+	ckpt->quiet = cfg->quiet;
+	ckpt->last = time(NULL);
+	return ckpt;
+fail_free:
+	free(ckpt->outfile);
+	free(ckpt->filename);
+	free(ckpt);
+fail:
+	perror("creating checkpoint");
+	return NULL;
+}
+
+int checkpoint_load(checkpoint_t *ckpt, sqfs_compressor_t *cmp)
+{
+	checkpoint_header_t hdr, ref;
+	int status = -1;
+	size_t i;
+	FILE *fp;
+
+	fp = fopen(ckpt->filename, "rb");
+	if (fp == NULL) {
+		perror(ckpt->filename);
+		return -1;
+	}
+
+	if (read_data(ckpt, fp, &hdr, sizeof(hdr)))
+		goto out;
+
+	fill_header(ckpt, cmp, &ref);
+
+	if (memcmp(hdr.magic, ref.magic, sizeof(hdr.magic)) != 0 ||
+	    hdr.version != ref.version || hdr.inode_size != ref.inode_size) {
+		fprintf(stderr, "%s: not a checkpoint of this version of "
+			"the tools\n", ckpt->filename);
+		goto out;
+	}
+
+	if (hdr.devblksize != ref.devblksize ||
+	    memcmp(&hdr.comp, &ref.comp, sizeof(hdr.comp)) != 0) {
+		fprintf(stderr, "%s: the checkpoint was created with a "
+			"different block size or compressor settings\n",
+			ckpt->filename);
+		goto out;
+	}
+
+	if (hdr.blkwr_size > SIZE_MAX || hdr.frag_size > SIZE_MAX ||
+	    hdr.file_count > SIZE_MAX) {
+		fprintf(stderr, "%s: checkpoint is too big\n", ckpt->filename);
+		goto out;
+	}
+
+	ckpt->blkwr_size = hdr.blkwr_size;
+	ckpt->frag_size = hdr.frag_size;
+	ckpt->blkwr_state = malloc(ckpt->blkwr_size);
+	ckpt->frag_state = malloc(ckpt->frag_size);
+	ckpt->resumed = alloc_array(sizeof(ckpt->resumed[0]), hdr.file_count);
+
+	if (ckpt->blkwr_state == NULL || ckpt->frag_state == NULL ||
+	    (ckpt->resumed == NULL && hdr.file_count > 0)) {
+		perror(ckpt->filename);
+		goto out;
+	}
+
+	if (read_data(ckpt, fp, ckpt->blkwr_state, ckpt->blkwr_size))
+		goto out;
+
+	if (read_data(ckpt, fp, ckpt->frag_state, ckpt->frag_size))
+		goto out;
+
+	for (i = 0; i < hdr.file_count; ++i) {
+		if (read_file_record(ckpt, fp))
+			goto out;
+	}
+
+	ckpt->have_checkpoint = true;
+	status = 0;
+out:
+	fclose(fp);
+	return status;
+}
+
+int checkpoint_restore(checkpoint_t *ckpt, sqfs_block_writer_t *wr,
+		       sqfs_frag_table_t *tbl)
+{
+	int ret;
+
+	ret = sqfs_block_writer_restore_state(wr, ckpt->blkwr_state,
+					      ckpt->blkwr_size);
+	if (ret) {
+		sqfs_perror(ckpt->filename, "restoring block writer state",
+			    ret);
+		return -1;
+	}
+
+	ret = sqfs_frag_table_restore_state(tbl, ckpt->frag_state,
+					    ckpt->frag_size);
+	if (ret) {
+		sqfs_perror(ckpt->filename, "restoring fragment table", ret);
+		return -1;
+	}
+
+	free(ckpt->blkwr_state);
+	free(ckpt->frag_state);
+	ckpt->blkwr_state = NULL;
+	ckpt->frag_state = NULL;
+
+	if (!ckpt->quiet) {
+		printf("Resuming after %lu files from %s\n",
+		       (unsigned long)ckpt->num_resumed, ckpt->filename);
+	}
+	return 0;
+}
+
+int checkpoint_finish(checkpoint_t *ckpt)
+{
+	if (ckpt->next_resumed < ckpt->num_resumed) {
+		fprintf(stderr, "%s: the input has fewer files than the "
+			"checkpoint\n", ckpt->filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+bool checkpoint_destroy(checkpoint_t *ckpt, bool success)
+{
+	bool keep = !success && ckpt->have_checkpoint;
+	size_t i;
+
+	if (success && ckpt->have_checkpoint)
+		remove(ckpt->filename);
+
+	if (keep) {
+		fprintf(stderr, "Keeping %s, the build can be resumed from "
+			"%s.\n", ckpt->outfile, ckpt->filename);
+	}
+
+	for (i = 0; i < ckpt->num_resumed; ++i) {
+		free(ckpt->resumed[i].inode);
+		free(ckpt->resumed[i].path);
+	}
+
+	for (i = 0; i < ckpt->num_files; ++i)
+		free(ckpt->files[i].path);
+
+	free(ckpt->resumed);
+	free(ckpt->blkwr_state);
+	free(ckpt->frag_state);
+	free(ckpt->files);
+	free(ckpt->tmpname);
+	free(ckpt->outfile);
+	free(ckpt->filename);
+	free(ckpt);
+	return keep;
+}
+
+int sqfs_writer_resume_file(sqfs_writer_t *sqfs, const char *path,
+			    sqfs_u64 size, sqfs_s64 mtime,
+			    sqfs_inode_generic_t **inode)
+{
+	checkpoint_t *ckpt = sqfs->ckpt;
+	resumed_file_t *file;
+	file_id_t id;
+
+	if (ckpt == NULL || ckpt->next_resumed >= ckpt->num_resumed)
+		return 0;
+
+	file = ckpt->resumed + ckpt->next_resumed;
+	get_file_id(&id, size, mtime);
+
+	if (strcmp(file->path, path) != 0) {
+		fprintf(stderr, "%s: the checkpoint %s continues with '%s' "
+			"at this point, the input files must be packed in "
+			"the same order\n", path, ckpt->filename, file->path);
+		return -1;
+	}
+
+	if (file->id.size != id.size || file->id.mtime != id.mtime) {
+		fprintf(stderr, "%s: file was modified after the "
+			"checkpoint %s was written\n", path, ckpt->filename);
+		return -1;
+	}
+
+	if (add_file(ckpt, inode, path, &id))
+		return -1;
+
+	*inode = file->inode;
+	file->inode = NULL;
+	ckpt->next_resumed += 1;
+	return 1;
+}
+
+int sqfs_writer_file_done(sqfs_writer_t *sqfs, const char *path,
+			  sqfs_u64 size, sqfs_s64 mtime,
+			  sqfs_inode_generic_t **inode)
+{
+	checkpoint_t *ckpt = sqfs->ckpt;
+	file_id_t id;
+
+	if (ckpt == NULL)
+		return 0;
+
+	get_file_id(&id, size, mtime);
+
+	if (add_file(ckpt, inode, path, &id))
+		return -1;
+
+	if (difftime(time(NULL), ckpt->last) < ckpt->interval)
+		return 0;
+
+	return write_checkpoint(sqfs);
+}
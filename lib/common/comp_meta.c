@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * comp_meta.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	sqfs_compressor_t base;
+
+	/* NULL if meta data is stored uncompressed */
+	sqfs_compressor_t *cmp;
+	bool own_cmp;
+
+	meta_compressor_stats_t stats;
+} meta_compressor_t;
+
+static void meta_get_configuration(const sqfs_compressor_t *base,
+				   sqfs_compressor_config_t *cfg)
+{
+	const meta_compressor_t *meta = (const meta_compressor_t *)base;
+
+	if (meta->cmp != NULL) {
+		meta->cmp->get_configuration(meta->cmp, cfg);
+	} else {
+		memset(cfg, 0, sizeof(*cfg));
+	}
+}
+
+static int meta_write_options(sqfs_compressor_t *base, sqfs_file_t *file)
+{
+	(void)base; (void)file;
+	return 0;
+}
+
+static int meta_read_options(sqfs_compressor_t *base, sqfs_file_t *file)
+{
+	(void)base; (void)file;
+	return SQFS_ERROR_UNSUPPORTED;
+}
+
+static sqfs_s32 meta_do_block(sqfs_compressor_t *base, const sqfs_u8 *in,
+			      sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	meta_compressor_t *meta = (meta_compressor_t *)base;
+	sqfs_s32 ret = 0;
+
+	if (meta->cmp != NULL) {
+		ret = meta->cmp->do_block(meta->cmp, in, size, out, outsize);
+		if (ret < 0)
+			return ret;
+	}
+
+	meta->stats.block_count += 1;
+	meta->stats.bytes_in += size;
+
+	if (ret > 0) {
+		meta->stats.bytes_out += ret;
+	} else {
+		meta->stats.bytes_out += size;
+		meta->stats.uncompressed_count += 1;
+	}
+
+	return ret;
+}
+
+static sqfs_object_t *meta_create_copy(const sqfs_object_t *base)
+{
+	const meta_compressor_t *other = (const meta_compressor_t *)base;
+	meta_compressor_t *meta;
+
+	meta = malloc(sizeof(*meta));
+	if (meta == NULL)
+		return NULL;
+
+	memcpy(meta, other, sizeof(*meta));
+
+	if (other->cmp != NULL) {
+		meta->cmp = sqfs_copy(other->cmp);
+		if (meta->cmp == NULL) {
+			free(meta);
+			return NULL;
+		}
+		meta->own_cmp = true;
+	}
+
+	return (sqfs_object_t *)meta;
+}
+
+static void meta_destroy(sqfs_object_t *base)
+{
+	meta_compressor_t *meta = (meta_compressor_t *)base;
+
+	if (meta->own_cmp)
+		sqfs_destroy(meta->cmp);
+
+	free(meta);
+}
+
+int meta_compressor_create(sqfs_compressor_t *cmp, bool own_cmp,
+			   sqfs_compressor_t **out)
+{
+	sqfs_compressor_t *base;
+	meta_compressor_t *meta;
+
+	meta = calloc(1, sizeof(*meta));
+	base = (sqfs_compressor_t *)meta;
+
+	if (meta == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	meta->cmp = cmp;
+	meta->own_cmp = cmp != NULL && own_cmp;
+
+	base->get_configuration = meta_get_configuration;
+	base->do_block = meta_do_block;
+	base->write_options = meta_write_options;
+	base->read_options = meta_read_options;
+	((sqfs_object_t *)base)->copy = meta_create_copy;
+	((sqfs_object_t *)base)->destroy = meta_destroy;
+
+	*out = base;
+	return 0;
+}
+
+const meta_compressor_stats_t *
+meta_compressor_get_stats(const sqfs_compressor_t *cmp)
+{
+	return &((const meta_compressor_t *)cmp)->stats;
+}
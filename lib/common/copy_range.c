@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * copy_range.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "common.h"
+
+#include <stdio.h>
+#include <errno.h>
+
+size_t get_stored_run(const sqfs_inode_generic_t *inode, size_t index,
+		      sqfs_u64 remaining, size_t block_size, sqfs_u64 *size)
+{
+	size_t i, diff, count = sqfs_inode_get_file_block_count(inode);
+	sqfs_u32 blk;
+
+	*size = 0;
+
+	for (i = index; i < count && remaining > 0; ++i) {
+		blk = inode->extra[i];
+		diff = remaining < block_size ? remaining : block_size;
+
+		if (SQFS_IS_BLOCK_COMPRESSED(blk) ||
+		    SQFS_ON_DISK_BLOCK_SIZE(blk) != diff) {
+			break;
+		}
+
+		*size += diff;
+		remaining -= diff;
+	}
+
+	return i - index;
+}
+
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SPLICE)
+/* upper bound for the number of bytes moved by a single system call */
+#define MAX_CHUNK (1024 * 1024 * 1024)
+
+static ssize_t copy_chunk(int image_fd, off_t *in_pos, int out_fd,
+			  sqfs_u64 *out_off, size_t size)
+{
+	if (out_off != NULL) {
+#ifdef HAVE_COPY_FILE_RANGE
+		off_t out_pos = *out_off;
+
+		return copy_file_range(image_fd, in_pos, out_fd, &out_pos,
+				       size, 0);
+#endif
+	} else {
+#ifdef HAVE_SPLICE
+		return splice(image_fd, in_pos, out_fd, NULL, size, 0);
+#endif
+	}
+
+	errno = ENOSYS;
+	return -1;
+}
+
+static bool is_unsupported(int err)
+{
+	return err == EINVAL || err == ENOSYS || err == EXDEV ||
+		err == EOPNOTSUPP || err == EBADF;
+}
+
+int copy_image_range(int image_fd, sqfs_u64 offset, int out_fd,
+		     sqfs_u64 *out_off, sqfs_u64 size)
+{
+	off_t in_pos = offset;
+	bool copied = false;
+	ssize_t ret;
+	size_t diff;
+
+	while (size > 0) {
+		diff = size > MAX_CHUNK ? MAX_CHUNK : size;
+
+		ret = copy_chunk(image_fd, &in_pos, out_fd, out_off, diff);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (!copied && is_unsupported(errno))
+				return 1;
+
+			perror("copying data blocks");
+			return -1;
+		}
+
+		if (ret == 0) {
+			fputs("copying data blocks: unexpected end of image\n",
+			      stderr);
+			return -1;
+		}
+
+		if (out_off != NULL)
+			*out_off += ret;
+
+		size -= ret;
+		copied = true;
+	}
+
+	return 0;
+}
+
+int open_image_fd(const char *path)
+{
+	return open(path, O_RDONLY);
+}
+#else
+int copy_image_range(int image_fd, sqfs_u64 offset, int out_fd,
+		     sqfs_u64 *out_off, sqfs_u64 size)
+{
+	(void)image_fd; (void)offset; (void)out_fd;
+	(void)out_off; (void)size;
+	return 1;
+}
+
+int open_image_fd(const char *path)
+{
+	(void)path;
+	return -1;
+}
+#endif
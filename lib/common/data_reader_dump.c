@@ -11,6 +11,10 @@
 #include <stdio.h>
 #include <errno.h>
 
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SPLICE)
+#	define WITH_COPY_RANGE
+#endif
+
 static int append_block(FILE *fp, const sqfs_u8 *data, size_t size)
 {
 	const sqfs_u8 *ptr = data;
@@ -35,16 +39,79 @@ static int append_block(FILE *fp, const sqfs_u8 *data, size_t size)
 	return 0;
 }
 
+#ifdef WITH_COPY_RANGE
+enum {
+	COPY_NONE = 0,
+	COPY_FILE,
+	COPY_PIPE,
+};
+
+static int get_copy_mode(int image_fd, FILE *fp)
+{
+	struct stat sb;
+
+	if (image_fd < 0 || fstat(fileno(fp), &sb) != 0)
+		return COPY_NONE;
+
+	if (S_ISREG(sb.st_mode))
+		return COPY_FILE;
+
+	return S_ISFIFO(sb.st_mode) ? COPY_PIPE : COPY_NONE;
+}
+
+static int copy_stored(int image_fd, sqfs_u64 location, FILE *fp,
+		       int mode, sqfs_u64 size)
+{
+	sqfs_u64 out_off;
+	off_t pos;
+	int ret;
+
+	if (fflush(fp) != 0)
+		goto fail;
+
+	if (mode == COPY_PIPE)
+		return copy_image_range(image_fd, location, fileno(fp),
+					NULL, size);
+
+	pos = ftello(fp);
+	if (pos < 0)
+		goto fail;
+
+	out_off = pos;
+	ret = copy_image_range(image_fd, location, fileno(fp),
+			       &out_off, size);
+
+	if (ret == 0 && fseeko(fp, out_off, SEEK_SET) != 0)
+		goto fail;
+
+	return ret;
+fail:
+	perror("writing data block");
+	return -1;
+}
+#endif
+
 int sqfs_data_reader_dump(const char *name, sqfs_data_reader_t *data,
-			  const sqfs_inode_generic_t *inode,
+			  const sqfs_inode_generic_t *inode, int image_fd,
 			  FILE *fp, size_t block_size, bool allow_sparse)
 {
-	size_t i, diff, chunk_size;
+	size_t i, diff, chunk_size, count;
 	sqfs_u64 filesz;
 	sqfs_u8 *chunk;
 	int err;
+#ifdef WITH_COPY_RANGE
+	int mode = get_copy_mode(image_fd, fp);
+	sqfs_u64 location, run_size;
+	size_t run;
+#else
+	(void)image_fd;
+#endif
 
 	sqfs_inode_get_file_size(inode, &filesz);
+	count = sqfs_inode_get_file_block_count(inode);
+#ifdef WITH_COPY_RANGE
+	sqfs_inode_get_file_block_start(inode, &location);
+#endif
 
 #if defined(_POSIX_VERSION) && (_POSIX_VERSION >= 200112L)
 	if (allow_sparse) {
@@ -57,9 +124,30 @@ int sqfs_data_reader_dump(const char *name, sqfs_data_reader_t *data,
 	allow_sparse = false;
 #endif
 
-	for (i = 0; i < sqfs_inode_get_file_block_count(inode); ++i) {
+	for (i = 0; i < count; ++i) {
 		diff = (filesz < block_size) ? filesz : block_size;
 
+#ifdef WITH_COPY_RANGE
+		run = mode == COPY_NONE ? 0 :
+			get_stored_run(inode, i, filesz, block_size, &run_size);
+
+		if (run > 0) {
+			err = copy_stored(image_fd, location, fp, mode,
+					  run_size);
+			if (err < 0)
+				return -1;
+
+			if (err == 0) {
+				location += run_size;
+				filesz -= run_size;
+				i += run - 1;
+				continue;
+			}
+
+			/* the kernel refused, read the blocks instead */
+			mode = COPY_NONE;
+		}
+#endif
 		if (SQFS_IS_SPARSE_BLOCK(inode->extra[i]) && allow_sparse) {
 			if (fseek(fp, diff, SEEK_CUR) < 0)
 				goto fail_sparse;
@@ -78,6 +166,9 @@ int sqfs_data_reader_dump(const char *name, sqfs_data_reader_t *data,
 				return -1;
 		}
 
+#ifdef WITH_COPY_RANGE
+		location += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+#endif
 		filesz -= diff;
 	}
 
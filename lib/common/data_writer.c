@@ -8,27 +8,18 @@
 
 static sqfs_u8 buffer[4096];
 
-int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
-			 sqfs_inode_generic_t **inode, sqfs_file_t *file,
-			 int flags)
+static int append_file_range(const char *filename, sqfs_block_processor_t *data,
+			     sqfs_file_t *file, sqfs_u64 offset,
+			     sqfs_u64 size)
 {
-	sqfs_u64 filesz, offset;
 	size_t diff;
 	int ret;
 
-	ret = sqfs_block_processor_begin_file(data, inode, flags);
-	if (ret) {
-		sqfs_perror(filename, "beginning file data blocks", ret);
-		return -1;
-	}
-
-	filesz = file->get_size(file);
-
-	for (offset = 0; offset < filesz; offset += diff) {
-		if (filesz - offset > sizeof(buffer)) {
+	for (; size > 0; offset += diff, size -= diff) {
+		if (size > sizeof(buffer)) {
 			diff = sizeof(buffer);
 		} else {
-			diff = filesz - offset;
+			diff = size;
 		}
 
 		ret = file->read_at(file, offset, buffer, diff);
@@ -44,6 +35,78 @@ int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
 		}
 	}
 
+	return 0;
+}
+
+static int append_hole(const char *filename, sqfs_block_processor_t *data,
+		       sqfs_u64 size)
+{
+	int ret;
+
+	if (size == 0)
+		return 0;
+
+	ret = sqfs_block_processor_append_sparse(data, size);
+	if (ret) {
+		sqfs_perror(filename, "packing file data", ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
+			 sqfs_inode_generic_t **inode, sqfs_file_t *file,
+			 int flags)
+{
+	return write_data_from_file_condensed(filename, data, inode, file,
+					      NULL, flags);
+}
+
+int write_data_from_file_condensed(const char *filename,
+				   sqfs_block_processor_t *data,
+				   sqfs_inode_generic_t **inode,
+				   sqfs_file_t *file, const sparse_map_t *map,
+				   int flags)
+{
+	sqfs_u64 filesz, offset;
+	int ret;
+
+	ret = sqfs_block_processor_begin_file(data, inode, flags);
+	if (ret) {
+		sqfs_perror(filename, "beginning file data blocks", ret);
+		return -1;
+	}
+
+	filesz = file->get_size(file);
+
+	if (map == NULL) {
+		if (append_file_range(filename, data, file, 0, filesz))
+			return -1;
+	} else {
+		for (offset = 0; map != NULL; map = map->next) {
+			if (map->offset < offset || map->offset > filesz ||
+			    map->count > filesz - map->offset) {
+				fprintf(stderr, "%s: broken sparse map\n",
+					filename);
+				return -1;
+			}
+
+			if (append_hole(filename, data, map->offset - offset))
+				return -1;
+
+			if (append_file_range(filename, data, file,
+					      map->offset, map->count)) {
+				return -1;
+			}
+
+			offset = map->offset + map->count;
+		}
+
+		if (append_hole(filename, data, filesz - offset))
+			return -1;
+	}
+
 	ret = sqfs_block_processor_end_file(data);
 	if (ret) {
 		sqfs_perror(filename, "finishing file data", ret);
@@ -15,6 +15,12 @@ typedef struct {
 	sqfs_file_t base;
 
 	const sparse_map_t *map;
+
+	/* sparse map entry that the last read ended in and the offset
+	   of its data in the condensed input stream */
+	const sparse_map_t *cursor;
+	sqfs_u64 cursor_poffset;
+
 	sqfs_u64 offset;
 	sqfs_u64 real_size;
 	sqfs_u64 apparent_size;
@@ -66,7 +72,7 @@ static int stdin_read_at(sqfs_file_t *base, sqfs_u64 offset,
 			return SQFS_ERROR_OUT_OF_BOUNDS;
 
 		if (offset > file->offset) {
-			diff = file->offset - offset;
+			diff = offset - file->offset;
 			diff = diff > (sqfs_u64)temp_size ? temp_size : diff;
 
 			ret = fread(temp, 1, diff, file->fp);
@@ -90,53 +96,61 @@ static int stdin_read_condensed(sqfs_file_t *base, sqfs_u64 offset,
 				void *buffer, size_t size)
 {
 	sqfs_file_stdinout_t *file = (sqfs_file_stdinout_t *)base;
-	sqfs_u64 poffset = 0, src_start;
+	sqfs_u64 poffset, src_start;
 	size_t dst_start, diff, count;
 	const sparse_map_t *it;
 	int err;
 
-	memset(buffer, 0, size);
-
-	for (it = file->map; it != NULL; it = it->next) {
-		if (it->offset + it->count <= offset) {
-			poffset += it->count;
-			continue;
-		}
+	/* Reads are usually sequential, so pick up where the last one left
+	   off instead of walking the entire map from the start. */
+	it = file->cursor;
+	poffset = file->cursor_poffset;
 
-		if (it->offset >= offset + size) {
-			poffset += it->count;
-			continue;
-		}
+	if (it == NULL || it->offset > offset) {
+		it = file->map;
+		poffset = 0;
+	}
 
-		count = size;
+	while (it != NULL && it->offset + it->count <= offset) {
+		poffset += it->count;
+		it = it->next;
+	}
 
-		if (offset + count >= it->offset + it->count)
-			count = it->offset + it->count - offset;
+	dst_start = 0;
 
-		if (it->offset < offset) {
-			diff = offset - it->offset;
+	for (; it != NULL && it->offset < offset + size; it = it->next) {
+		file->cursor = it;
+		file->cursor_poffset = poffset;
 
-			src_start = poffset + diff;
-			dst_start = 0;
-			count -= diff;
-		} else if (it->offset > offset) {
+		if (it->offset > offset) {
 			diff = it->offset - offset;
 
+			memset((char *)buffer + dst_start, 0, diff - dst_start);
+
 			src_start = poffset;
 			dst_start = diff;
 		} else {
-			src_start = poffset;
-			dst_start = 0;
+			src_start = poffset + (offset - it->offset);
 		}
 
+		count = it->offset + it->count - (offset + dst_start);
+		if (count > size - dst_start)
+			count = size - dst_start;
+
 		err = stdin_read_at(base, src_start,
 				    (char *)buffer + dst_start, count);
 		if (err)
 			return err;
 
+		dst_start += count;
+
+		if (dst_start == size)
+			return 0;
+
 		poffset += it->count;
 	}
 
+	memset((char *)buffer + dst_start, 0, size - dst_start);
 	return 0;
 }
 
@@ -163,7 +177,7 @@ sqfs_file_t *sqfs_get_stdin_file(FILE *fp, const sparse_map_t *map,
 
 	if (map != NULL) {
 		for (it = map; it != NULL; it = it->next)
-			file->real_size += map->count;
+			file->real_size += it->count;
 	} else {
 		file->real_size = size;
 	}
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * parse_cpu_list.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "common.h"
+
+#include <stdlib.h>
+#include <ctype.h>
+
+#define MAX_CPU_INDEX (65535)
+
+static int parse_index(const char **str, unsigned int *out)
+{
+	const char *in = *str;
+	unsigned int acc = 0;
+
+	if (!isdigit(*in))
+		return -1;
+
+	while (isdigit(*in)) {
+		acc = acc * 10 + (*(in++) - '0');
+
+		if (acc > MAX_CPU_INDEX)
+			return -1;
+	}
+
+	*str = in;
+	*out = acc;
+	return 0;
+}
+
+int parse_cpu_list(const char *str, unsigned int **out, size_t *count)
+{
+	unsigned int first, last, *list = NULL, *new;
+	size_t num = 0, max = 0;
+	const char *in = str;
+
+	for (;;) {
+		if (parse_index(&in, &first))
+			goto fail_parse;
+
+		last = first;
+
+		if (*in == '-') {
+			++in;
+			if (parse_index(&in, &last) || last < first)
+				goto fail_parse;
+		}
+
+		while (first <= last) {
+			if (num == max) {
+				max = max ? max * 2 : 16;
+				new = realloc(list, sizeof(list[0]) * max);
+				if (new == NULL)
+					goto fail_errno;
+				list = new;
+			}
+
+			list[num++] = first++;
+		}
+
+		if (*in == '\0')
+			break;
+
+		if (*in != ',')
+			goto fail_parse;
+		++in;
+	}
+
+	*out = list;
+	*count = num;
+	return 0;
+fail_parse:
+	fprintf(stderr, "Cannot parse CPU list '%s'.\n", str);
+	free(list);
+	return -1;
+fail_errno:
+	perror("parsing CPU list");
+	free(list);
+	return -1;
+}
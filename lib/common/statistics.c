@@ -53,3 +53,64 @@ void sqfs_print_statistics(const sqfs_super_t *super,
 	printf("Number of unique group/user IDs: %u\n", super->id_count);
 	fputc('\n', stdout);
 }
+
+void sqfs_print_tuning_statistics(const sqfs_block_processor_t *blk)
+{
+	const sqfs_block_processor_stats_t *proc_stats;
+
+	proc_stats = sqfs_block_processor_get_stats(blk);
+
+	printf("Compressor workers active: %u out of %u\n",
+	       (unsigned int)proc_stats->active_worker_count,
+	       (unsigned int)proc_stats->worker_count);
+	printf("Data block backlog: " PRI_U64 "\n", proc_stats->backlog_limit);
+	printf("Times the workers ran out of data: " PRI_U64 "\n",
+	       proc_stats->worker_idle_count);
+	printf("Times the packer waited for the workers: " PRI_U64 "\n",
+	       proc_stats->frontend_stall_count);
+	fputc('\n', stdout);
+}
+
+void sqfs_print_pool_statistics(const sqfs_buffer_pool_t *pool)
+{
+	const sqfs_buffer_pool_stats_t *stats = sqfs_buffer_pool_get_stats(pool);
+	char allocated[32], huge[32], thp[32];
+
+	print_size(stats->bytes_allocated, allocated, false);
+	print_size(stats->huge_page_bytes, huge, false);
+	print_size(stats->thp_advised_bytes, thp, false);
+
+	printf("Buffer pool memory: %s\n", allocated);
+	printf("Backed by huge pages: %s\n", huge);
+	printf("Advised for transparent huge pages: %s\n", thp);
+	printf("Buffers in the pool: " PRI_U64 ", at most " PRI_U64
+	       " in use\n", stats->buffer_count, stats->peak_buffers_in_use);
+	printf("Buffer requests served: " PRI_U64 "\n", stats->request_count);
+	fputc('\n', stdout);
+}
+
+void sqfs_print_meta_statistics(const sqfs_compressor_t *meta_cmp)
+{
+	const meta_compressor_stats_t *stats;
+	char in_sz[32], out_sz[32];
+	size_t ratio;
+
+	stats = meta_compressor_get_stats(meta_cmp);
+
+	if (stats->bytes_in > 0) {
+		ratio = (100 * stats->bytes_out) / stats->bytes_in;
+	} else {
+		ratio = 100;
+	}
+
+	print_size(stats->bytes_in, in_sz, false);
+	print_size(stats->bytes_out, out_sz, false);
+
+	printf("Meta data bytes: %s\n", in_sz);
+	printf("Meta data bytes written: %s\n", out_sz);
+	printf("Meta data compression ratio: " PRI_SZ "%%\n", ratio);
+	printf("Meta data blocks written: " PRI_U64 "\n", stats->block_count);
+	printf("Out of which were stored uncompressed: " PRI_U64 "\n",
+	       stats->uncompressed_count);
+	fputc('\n', stdout);
+}
@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * thread_pool.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "common.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+typedef struct task_t {
+	struct task_t *next;
+	void (*run)(void *arg);
+	void *arg;
+} task_t;
+
+typedef struct {
+	sqfs_executor_t base;
+
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	pthread_cond_t idle_cond;
+
+	task_t *queue;
+	task_t *queue_last;
+	task_t *free_list;
+	bool terminate;
+
+	/* tasks that have been submitted, but not completed yet */
+	size_t pending;
+
+	unsigned int num_threads;
+	pthread_t threads[];
+} thread_pool_t;
+
+static void *worker_proc(void *arg)
+{
+	thread_pool_t *pool = arg;
+	task_t *task;
+
+	pthread_mutex_lock(&pool->mtx);
+
+	for (;;) {
+		while (pool->queue == NULL && !pool->terminate)
+			pthread_cond_wait(&pool->cond, &pool->mtx);
+
+		task = pool->queue;
+		if (task == NULL)
+			break;
+
+		pool->queue = task->next;
+		if (pool->queue == NULL)
+			pool->queue_last = NULL;
+		pthread_mutex_unlock(&pool->mtx);
+
+		task->run(task->arg);
+
+		pthread_mutex_lock(&pool->mtx);
+		task->next = pool->free_list;
+		pool->free_list = task;
+
+		pool->pending -= 1;
+		if (pool->pending == 0)
+			pthread_cond_broadcast(&pool->idle_cond);
+	}
+
+	pthread_mutex_unlock(&pool->mtx);
+	return NULL;
+}
+
+static int submit(sqfs_executor_t *exec, void (*run)(void *arg), void *arg)
+{
+	thread_pool_t *pool = (thread_pool_t *)exec;
+	task_t *task;
+
+	pthread_mutex_lock(&pool->mtx);
+	task = pool->free_list;
+
+	if (task != NULL) {
+		pool->free_list = task->next;
+	} else {
+		task = malloc(sizeof(*task));
+		if (task == NULL) {
+			pthread_mutex_unlock(&pool->mtx);
+			return -1;
+		}
+	}
+
+	task->next = NULL;
+	task->run = run;
+	task->arg = arg;
+
+	if (pool->queue_last == NULL) {
+		pool->queue = pool->queue_last = task;
+	} else {
+		pool->queue_last->next = task;
+		pool->queue_last = task;
+	}
+
+	pool->pending += 1;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mtx);
+	return 0;
+}
+
+sqfs_executor_t *thread_pool_create(unsigned int num_threads)
+{
+	sigset_t set, oldset;
+	thread_pool_t *pool;
+	unsigned int i;
+	size_t size;
+	int ret;
+
+	if (num_threads < 1)
+		num_threads = 1;
+
+	if (SZ_MUL_OV(sizeof(pool->threads[0]), num_threads, &size) ||
+	    SZ_ADD_OV(sizeof(*pool), size, &size)) {
+		fputs("creating thread pool: too many threads\n", stderr);
+		return NULL;
+	}
+
+	pool = calloc(1, size);
+	if (pool == NULL) {
+		perror("creating thread pool");
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->mtx, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pthread_cond_init(&pool->idle_cond, NULL);
+
+	pool->base.size = sizeof(pool->base);
+	pool->base.concurrency = num_threads;
+	pool->base.submit = submit;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+
+	for (i = 0; i < num_threads; ++i) {
+		ret = pthread_create(pool->threads + i, NULL,
+				     worker_proc, pool);
+		if (ret != 0) {
+			fprintf(stderr, "creating worker thread: %s\n",
+				strerror(ret));
+			break;
+		}
+
+		pool->num_threads += 1;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (pool->num_threads < num_threads) {
+		thread_pool_destroy((sqfs_executor_t *)pool);
+		return NULL;
+	}
+
+	return (sqfs_executor_t *)pool;
+}
+
+void thread_pool_destroy(sqfs_executor_t *exec)
+{
+	thread_pool_t *pool = (thread_pool_t *)exec;
+	task_t *task;
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->mtx);
+	pool->terminate = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mtx);
+
+	for (i = 0; i < pool->num_threads; ++i)
+		pthread_join(pool->threads[i], NULL);
+
+	while (pool->free_list != NULL) {
+		task = pool->free_list;
+		pool->free_list = task->next;
+		free(task);
+	}
+
+	pthread_cond_destroy(&pool->idle_cond);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mtx);
+	free(pool);
+}
+
+void thread_pool_wait(sqfs_executor_t *exec)
+{
+	thread_pool_t *pool = (thread_pool_t *)exec;
+
+	pthread_mutex_lock(&pool->mtx);
+	while (pool->pending > 0)
+		pthread_cond_wait(&pool->idle_cond, &pool->mtx);
+	pthread_mutex_unlock(&pool->mtx);
+}
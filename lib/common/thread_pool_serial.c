@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * thread_pool_serial.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "common.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+static int submit(sqfs_executor_t *exec, void (*run)(void *arg), void *arg)
+{
+	(void)exec;
+	run(arg);
+	return 0;
+}
+
+sqfs_executor_t *thread_pool_create(unsigned int num_threads)
+{
+	sqfs_executor_t *exec = calloc(1, sizeof(*exec));
+	(void)num_threads;
+
+	if (exec == NULL) {
+		perror("creating thread pool");
+		return NULL;
+	}
+
+	exec->size = sizeof(*exec);
+	exec->concurrency = 1;
+	exec->submit = submit;
+	return exec;
+}
+
+void thread_pool_destroy(sqfs_executor_t *exec)
+{
+	free(exec);
+}
+
+void thread_pool_wait(sqfs_executor_t *exec)
+{
+	(void)exec;
+}
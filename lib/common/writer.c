@@ -55,6 +55,83 @@ fail_errno:
 	goto out;
 }
 
+static int pin_workers(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
+{
+	unsigned int *cpus;
+	size_t count;
+	int ret;
+
+	if (parse_cpu_list(wrcfg->cpu_list, &cpus, &count))
+		return -1;
+
+	ret = sqfs_block_processor_set_cpu_affinity(sqfs->data, cpus, count);
+	free(cpus);
+
+	if (ret) {
+		sqfs_perror(wrcfg->filename, "pinning compressor workers", ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int create_compressor(const sqfs_compressor_config_t *cfg,
+			     sqfs_compressor_t **out)
+{
+	int ret;
+
+	*out = NULL;
+	ret = sqfs_compressor_create(cfg, out);
+
+#ifdef WITH_LZO
+	if (cfg->id == SQFS_COMP_LZO) {
+		if (*out != NULL)
+			sqfs_destroy(*out);
+
+		ret = lzo_compressor_create(cfg, out);
+	}
+#endif
+	return ret;
+}
+
+/*
+  The decompressor does not care about the compression level, so the meta
+  data can be compressed with different settings than the data, or stored
+  uncompressed for faster lookups.
+ */
+static int create_meta_compressor(sqfs_writer_t *sqfs,
+				  const sqfs_writer_cfg_t *wrcfg,
+				  const sqfs_compressor_config_t *metacfg)
+{
+	sqfs_compressor_t *cmp = sqfs->cmp;
+	int ret;
+
+	if (wrcfg->uncompressed_meta) {
+		cmp = NULL;
+		sqfs->super.flags |= SQFS_FLAG_UNCOMPRESSED_INODES |
+			SQFS_FLAG_UNCOMPRESSED_XATTRS |
+			SQFS_FLAG_UNCOMPRESSED_IDS;
+	} else if (wrcfg->meta_comp_extra != NULL) {
+		ret = create_compressor(metacfg, &cmp);
+		if (ret != 0) {
+			sqfs_perror(wrcfg->filename,
+				    "creating meta data compressor", ret);
+			return -1;
+		}
+	}
+
+	ret = meta_compressor_create(cmp, cmp != sqfs->cmp, &sqfs->meta_cmp);
+	if (ret != 0) {
+		if (cmp != NULL && cmp != sqfs->cmp)
+			sqfs_destroy(cmp);
+		sqfs_perror(wrcfg->filename, "creating meta data compressor",
+			    ret);
+		return -1;
+	}
+
+	return 0;
+}
+
 void sqfs_writer_cfg_init(sqfs_writer_cfg_t *cfg)
 {
 	memset(cfg, 0, sizeof(*cfg));
@@ -63,14 +140,18 @@ void sqfs_writer_cfg_init(sqfs_writer_cfg_t *cfg)
 	cfg->block_size = SQFS_DEFAULT_BLOCK_SIZE;
 	cfg->devblksize = SQFS_DEVBLK_SIZE;
 	cfg->comp_id = compressor_get_default();
+	cfg->checkpoint_interval = 600;
 }
 
 int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 {
-	sqfs_compressor_config_t cfg;
+	sqfs_compressor_config_t cfg, metacfg;
 	int ret, flags;
 
 	sqfs->filename = wrcfg->filename;
+	sqfs->pool = wrcfg->pool;
+	sqfs->own_pool = NULL;
+	sqfs->ckpt = NULL;
 
 	if (compressor_cfg_init_options(&cfg, wrcfg->comp_id,
 					wrcfg->block_size,
@@ -78,31 +159,39 @@ int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 		return -1;
 	}
 
-	sqfs->outfile = sqfs_open_file(wrcfg->filename, wrcfg->outmode);
+	if (wrcfg->meta_comp_extra != NULL && !wrcfg->uncompressed_meta &&
+	    compressor_cfg_init_options(&metacfg, wrcfg->comp_id,
+					wrcfg->block_size,
+					wrcfg->meta_comp_extra)) {
+		return -1;
+	}
+
+	if (wrcfg->checkpoint != NULL) {
+		sqfs->ckpt = checkpoint_create(wrcfg);
+		if (sqfs->ckpt == NULL)
+			return -1;
+	}
+
+	sqfs->outfile = sqfs_open_file(wrcfg->filename,
+				       wrcfg->resume ? SQFS_FILE_OPEN_EXISTING :
+				       wrcfg->outmode);
 	if (sqfs->outfile == NULL) {
 		perror(wrcfg->filename);
-		return -1;
+		goto fail_ckpt;
 	}
 
 	if (fstree_init(&sqfs->fs, wrcfg->fs_defaults))
 		goto fail_file;
 
-	ret = sqfs_compressor_create(&cfg, &sqfs->cmp);
-
-#ifdef WITH_LZO
-	if (cfg.id == SQFS_COMP_LZO) {
-		if (sqfs->cmp != NULL)
-			sqfs_destroy(sqfs->cmp);
-
-		ret = lzo_compressor_create(&cfg, &sqfs->cmp);
-	}
-#endif
-
+	ret = create_compressor(&cfg, &sqfs->cmp);
 	if (ret != 0) {
 		sqfs_perror(wrcfg->filename, "creating compressor", ret);
 		goto fail_fs;
 	}
 
+	if (wrcfg->resume && checkpoint_load(sqfs->ckpt, sqfs->cmp))
+		goto fail_cmp;
+
 	ret = sqfs_super_init(&sqfs->super, wrcfg->block_size,
 			      sqfs->fs.defaults.st_mtime, wrcfg->comp_id);
 	if (ret) {
@@ -125,11 +214,14 @@ int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 	if (ret > 0)
 		sqfs->super.flags |= SQFS_FLAG_COMPRESSOR_OPTIONS;
 
+	if (create_meta_compressor(sqfs, wrcfg, &metacfg))
+		goto fail_cmp;
+
 	sqfs->blkwr = sqfs_block_writer_create(sqfs->outfile,
 					       wrcfg->devblksize, 0);
 	if (sqfs->blkwr == NULL) {
 		perror("creating block writer");
-		goto fail_cmp;
+		goto fail_meta_cmp;
 	}
 
 	sqfs->fragtbl = sqfs_frag_table_create(0);
@@ -138,15 +230,56 @@ int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 		goto fail_blkwr;
 	}
 
-	sqfs->data = sqfs_block_processor_create(sqfs->super.block_size,
-						 sqfs->cmp, wrcfg->num_jobs,
-						 wrcfg->max_backlog,
-						 sqfs->blkwr, sqfs->fragtbl);
+	if (wrcfg->resume &&
+	    checkpoint_restore(sqfs->ckpt, sqfs->blkwr, sqfs->fragtbl)) {
+		goto fail_fragtbl;
+	}
+
+	if (wrcfg->exec != NULL) {
+		sqfs->data = sqfs_block_processor_create_exec(
+						sqfs->super.block_size,
+						sqfs->cmp, wrcfg->exec,
+						wrcfg->max_backlog,
+						sqfs->blkwr, sqfs->fragtbl);
+	} else {
+		sqfs->data = sqfs_block_processor_create(
+						sqfs->super.block_size,
+						sqfs->cmp, wrcfg->num_jobs,
+						wrcfg->max_backlog,
+						sqfs->blkwr, sqfs->fragtbl);
+	}
+
 	if (sqfs->data == NULL) {
 		perror("creating data block processor");
 		goto fail_fragtbl;
 	}
 
+	if (wrcfg->auto_tune)
+		sqfs_block_processor_set_auto_tune(sqfs->data, true);
+
+	if (wrcfg->cpu_list != NULL && pin_workers(sqfs, wrcfg))
+		goto fail_data;
+
+	if (sqfs->pool == NULL && wrcfg->huge_pages) {
+		sqfs->own_pool = sqfs_buffer_pool_create(sqfs->super.block_size,
+						SQFS_BUFFER_POOL_HUGE_PAGES);
+		if (sqfs->own_pool == NULL) {
+			perror("creating buffer pool");
+			goto fail_data;
+		}
+
+		sqfs->pool = sqfs->own_pool;
+	}
+
+	if (sqfs->pool != NULL) {
+		ret = sqfs_block_processor_set_buffer_pool(sqfs->data,
+							   sqfs->pool);
+		if (ret) {
+			sqfs_perror(wrcfg->filename, "setting buffer pool", ret);
+			goto fail_data;
+		}
+	}
+
 	sqfs->idtbl = sqfs_id_table_create(0);
 	if (sqfs->idtbl == NULL) {
 		sqfs_perror(wrcfg->filename, "creating ID table",
@@ -164,13 +297,13 @@ int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 		}
 	}
 
-	sqfs->im = sqfs_meta_writer_create(sqfs->outfile, sqfs->cmp, 0);
+	sqfs->im = sqfs_meta_writer_create(sqfs->outfile, sqfs->meta_cmp, 0);
 	if (sqfs->im == NULL) {
 		fputs("Error creating inode meta data writer.\n", stderr);
 		goto fail_xwr;
 	}
 
-	sqfs->dm = sqfs_meta_writer_create(sqfs->outfile, sqfs->cmp,
+	sqfs->dm = sqfs_meta_writer_create(sqfs->outfile, sqfs->meta_cmp,
 					   SQFS_META_WRITER_KEEP_IN_MEMORY);
 	if (sqfs->dm == NULL) {
 		fputs("Error creating directory meta data writer.\n", stderr);
@@ -199,16 +332,23 @@ fail_id:
 	sqfs_destroy(sqfs->idtbl);
 fail_data:
 	sqfs_destroy(sqfs->data);
+	if (sqfs->own_pool != NULL)
+		sqfs_destroy(sqfs->own_pool);
 fail_fragtbl:
 	sqfs_destroy(sqfs->fragtbl);
 fail_blkwr:
 	sqfs_destroy(sqfs->blkwr);
+fail_meta_cmp:
+	sqfs_destroy(sqfs->meta_cmp);
 fail_cmp:
 	sqfs_destroy(sqfs->cmp);
 fail_fs:
 	fstree_cleanup(&sqfs->fs);
 fail_file:
 	sqfs_destroy(sqfs->outfile);
+fail_ckpt:
+	if (sqfs->ckpt != NULL)
+		checkpoint_destroy(sqfs->ckpt, false);
 	return -1;
 }
 
@@ -216,6 +356,9 @@ int sqfs_writer_finish(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *cfg)
 {
 	int ret;
 
+	if (sqfs->ckpt != NULL && checkpoint_finish(sqfs->ckpt))
+		return -1;
+
 	if (!cfg->quiet)
 		fputs("Waiting for remaining data blocks...\n", stdout);
 
@@ -230,6 +373,13 @@ int sqfs_writer_finish(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *cfg)
 
 	sqfs->super.inode_count = sqfs->fs.unique_inode_count;
 
+	ret = sqfs_dir_writer_reserve_export_table(sqfs->dirwr,
+						   sqfs->fs.unique_inode_count);
+	if (ret) {
+		sqfs_perror(cfg->filename, "allocating export table", ret);
+		return -1;
+	}
+
 	if (sqfs_serialize_fstree(cfg->filename, sqfs))
 		return -1;
 
@@ -237,7 +387,7 @@ int sqfs_writer_finish(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *cfg)
 		fputs("Writing fragment table...\n", stdout);
 
 	ret = sqfs_frag_table_write(sqfs->fragtbl, sqfs->outfile,
-				    &sqfs->super, sqfs->cmp);
+				    &sqfs->super, sqfs->meta_cmp);
 	if (ret) {
 		sqfs_perror(cfg->filename, "writing fragment table", ret);
 		return -1;
@@ -249,7 +399,7 @@ int sqfs_writer_finish(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *cfg)
 
 
 		ret = sqfs_dir_writer_write_export_table(sqfs->dirwr,
-						sqfs->outfile, sqfs->cmp,
+						sqfs->outfile, sqfs->meta_cmp,
 						sqfs->fs.root->inode_num,
 						sqfs->fs.root->inode_ref,
 						&sqfs->super);
@@ -261,7 +411,7 @@ int sqfs_writer_finish(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *cfg)
 		fputs("Writing ID table...\n", stdout);
 
 	ret = sqfs_id_table_write(sqfs->idtbl, sqfs->outfile,
-				  &sqfs->super, sqfs->cmp);
+				  &sqfs->super, sqfs->meta_cmp);
 	if (ret) {
 		sqfs_perror(cfg->filename, "writing ID table", ret);
 		return -1;
@@ -272,7 +422,7 @@ int sqfs_writer_finish(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *cfg)
 			fputs("Writing extended attributes...\n", stdout);
 
 		ret = sqfs_xattr_writer_flush(sqfs->xwr, sqfs->outfile,
-					      &sqfs->super, sqfs->cmp);
+					      &sqfs->super, sqfs->meta_cmp);
 		if (ret) {
 			sqfs_perror(cfg->filename, "writing extended attributes", ret);
 			return -1;
@@ -292,14 +442,25 @@ int sqfs_writer_finish(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *cfg)
 		return -1;
 	}
 
-	if (!cfg->quiet)
+	if (!cfg->quiet) {
 		sqfs_print_statistics(&sqfs->super, sqfs->data, sqfs->blkwr);
 
+		if (cfg->auto_tune)
+			sqfs_print_tuning_statistics(sqfs->data);
+
+		if (sqfs->pool != NULL)
+			sqfs_print_pool_statistics(sqfs->pool);
+
+		sqfs_print_meta_statistics(sqfs->meta_cmp);
+	}
+
 	return 0;
 }
 
 void sqfs_writer_cleanup(sqfs_writer_t *sqfs, int status)
 {
+	bool keep = false;
+
 	if (sqfs->xwr != NULL)
 		sqfs_destroy(sqfs->xwr);
 
@@ -308,13 +469,20 @@ void sqfs_writer_cleanup(sqfs_writer_t *sqfs, int status)
 	sqfs_destroy(sqfs->im);
 	sqfs_destroy(sqfs->idtbl);
 	sqfs_destroy(sqfs->data);
+	if (sqfs->own_pool != NULL)
+		sqfs_destroy(sqfs->own_pool);
 	sqfs_destroy(sqfs->blkwr);
 	sqfs_destroy(sqfs->fragtbl);
+	sqfs_destroy(sqfs->meta_cmp);
 	sqfs_destroy(sqfs->cmp);
 	fstree_cleanup(&sqfs->fs);
 	sqfs_destroy(sqfs->outfile);
 
-	if (status != EXIT_SUCCESS) {
+	/* a partial image with a checkpoint can still be resumed */
+	if (sqfs->ckpt != NULL)
+		keep = checkpoint_destroy(sqfs->ckpt, status == EXIT_SUCCESS);
+
+	if (status != EXIT_SUCCESS && !keep) {
 #if defined(_WIN32) || defined(__WINDOWS__)
 		WCHAR *path = path_to_windows(sqfs->filename);
 
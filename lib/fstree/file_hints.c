@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * file_hints.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/block.h"
+#include "fstree.h"
+
+#include <string.h>
+
+static const struct {
+	const char *name;
+	int flag;
+} hints[] = {
+	{ "nocompress", SQFS_BLK_DONT_COMPRESS },
+	{ "nofragment", SQFS_BLK_DONT_FRAGMENT },
+	{ "align", SQFS_BLK_ALIGN },
+	{ "nodedup", SQFS_BLK_DONT_DEDUPLICATE },
+};
+
+int fstree_parse_file_hints(const char *str, size_t len, int *flags)
+{
+	size_t i, n;
+
+	while (len > 0) {
+		for (n = 0; n < len && str[n] != ','; ++n)
+			;
+
+		for (i = 0; i < sizeof(hints) / sizeof(hints[0]); ++i) {
+			if (strlen(hints[i].name) == n &&
+			    strncmp(hints[i].name, str, n) == 0) {
+				break;
+			}
+		}
+
+		if (i == sizeof(hints) / sizeof(hints[0]))
+			return -1;
+
+		*flags |= hints[i].flag;
+
+		if (n < len)
+			++n;
+
+		str += n;
+		len -= n;
+	}
+
+	return 0;
+}
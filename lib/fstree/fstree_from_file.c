@@ -14,20 +14,245 @@
 #include <ctype.h>
 #include <errno.h>
 
-static int add_generic(fstree_t *fs, const char *filename, size_t line_num,
-		       const char *path, struct stat *sb, const char *extra)
+#if !defined(_WIN32) && !defined(__WINDOWS__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define USE_MMAP
+#endif
+
+typedef struct {
+	fstree_t *fs;
+	const char *filename;
+	size_t line_num;
+
+	/*
+	  If the tree was empty to begin with, every node added to it is
+	  recorded in an open addressed table keyed by parent and name, so
+	  neither resolving the parent nor checking for duplicates needs to
+	  walk the (unsorted) lists of children.
+	 */
+	bool indexed;
+	tree_node_t **index;
+	size_t index_size;
+	size_t index_count;
+
+	/* packing hints attached to the keyword of the current entry */
+	int file_flags;
+
+	/* the directory of the previous entry and its path */
+	tree_node_t *last_dir;
+	char *last_dir_path;
+	size_t last_dir_len;
+	size_t last_dir_max;
+} parser_t;
+
+static sqfs_u32 name_hash(const tree_node_t *parent, const char *name,
+			  size_t len)
 {
-	if (fstree_add_generic(fs, path, sb, extra) == NULL) {
+	sqfs_u32 hash = 2166136261U ^ (sqfs_u32)((uintptr_t)parent >> 4);
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619U;
+
+	return hash;
+}
+
+static tree_node_t *index_find(const parser_t *p, const tree_node_t *parent,
+			       const char *name, size_t len)
+{
+	size_t i, mask = p->index_size - 1;
+	tree_node_t *n;
+
+	if (p->index_size == 0)
+		return NULL;
+
+	i = name_hash(parent, name, len) & mask;
+
+	while ((n = p->index[i]) != NULL) {
+		if (n->parent == parent && strncmp(n->name, name, len) == 0 &&
+		    n->name[len] == '\0') {
+			return n;
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+static void index_put(tree_node_t **index, size_t size, tree_node_t *n)
+{
+	size_t i = name_hash(n->parent, n->name, strlen(n->name)) & (size - 1);
+
+	while (index[i] != NULL)
+		i = (i + 1) & (size - 1);
+
+	index[i] = n;
+}
+
+static int index_insert(parser_t *p, tree_node_t *n)
+{
+	size_t i, size = p->index_size;
+	tree_node_t **index;
+
+	if ((p->index_count + 1) * 2 > size) {
+		size = size ? size * 2 : 1024;
+
+		index = calloc(size, sizeof(index[0]));
+		if (index == NULL)
+			return -1;
+
+		for (i = 0; i < p->index_size; ++i) {
+			if (p->index[i] != NULL)
+				index_put(index, size, p->index[i]);
+		}
+
+		free(p->index);
+		p->index = index;
+		p->index_size = size;
+	}
+
+	index_put(p->index, p->index_size, n);
+	p->index_count += 1;
+	return 0;
+}
+
+/* same as fstree_get_node_by_path with implicit creation, using the index */
+static tree_node_t *walk_dir(parser_t *p, const char *path, size_t len)
+{
+	tree_node_t *n = p->fs->root, *child;
+	const char *end;
+	size_t diff;
+
+	while (len > 0) {
+		if (!S_ISDIR(n->mode)) {
+			errno = ENOTDIR;
+			return NULL;
+		}
+
+		end = memchr(path, '/', len);
+		diff = end == NULL ? len : (size_t)(end - path);
+
+		child = index_find(p, n, path, diff);
+		if (child == NULL) {
+			child = fstree_mknode(n, path, diff, NULL,
+					      &p->fs->defaults);
+			if (child == NULL)
+				return NULL;
+
+			child->data.dir.created_implicitly = true;
+
+			if (index_insert(p, child))
+				return NULL;
+		}
+
+		n = child;
+		path += diff;
+		len -= diff;
+
+		if (len > 0) {
+			++path;
+			--len;
+		}
+	}
+
+	if (!S_ISDIR(n->mode)) {
+		errno = ENOTDIR;
+		return NULL;
+	}
+
+	return n;
+}
+
+static tree_node_t *get_parent(parser_t *p, const char *path)
+{
+	const char *sep = strrchr(path, '/');
+	size_t len = sep == NULL ? 0 : (size_t)(sep - path);
+	tree_node_t *dir;
+	char *new;
+
+	if (p->last_dir != NULL && p->last_dir_len == len &&
+	    memcmp(p->last_dir_path, path, len) == 0) {
+		return p->last_dir;
+	}
+
+	dir = walk_dir(p, path, len);
+	if (dir == NULL)
+		return NULL;
+
+	if (len >= p->last_dir_max) {
+		new = realloc(p->last_dir_path, len + 1);
+		if (new == NULL)
+			return NULL;
+
+		p->last_dir_path = new;
+		p->last_dir_max = len + 1;
+	}
+
+	memcpy(p->last_dir_path, path, len);
+	p->last_dir_len = len;
+	p->last_dir = dir;
+	return dir;
+}
+
+static tree_node_t *add_node(parser_t *p, const char *path,
+			     const struct stat *sb, const char *extra)
+{
+	tree_node_t *parent, *child;
+	const char *name;
+
+	if (!p->indexed)
+		return fstree_add_generic(p->fs, path, sb, extra);
+
+	parent = get_parent(p, path);
+	if (parent == NULL)
+		return NULL;
+
+	name = strrchr(path, '/');
+	name = (name == NULL ? path : (name + 1));
+
+	child = index_find(p, parent, name, strlen(name));
+
+	if (child != NULL) {
+		if (!S_ISDIR(child->mode) || !S_ISDIR(sb->st_mode) ||
+		    !child->data.dir.created_implicitly) {
+			errno = EEXIST;
+			return NULL;
+		}
+
+		child->uid = sb->st_uid;
+		child->gid = sb->st_gid;
+		child->mode = sb->st_mode;
+		child->mod_time = sb->st_mtime;
+		child->data.dir.created_implicitly = false;
+		return child;
+	}
+
+	child = fstree_mknode(parent, name, strlen(name), extra, sb);
+	if (child == NULL)
+		return NULL;
+
+	if (index_insert(p, child))
+		return NULL;
+
+	return child;
+}
+
+static int add_generic(parser_t *p, const char *path, struct stat *sb,
+		       const char *extra)
+{
+	if (add_node(p, path, sb, extra) == NULL) {
 		fprintf(stderr, "%s: " PRI_SZ ": %s: %s\n",
-			filename, line_num, path, strerror(errno));
+			p->filename, p->line_num, path, strerror(errno));
 		return -1;
 	}
 
 	return 0;
 }
 
-static int add_device(fstree_t *fs, const char *filename, size_t line_num,
-		      const char *path, struct stat *sb, const char *extra)
+static int add_device(parser_t *p, const char *path, struct stat *sb,
+		      const char *extra)
 {
 	unsigned int maj, min;
 	char c;
@@ -35,7 +260,7 @@ static int add_device(fstree_t *fs, const char *filename, size_t line_num,
 	if (sscanf(extra, "%c %u %u", &c, &maj, &min) != 3) {
 		fprintf(stderr, "%s: " PRI_SZ ": "
 			"expected '<c|b> major minor'\n",
-			filename, line_num);
+			p->filename, p->line_num);
 		return -1;
 	}
 
@@ -45,31 +270,73 @@ static int add_device(fstree_t *fs, const char *filename, size_t line_num,
 		sb->st_mode |= S_IFBLK;
 	} else {
 		fprintf(stderr, "%s: " PRI_SZ ": unknown device type '%c'\n",
-			filename, line_num, c);
+			p->filename, p->line_num, c);
 		return -1;
 	}
 
 	sb->st_rdev = makedev(maj, min);
-	return add_generic(fs, filename, line_num, path, sb, NULL);
+	return add_generic(p, path, sb, NULL);
 }
 
-static int add_file(fstree_t *fs, const char *filename, size_t line_num,
-		    const char *path, struct stat *basic, const char *extra)
+static int add_file(parser_t *p, const char *path, struct stat *basic,
+		    const char *extra)
 {
+	tree_node_t *n;
+
 	if (extra == NULL || *extra == '\0')
 		extra = path;
 
-	return add_generic(fs, filename, line_num, path, basic, extra);
+	n = add_node(p, path, basic, extra);
+	if (n == NULL) {
+		fprintf(stderr, "%s: " PRI_SZ ": %s: %s\n",
+			p->filename, p->line_num, path, strerror(errno));
+		return -1;
+	}
+
+	n->data.file.flags = p->file_flags;
+	return 0;
+}
+
+static tree_node_t *add_link_node(parser_t *p, const char *path,
+				  const char *target)
+{
+	struct stat sb;
+	tree_node_t *n;
+	char *copy;
+
+	if (!p->indexed)
+		return fstree_add_hard_link(p->fs, path, target);
+
+	copy = strdup(target);
+	if (copy == NULL)
+		return NULL;
+
+	if (canonicalize_name(copy)) {
+		free(copy);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	memset(&sb, 0, sizeof(sb));
+	sb.st_mode = S_IFLNK | 0777;
+
+	n = add_node(p, path, &sb, copy);
+	free(copy);
+
+	if (n != NULL)
+		n->mode = FSTREE_MODE_HARD_LINK;
+
+	return n;
 }
 
-static int add_hard_link(fstree_t *fs, const char *filename, size_t line_num,
-			 const char *path, struct stat *basic, const char *extra)
+static int add_hard_link(parser_t *p, const char *path, struct stat *basic,
+			 const char *extra)
 {
 	(void)basic;
 
-	if (fstree_add_hard_link(fs, path, extra) == NULL) {
+	if (add_link_node(p, path, extra) == NULL) {
 		fprintf(stderr, "%s: " PRI_SZ ": %s\n",
-			filename, line_num, strerror(errno));
+			p->filename, p->line_num, strerror(errno));
 		return -1;
 	}
 	return 0;
@@ -79,16 +346,17 @@ static const struct {
 	const char *keyword;
 	unsigned int mode;
 	bool need_extra;
-	int (*callback)(fstree_t *fs, const char *filename, size_t line_num,
-			const char *path, struct stat *sb, const char *extra);
+	bool allow_hints;
+	int (*callback)(parser_t *p, const char *path, struct stat *sb,
+			const char *extra);
 } file_list_hooks[] = {
-	{ "dir", S_IFDIR, false, add_generic },
-	{ "slink", S_IFLNK, true, add_generic },
-	{ "link", 0, true, add_hard_link },
-	{ "nod", 0, true, add_device },
-	{ "pipe", S_IFIFO, false, add_generic },
-	{ "sock", S_IFSOCK, false, add_generic },
-	{ "file", S_IFREG, false, add_file },
+	{ "dir", S_IFDIR, false, false, add_generic },
+	{ "slink", S_IFLNK, true, false, add_generic },
+	{ "link", 0, true, false, add_hard_link },
+	{ "nod", 0, true, false, add_device },
+	{ "pipe", S_IFIFO, false, false, add_generic },
+	{ "sock", S_IFSOCK, false, false, add_generic },
+	{ "file", S_IFREG, false, true, add_file },
 };
 
 #define NUM_HOOKS (sizeof(file_list_hooks) / sizeof(file_list_hooks[0]))
@@ -115,28 +383,42 @@ static void trim_line(char *line)
 	line[i] = '\0';
 }
 
-static int handle_line(fstree_t *fs, const char *filename,
-		       size_t line_num, char *line)
+static int handle_line(parser_t *p, char *line)
 {
-	const char *extra = NULL, *msg = NULL;
+	const char *extra = NULL, *msg = NULL, *hints = NULL;
 	char keyword[16], *path, *ptr;
+	size_t i, hints_len = 0;
 	unsigned int x;
 	struct stat sb;
-	size_t i;
 
 	memset(&sb, 0, sizeof(sb));
-	sb.st_mtime = fs->defaults.st_mtime;
+	sb.st_mtime = p->fs->defaults.st_mtime;
 
 	/* isolate keyword */
 	for (i = 0; isalpha(line[i]); ++i)
 		;
 
-	if (i >= sizeof(keyword) || i == 0 || !isspace(line[i]))
+	if (i >= sizeof(keyword) || i == 0)
 		goto fail_ent;
 
 	memcpy(keyword, line, i);
 	keyword[i] = '\0';
 
+	/* packing hints are attached to the keyword, e.g. file[nocompress] */
+	if (line[i] == '[') {
+		hints = line + i + 1;
+
+		ptr = strchr(hints, ']');
+		if (ptr == NULL)
+			goto fail_ent;
+
+		hints_len = ptr - hints;
+		i = ptr - line + 1;
+	}
+
+	if (!isspace(line[i]))
+		goto fail_ent;
+
 	while (isspace(line[i]))
 		++i;
 
@@ -245,20 +527,32 @@ static int handle_line(fstree_t *fs, const char *filename,
 			if (file_list_hooks[i].need_extra && extra == NULL)
 				goto fail_no_extra;
 
+			if (hints != NULL && !file_list_hooks[i].allow_hints)
+				goto fail_hints;
+
+			p->file_flags = 0;
+			if (hints != NULL &&
+			    fstree_parse_file_hints(hints, hints_len,
+						    &p->file_flags) != 0) {
+				goto fail_hints;
+			}
+
 			sb.st_mode |= file_list_hooks[i].mode;
 
-			return file_list_hooks[i].callback(fs, filename,
-							   line_num, path,
-							   &sb, extra);
+			return file_list_hooks[i].callback(p, path, &sb, extra);
 		}
 	}
 
-	fprintf(stderr, "%s: " PRI_SZ ": unknown entry type '%s'.\n", filename,
-		line_num, keyword);
+	fprintf(stderr, "%s: " PRI_SZ ": unknown entry type '%s'.\n",
+		p->filename, p->line_num, keyword);
 	return -1;
 fail_no_extra:
 	fprintf(stderr, "%s: " PRI_SZ ": missing argument for %s.\n",
-		filename, line_num, keyword);
+		p->filename, p->line_num, keyword);
+	return -1;
+fail_hints:
+	fprintf(stderr, "%s: " PRI_SZ ": invalid packing hints for %s.\n",
+		p->filename, p->line_num, keyword);
 	return -1;
 fail_uid_gid:
 	msg = "uid & gid must be decimal numbers";
@@ -273,50 +567,135 @@ fail_ent:
 	msg = "error in entry description";
 	goto out_desc;
 out_desc:
-	fprintf(stderr, "%s: " PRI_SZ ": %s.\n", filename, line_num, msg);
-	fputs("expected: <type> <path> <mode> <uid> <gid> [<extra>]\n",
-	      stderr);
+	fprintf(stderr, "%s: " PRI_SZ ": %s.\n", p->filename, p->line_num, msg);
+	fputs("expected: <type>[<hints>] <path> <mode> <uid> <gid> "
+	      "[<extra>]\n", stderr);
 	return -1;
 }
 
-int fstree_from_file(fstree_t *fs, const char *filename, FILE *fp)
+static int handle_raw_line(parser_t *p, char *line)
+{
+	p->line_num += 1;
+
+	trim_line(line);
+
+	if (line[0] == '\0')
+		return 0;
+
+	return handle_line(p, line);
+}
+
+#ifdef USE_MMAP
+/*
+  Map the file privately and tokenize the lines in place. Returns a positive
+  value if the file cannot be mapped, e.g. because it is a pipe.
+ */
+static int from_mapping(parser_t *p, FILE *fp)
+{
+	char *map, *ptr, *end, *nl, *last;
+	struct stat sb;
+	int fd, ret = 0;
+
+	fd = fileno(fp);
+	if (fd < 0 || ftell(fp) != 0)
+		return 1;
+
+	if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || sb.st_size <= 0)
+		return 1;
+
+	if ((sizeof(size_t) < sizeof(sb.st_size)) &&
+	    (sqfs_u64)sb.st_size > (sqfs_u64)SIZE_MAX) {
+		return 1;
+	}
+
+	map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		   fd, 0);
+	if (map == MAP_FAILED)
+		return 1;
+
+#ifdef MADV_SEQUENTIAL
+	madvise(map, sb.st_size, MADV_SEQUENTIAL);
+#endif
+
+	ptr = map;
+	end = map + sb.st_size;
+
+	while (ret == 0 && ptr < end) {
+		nl = memchr(ptr, '\n', end - ptr);
+
+		if (nl != NULL) {
+			*nl = '\0';
+			ret = handle_raw_line(p, ptr);
+			ptr = nl + 1;
+			continue;
+		}
+
+		/* no room for a terminator after the last line */
+		last = strndup(ptr, end - ptr);
+		if (last == NULL) {
+			perror(p->filename);
+			ret = -1;
+			break;
+		}
+
+		ret = handle_raw_line(p, last);
+		free(last);
+		break;
+	}
+
+	munmap(map, sb.st_size);
+	return ret;
+}
+#endif
+
+static int from_stream(parser_t *p, FILE *fp)
 {
-	size_t n, line_num = 0;
+	char *line = NULL;
+	size_t n = 0;
 	ssize_t ret;
-	char *line;
 
 	for (;;) {
-		line = NULL;
-		n = 0;
 		errno = 0;
 
 		ret = getline(&line, &n, fp);
-		++line_num;
-
 		if (ret < 0) {
-			if (errno == 0) {
-				free(line);
+			if (errno == 0)
 				break;
-			}
-
-			perror(filename);
-			goto fail_line;
-		}
 
-		trim_line(line);
-
-		if (line[0] == '\0') {
-			free(line);
-			continue;
+			perror(p->filename);
+			goto fail;
 		}
 
-		if (handle_line(fs, filename, line_num, line))
-			goto fail_line;
-
-		free(line);
+		if (handle_raw_line(p, line))
+			goto fail;
 	}
+
+	free(line);
 	return 0;
-fail_line:
+fail:
 	free(line);
 	return -1;
 }
+
+int fstree_from_file(fstree_t *fs, const char *filename, FILE *fp)
+{
+	parser_t p;
+	int ret;
+
+	memset(&p, 0, sizeof(p));
+	p.fs = fs;
+	p.filename = filename;
+	p.indexed = (fs->root->data.dir.children == NULL);
+
+#ifdef USE_MMAP
+	ret = from_mapping(&p, fp);
+	if (ret > 0)
+		ret = from_stream(&p, fp);
+#else
+	ret = from_stream(&p, fp);
+#endif
+
+	free(p.last_dir_path);
+	free(p.index);
+	return ret;
+}
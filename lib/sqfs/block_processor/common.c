@@ -44,6 +44,71 @@ static int set_block_size(sqfs_inode_generic_t **inode,
 	return 0;
 }
 
+void block_processor_free_block(sqfs_block_processor_t *proc,
+				sqfs_block_t *blk)
+{
+	if (proc->pool != NULL) {
+		buffer_pool_put(proc->pool, blk);
+	} else {
+		free(blk);
+	}
+}
+
+static void file_block_done(sqfs_block_t *blk)
+{
+	if (blk->file != NULL) {
+		assert(blk->file->refs > 0);
+		blk->file->refs -= 1;
+		blk->file = NULL;
+	}
+}
+
+int block_processor_report_files(sqfs_block_processor_t *proc)
+{
+	pending_file_t *file;
+	int err;
+
+	while (proc->pending_files != NULL &&
+	       proc->pending_files->refs == 0) {
+		file = proc->pending_files;
+		proc->pending_files = file->next;
+		if (proc->pending_files == NULL)
+			proc->pending_last = NULL;
+
+		file->next = proc->pending_free;
+		proc->pending_free = file;
+
+		if (proc->file_done == NULL)
+			continue;
+
+		err = proc->file_done(proc->file_done_user, file->inode);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+void block_processor_free_files(sqfs_block_processor_t *proc)
+{
+	pending_file_t *file;
+
+	while (proc->pending_files != NULL) {
+		file = proc->pending_files;
+		proc->pending_files = file->next;
+		free(file);
+	}
+
+	while (proc->pending_free != NULL) {
+		file = proc->pending_free;
+		proc->pending_free = file->next;
+		free(file);
+	}
+
+	proc->pending_last = NULL;
+	proc->file_current = NULL;
+}
+
 static void release_old_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 {
 	sqfs_block_t *it;
@@ -103,6 +168,8 @@ int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 
 	if (blk->flags & SQFS_BLK_LAST_BLOCK)
 		sqfs_inode_set_file_block_start(*(blk->inode), location);
+
+	file_block_done(blk);
 out:
 	release_old_block(proc, blk);
 	return err;
@@ -120,7 +187,7 @@ int block_processor_do_block(sqfs_block_t *block, sqfs_compressor_t *cmp,
 	size_t offset;
 	sqfs_s32 ret;
 
-	if (block->size == 0)
+	if (block->size == 0 || (block->flags & SQFS_BLK_IS_SPARSE))
 		return 0;
 
 	if (block->flags & SQFS_BLK_FRAGMENT_BLOCK) {
@@ -172,6 +239,7 @@ int process_completed_fragment(sqfs_block_processor_t *proc, sqfs_block_t *frag,
 		(*(frag->inode))->data.file_ext.sparse += frag->size;
 
 		proc->stats.sparse_block_count += 1;
+		file_block_done(frag);
 		release_old_block(proc, frag);
 		return 0;
 	}
@@ -185,6 +253,7 @@ int process_completed_fragment(sqfs_block_processor_t *proc, sqfs_block_t *frag,
 		if (err == 0) {
 			sqfs_inode_set_frag_location(*(frag->inode),
 						     index, offset);
+			file_block_done(frag);
 			release_old_block(proc, frag);
 			return 0;
 		}
@@ -226,6 +295,7 @@ int process_completed_fragment(sqfs_block_processor_t *proc, sqfs_block_t *frag,
 		goto fail_outblk;
 
 	sqfs_inode_set_frag_location(*(frag->inode), index, offset);
+	file_block_done(frag);
 	proc->stats.actual_frag_count += 1;
 	return 0;
 fail:
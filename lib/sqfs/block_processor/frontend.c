@@ -14,16 +14,29 @@ static sqfs_block_t *get_new_block(sqfs_block_processor_t *proc)
 	if (proc->free_list != NULL) {
 		blk = proc->free_list;
 		proc->free_list = blk->next;
+	} else if (proc->pool != NULL) {
+		blk = buffer_pool_get(proc->pool);
 	} else {
 		blk = malloc(sizeof(*blk) + proc->max_block_size);
 	}
 
+	proc->have_blocks = true;
+
 	if (blk != NULL)
 		memset(blk, 0, sizeof(*blk));
 
 	return blk;
 }
 
+/* every block of a file holds a reference on it until it updated the inode */
+static void track_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	if (proc->file_current != NULL) {
+		blk->file = proc->file_current;
+		blk->file->refs += 1;
+	}
+}
+
 static int add_sentinel_block(sqfs_block_processor_t *proc)
 {
 	sqfs_block_t *blk = get_new_block(proc);
@@ -34,6 +47,7 @@ static int add_sentinel_block(sqfs_block_processor_t *proc)
 	blk->inode = proc->inode;
 	blk->flags = proc->blk_flags | SQFS_BLK_LAST_BLOCK;
 
+	track_block(proc, blk);
 	return append_to_work_queue(proc, blk);
 }
 
@@ -51,9 +65,66 @@ static int flush_block(sqfs_block_processor_t *proc)
 	}
 
 	block->index = proc->blk_index++;
+	track_block(proc, block);
 	return append_to_work_queue(proc, block);
 }
 
+int sqfs_block_processor_set_buffer_pool(sqfs_block_processor_t *proc,
+					 sqfs_buffer_pool_t *pool)
+{
+	if (proc->have_blocks)
+		return SQFS_ERROR_SEQUENCE;
+
+	if (buffer_pool_capacity(pool) < sizeof(sqfs_block_t) +
+	    proc->max_block_size) {
+		return SQFS_ERROR_ARG_INVALID;
+	}
+
+	proc->pool = pool;
+	return 0;
+}
+
+int sqfs_block_processor_set_file_done_callback(sqfs_block_processor_t *proc,
+						void *user,
+						int (*file_done)(void *user,
+						sqfs_inode_generic_t **inode))
+{
+	if (proc->inode != NULL)
+		return SQFS_ERROR_SEQUENCE;
+
+	proc->file_done = file_done;
+	proc->file_done_user = user;
+	return 0;
+}
+
+static int begin_pending_file(sqfs_block_processor_t *proc,
+			      sqfs_inode_generic_t **inode)
+{
+	pending_file_t *file = proc->pending_free;
+
+	if (file != NULL) {
+		proc->pending_free = file->next;
+	} else {
+		file = malloc(sizeof(*file));
+		if (file == NULL)
+			return SQFS_ERROR_ALLOC;
+	}
+
+	file->next = NULL;
+	file->inode = inode;
+	file->refs = 1;
+
+	if (proc->pending_last == NULL) {
+		proc->pending_files = file;
+	} else {
+		proc->pending_last->next = file;
+	}
+
+	proc->pending_last = file;
+	proc->file_current = file;
+	return 0;
+}
+
 int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
 				    sqfs_inode_generic_t **inode, sqfs_u32 flags)
 {
@@ -70,16 +141,38 @@ int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
 	(*inode)->base.type = SQFS_INODE_FILE;
 	sqfs_inode_set_frag_location(*inode, 0xFFFFFFFF, 0xFFFFFFFF);
 
+	if (proc->file_done != NULL && begin_pending_file(proc, inode)) {
+		free(*inode);
+		*inode = NULL;
+		return SQFS_ERROR_ALLOC;
+	}
+
 	proc->inode = inode;
 	proc->blk_flags = flags | SQFS_BLK_FIRST_BLOCK;
 	proc->blk_index = 0;
 	return 0;
 }
 
+static int get_current_block(sqfs_block_processor_t *proc)
+{
+	sqfs_block_t *new;
+
+	if (proc->blk_current == NULL) {
+		new = get_new_block(proc);
+		if (new == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		proc->blk_current = new;
+		proc->blk_current->flags = proc->blk_flags;
+		proc->blk_current->inode = proc->inode;
+	}
+
+	return 0;
+}
+
 int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
 				size_t size)
 {
-	sqfs_block_t *new;
 	sqfs_u64 filesize;
 	size_t diff;
 	int err;
@@ -88,15 +181,9 @@ int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
 	sqfs_inode_set_file_size(*(proc->inode), filesize + size);
 
 	while (size > 0) {
-		if (proc->blk_current == NULL) {
-			new = get_new_block(proc);
-			if (new == NULL)
-				return SQFS_ERROR_ALLOC;
-
-			proc->blk_current = new;
-			proc->blk_current->flags = proc->blk_flags;
-			proc->blk_current->inode = proc->inode;
-		}
+		err = get_current_block(proc);
+		if (err)
+			return err;
 
 		diff = proc->max_block_size - proc->blk_current->size;
 
@@ -128,22 +215,83 @@ int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
 	return 0;
 }
 
-int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
+int sqfs_block_processor_append_sparse(sqfs_block_processor_t *proc,
+				       sqfs_u64 size)
 {
+	sqfs_u64 filesize;
+	size_t diff;
 	int err;
 
 	if (proc->inode == NULL)
 		return SQFS_ERROR_SEQUENCE;
 
-	if (!(proc->blk_flags & SQFS_BLK_FIRST_BLOCK)) {
-		if (proc->blk_current != NULL &&
-		    (proc->blk_flags & SQFS_BLK_DONT_FRAGMENT)) {
-			proc->blk_current->flags |= SQFS_BLK_LAST_BLOCK;
-		} else {
-			err = add_sentinel_block(proc);
+	sqfs_inode_get_file_size(*(proc->inode), &filesize);
+	sqfs_inode_set_file_size(*(proc->inode), filesize + size);
+
+	while (size > 0) {
+		err = get_current_block(proc);
+		if (err)
+			return err;
+
+		/* whole blocks are tagged as sparse right away,
+		   without ever touching the payload */
+		if (proc->blk_current->size == 0 &&
+		    size >= proc->max_block_size) {
+			proc->blk_current->flags |= SQFS_BLK_IS_SPARSE;
+			proc->blk_current->size = proc->max_block_size;
+			proc->stats.input_bytes_read += proc->max_block_size;
+			size -= proc->max_block_size;
+
+			err = flush_block(proc);
+			if (err)
+				return err;
+			continue;
+		}
+
+		diff = proc->max_block_size - proc->blk_current->size;
+
+		if (diff == 0) {
+			err = flush_block(proc);
 			if (err)
 				return err;
+			continue;
 		}
+
+		if (diff > size)
+			diff = size;
+
+		memset(proc->blk_current->data + proc->blk_current->size,
+		       0, diff);
+
+		size -= diff;
+		proc->blk_current->size += diff;
+
+		proc->stats.input_bytes_read += diff;
+	}
+
+	if (proc->blk_current != NULL &&
+	    proc->blk_current->size == proc->max_block_size) {
+		return flush_block(proc);
+	}
+
+	return 0;
+}
+
+int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
+{
+	int err;
+
+	if (proc->inode == NULL)
+		return SQFS_ERROR_SEQUENCE;
+
+	if (proc->blk_current != NULL &&
+	    (proc->blk_flags & SQFS_BLK_DONT_FRAGMENT)) {
+		/* also if the file is shorter than a single block */
+		proc->blk_current->flags |= SQFS_BLK_LAST_BLOCK;
+	} else if (!(proc->blk_flags & SQFS_BLK_FIRST_BLOCK)) {
+		err = add_sentinel_block(proc);
+		if (err)
+			return err;
 	}
 
 	if (proc->blk_current != NULL) {
@@ -154,6 +302,13 @@ int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
 
 	proc->inode = NULL;
 	proc->blk_flags = 0;
+
+	if (proc->file_current != NULL) {
+		proc->file_current->refs -= 1;
+		proc->file_current = NULL;
+		return block_processor_report_files(proc);
+	}
+
 	return 0;
 }
 
@@ -13,6 +13,7 @@
 #include "sqfs/block_writer.h"
 #include "sqfs/frag_table.h"
 #include "sqfs/compressor.h"
+#include "sqfs/executor.h"
 #include "sqfs/inode.h"
 #include "sqfs/table.h"
 #include "sqfs/error.h"
@@ -20,14 +21,30 @@
 #include "sqfs/io.h"
 #include "util.h"
 
+#include "../buffer_pool.h"
+
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 
+/* A file that has not been reported as done yet. */
+typedef struct pending_file_t {
+	struct pending_file_t *next;
+	sqfs_inode_generic_t **inode;
+
+	/* Number of blocks that still have to set a location in the
+	   inode, plus one while the file is still open. */
+	unsigned int refs;
+} pending_file_t;
+
 typedef struct sqfs_block_t {
 	struct sqfs_block_t *next;
 	sqfs_inode_generic_t **inode;
 
+	/* Set if the file the block belongs to is tracked for completion,
+	   cleared once the block is done updating the inode. */
+	pending_file_t *file;
+
 	sqfs_u32 proc_seq_num;
 	sqfs_u32 io_seq_num;
 	sqfs_u32 flags;
@@ -62,6 +79,18 @@ struct sqfs_block_processor_t {
 
 	sqfs_block_t *free_list;
 
+	/* files in the order they were started, until reported as done */
+	int (*file_done)(void *user, sqfs_inode_generic_t **inode);
+	void *file_done_user;
+	pending_file_t *pending_files;
+	pending_file_t *pending_last;
+	pending_file_t *pending_free;
+	pending_file_t *file_current;
+
+	/* if set, block buffers and worker scratch buffers come from here */
+	sqfs_buffer_pool_t *pool;
+	bool have_blocks;
+
 	size_t max_block_size;
 };
 
@@ -76,6 +105,14 @@ SQFS_INTERNAL
 int block_processor_do_block(sqfs_block_t *block, sqfs_compressor_t *cmp,
 			     sqfs_u8 *scratch, size_t scratch_size);
 
+SQFS_INTERNAL
+void block_processor_free_block(sqfs_block_processor_t *proc,
+				sqfs_block_t *blk);
+
+SQFS_INTERNAL int block_processor_report_files(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void block_processor_free_files(sqfs_block_processor_t *proc);
+
 SQFS_INTERNAL
 int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block);
 
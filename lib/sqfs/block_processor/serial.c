@@ -13,14 +13,14 @@ typedef struct {
 	sqfs_u8 scratch[];
 } serial_block_processor_t;
 
-static void free_block_list(sqfs_block_t *list)
+static void free_block_list(sqfs_block_processor_t *proc, sqfs_block_t *list)
 {
 	sqfs_block_t *blk;
 
 	while (list != NULL) {
 		blk = list;
 		list = blk->next;
-		free(blk);
+		block_processor_free_block(proc, blk);
 	}
 }
 
@@ -28,14 +28,17 @@ static void block_processor_destroy(sqfs_object_t *obj)
 {
 	sqfs_block_processor_t *proc = (sqfs_block_processor_t *)obj;
 
-	free_block_list(proc->free_list);
+	free_block_list(proc, proc->free_list);
 
 	if (proc->frag_block != NULL) {
-		free_block_list(proc->frag_block->frag_list);
-		free(proc->frag_block);
+		free_block_list(proc, proc->frag_block->frag_list);
+		block_processor_free_block(proc, proc->frag_block);
 	}
 
-	free(proc->blk_current);
+	if (proc->blk_current != NULL)
+		block_processor_free_block(proc, proc->blk_current);
+
+	block_processor_free_files(proc);
 	free(proc);
 }
 
@@ -58,10 +61,42 @@ sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
 	proc->base.frag_tbl = tbl;
 	proc->base.wr = wr;
 	proc->base.stats.size = sizeof(proc->base.stats);
+	proc->base.stats.backlog_limit = 1;
+	proc->base.stats.worker_count = 1;
+	proc->base.stats.active_worker_count = 1;
 	((sqfs_object_t *)proc)->destroy = block_processor_destroy;
 	return (sqfs_block_processor_t *)proc;
 }
 
+sqfs_block_processor_t
+*sqfs_block_processor_create_exec(size_t max_block_size,
+				  sqfs_compressor_t *cmp,
+				  sqfs_executor_t *exec,
+				  size_t max_backlog,
+				  sqfs_block_writer_t *wr,
+				  sqfs_frag_table_t *tbl)
+{
+	if (exec->size != sizeof(*exec))
+		return NULL;
+
+	return sqfs_block_processor_create(max_block_size, cmp, 1,
+					   max_backlog, wr, tbl);
+}
+
+void sqfs_block_processor_set_auto_tune(sqfs_block_processor_t *proc,
+					bool enable)
+{
+	(void)proc; (void)enable;
+}
+
+int sqfs_block_processor_set_cpu_affinity(sqfs_block_processor_t *proc,
+					  const unsigned int *cpus,
+					  size_t count)
+{
+	(void)proc; (void)cpus; (void)count;
+	return SQFS_ERROR_UNSUPPORTED;
+}
+
 int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 {
 	serial_block_processor_t *sproc = (serial_block_processor_t *)proc;
@@ -80,7 +115,7 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 		sproc->status = process_completed_fragment(proc, block,
 							   &fragblk);
 		if (fragblk == NULL)
-			return sproc->status;
+			goto out;
 
 		block = fragblk;
 		sproc->status = block_processor_do_block(block, proc->cmp,
@@ -91,10 +126,13 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 	}
 
 	sproc->status = process_completed_block(proc, block);
+out:
+	if (sproc->status == 0)
+		sproc->status = block_processor_report_files(proc);
 	return sproc->status;
 fail:
-	free_block_list(block->frag_list);
-	free(block);
+	free_block_list(proc, block->frag_list);
+	block_processor_free_block(proc, block);
 	return sproc->status;
 }
 
@@ -121,8 +159,8 @@ int sqfs_block_processor_finish(sqfs_block_processor_t *proc)
 	return sproc->status;
 fail:
 	if (proc->frag_block != NULL) {
-		free_block_list(proc->frag_block->frag_list);
-		free(proc->frag_block);
+		free_block_list(proc, proc->frag_block->frag_list);
+		block_processor_free_block(proc, proc->frag_block);
 		proc->frag_block = NULL;
 	}
 	return sproc->status;
@@ -7,43 +7,10 @@
 #define SQFS_BUILDING_DLL
 #include "internal.h"
 
-#if defined(_WIN32) || defined(__WINDOWS__)
-#	define WIN32_LEAN_AND_MEAN
-#	include <windows.h>
-#	define LOCK(mtx) EnterCriticalSection(mtx)
-#	define UNLOCK(mtx) LeaveCriticalSection(mtx)
-#	define AWAIT(cond, mtx) SleepConditionVariableCS(cond, mtx, INFINITE)
-#	define SIGNAL_ALL(cond) WakeAllConditionVariable(cond)
-#	define THREAD_JOIN(t) \
-		if (t != NULL) { \
-			WaitForSingleObject(t, INFINITE); \
-			CloseHandle(t); \
-		}
-#	define MUTEX_DESTROY(mtx) DeleteCriticalSection(mtx)
-#	define CONDITION_DESTROY(cond)
-#	define THREAD_EXIT_SUCCESS 0
-#	define THREAD_TYPE DWORD WINAPI
-#	define THREAD_ARG LPVOID
-#	define THREAD_HANDLE HANDLE
-#	define MUTEX_TYPE CRITICAL_SECTION
-#	define CONDITION_TYPE CONDITION_VARIABLE
-#else
-#	include <pthread.h>
-#	include <signal.h>
-#	define LOCK(mtx) pthread_mutex_lock(mtx)
-#	define UNLOCK(mtx) pthread_mutex_unlock(mtx)
-#	define AWAIT(cond, mtx) pthread_cond_wait(cond, mtx)
-#	define SIGNAL_ALL(cond) pthread_cond_broadcast(cond)
-#	define THREAD_JOIN(t) if (t != (pthread_t)0) { pthread_join(t, NULL); }
-#	define MUTEX_DESTROY(mtx) pthread_mutex_destroy(mtx)
-#	define CONDITION_DESTROY(cond) pthread_cond_destroy(cond)
-#	define THREAD_EXIT_SUCCESS NULL
-#	define THREAD_TYPE void *
-#	define THREAD_ARG void *
-#	define THREAD_HANDLE pthread_t
-#	define MUTEX_TYPE pthread_mutex_t
-#	define CONDITION_TYPE pthread_cond_t
-#endif
+#include "../threading.h"
+
+/* number of enqueued blocks between two auto tuning decisions */
+#define AUTO_TUNE_WINDOW (32)
 
 typedef struct compress_worker_t compress_worker_t;
 typedef struct thread_pool_processor_t thread_pool_processor_t;
@@ -52,7 +19,13 @@ struct compress_worker_t {
 	thread_pool_processor_t *shared;
 	sqfs_compressor_t *cmp;
 	THREAD_HANDLE thread;
-	sqfs_u8 scratch[];
+	unsigned int index;
+
+	/* if an executor is used, next entry in the idle list */
+	compress_worker_t *next;
+
+	/* allocated on first use, by the thread that uses it */
+	sqfs_u8 *scratch;
 };
 
 struct thread_pool_processor_t {
@@ -64,6 +37,7 @@ struct thread_pool_processor_t {
 
 	sqfs_block_t *proc_queue;
 	sqfs_block_t *proc_queue_last;
+	size_t proc_queue_len;
 
 	sqfs_block_t *io_queue;
 	sqfs_block_t *done;
@@ -79,39 +53,82 @@ struct thread_pool_processor_t {
 	unsigned int num_workers;
 	size_t max_backlog;
 
+	/*
+	  Only the first active_workers workers pick up blocks and at most
+	  backlog_limit blocks are in flight. Without auto tuning, those are
+	  always num_workers and max_backlog. With auto tuning, they are
+	  adjusted every AUTO_TUNE_WINDOW blocks, based on how often the
+	  workers went idle and the front end stalled in that window.
+	 */
+	unsigned int active_workers;
+	size_t backlog_limit;
+	sqfs_u64 idle_count;
+
+	bool auto_tune;
+	size_t tune_blocks;
+	sqfs_u64 tune_idle_start;
+	sqfs_u64 tune_stall_start;
+
+	/*
+	  If an executor is used, workers are not threads but sets of
+	  compressor and scratch buffer, handed out to tasks from the idle
+	  list. A task counts as active from submission until it returns and
+	  as busy while it is compressing a block.
+	 */
+	sqfs_executor_t *exec;
+	compress_worker_t *idle;
+	unsigned int active_tasks;
+	unsigned int busy_tasks;
+
 	compress_worker_t *workers[];
 };
 
-static void free_blk_list(sqfs_block_t *list)
+static void free_blk_list(sqfs_block_processor_t *proc, sqfs_block_t *list)
 {
 	sqfs_block_t *it;
 
 	while (list != NULL) {
 		it = list;
 		list = list->next;
-		free(it);
+		block_processor_free_block(proc, it);
 	}
 }
 
-static sqfs_block_t *get_next_work_item(thread_pool_processor_t *shared)
+static sqfs_block_t *try_get_work_item(thread_pool_processor_t *shared)
 {
-	sqfs_block_t *blk = NULL;
+	sqfs_block_t *blk;
 
-	while (shared->proc_queue == NULL && shared->status == 0)
-		AWAIT(&shared->queue_cond, &shared->mtx);
+	if (shared->status != 0 || shared->proc_queue == NULL)
+		return NULL;
 
-	if (shared->status == 0) {
-		blk = shared->proc_queue;
-		shared->proc_queue = blk->next;
-		blk->next = NULL;
+	blk = shared->proc_queue;
+	shared->proc_queue = blk->next;
+	shared->proc_queue_len -= 1;
+	blk->next = NULL;
 
-		if (shared->proc_queue == NULL)
-			shared->proc_queue_last = NULL;
-	}
+	if (shared->proc_queue == NULL)
+		shared->proc_queue_last = NULL;
 
 	return blk;
 }
 
+static sqfs_block_t *get_next_work_item(thread_pool_processor_t *shared,
+					compress_worker_t *worker)
+{
+	if (shared->proc_queue == NULL && shared->status == 0 &&
+	    worker->index < shared->active_workers) {
+		shared->idle_count += 1;
+	}
+
+	while ((shared->proc_queue == NULL ||
+		worker->index >= shared->active_workers) &&
+	       shared->status == 0) {
+		AWAIT(&shared->queue_cond, &shared->mtx);
+	}
+
+	return try_get_work_item(shared);
+}
+
 static void store_completed_block(thread_pool_processor_t *shared,
 				  sqfs_block_t *blk, int status)
 {
@@ -138,6 +155,26 @@ static void store_completed_block(thread_pool_processor_t *shared,
 	SIGNAL_ALL(&shared->done_cond);
 }
 
+static int compress_block(compress_worker_t *worker, sqfs_block_t *blk)
+{
+	size_t max_block_size = worker->shared->base.max_block_size;
+	sqfs_buffer_pool_t *pool = worker->shared->base.pool;
+
+	if (worker->scratch == NULL) {
+		if (pool != NULL) {
+			worker->scratch = buffer_pool_get(pool);
+		} else {
+			worker->scratch = malloc(max_block_size);
+		}
+
+		if (worker->scratch == NULL)
+			return SQFS_ERROR_ALLOC;
+	}
+
+	return block_processor_do_block(blk, worker->cmp, worker->scratch,
+					max_block_size);
+}
+
 static THREAD_TYPE worker_proc(THREAD_ARG arg)
 {
 	compress_worker_t *worker = arg;
@@ -150,20 +187,78 @@ static THREAD_TYPE worker_proc(THREAD_ARG arg)
 		if (blk != NULL)
 			store_completed_block(shared, blk, status);
 
-		blk = get_next_work_item(shared);
+		blk = get_next_work_item(shared, worker);
 		UNLOCK(&shared->mtx);
 
 		if (blk == NULL)
 			break;
 
-		status = block_processor_do_block(blk, worker->cmp,
-						  worker->scratch,
-						  shared->base.max_block_size);
+		status = compress_block(worker, blk);
 	}
 
 	return THREAD_EXIT_SUCCESS;
 }
 
+static void executor_task(void *arg)
+{
+	thread_pool_processor_t *shared = arg;
+	compress_worker_t *worker;
+	sqfs_block_t *blk;
+	int status;
+
+	LOCK(&shared->mtx);
+	worker = shared->idle;
+	shared->idle = worker->next;
+
+	for (;;) {
+		blk = try_get_work_item(shared);
+		if (blk == NULL) {
+			if (shared->status == 0)
+				shared->idle_count += 1;
+			break;
+		}
+
+		shared->busy_tasks += 1;
+		UNLOCK(&shared->mtx);
+
+		status = compress_block(worker, blk);
+
+		LOCK(&shared->mtx);
+		shared->busy_tasks -= 1;
+		store_completed_block(shared, blk, status);
+	}
+
+	worker->next = shared->idle;
+	shared->idle = worker;
+	shared->active_tasks -= 1;
+	SIGNAL_ALL(&shared->done_cond);
+	UNLOCK(&shared->mtx);
+}
+
+/*
+  Called with the lock held. Submit another task as long as there are more
+  queued blocks than tasks that have been submitted but not started yet.
+ */
+static void submit_tasks(thread_pool_processor_t *proc)
+{
+	int ret;
+
+	if (proc->exec == NULL)
+		return;
+
+	while (proc->status == 0 && proc->active_tasks < proc->active_workers &&
+	       (proc->active_tasks - proc->busy_tasks) < proc->proc_queue_len) {
+		proc->active_tasks += 1;
+		UNLOCK(&proc->mtx);
+
+		ret = proc->exec->submit(proc->exec, executor_task, proc);
+		if (ret != 0)
+			executor_task(proc);
+
+		LOCK(&proc->mtx);
+	}
+}
+
 static void block_processor_destroy(sqfs_object_t *obj)
 {
 	thread_pool_processor_t *proc = (thread_pool_processor_t *)obj;
@@ -172,6 +267,9 @@ static void block_processor_destroy(sqfs_object_t *obj)
 	LOCK(&proc->mtx);
 	proc->status = -1;
 	SIGNAL_ALL(&proc->queue_cond);
+
+	while (proc->active_tasks > 0)
+		AWAIT(&proc->done_cond, &proc->mtx);
 	UNLOCK(&proc->mtx);
 
 	for (i = 0; i < proc->num_workers; ++i) {
@@ -181,6 +279,12 @@ static void block_processor_destroy(sqfs_object_t *obj)
 			if (proc->workers[i]->cmp != NULL)
 				sqfs_destroy(proc->workers[i]->cmp);
 
+			if (proc->base.pool != NULL) {
+				buffer_pool_put(proc->base.pool,
+						proc->workers[i]->scratch);
+			} else {
+				free(proc->workers[i]->scratch);
+			}
 			free(proc->workers[i]);
 		}
 	}
@@ -189,18 +293,26 @@ static void block_processor_destroy(sqfs_object_t *obj)
 	CONDITION_DESTROY(&proc->queue_cond);
 	MUTEX_DESTROY(&proc->mtx);
 
-	free_blk_list(proc->proc_queue);
-	free_blk_list(proc->io_queue);
-	free_blk_list(proc->done);
-	free_blk_list(proc->base.free_list);
-	free(proc->base.blk_current);
-	free(proc->base.frag_block);
+	free_blk_list(&proc->base, proc->proc_queue);
+	free_blk_list(&proc->base, proc->io_queue);
+	free_blk_list(&proc->base, proc->done);
+	free_blk_list(&proc->base, proc->base.free_list);
+	if (proc->base.blk_current != NULL) {
+		block_processor_free_block(&proc->base,
+					   proc->base.blk_current);
+	}
+	if (proc->base.frag_block != NULL) {
+		block_processor_free_block(&proc->base,
+					   proc->base.frag_block);
+	}
+	block_processor_free_files(&proc->base);
 	free(proc);
 }
 
 static thread_pool_processor_t *block_processor_create(size_t max_block_size,
 						       sqfs_compressor_t *cmp,
 						       unsigned int num_workers,
+						       sqfs_executor_t *exec,
 						       size_t max_backlog,
 						       sqfs_block_writer_t *wr,
 						       sqfs_frag_table_t *tbl)
@@ -216,27 +328,40 @@ static thread_pool_processor_t *block_processor_create(size_t max_block_size,
 	if (proc == NULL)
 		return NULL;
 
+	MUTEX_INIT(&proc->mtx);
+	CONDITION_INIT(&proc->queue_cond);
+	CONDITION_INIT(&proc->done_cond);
+
+	proc->exec = exec;
 	proc->num_workers = num_workers;
 	proc->max_backlog = max_backlog;
+	proc->active_workers = num_workers;
+	proc->backlog_limit = max_backlog;
 	proc->base.max_block_size = max_block_size;
 	proc->base.cmp = cmp;
 	proc->base.frag_tbl = tbl;
 	proc->base.wr = wr;
 	proc->base.stats.size = sizeof(proc->base.stats);
+	proc->base.stats.backlog_limit = max_backlog;
+	proc->base.stats.worker_count = num_workers;
+	proc->base.stats.active_worker_count = num_workers;
 	((sqfs_object_t *)proc)->destroy = block_processor_destroy;
 
 	for (i = 0; i < num_workers; ++i) {
-		proc->workers[i] = alloc_flex(sizeof(compress_worker_t),
-					      1, max_block_size);
+		proc->workers[i] = calloc(1, sizeof(compress_worker_t));
 
 		if (proc->workers[i] == NULL)
 			goto fail;
 
 		proc->workers[i]->shared = proc;
+		proc->workers[i]->index = i;
 		proc->workers[i]->cmp = sqfs_copy(cmp);
 
 		if (proc->workers[i]->cmp == NULL)
 			goto fail;
+
+		proc->workers[i]->next = proc->idle;
+		proc->idle = proc->workers[i];
 	}
 
 	return proc;
@@ -257,14 +382,10 @@ sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
 	unsigned int i;
 
 	proc = block_processor_create(max_block_size, cmp, num_workers,
-				      max_backlog, wr, tbl);
+				      NULL, max_backlog, wr, tbl);
 	if (proc == NULL)
 		return NULL;
 
-	InitializeCriticalSection(&proc->mtx);
-	InitializeConditionVariable(&proc->queue_cond);
-	InitializeConditionVariable(&proc->done_cond);
-
 	for (i = 0; i < num_workers; ++i) {
 		proc->workers[i]->thread = CreateThread(NULL, 0, worker_proc,
 							proc->workers[i], 0, 0);
@@ -291,14 +412,10 @@ sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
 	int ret;
 
 	proc = block_processor_create(max_block_size, cmp, num_workers,
-				      max_backlog, wr, tbl);
+				      NULL, max_backlog, wr, tbl);
 	if (proc == NULL)
 		return NULL;
 
-	proc->mtx = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
-	proc->queue_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
-	proc->done_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
-
 	sigfillset(&set);
 	pthread_sigmask(SIG_SETMASK, &set, &oldset);
 
@@ -319,6 +436,22 @@ fail:
 }
 #endif
 
+sqfs_block_processor_t
+*sqfs_block_processor_create_exec(size_t max_block_size,
+				  sqfs_compressor_t *cmp,
+				  sqfs_executor_t *exec,
+				  size_t max_backlog,
+				  sqfs_block_writer_t *wr,
+				  sqfs_frag_table_t *tbl)
+{
+	if (exec->size != sizeof(*exec) || exec->submit == NULL)
+		return NULL;
+
+	return (sqfs_block_processor_t *)
+		block_processor_create(max_block_size, cmp, exec->concurrency,
+				       exec, max_backlog, wr, tbl);
+}
+
 static void store_io_block(thread_pool_processor_t *proc, sqfs_block_t *blk)
 {
 	sqfs_block_t *it = proc->io_queue, *prev = NULL;
@@ -375,6 +508,125 @@ static sqfs_block_t *try_dequeue_done(thread_pool_processor_t *proc)
 	return out;
 }
 
+/*
+  Called with the lock held, every time the front end enqueues a block. If
+  the front end had to wait in a considerable number of cases, more workers
+  are needed. If the workers kept running dry while the front end never had
+  to wait, the input can't keep up and a worker can be parked.
+ */
+static void auto_tune(thread_pool_processor_t *proc)
+{
+	sqfs_u64 idle, stall;
+
+	proc->tune_blocks += 1;
+	if (proc->tune_blocks < AUTO_TUNE_WINDOW)
+		return;
+
+	idle = proc->idle_count - proc->tune_idle_start;
+	stall = proc->base.stats.frontend_stall_count - proc->tune_stall_start;
+
+	if (stall >= AUTO_TUNE_WINDOW / 4) {
+		if (proc->active_workers < proc->num_workers)
+			proc->active_workers += 1;
+	} else if (stall == 0 && idle >= AUTO_TUNE_WINDOW / 2) {
+		if (proc->active_workers > 1)
+			proc->active_workers -= 1;
+	}
+
+	proc->backlog_limit = (proc->max_backlog * proc->active_workers) /
+			      proc->num_workers;
+	if (proc->backlog_limit < 1)
+		proc->backlog_limit = 1;
+
+	proc->tune_blocks = 0;
+	proc->tune_idle_start = proc->idle_count;
+	proc->tune_stall_start = proc->base.stats.frontend_stall_count;
+	SIGNAL_ALL(&proc->queue_cond);
+}
+
+static void update_stats(thread_pool_processor_t *proc)
+{
+	proc->base.stats.worker_idle_count = proc->idle_count;
+	proc->base.stats.backlog_limit = proc->backlog_limit;
+	proc->base.stats.worker_count = proc->num_workers;
+	proc->base.stats.active_worker_count = proc->active_workers;
+}
+
+void sqfs_block_processor_set_auto_tune(sqfs_block_processor_t *proc,
+					bool enable)
+{
+	thread_pool_processor_t *thproc = (thread_pool_processor_t *)proc;
+
+	LOCK(&thproc->mtx);
+	thproc->auto_tune = enable;
+	thproc->active_workers = thproc->num_workers;
+	thproc->backlog_limit = thproc->max_backlog;
+	thproc->tune_blocks = 0;
+	thproc->tune_idle_start = thproc->idle_count;
+	thproc->tune_stall_start = proc->stats.frontend_stall_count;
+	update_stats(thproc);
+	SIGNAL_ALL(&thproc->queue_cond);
+	UNLOCK(&thproc->mtx);
+}
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+static int pin_thread(HANDLE thread, unsigned int cpu)
+{
+	if (cpu >= sizeof(DWORD_PTR) * CHAR_BIT)
+		return SQFS_ERROR_ARG_INVALID;
+
+	if (SetThreadAffinityMask(thread, (DWORD_PTR)1 << cpu) == 0)
+		return SQFS_ERROR_INTERNAL;
+
+	return 0;
+}
+#elif defined(HAVE_PTHREAD_SETAFFINITY_NP)
+static int pin_thread(pthread_t thread, unsigned int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu >= CPU_SETSIZE)
+		return SQFS_ERROR_ARG_INVALID;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+		return SQFS_ERROR_ARG_INVALID;
+
+	return 0;
+}
+#endif
+
+int sqfs_block_processor_set_cpu_affinity(sqfs_block_processor_t *proc,
+					  const unsigned int *cpus,
+					  size_t count)
+{
+#if defined(_WIN32) || defined(__WINDOWS__) || \
+	defined(HAVE_PTHREAD_SETAFFINITY_NP)
+	thread_pool_processor_t *thproc = (thread_pool_processor_t *)proc;
+	unsigned int i;
+	int ret;
+
+	if (thproc->exec != NULL)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	if (count == 0)
+		return SQFS_ERROR_ARG_INVALID;
+
+	for (i = 0; i < thproc->num_workers; ++i) {
+		ret = pin_thread(thproc->workers[i]->thread, cpus[i % count]);
+		if (ret != 0)
+			return ret;
+	}
+
+	return 0;
+#else
+	(void)proc; (void)cpus; (void)count;
+	return SQFS_ERROR_UNSUPPORTED;
+#endif
+}
+
 static void append_block(thread_pool_processor_t *proc, sqfs_block_t *block)
 {
 	if (proc->proc_queue_last == NULL) {
@@ -386,6 +638,7 @@ static void append_block(thread_pool_processor_t *proc, sqfs_block_t *block)
 
 	block->proc_seq_num = proc->proc_enq_id++;
 	block->next = NULL;
+	proc->proc_queue_len += 1;
 	proc->backlog += 1;
 }
 
@@ -398,14 +651,19 @@ static int handle_io_queue(thread_pool_processor_t *proc, sqfs_block_t *list)
 		it = list;
 		list = list->next;
 		status = process_completed_block(&proc->base, it);
+	}
 
-		if (status != 0) {
-			LOCK(&proc->mtx);
-			if (proc->status == 0)
-				proc->status = status;
-			SIGNAL_ALL(&proc->queue_cond);
-			UNLOCK(&proc->mtx);
-		}
+	free_blk_list(&proc->base, list);
+
+	if (status == 0)
+		status = block_processor_report_files(&proc->base);
+
+	if (status != 0) {
+		LOCK(&proc->mtx);
+		if (proc->status == 0)
+			proc->status = status;
+		SIGNAL_ALL(&proc->queue_cond);
+		UNLOCK(&proc->mtx);
 	}
 
 	return status;
@@ -416,6 +674,7 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 	thread_pool_processor_t *thproc = (thread_pool_processor_t *)proc;
 	sqfs_block_t *io_list = NULL, *io_list_last = NULL;
 	sqfs_block_t *blk, *fragblk;
+	bool stalled = false;
 	int status;
 
 	LOCK(&thproc->mtx);
@@ -428,8 +687,11 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 			if (thproc->backlog == 0)
 				break;
 		} else {
-			if (thproc->backlog < thproc->max_backlog) {
+			if (thproc->backlog < thproc->backlog_limit) {
 				append_block(thproc, block);
+				if (thproc->auto_tune)
+					auto_tune(thproc);
+				submit_tasks(thproc);
 				block = NULL;
 				break;
 			}
@@ -448,6 +710,10 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 
 		blk = try_dequeue_done(thproc);
 		if (blk == NULL) {
+			if (block != NULL && !stalled) {
+				proc->stats.frontend_stall_count += 1;
+				stalled = true;
+			}
 			AWAIT(&thproc->done_cond, &thproc->mtx);
 			continue;
 		}
@@ -461,6 +727,7 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 				fragblk->io_seq_num = thproc->io_enq_id++;
 				append_block(thproc, fragblk);
 				SIGNAL_ALL(&thproc->queue_cond);
+				submit_tasks(thproc);
 			}
 		} else {
 			if (!(blk->flags & SQFS_BLK_FRAGMENT_BLOCK))
@@ -468,14 +735,16 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 			store_io_block(thproc, blk);
 		}
 	}
+	update_stats(thproc);
 	SIGNAL_ALL(&thproc->queue_cond);
 	UNLOCK(&thproc->mtx);
-	free(block);
+	if (block != NULL)
+		block_processor_free_block(proc, block);
 
 	if (status == 0) {
 		status = handle_io_queue(thproc, io_list);
 	} else {
-		free_blk_list(io_list);
+		free_blk_list(proc, io_list);
 	}
 
 	return status;
@@ -499,9 +768,7 @@ int sqfs_block_processor_finish(sqfs_block_processor_t *proc)
 		blk->next = NULL;
 		proc->frag_block = NULL;
 
-		status = block_processor_do_block(blk, proc->cmp,
-						  thproc->workers[0]->scratch,
-						  proc->max_block_size);
+		status = compress_block(thproc->workers[0], blk);
 
 		if (status == 0)
 			status = handle_io_queue(thproc, blk);
@@ -11,15 +11,33 @@
 #include "sqfs/error.h"
 #include "sqfs/block.h"
 #include "sqfs/io.h"
+#include "compat.h"
 #include "util.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #define MK_BLK_HASH(chksum, size) \
 	(((sqfs_u64)(size) << 32) | (sqfs_u64)(chksum))
 
 #define INIT_BLOCK_COUNT (128)
 
+/*
+  Serialized state: a header of little endian 64 bit words, followed by the
+  offset and hash of each block.
+ */
+enum {
+	STATE_DATA_AREA_START = 0,
+	STATE_FILE_SIZE,
+	STATE_BLOCK_COUNT,
+	STATE_BYTES_SUBMITTED,
+	STATE_BYTES_WRITTEN,
+	STATE_BLOCKS_SUBMITTED,
+	STATE_BLOCKS_WRITTEN,
+
+	STATE_HEADER_WORDS,
+};
+
 typedef struct {
 	sqfs_u64 offset;
 	sqfs_u64 hash;
@@ -68,11 +86,16 @@ static int store_block_location(sqfs_block_writer_t *wr, sqfs_u64 offset,
 	return 0;
 }
 
-static size_t deduplicate_blocks(sqfs_block_writer_t *wr, size_t count)
+/* an aligned file can only reuse blocks that start out aligned as well */
+static size_t deduplicate_blocks(sqfs_block_writer_t *wr, size_t count,
+				 bool align)
 {
 	size_t i, j;
 
 	for (i = 0; i < wr->file_start; ++i) {
+		if (align && (wr->blocks[i].offset % wr->devblksz) != 0)
+			continue;
+
 		for (j = 0; j < count; ++j) {
 			if (wr->blocks[i + j].hash == 0)
 				break;
@@ -89,31 +112,61 @@ static size_t deduplicate_blocks(sqfs_block_writer_t *wr, size_t count)
 	return i;
 }
 
-static int align_file(sqfs_block_writer_t *wr)
+/*
+  Append a data block to the file, optionally preceeded by padding to align
+  it. Both are written with a single vectored write. The location is where
+  the block is (or would have been) stored.
+ */
+static int append_block(sqfs_block_writer_t *wr, bool align,
+			const sqfs_u8 *data, sqfs_u32 size, sqfs_u32 info,
+			sqfs_u32 checksum, sqfs_u64 *location)
 {
-	void *padding;
-	sqfs_u64 size;
-	size_t diff;
-	int ret;
-
-	size = wr->file->get_size(wr->file);
-	diff = size % wr->devblksz;
-	if (diff == 0)
-		return 0;
-
-	padding = calloc(1, diff);
-	if (padding == 0)
-		return SQFS_ERROR_ALLOC;
+	void *padding = NULL;
+	sqfs_iovec_t vec[2];
+	sqfs_u64 offset;
+	size_t diff = 0;
+	int ret, count = 0;
+
+	offset = wr->file->get_size(wr->file);
 
-	if (wr->hooks != NULL && wr->hooks->prepare_padding != NULL)
-		wr->hooks->prepare_padding(wr->user_ptr, padding, diff);
+	if (align && (offset % wr->devblksz) != 0)
+		diff = wr->devblksz - offset % wr->devblksz;
 
-	ret = wr->file->write_at(wr->file, size, padding, diff);
-	free(padding);
-	if (ret)
-		return ret;
+	*location = offset + diff;
+
+	if (diff > 0) {
+		padding = calloc(1, diff);
+		if (padding == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		if (wr->hooks != NULL && wr->hooks->prepare_padding != NULL)
+			wr->hooks->prepare_padding(wr->user_ptr, padding, diff);
 
-	return store_block_location(wr, size, 0, 0);
+		ret = store_block_location(wr, offset, 0, 0);
+		if (ret)
+			goto out;
+
+		vec[count].data = padding;
+		vec[count].size = diff;
+		++count;
+	}
+
+	if (size > 0) {
+		ret = store_block_location(wr, offset + diff, info, checksum);
+		if (ret)
+			goto out;
+
+		vec[count].data = (void *)data;
+		vec[count].size = size;
+		++count;
+	}
+
+	ret = 0;
+	if (count > 0)
+		ret = sqfs_file_write_at_v(wr->file, offset, vec, count);
+out:
+	free(padding);
+	return ret;
 }
 
 static void block_writer_destroy(sqfs_object_t *wr)
@@ -168,6 +221,7 @@ int sqfs_block_writer_write(sqfs_block_writer_t *wr, sqfs_u32 size,
 	size_t start, count;
 	sqfs_u64 offset;
 	sqfs_u32 out;
+	bool align;
 	int err;
 
 	if (wr->hooks != NULL && wr->hooks->pre_block_write != NULL) {
@@ -183,29 +237,32 @@ int sqfs_block_writer_write(sqfs_block_writer_t *wr, sqfs_u32 size,
 	if (flags & SQFS_BLK_FIRST_BLOCK) {
 		wr->start = wr->file->get_size(wr->file);
 		wr->file_start = wr->num_blocks;
-
-		if (flags & SQFS_BLK_ALIGN) {
-			err = align_file(wr);
-			if (err)
-				return err;
-		}
 	}
 
-	offset = wr->file->get_size(wr->file);
-	*location = offset;
+	align = (flags & SQFS_BLK_FIRST_BLOCK) && (flags & SQFS_BLK_ALIGN);
 
-	if (size != 0 && !(flags & SQFS_BLK_IS_SPARSE)) {
+	if (size == 0 || (flags & SQFS_BLK_IS_SPARSE)) {
+		err = append_block(wr, align, NULL, 0, 0, 0, location);
+		if (err)
+			return err;
+
+		if (flags & SQFS_BLK_FIRST_BLOCK)
+			wr->file_start = wr->num_blocks;
+	} else {
 		out = size;
 		if (!(flags & SQFS_BLK_IS_COMPRESSED))
 			out |= 1 << 24;
 
-		err = store_block_location(wr, offset, out, checksum);
+		err = append_block(wr, align, data, size, out, checksum,
+				   location);
 		if (err)
 			return err;
 
-		err = wr->file->write_at(wr->file, offset, data, size);
-		if (err)
-			return err;
+		/* the file starts after the alignment padding, if any */
+		if (flags & SQFS_BLK_FIRST_BLOCK)
+			wr->file_start = wr->num_blocks - 1;
+
+		offset = *location;
 
 		wr->stats.bytes_submitted += size;
 		wr->stats.blocks_submitted += 1;
@@ -219,18 +276,22 @@ int sqfs_block_writer_write(sqfs_block_writer_t *wr, sqfs_u32 size,
 	}
 
 	if (flags & SQFS_BLK_LAST_BLOCK) {
+		/* trailing padding is not part of the file for deduplication */
+		count = wr->num_blocks - wr->file_start;
+
 		if (flags & SQFS_BLK_ALIGN) {
-			err = align_file(wr);
+			err = append_block(wr, true, NULL, 0, 0, 0, &offset);
 			if (err)
 				return err;
 		}
 
-		count = wr->num_blocks - wr->file_start;
-
 		if (count == 0) {
 			*location = 0;
-		} else if (!(flags & SQFS_BLK_DONT_DEDUPLICATE)) {
-			start = deduplicate_blocks(wr, count);
+		} else if (flags & SQFS_BLK_DONT_DEDUPLICATE) {
+			*location = wr->blocks[wr->file_start].offset;
+		} else {
+			start = deduplicate_blocks(wr, count,
+						   (flags & SQFS_BLK_ALIGN) != 0);
 			offset = wr->blocks[start].offset;
 
 			*location = offset;
@@ -243,6 +304,13 @@ int sqfs_block_writer_write(sqfs_block_writer_t *wr, sqfs_u32 size,
 				wr->num_blocks = offset;
 			} else {
 				wr->num_blocks = wr->file_start;
+
+				/* drop the alignment padding along with it */
+				while (wr->num_blocks > 0 &&
+				       wr->blocks[wr->num_blocks - 1].offset >=
+				       wr->start) {
+					wr->num_blocks -= 1;
+				}
 			}
 
 			err = wr->file->truncate(wr->file, wr->start);
@@ -262,3 +330,111 @@ const sqfs_block_writer_stats_t
 {
 	return &wr->stats;
 }
+
+int sqfs_block_writer_save_state(const sqfs_block_writer_t *wr,
+				 void **out, size_t *size)
+{
+	sqfs_u64 *state;
+	size_t i, count;
+
+	if (SZ_MUL_OV(wr->num_blocks, 2, &count) ||
+	    SZ_ADD_OV(count, STATE_HEADER_WORDS, &count) ||
+	    SZ_MUL_OV(count, sizeof(state[0]), size)) {
+		return SQFS_ERROR_OVERFLOW;
+	}
+
+	state = malloc(*size);
+	if (state == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	state[STATE_DATA_AREA_START] = htole64(wr->data_area_start);
+	state[STATE_FILE_SIZE] = htole64(wr->file->get_size(wr->file));
+	state[STATE_BLOCK_COUNT] = htole64(wr->num_blocks);
+	state[STATE_BYTES_SUBMITTED] = htole64(wr->stats.bytes_submitted);
+	state[STATE_BYTES_WRITTEN] = htole64(wr->stats.bytes_written);
+	state[STATE_BLOCKS_SUBMITTED] = htole64(wr->stats.blocks_submitted);
+	state[STATE_BLOCKS_WRITTEN] = htole64(wr->stats.blocks_written);
+
+	for (i = 0; i < wr->num_blocks; ++i) {
+		state[STATE_HEADER_WORDS + 2 * i] =
+			htole64(wr->blocks[i].offset);
+		state[STATE_HEADER_WORDS + 2 * i + 1] =
+			htole64(wr->blocks[i].hash);
+	}
+
+	*out = state;
+	return 0;
+}
+
+int sqfs_block_writer_restore_state(sqfs_block_writer_t *wr,
+				    const void *data, size_t size)
+{
+	const sqfs_u8 *raw = data;
+	sqfs_u64 hdr[STATE_HEADER_WORDS];
+	size_t i, count, max_blocks;
+	blk_info_t *blocks;
+	int err;
+
+	if (wr->num_blocks != 0 || wr->stats.blocks_submitted != 0)
+		return SQFS_ERROR_SEQUENCE;
+
+	if (size < sizeof(hdr) || (size % sizeof(hdr[0])) != 0)
+		return SQFS_ERROR_CORRUPTED;
+
+	memcpy(hdr, raw, sizeof(hdr));
+
+	for (i = 0; i < STATE_HEADER_WORDS; ++i)
+		hdr[i] = le64toh(hdr[i]);
+
+	count = (size - sizeof(hdr)) / (2 * sizeof(hdr[0]));
+
+	if (hdr[STATE_BLOCK_COUNT] != count ||
+	    (size - sizeof(hdr)) % (2 * sizeof(hdr[0])) != 0 ||
+	    hdr[STATE_DATA_AREA_START] > hdr[STATE_FILE_SIZE]) {
+		return SQFS_ERROR_CORRUPTED;
+	}
+
+	if (wr->file->get_size(wr->file) < hdr[STATE_FILE_SIZE])
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	max_blocks = count > INIT_BLOCK_COUNT ? count : INIT_BLOCK_COUNT;
+
+	blocks = alloc_array(sizeof(blocks[0]), max_blocks);
+	if (blocks == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	raw += sizeof(hdr);
+
+	for (i = 0; i < count; ++i) {
+		memcpy(&blocks[i].offset, raw, sizeof(blocks[i].offset));
+		raw += sizeof(blocks[i].offset);
+		memcpy(&blocks[i].hash, raw, sizeof(blocks[i].hash));
+		raw += sizeof(blocks[i].hash);
+
+		blocks[i].offset = le64toh(blocks[i].offset);
+		blocks[i].hash = le64toh(blocks[i].hash);
+
+		if (blocks[i].offset > hdr[STATE_FILE_SIZE]) {
+			free(blocks);
+			return SQFS_ERROR_CORRUPTED;
+		}
+	}
+
+	err = wr->file->truncate(wr->file, hdr[STATE_FILE_SIZE]);
+	if (err) {
+		free(blocks);
+		return err;
+	}
+
+	free(wr->blocks);
+	wr->blocks = blocks;
+	wr->num_blocks = count;
+	wr->max_blocks = max_blocks;
+	wr->data_area_start = hdr[STATE_DATA_AREA_START];
+
+	wr->stats.bytes_submitted = hdr[STATE_BYTES_SUBMITTED];
+	wr->stats.bytes_written = hdr[STATE_BYTES_WRITTEN];
+	wr->stats.blocks_submitted = hdr[STATE_BLOCKS_SUBMITTED];
+	wr->stats.blocks_written = hdr[STATE_BLOCKS_WRITTEN];
+	return 0;
+}
@@ -0,0 +1,287 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * buffer_pool.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "buffer_pool.h"
+
+#include "sqfs/error.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+#	define WIN32_LEAN_AND_MEAN
+#	include <windows.h>
+#	define LOCK(mtx) EnterCriticalSection(mtx)
+#	define UNLOCK(mtx) LeaveCriticalSection(mtx)
+#	define MUTEX_INIT(mtx) InitializeCriticalSection(mtx)
+#	define MUTEX_DESTROY(mtx) DeleteCriticalSection(mtx)
+#	define MUTEX_TYPE CRITICAL_SECTION
+#elif defined(WITH_PTHREAD)
+#	include <pthread.h>
+#	define LOCK(mtx) pthread_mutex_lock(mtx)
+#	define UNLOCK(mtx) pthread_mutex_unlock(mtx)
+#	define MUTEX_INIT(mtx) pthread_mutex_init(mtx, NULL)
+#	define MUTEX_DESTROY(mtx) pthread_mutex_destroy(mtx)
+#	define MUTEX_TYPE pthread_mutex_t
+#else
+#	define LOCK(mtx)
+#	define UNLOCK(mtx)
+#	define MUTEX_INIT(mtx)
+#	define MUTEX_DESTROY(mtx)
+#	define MUTEX_TYPE int
+#endif
+
+#if !defined(_WIN32) && !defined(__WINDOWS__)
+#	include <sys/mman.h>
+#	if defined(MAP_ANONYMOUS) || defined(MAP_ANON)
+#		define HAVE_MMAP_ANON
+#		ifndef MAP_ANONYMOUS
+#			define MAP_ANONYMOUS MAP_ANON
+#		endif
+#	endif
+#endif
+
+/* room left in every buffer for a data block header */
+#define BUFFER_HEADROOM (128)
+
+/* slabs are allocated in multiples of this, the common huge page size */
+#define SLAB_ALIGN (2 * 1024 * 1024)
+
+/* minimum number of buffers per slab */
+#define SLAB_MIN_BUFFERS (8)
+
+typedef struct slab_t {
+	struct slab_t *next;
+	void *mem;
+	size_t size;
+	bool mapped;
+} slab_t;
+
+typedef struct free_buffer_t {
+	struct free_buffer_t *next;
+} free_buffer_t;
+
+struct sqfs_buffer_pool_t {
+	sqfs_object_t obj;
+
+	MUTEX_TYPE mtx;
+
+	size_t buffer_size;
+	size_t slab_size;
+	sqfs_u32 flags;
+
+	slab_t *slabs;
+	free_buffer_t *free_list;
+
+	sqfs_buffer_pool_stats_t stats;
+};
+
+#ifdef HAVE_MMAP_ANON
+static void *map_slab(sqfs_buffer_pool_t *pool, size_t size)
+{
+	void *mem;
+
+#ifdef MAP_HUGETLB
+	if (pool->flags & SQFS_BUFFER_POOL_HUGE_PAGES) {
+		mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+		if (mem != MAP_FAILED) {
+			pool->stats.huge_page_bytes += size;
+			return mem;
+		}
+	}
+#endif
+
+#ifdef MADV_HUGEPAGE
+	/*
+	  Transparent huge pages can only be used for aligned ranges, so map
+	  a bit more and trim it down to an aligned range.
+	 */
+	if (pool->flags & SQFS_BUFFER_POOL_HUGE_PAGES) {
+		char *start, *aligned;
+		size_t head, tail;
+
+		mem = mmap(NULL, size + SLAB_ALIGN, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED)
+			return NULL;
+
+		start = mem;
+		head = SLAB_ALIGN - (size_t)((uintptr_t)start % SLAB_ALIGN);
+		if (head == SLAB_ALIGN)
+			head = 0;
+		tail = SLAB_ALIGN - head;
+		aligned = start + head;
+
+		if (head > 0)
+			munmap(start, head);
+		if (tail > 0)
+			munmap(aligned + size, tail);
+
+		if (madvise(aligned, size, MADV_HUGEPAGE) == 0)
+			pool->stats.thp_advised_bytes += size;
+
+		return aligned;
+	}
+#endif
+
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	return mem == MAP_FAILED ? NULL : mem;
+}
+#endif
+
+static int add_slab(sqfs_buffer_pool_t *pool)
+{
+	size_t i, count = pool->slab_size / pool->buffer_size;
+	free_buffer_t *buf;
+	slab_t *slab;
+
+	slab = calloc(1, sizeof(*slab));
+	if (slab == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	slab->size = pool->slab_size;
+
+#ifdef HAVE_MMAP_ANON
+	slab->mem = map_slab(pool, slab->size);
+	slab->mapped = (slab->mem != NULL);
+#endif
+	if (slab->mem == NULL)
+		slab->mem = malloc(slab->size);
+
+	if (slab->mem == NULL) {
+		free(slab);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	for (i = 0; i < count; ++i) {
+		buf = (free_buffer_t *)((char *)slab->mem +
+					i * pool->buffer_size);
+		buf->next = pool->free_list;
+		pool->free_list = buf;
+	}
+
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+
+	pool->stats.bytes_allocated += slab->size;
+	pool->stats.buffer_count += count;
+	return 0;
+}
+
+static void buffer_pool_destroy(sqfs_object_t *obj)
+{
+	sqfs_buffer_pool_t *pool = (sqfs_buffer_pool_t *)obj;
+	slab_t *slab;
+
+	while (pool->slabs != NULL) {
+		slab = pool->slabs;
+		pool->slabs = slab->next;
+
+#ifdef HAVE_MMAP_ANON
+		if (slab->mapped) {
+			munmap(slab->mem, slab->size);
+		} else {
+			free(slab->mem);
+		}
+#else
+		free(slab->mem);
+#endif
+		free(slab);
+	}
+
+	MUTEX_DESTROY(&pool->mtx);
+	free(pool);
+}
+
+sqfs_buffer_pool_t *sqfs_buffer_pool_create(size_t max_block_size,
+					    sqfs_u32 flags)
+{
+	sqfs_buffer_pool_t *pool;
+	size_t size;
+
+	if (flags & ~SQFS_BUFFER_POOL_ALL_FLAGS)
+		return NULL;
+
+	if (SZ_ADD_OV(max_block_size, BUFFER_HEADROOM + 63, &size))
+		return NULL;
+
+	size -= size % 64;
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL)
+		return NULL;
+
+	pool->buffer_size = size;
+	pool->flags = flags;
+
+	if (SZ_MUL_OV(size, SLAB_MIN_BUFFERS, &size) ||
+	    SZ_ADD_OV(size, SLAB_ALIGN - 1, &size)) {
+		free(pool);
+		return NULL;
+	}
+
+	pool->slab_size = size - size % SLAB_ALIGN;
+
+	pool->stats.size = sizeof(pool->stats);
+	pool->stats.buffer_size = pool->buffer_size;
+
+	MUTEX_INIT(&pool->mtx);
+	((sqfs_object_t *)pool)->destroy = buffer_pool_destroy;
+	return pool;
+}
+
+const sqfs_buffer_pool_stats_t
+*sqfs_buffer_pool_get_stats(const sqfs_buffer_pool_t *pool)
+{
+	return &pool->stats;
+}
+
+size_t buffer_pool_capacity(const sqfs_buffer_pool_t *pool)
+{
+	return pool->buffer_size;
+}
+
+void *buffer_pool_get(sqfs_buffer_pool_t *pool)
+{
+	free_buffer_t *buf = NULL;
+
+	LOCK(&pool->mtx);
+	if (pool->free_list == NULL && add_slab(pool) != 0)
+		goto out;
+
+	buf = pool->free_list;
+	pool->free_list = buf->next;
+
+	pool->stats.request_count += 1;
+	pool->stats.buffers_in_use += 1;
+
+	if (pool->stats.buffers_in_use > pool->stats.peak_buffers_in_use)
+		pool->stats.peak_buffers_in_use = pool->stats.buffers_in_use;
+out:
+	UNLOCK(&pool->mtx);
+	return buf;
+}
+
+void buffer_pool_put(sqfs_buffer_pool_t *pool, void *ptr)
+{
+	free_buffer_t *buf = ptr;
+
+	if (buf == NULL)
+		return;
+
+	LOCK(&pool->mtx);
+	buf->next = pool->free_list;
+	pool->free_list = buf;
+	pool->stats.buffers_in_use -= 1;
+	UNLOCK(&pool->mtx);
+}
@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * buffer_pool.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include "config.h"
+
+#include "sqfs/buffer_pool.h"
+
+/* Size of the buffers handed out by a pool. */
+SQFS_INTERNAL size_t buffer_pool_capacity(const sqfs_buffer_pool_t *pool);
+
+/* Get a buffer of buffer_pool_capacity bytes. Returns NULL on failure. */
+SQFS_INTERNAL void *buffer_pool_get(sqfs_buffer_pool_t *pool);
+
+/* Return a buffer obtained from buffer_pool_get. NULL is ignored. */
+SQFS_INTERNAL void buffer_pool_put(sqfs_buffer_pool_t *pool, void *ptr);
+
+#endif /* BUFFER_POOL_H */
@@ -17,16 +17,30 @@
 #include "sqfs/io.h"
 #include "util.h"
 
+#include "buffer_pool.h"
+
 #include <stdlib.h>
 #include <string.h>
 
+/*
+  The maximum number of consecutive data blocks of a file that are read
+  from the image with a single read.
+ */
+#define READ_AHEAD_BLOCKS (8)
+
 struct sqfs_data_reader_t {
 	sqfs_object_t obj;
 
 	sqfs_frag_table_t *frag_tbl;
 	sqfs_compressor_t *cmp;
 	sqfs_file_t *file;
+	sqfs_buffer_pool_t *pool;
 
+	/*
+	  Buffers for the most recently used data and fragment block. They
+	  are allocated once and reused. A size of 0 means that the buffer
+	  does not hold a valid block.
+	 */
 	sqfs_u8 *data_block;
 	size_t data_blk_size;
 	sqfs_u64 current_block;
@@ -36,76 +50,210 @@ struct sqfs_data_reader_t {
 	sqfs_u32 current_frag_index;
 	sqfs_u32 block_size;
 
+	/*
+	  The on-disk data of a range of consecutive blocks, read at once.
+	  Allocated on first use, a size of 0 means that it holds no data.
+	 */
+	sqfs_u8 *staging;
+	sqfs_u64 staging_start;
+	size_t staging_size;
+
 	sqfs_u8 scratch[];
 };
 
-static int get_block(sqfs_data_reader_t *data, sqfs_u64 off, sqfs_u32 size,
-		     sqfs_u32 max_size, size_t *out_sz, sqfs_u8 **out)
+static sqfs_u8 *alloc_buffer(sqfs_data_reader_t *data)
+{
+	if (data->pool != NULL)
+		return buffer_pool_get(data->pool);
+
+	return malloc(data->block_size);
+}
+
+static void free_buffer(sqfs_data_reader_t *data, sqfs_u8 *buffer)
+{
+	if (data->pool != NULL) {
+		buffer_pool_put(data->pool, buffer);
+	} else {
+		free(buffer);
+	}
+}
+
+/*
+  Get the on-disk data of a block from the staging buffer. If it isn't
+  there and the caller expects to read more blocks after it, load the
+  entire span into the staging buffer first. Returns NULL in out if the
+  block should be read directly.
+ */
+static int get_staged(sqfs_data_reader_t *data, sqfs_u64 off,
+		      sqfs_u32 on_disk_size, sqfs_u64 span,
+		      const sqfs_u8 **out)
 {
+	sqfs_u64 end = data->staging_start + data->staging_size;
+	int err;
+
+	*out = NULL;
+
+	if (data->staging_size > 0 && off >= data->staging_start &&
+	    off < end && on_disk_size <= (end - off)) {
+		*out = data->staging + (off - data->staging_start);
+		return 0;
+	}
+
+	if (span <= on_disk_size)
+		return 0;
+
+	if (data->staging == NULL) {
+		data->staging = alloc_array(data->block_size,
+					    READ_AHEAD_BLOCKS);
+		if (data->staging == NULL)
+			return SQFS_ERROR_ALLOC;
+	}
+
+	data->staging_size = 0;
+
+	err = data->file->read_at(data->file, off, data->staging, span);
+	if (err)
+		return err;
+
+	data->staging_start = off;
+	data->staging_size = span;
+	*out = data->staging;
+	return 0;
+}
+
+/*
+  Compute the number of bytes that the on-disk data of the given number
+  of blocks, starting at the given index, takes up.
+ */
+static sqfs_u64 get_span(const sqfs_data_reader_t *data,
+			 const sqfs_inode_generic_t *inode,
+			 size_t index, size_t count)
+{
+	size_t i, block_count = sqfs_inode_get_file_block_count(inode);
+	sqfs_u64 span = 0;
+
+	if (count > READ_AHEAD_BLOCKS)
+		count = READ_AHEAD_BLOCKS;
+
+	for (i = index; i < block_count && (i - index) < count; ++i) {
+		if (SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]) > data->block_size)
+			break;
+
+		span += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+	}
+
+	return span;
+}
+
+static int read_block(sqfs_data_reader_t *data, sqfs_u64 off, sqfs_u32 size,
+		      sqfs_u32 max_size, sqfs_u64 span, size_t *out_sz,
+		      sqfs_u8 *out)
+{
+	const sqfs_u8 *raw;
 	sqfs_u32 on_disk_size;
 	sqfs_s32 ret;
 	int err;
 
-	*out = alloc_array(1, max_size);
 	*out_sz = max_size;
 
-	if (*out == NULL) {
-		err = SQFS_ERROR_ALLOC;
-		goto fail;
-	}
-
-	if (SQFS_IS_SPARSE_BLOCK(size))
+	if (SQFS_IS_SPARSE_BLOCK(size)) {
+		memset(out, 0, max_size);
 		return 0;
+	}
 
 	on_disk_size = SQFS_ON_DISK_BLOCK_SIZE(size);
 
-	if (on_disk_size > max_size) {
-		err = SQFS_ERROR_OVERFLOW;
-		goto fail;
-	}
+	if (on_disk_size > max_size)
+		return SQFS_ERROR_OVERFLOW;
+
+	err = get_staged(data, off, on_disk_size, span, &raw);
+	if (err)
+		return err;
 
 	if (SQFS_IS_BLOCK_COMPRESSED(size)) {
-		err = data->file->read_at(data->file, off,
-					  data->scratch, on_disk_size);
-		if (err)
-			goto fail;
+		if (raw == NULL) {
+			err = data->file->read_at(data->file, off,
+						  data->scratch, on_disk_size);
+			if (err)
+				return err;
 
-		ret = data->cmp->do_block(data->cmp, data->scratch,
-					  on_disk_size, *out, max_size);
-		if (ret <= 0) {
-			err = ret < 0 ? ret : SQFS_ERROR_OVERFLOW;
-			goto fail;
+			raw = data->scratch;
 		}
 
+		ret = data->cmp->do_block(data->cmp, raw,
+					  on_disk_size, out, max_size);
+		if (ret <= 0)
+			return ret < 0 ? ret : SQFS_ERROR_OVERFLOW;
+
 		*out_sz = ret;
 	} else {
-		err = data->file->read_at(data->file, off,
-					  *out, on_disk_size);
-		if (err)
-			goto fail;
+		if (raw == NULL) {
+			err = data->file->read_at(data->file, off, out,
+						  on_disk_size);
+			if (err)
+				return err;
+		} else {
+			memcpy(out, raw, on_disk_size);
+		}
 
 		*out_sz = on_disk_size;
 	}
 
 	return 0;
-fail:
-	free(*out);
-	*out = NULL;
+}
+
+static int get_block(sqfs_data_reader_t *data, sqfs_u64 off, sqfs_u32 size,
+		     sqfs_u32 max_size, sqfs_u64 span, size_t *out_sz,
+		     sqfs_u8 **out)
+{
+	int err;
+
+	*out = alloc_array(1, max_size);
 	*out_sz = 0;
+
+	if (*out == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	err = read_block(data, off, size, max_size, span, out_sz, *out);
+	if (err) {
+		free(*out);
+		*out = NULL;
+		*out_sz = 0;
+	}
+
+	return err;
+}
+
+static int precache_block(sqfs_data_reader_t *data, sqfs_u64 location,
+			  sqfs_u32 size, sqfs_u64 span, size_t *out_sz,
+			  sqfs_u8 **out)
+{
+	int err;
+
+	if (*out == NULL) {
+		*out = alloc_buffer(data);
+		if (*out == NULL)
+			return SQFS_ERROR_ALLOC;
+	}
+
+	err = read_block(data, location, size, data->block_size, span,
+			 out_sz, *out);
+	if (err)
+		*out_sz = 0;
+
 	return err;
 }
 
 static int precache_data_block(sqfs_data_reader_t *data, sqfs_u64 location,
-			       sqfs_u32 size)
+			       sqfs_u32 size, sqfs_u64 span)
 {
-	if (data->data_block != NULL && data->current_block == location)
+	if (data->data_blk_size != 0 && data->current_block == location)
 		return 0;
 
-	free(data->data_block);
 	data->current_block = location;
 
-	return get_block(data, location, size, data->block_size,
-			 &data->data_blk_size, &data->data_block);
+	return precache_block(data, location, size, span,
+			      &data->data_blk_size, &data->data_block);
 }
 
 static int precache_fragment_block(sqfs_data_reader_t *data, size_t idx)
@@ -113,18 +261,17 @@ static int precache_fragment_block(sqfs_data_reader_t *data, size_t idx)
 	sqfs_fragment_t ent;
 	int ret;
 
-	if (data->frag_block != NULL && idx == data->current_frag_index)
+	if (data->frag_blk_size != 0 && idx == data->current_frag_index)
 		return 0;
 
 	ret = sqfs_frag_table_lookup(data->frag_tbl, idx, &ent);
 	if (ret != 0)
 		return ret;
 
-	free(data->frag_block);
 	data->current_frag_index = idx;
 
-	return get_block(data, ent.start_offset, ent.size, data->block_size,
-			 &data->frag_blk_size, &data->frag_block);
+	return precache_block(data, ent.start_offset, ent.size, 0,
+			      &data->frag_blk_size, &data->frag_block);
 }
 
 static void data_reader_destroy(sqfs_object_t *obj)
@@ -132,8 +279,9 @@ static void data_reader_destroy(sqfs_object_t *obj)
 	sqfs_data_reader_t *data = (sqfs_data_reader_t *)obj;
 
 	sqfs_destroy(data->frag_tbl);
-	free(data->data_block);
-	free(data->frag_block);
+	free_buffer(data, data->data_block);
+	free_buffer(data, data->frag_block);
+	free(data->staging);
 	free(data);
 }
 
@@ -148,12 +296,15 @@ static sqfs_object_t *data_reader_copy(const sqfs_object_t *obj)
 
 	memcpy(copy, data, sizeof(*data) + data->block_size);
 
+	copy->staging = NULL;
+	copy->staging_size = 0;
+
 	copy->frag_tbl = sqfs_copy(data->frag_tbl);
 	if (copy->frag_tbl == NULL)
 		goto fail_ftbl;
 
 	if (data->data_block != NULL) {
-		copy->data_block = malloc(data->data_blk_size);
+		copy->data_block = alloc_buffer(copy);
 		if (copy->data_block == NULL)
 			goto fail_dblk;
 
@@ -161,8 +312,8 @@ static sqfs_object_t *data_reader_copy(const sqfs_object_t *obj)
 		       data->data_blk_size);
 	}
 
-	if (copy->frag_block != NULL) {
-		copy->frag_block = malloc(copy->frag_blk_size);
+	if (data->frag_block != NULL) {
+		copy->frag_block = alloc_buffer(copy);
 		if (copy->frag_block == NULL)
 			goto fail_fblk;
 
@@ -170,11 +321,11 @@ static sqfs_object_t *data_reader_copy(const sqfs_object_t *obj)
 		       data->frag_blk_size);
 	}
 
-	/* XXX: file and cmp aren't deep-copied becaues data
+	/* XXX: file, cmp and pool aren't deep-copied becaues data
 	        doesn't own them either. */
 	return (sqfs_object_t *)copy;
 fail_fblk:
-	free(copy->data_block);
+	free_buffer(copy, copy->data_block);
 fail_dblk:
 	sqfs_destroy(copy->frag_tbl);
 fail_ftbl:
@@ -210,8 +361,7 @@ int sqfs_data_reader_load_fragment_table(sqfs_data_reader_t *data,
 {
 	int ret;
 
-	free(data->frag_block);
-	data->frag_block = NULL;
+	data->frag_blk_size = 0;
 	data->current_frag_index = 0;
 
 	ret = sqfs_frag_table_read(data->frag_tbl, data->file,
@@ -223,6 +373,24 @@ int sqfs_data_reader_load_fragment_table(sqfs_data_reader_t *data,
 	return 0;
 }
 
+int sqfs_data_reader_set_buffer_pool(sqfs_data_reader_t *data,
+				     sqfs_buffer_pool_t *pool)
+{
+	if (buffer_pool_capacity(pool) < data->block_size)
+		return SQFS_ERROR_ARG_INVALID;
+
+	free_buffer(data, data->data_block);
+	free_buffer(data, data->frag_block);
+
+	data->data_block = NULL;
+	data->data_blk_size = 0;
+	data->frag_block = NULL;
+	data->frag_blk_size = 0;
+
+	data->pool = pool;
+	return 0;
+}
+
 int sqfs_data_reader_get_block(sqfs_data_reader_t *data,
 			       const sqfs_inode_generic_t *inode,
 			       size_t index, size_t *size, sqfs_u8 **out)
@@ -243,8 +411,9 @@ int sqfs_data_reader_get_block(sqfs_data_reader_t *data,
 
 	unpacked_size = filesz < data->block_size ? filesz : data->block_size;
 
-	return get_block(data, off, inode->extra[index],
-			 unpacked_size, size, out);
+	return get_block(data, off, inode->extra[index], unpacked_size,
+			 get_span(data, inode, index, READ_AHEAD_BLOCKS),
+			 size, out);
 }
 
 int sqfs_data_reader_get_fragment(sqfs_data_reader_t *data,
@@ -289,8 +458,8 @@ sqfs_s32 sqfs_data_reader_read(sqfs_data_reader_t *data,
 			       sqfs_u64 offset, void *buffer, sqfs_u32 size)
 {
 	sqfs_u32 frag_idx, frag_off, diff, total = 0;
-	size_t i, block_count;
-	sqfs_u64 off, filesz;
+	size_t i, block_count, count;
+	sqfs_u64 off, filesz, span;
 	char *ptr;
 	int err;
 
@@ -317,6 +486,10 @@ sqfs_s32 sqfs_data_reader_read(sqfs_data_reader_t *data,
 		}
 	}
 
+	/* read ahead as many blocks as the request touches */
+	count = ((sqfs_u64)offset + size + data->block_size - 1) /
+		data->block_size;
+
 	/* copy data from blocks */
 	while (i < block_count && size > 0 && filesz > 0) {
 		diff = data->block_size - offset;
@@ -326,7 +499,10 @@ sqfs_s32 sqfs_data_reader_read(sqfs_data_reader_t *data,
 		if (SQFS_IS_SPARSE_BLOCK(inode->extra[i])) {
 			memset(buffer, 0, diff);
 		} else {
-			err = precache_data_block(data, off, inode->extra[i]);
+			span = get_span(data, inode, i, count);
+
+			err = precache_data_block(data, off, inode->extra[i],
+						  span);
 			if (err)
 				return err;
 
@@ -341,6 +517,7 @@ sqfs_s32 sqfs_data_reader_read(sqfs_data_reader_t *data,
 		}
 
 		++i;
+		--count;
 		offset = 0;
 		size -= diff;
 		total += diff;
@@ -14,6 +14,7 @@
 #include "sqfs/inode.h"
 #include "sqfs/error.h"
 #include "sqfs/dir.h"
+#include "inode_cache.h"
 #include "util.h"
 
 #include <string.h>
@@ -34,6 +35,13 @@ struct sqfs_dir_reader_t {
 	size_t start_size;
 	sqfs_u16 dir_offset;
 	sqfs_u16 inode_offset;
+
+	/* the entry returned by sqfs_dir_reader_next, reused across calls */
+	sqfs_dir_entry_t *ent;
+	size_t ent_max;
+
+	/* optional, shared with all copies of the reader */
+	sqfs_inode_cache_t *icache;
 };
 
 static void dir_reader_destroy(sqfs_object_t *obj)
@@ -42,6 +50,7 @@ static void dir_reader_destroy(sqfs_object_t *obj)
 
 	sqfs_destroy(rd->meta_inode);
 	sqfs_destroy(rd->meta_dir);
+	free(rd->ent);
 	free(rd);
 }
 
@@ -54,6 +63,8 @@ static sqfs_object_t *dir_reader_copy(const sqfs_object_t *obj)
 		return NULL;
 
 	memcpy(copy, rd, sizeof(*copy));
+	copy->ent = NULL;
+	copy->ent_max = 0;
 
 	copy->meta_inode = sqfs_copy(rd->meta_inode);
 	if (copy->meta_inode == NULL)
@@ -148,9 +159,8 @@ int sqfs_dir_reader_open_dir(sqfs_dir_reader_t *rd,
 	return sqfs_meta_reader_seek(rd->meta_dir, block_start, offset);
 }
 
-int sqfs_dir_reader_read(sqfs_dir_reader_t *rd, sqfs_dir_entry_t **out)
+int sqfs_dir_reader_next(sqfs_dir_reader_t *rd, const sqfs_dir_entry_t **out)
 {
-	sqfs_dir_entry_t *ent;
 	size_t count;
 	int err;
 
@@ -166,11 +176,12 @@ int sqfs_dir_reader_read(sqfs_dir_reader_t *rd, sqfs_dir_entry_t **out)
 		rd->entries = rd->hdr.count + 1;
 	}
 
-	err = sqfs_meta_reader_read_dir_ent(rd->meta_dir, &ent);
+	err = sqfs_meta_reader_read_dir_ent_into(rd->meta_dir, &rd->ent,
+						 &rd->ent_max);
 	if (err)
 		return err;
 
-	count = sizeof(*ent) + strlen((const char *)ent->name);
+	count = sizeof(*rd->ent) + strlen((const char *)rd->ent->name);
 
 	if (count > rd->size) {
 		rd->size = 0;
@@ -180,8 +191,30 @@ int sqfs_dir_reader_read(sqfs_dir_reader_t *rd, sqfs_dir_entry_t **out)
 		rd->entries -= 1;
 	}
 
-	rd->inode_offset = ent->offset;
-	*out = ent;
+	rd->inode_offset = rd->ent->offset;
+	*out = rd->ent;
+	return 0;
+}
+
+int sqfs_dir_reader_read(sqfs_dir_reader_t *rd, sqfs_dir_entry_t **out)
+{
+	const sqfs_dir_entry_t *ent;
+	sqfs_dir_entry_t *copy;
+	size_t size;
+	int err;
+
+	err = sqfs_dir_reader_next(rd, &ent);
+	if (err)
+		return err;
+
+	size = sizeof(*ent) + ent->size + 2;
+
+	copy = malloc(size);
+	if (copy == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	memcpy(copy, ent, size);
+	*out = copy;
 	return 0;
 }
 
@@ -197,7 +230,7 @@ int sqfs_dir_reader_rewind(sqfs_dir_reader_t *rd)
 
 int sqfs_dir_reader_find(sqfs_dir_reader_t *rd, const char *name)
 {
-	sqfs_dir_entry_t *ent;
+	const sqfs_dir_entry_t *ent;
 	int ret;
 
 	if (rd->size != rd->start_size) {
@@ -207,29 +240,61 @@ int sqfs_dir_reader_find(sqfs_dir_reader_t *rd, const char *name)
 	}
 
 	do {
-		ret = sqfs_dir_reader_read(rd, &ent);
+		ret = sqfs_dir_reader_next(rd, &ent);
 		if (ret < 0)
 			return ret;
 		if (ret > 0)
 			return SQFS_ERROR_NO_ENTRY;
 
 		ret = strcmp((const char *)ent->name, name);
-		free(ent);
 	} while (ret < 0);
 
 	return ret == 0 ? 0 : SQFS_ERROR_NO_ENTRY;
 }
 
+static int read_inode(sqfs_dir_reader_t *rd, sqfs_u64 block_start,
+		      sqfs_u16 offset, sqfs_inode_generic_t **inode)
+{
+	sqfs_u64 ref = (block_start << 16) | offset;
+	int ret;
+
+	if (rd->icache != NULL) {
+		ret = inode_cache_get(rd->icache, ref, inode);
+		if (ret <= 0)
+			return ret;
+	}
+
+	ret = sqfs_meta_reader_read_inode_into(rd->meta_inode, rd->super,
+					       block_start, offset, inode);
+	if (ret)
+		return ret;
+
+	if (rd->icache != NULL)
+		inode_cache_put(rd->icache, ref, *inode);
+
+	return 0;
+}
+
 int sqfs_dir_reader_get_inode(sqfs_dir_reader_t *rd,
 			      sqfs_inode_generic_t **inode)
 {
-	sqfs_u64 block_start;
+	int ret;
+
+	*inode = NULL;
 
-	block_start = rd->hdr.start_block;
+	ret = read_inode(rd, rd->hdr.start_block, rd->inode_offset, inode);
+	if (ret) {
+		free(*inode);
+		*inode = NULL;
+	}
 
-	return sqfs_meta_reader_read_inode(rd->meta_inode, rd->super,
-					   block_start, rd->inode_offset,
-					   inode);
+	return ret;
+}
+
+int sqfs_dir_reader_get_inode_into(sqfs_dir_reader_t *rd,
+				   sqfs_inode_generic_t **inode)
+{
+	return read_inode(rd, rd->hdr.start_block, rd->inode_offset, inode);
 }
 
 int sqfs_dir_reader_get_root_inode(sqfs_dir_reader_t *rd,
@@ -237,9 +302,23 @@ int sqfs_dir_reader_get_root_inode(sqfs_dir_reader_t *rd,
 {
 	sqfs_u64 block_start = rd->super->root_inode_ref >> 16;
 	sqfs_u16 offset = rd->super->root_inode_ref & 0xFFFF;
+	int ret;
+
+	*inode = NULL;
+
+	ret = read_inode(rd, block_start, offset, inode);
+	if (ret) {
+		free(*inode);
+		*inode = NULL;
+	}
 
-	return sqfs_meta_reader_read_inode(rd->meta_inode, rd->super,
-					   block_start, offset, inode);
+	return ret;
+}
+
+void sqfs_dir_reader_set_inode_cache(sqfs_dir_reader_t *rd,
+				     sqfs_inode_cache_t *cache)
+{
+	rd->icache = cache;
 }
 
 int sqfs_dir_reader_find_by_path(sqfs_dir_reader_t *rd,
@@ -247,7 +326,7 @@ int sqfs_dir_reader_find_by_path(sqfs_dir_reader_t *rd,
 				 const char *path, sqfs_inode_generic_t **out)
 {
 	sqfs_inode_generic_t *inode;
-	sqfs_dir_entry_t *ent;
+	const sqfs_dir_entry_t *ent;
 	const char *ptr;
 	int ret = 0;
 
@@ -261,6 +340,8 @@ int sqfs_dir_reader_find_by_path(sqfs_dir_reader_t *rd,
 		} else {
 			memcpy(inode, start,
 			       sizeof(*start) + start->payload_bytes_used);
+			inode->payload_bytes_available =
+				start->payload_bytes_used;
 		}
 	}
 
@@ -275,9 +356,8 @@ int sqfs_dir_reader_find_by_path(sqfs_dir_reader_t *rd,
 		}
 
 		ret = sqfs_dir_reader_open_dir(rd, inode);
-		free(inode);
 		if (ret)
-			return ret;
+			goto fail;
 
 		ptr = strchr(path, '/');
 		if (ptr == NULL) {
@@ -290,29 +370,33 @@ int sqfs_dir_reader_find_by_path(sqfs_dir_reader_t *rd,
 		}
 
 		do {
-			ret = sqfs_dir_reader_read(rd, &ent);
+			ret = sqfs_dir_reader_next(rd, &ent);
 			if (ret < 0)
-				return ret;
+				goto fail;
 
 			if (ret == 0) {
 				ret = strncmp((const char *)ent->name,
 					      path, ptr - path);
 				if (ret == 0)
 					ret = ent->name[ptr - path];
-				free(ent);
 			}
 		} while (ret < 0);
 
-		if (ret > 0)
-			return SQFS_ERROR_NO_ENTRY;
+		if (ret > 0) {
+			ret = SQFS_ERROR_NO_ENTRY;
+			goto fail;
+		}
 
-		ret = sqfs_dir_reader_get_inode(rd, &inode);
+		ret = sqfs_dir_reader_get_inode_into(rd, &inode);
 		if (ret)
-			return ret;
+			goto fail;
 
 		path = ptr;
 	}
 
 	*out = inode;
 	return 0;
+fail:
+	free(inode);
+	return ret;
 }
@@ -20,31 +20,47 @@
 #include <stdlib.h>
 #include <string.h>
 
-typedef struct dir_entry_t {
-	struct dir_entry_t *next;
-	sqfs_u64 inode_ref;
-	sqfs_u32 inode_num;
-	sqfs_u16 type;
-	size_t name_len;
-	char name[];
-} dir_entry_t;
+/* index records are allocated from chunks of this size */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct arena_chunk_t {
+	struct arena_chunk_t *next;
+	size_t size;
+	size_t used;
+	sqfs_u8 data[];
+} arena_chunk_t;
 
 typedef struct index_ent_t {
 	struct index_ent_t *next;
-	dir_entry_t *ent;
 	sqfs_u64 block;
 	sqfs_u32 index;
+	sqfs_u32 name_len;
+	char name[];
 } index_ent_t;
 
 struct sqfs_dir_writer_t {
 	sqfs_object_t base;
 
-	dir_entry_t *list;
-	dir_entry_t *list_end;
+	/* chunks are kept across directories and reused after a reset */
+	arena_chunk_t *arena;
+	arena_chunk_t *arena_current;
 
 	index_ent_t *idx;
 	index_ent_t *idx_end;
 
+	/*
+	  The header and entries that are currently being accumulated in
+	  on-disk format. They are appended to the meta data writer as soon
+	  as an entry is added that cannot share the header.
+	 */
+	sqfs_u8 *run;
+	size_t run_used;
+	size_t run_max;
+	size_t run_count;
+	size_t run_size;
+	sqfs_u64 run_block;
+	sqfs_u32 run_inode;
+
 	sqfs_u64 dir_ref;
 	size_t dir_size;
 	size_t ent_count;
@@ -70,35 +86,87 @@ static int get_type(sqfs_u16 mode)
 	return SQFS_ERROR_UNSUPPORTED;
 }
 
-static void writer_reset(sqfs_dir_writer_t *writer)
+static void *arena_alloc(sqfs_dir_writer_t *writer, size_t size)
 {
-	dir_entry_t *ent;
-	index_ent_t *idx;
+	arena_chunk_t *chunk = writer->arena_current, *new;
+	void *ptr;
 
-	while (writer->idx != NULL) {
-		idx = writer->idx;
-		writer->idx = idx->next;
-		free(idx);
+	size = (size + sizeof(sqfs_u64) - 1) & ~(sizeof(sqfs_u64) - 1);
+
+	if (chunk != NULL && (chunk->size - chunk->used) >= size)
+		goto out;
+
+	if (chunk != NULL && chunk->next != NULL &&
+	    chunk->next->size >= size) {
+		chunk = chunk->next;
+		goto out;
 	}
 
-	while (writer->list != NULL) {
-		ent = writer->list;
-		writer->list = ent->next;
-		free(ent);
+	new = alloc_flex(sizeof(*new), 1,
+			 size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE);
+	if (new == NULL)
+		return NULL;
+
+	new->size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+
+	if (chunk == NULL) {
+		new->next = writer->arena;
+		writer->arena = new;
+	} else {
+		new->next = chunk->next;
+		chunk->next = new;
 	}
 
-	writer->list_end = NULL;
+	chunk = new;
+out:
+	writer->arena_current = chunk;
+	ptr = chunk->data + chunk->used;
+	chunk->used += size;
+	return ptr;
+}
+
+static void writer_reset(sqfs_dir_writer_t *writer)
+{
+	arena_chunk_t *chunk;
+
+	for (chunk = writer->arena; chunk != NULL; chunk = chunk->next)
+		chunk->used = 0;
+
+	writer->arena_current = writer->arena;
+	writer->idx = NULL;
 	writer->idx_end = NULL;
+	writer->run_used = 0;
+	writer->run_count = 0;
 	writer->dir_ref = 0;
 	writer->dir_size = 0;
 	writer->ent_count = 0;
 }
 
+static int grow_export_table(sqfs_dir_writer_t *writer, size_t new_max)
+{
+	size_t i, size;
+	sqfs_u64 *new;
+
+	if (SZ_MUL_OV(new_max, sizeof(writer->export_tbl[0]), &size))
+		return SQFS_ERROR_ALLOC;
+
+	new = realloc(writer->export_tbl, size);
+	if (new == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	for (i = writer->export_tbl_max; i < new_max; ++i)
+		new[i] = 0xFFFFFFFFFFFFFFFFUL;
+
+	writer->export_tbl = new;
+	writer->export_tbl_max = new_max;
+	return 0;
+}
+
 static int add_export_table_entry(sqfs_dir_writer_t *writer,
 				  sqfs_u32 inum, sqfs_u64 iref)
 {
-	size_t i, new_max;
-	sqfs_u64 *new;
+	size_t new_max;
+	int err;
 
 	if (writer->export_tbl == NULL)
 		return 0;
@@ -114,20 +182,9 @@ static int add_export_table_entry(sqfs_dir_writer_t *writer,
 	}
 
 	if (new_max > writer->export_tbl_max) {
-		if (SZ_MUL_OV(new_max, sizeof(writer->export_tbl[0]), &new_max))
-			return SQFS_ERROR_ALLOC;
-
-		new = realloc(writer->export_tbl, new_max);
-		if (new == NULL)
-			return SQFS_ERROR_ALLOC;
-
-		new_max /= sizeof(writer->export_tbl[0]);
-
-		for (i = writer->export_tbl_max; i < new_max; ++i)
-			new[i] = 0xFFFFFFFFFFFFFFFFUL;
-
-		writer->export_tbl = new;
-		writer->export_tbl_max = new_max;
+		err = grow_export_table(writer, new_max);
+		if (err)
+			return err;
 	}
 
 	writer->export_tbl[inum - 1] = iref;
@@ -141,8 +198,15 @@ static int add_export_table_entry(sqfs_dir_writer_t *writer,
 static void dir_writer_destroy(sqfs_object_t *obj)
 {
 	sqfs_dir_writer_t *writer = (sqfs_dir_writer_t *)obj;
+	arena_chunk_t *chunk;
 
-	writer_reset(writer);
+	while (writer->arena != NULL) {
+		chunk = writer->arena;
+		writer->arena = chunk->next;
+		free(chunk);
+	}
+
+	free(writer->run);
 	free(writer->export_tbl);
 	free(writer);
 }
@@ -178,6 +242,17 @@ sqfs_dir_writer_t *sqfs_dir_writer_create(sqfs_meta_writer_t *dm,
 	return writer;
 }
 
+int sqfs_dir_writer_reserve_export_table(sqfs_dir_writer_t *writer,
+					 size_t inode_count)
+{
+	if (writer->export_tbl == NULL ||
+	    inode_count <= writer->export_tbl_max) {
+		return 0;
+	}
+
+	return grow_export_table(writer, inode_count);
+}
+
 int sqfs_dir_writer_begin(sqfs_dir_writer_t *writer, sqfs_u32 flags)
 {
 	sqfs_u32 offset;
@@ -193,98 +268,96 @@ int sqfs_dir_writer_begin(sqfs_dir_writer_t *writer, sqfs_u32 flags)
 	return 0;
 }
 
-int sqfs_dir_writer_add_entry(sqfs_dir_writer_t *writer, const char *name,
-			      sqfs_u32 inode_num, sqfs_u64 inode_ref,
-			      sqfs_u16 mode)
+static int run_reserve(sqfs_dir_writer_t *writer, size_t size)
 {
-	dir_entry_t *ent;
-	int type, err;
-
-	type = get_type(mode);
-	if (type < 0)
-		return type;
-
-	if (name[0] == '\0' || inode_num < 1)
-		return SQFS_ERROR_ARG_INVALID;
+	size_t new_max = writer->run_max ? writer->run_max : 1024;
+	sqfs_u8 *new;
 
-	err = add_export_table_entry(writer, inode_num, inode_ref);
-	if (err)
-		return err;
-
-	ent = alloc_flex(sizeof(*ent), 1, strlen(name));
-	if (ent == NULL)
-		return SQFS_ERROR_ALLOC;
+	while ((new_max - writer->run_used) < size) {
+		if (SZ_MUL_OV(new_max, 2, &new_max))
+			return SQFS_ERROR_ALLOC;
+	}
 
-	ent->inode_ref = inode_ref;
-	ent->inode_num = inode_num;
-	ent->type = type;
-	ent->name_len = strlen(name);
-	memcpy(ent->name, name, ent->name_len);
+	if (new_max > writer->run_max) {
+		new = realloc(writer->run, new_max);
+		if (new == NULL)
+			return SQFS_ERROR_ALLOC;
 
-	if (writer->list_end == NULL) {
-		writer->list = writer->list_end = ent;
-	} else {
-		writer->list_end->next = ent;
-		writer->list_end = ent;
+		writer->run = new;
+		writer->run_max = new_max;
 	}
 
-	writer->ent_count += 1;
 	return 0;
 }
 
-static size_t get_conseq_entry_count(sqfs_u32 offset, dir_entry_t *head)
+static bool run_can_append(const sqfs_dir_writer_t *writer,
+			   sqfs_u32 inode_num, sqfs_u64 inode_ref,
+			   size_t name_len)
 {
-	size_t size, count = 0;
-	dir_entry_t *it;
 	sqfs_s32 diff;
 
-	size = (offset + sizeof(sqfs_dir_header_t)) % SQFS_META_BLOCK_SIZE;
+	if (writer->run_count == 0 || writer->run_count == SQFS_MAX_DIR_ENT)
+		return false;
 
-	for (it = head; it != NULL; it = it->next) {
-		if ((it->inode_ref >> 16) != (head->inode_ref >> 16))
-			break;
+	if ((inode_ref >> 16) != writer->run_block)
+		return false;
 
-		diff = it->inode_num - head->inode_num;
+	diff = inode_num - writer->run_inode;
 
-		if (diff > 32767 || diff < -32767)
-			break;
+	if (diff > 32767 || diff < -32767)
+		return false;
 
-		size += sizeof(sqfs_dir_entry_t) + it->name_len;
+	return (writer->run_size + sizeof(sqfs_dir_entry_t) +
+		name_len) <= SQFS_META_BLOCK_SIZE;
+}
 
-		if (count > 0 && size > SQFS_META_BLOCK_SIZE)
-			break;
+static int run_flush(sqfs_dir_writer_t *writer)
+{
+	sqfs_dir_header_t hdr;
+	int err;
 
-		count += 1;
+	if (writer->run_count == 0)
+		return 0;
 
-		if (count == SQFS_MAX_DIR_ENT)
-			break;
-	}
+	memcpy(&hdr, writer->run, sizeof(hdr));
+	hdr.count = htole32(writer->run_count - 1);
+	memcpy(writer->run, &hdr, sizeof(hdr));
+
+	err = sqfs_meta_writer_append(writer->dm, writer->run,
+				      writer->run_used);
+	if (err)
+		return err;
 
-	return count;
+	writer->dir_size += writer->run_used;
+	writer->run_used = 0;
+	writer->run_count = 0;
+	return 0;
 }
 
-static int add_header(sqfs_dir_writer_t *writer, size_t count,
-		      dir_entry_t *ref, sqfs_u64 block)
+static int run_begin(sqfs_dir_writer_t *writer, const char *name,
+		     size_t name_len, sqfs_u32 inode_num, sqfs_u64 inode_ref)
 {
 	sqfs_dir_header_t hdr;
 	index_ent_t *idx;
+	sqfs_u32 offset;
+	sqfs_u64 block;
 	int err;
 
-	hdr.count = htole32(count - 1);
-	hdr.start_block = htole32(ref->inode_ref >> 16);
-	hdr.inode_number = htole32(ref->inode_num);
-
-	err = sqfs_meta_writer_append(writer->dm, &hdr, sizeof(hdr));
+	err = run_reserve(writer, sizeof(hdr));
 	if (err)
 		return err;
 
-	idx = calloc(1, sizeof(*idx));
+	idx = arena_alloc(writer, sizeof(*idx) + name_len);
 	if (idx == NULL)
 		return SQFS_ERROR_ALLOC;
 
-	idx->ent = ref;
+	sqfs_meta_writer_get_position(writer->dm, &block, &offset);
+
+	idx->next = NULL;
 	idx->block = block;
 	idx->index = writer->dir_size;
+	idx->name_len = name_len;
+	memcpy(idx->name, name, name_len);
 
 	if (writer->idx_end == NULL) {
 		writer->idx = writer->idx_end = idx;
@@ -293,57 +366,77 @@ static int add_header(sqfs_dir_writer_t *writer, size_t count,
 		writer->idx_end = idx;
 	}
 
-	writer->dir_size += sizeof(hdr);
+	hdr.count = 0;
+	hdr.start_block = htole32(inode_ref >> 16);
+	hdr.inode_number = htole32(inode_num);
+
+	memcpy(writer->run, &hdr, sizeof(hdr));
+	writer->run_used = sizeof(hdr);
+	writer->run_block = inode_ref >> 16;
+	writer->run_inode = inode_num;
+	writer->run_size = (offset + sizeof(hdr)) % SQFS_META_BLOCK_SIZE;
 	return 0;
 }
 
-int sqfs_dir_writer_end(sqfs_dir_writer_t *writer)
+int sqfs_dir_writer_add_entry(sqfs_dir_writer_t *writer, const char *name,
+			      sqfs_u32 inode_num, sqfs_u64 inode_ref,
+			      sqfs_u16 mode)
 {
-	dir_entry_t *it, *first;
 	sqfs_dir_entry_t ent;
 	sqfs_u16 *diff_u16;
-	size_t i, count;
-	sqfs_u32 offset;
-	sqfs_u64 block;
-	int err;
+	size_t name_len;
+	int type, err;
+
+	type = get_type(mode);
+	if (type < 0)
+		return type;
+
+	if (name[0] == '\0' || inode_num < 1)
+		return SQFS_ERROR_ARG_INVALID;
+
+	err = add_export_table_entry(writer, inode_num, inode_ref);
+	if (err)
+		return err;
 
-	for (it = writer->list; it != NULL; ) {
-		sqfs_meta_writer_get_position(writer->dm, &block, &offset);
-		count = get_conseq_entry_count(offset, it);
+	name_len = strlen(name);
 
-		err = add_header(writer, count, it, block);
+	if (!run_can_append(writer, inode_num, inode_ref, name_len)) {
+		err = run_flush(writer);
 		if (err)
 			return err;
 
-		first = it;
+		err = run_begin(writer, name, name_len, inode_num, inode_ref);
+		if (err)
+			return err;
+	}
 
-		for (i = 0; i < count; ++i) {
-			ent.offset = htole16(it->inode_ref & 0x0000FFFF);
-			ent.inode_diff = it->inode_num - first->inode_num;
-			ent.type = htole16(it->type);
-			ent.size = htole16(it->name_len - 1);
+	err = run_reserve(writer, sizeof(ent) + name_len);
+	if (err)
+		return err;
 
-			diff_u16 = (sqfs_u16 *)&ent.inode_diff;
-			*diff_u16 = htole16(*diff_u16);
+	ent.offset = htole16(inode_ref & 0x0000FFFF);
+	ent.inode_diff = inode_num - writer->run_inode;
+	ent.type = htole16(type);
+	ent.size = htole16(name_len - 1);
 
-			err = sqfs_meta_writer_append(writer->dm, &ent,
-						      sizeof(ent));
-			if (err)
-				return err;
+	diff_u16 = (sqfs_u16 *)&ent.inode_diff;
+	*diff_u16 = htole16(*diff_u16);
 
-			err = sqfs_meta_writer_append(writer->dm, it->name,
-						      it->name_len);
-			if (err)
-				return err;
-
-			writer->dir_size += sizeof(ent) + it->name_len;
-			it = it->next;
-		}
-	}
+	memcpy(writer->run + writer->run_used, &ent, sizeof(ent));
+	memcpy(writer->run + writer->run_used + sizeof(ent), name, name_len);
 
+	writer->run_used += sizeof(ent) + name_len;
+	writer->run_size += sizeof(ent) + name_len;
+	writer->run_count += 1;
+	writer->ent_count += 1;
 	return 0;
 }
 
+int sqfs_dir_writer_end(sqfs_dir_writer_t *writer)
+{
+	return run_flush(writer);
+}
+
 size_t sqfs_dir_writer_get_size(const sqfs_dir_writer_t *writer)
 {
 	return writer->dir_size;
@@ -360,7 +453,7 @@ size_t sqfs_dir_writer_get_index_size(const sqfs_dir_writer_t *writer)
 	index_ent_t *idx;
 
 	for (idx = writer->idx; idx != NULL; idx = idx->next)
-		index_size += sizeof(sqfs_dir_index_t) + idx->ent->name_len;
+		index_size += sizeof(sqfs_dir_index_t) + idx->name_len;
 
 	return index_size;
 }
@@ -386,7 +479,7 @@ sqfs_inode_generic_t
 	index_size = 0;
 
 	for (idx = writer->idx; idx != NULL; idx = idx->next)
-		index_size += sizeof(ent) + idx->ent->name_len;
+		index_size += sizeof(ent) + idx->name_len;
 
 	inode = alloc_flex(sizeof(*inode), 1, index_size);
 	if (inode == NULL)
@@ -423,17 +516,16 @@ sqfs_inode_generic_t
 			memset(&ent, 0, sizeof(ent));
 			ent.start_block = idx->block;
 			ent.index = idx->index;
-			ent.size = idx->ent->name_len - 1;
+			ent.size = idx->name_len - 1;
 
 			ptr = (sqfs_u8 *)inode->extra +
 				inode->payload_bytes_used;
 			memcpy(ptr, &ent, sizeof(ent));
-			memcpy(ptr + sizeof(ent), idx->ent->name,
-			       idx->ent->name_len);
+			memcpy(ptr + sizeof(ent), idx->name, idx->name_len);
 
 			inode->data.dir_ext.inodex_count += 1;
 			inode->payload_bytes_used += sizeof(ent);
-			inode->payload_bytes_used += idx->ent->name_len;
+			inode->payload_bytes_used += idx->name_len;
 		}
 	}
 
@@ -13,21 +13,37 @@
 #include "sqfs/error.h"
 #include "sqfs/block.h"
 #include "compat.h"
-
-#include "hash_table.h"
+#include "util.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+/*
+  Tail end deduplication index. The entries are stored inline in an open
+  addressed hash table with linear probing, that is kept at most 3/4 full,
+  i.e. it costs between 21 and 43 bytes per unique tail end (16 byte entries
+  at a load factor between 3/8 and 3/4), without any per-entry allocations.
 
-typedef struct chunk_info_t {
-	struct chunk_info_t *next;
+  An entry with a size of 0 is unused, tail ends are never empty.
+ */
+typedef struct {
+	sqfs_u32 hash;
+	sqfs_u32 size;
 	sqfs_u32 index;
 	sqfs_u32 offset;
-	sqfs_u32 size;
-	sqfs_u32 hash;
 } chunk_info_t;
 
+#define CHUNK_INDEX_MIN_SIZE (128)
+
+/*
+  Serialized state: the number of table entries and tail ends as little
+  endian 64 bit words, followed by the table entries in on-disk format and
+  the tail ends as little endian 32 bit words.
+ */
+typedef struct {
+	sqfs_u64 used;
+	sqfs_u64 chunk_count;
+} state_header_t;
 
 struct sqfs_frag_table_t {
 	sqfs_object_t base;
@@ -36,32 +52,56 @@ struct sqfs_frag_table_t {
 	size_t used;
 	sqfs_fragment_t *table;
 
-	struct hash_table *ht;
+	/* always a power of two */
+	size_t chunk_capacity;
+	size_t chunk_count;
+	chunk_info_t *chunks;
 };
 
-static uint32_t chunk_info_hash(const void *key)
+static chunk_info_t *chunk_slot(chunk_info_t *chunks, size_t capacity,
+				sqfs_u32 hash, sqfs_u32 size)
 {
-	const chunk_info_t *chunk = key;
-	return chunk->hash;
-}
+	size_t mask = capacity - 1, i = hash & mask;
 
-static bool chunk_info_equals(const void *a, const void *b)
-{
-	const chunk_info_t *a_ = a, *b_ = b;
-	return a_->size == b_->size &&
-	       a_->hash == b_->hash;
+	while (chunks[i].size != 0) {
+		if (chunks[i].hash == hash && chunks[i].size == size)
+			break;
+
+		i = (i + 1) & mask;
+	}
+
+	return chunks + i;
 }
 
-static void delete_function(struct hash_entry *entry)
+static int grow_chunk_index(sqfs_frag_table_t *tbl, size_t capacity)
 {
-	free(entry->data);
+	chunk_info_t *new, *slot;
+	size_t i;
+
+	new = alloc_array(sizeof(new[0]), capacity);
+	if (new == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	for (i = 0; i < tbl->chunk_capacity; ++i) {
+		if (tbl->chunks[i].size == 0)
+			continue;
+
+		slot = chunk_slot(new, capacity, tbl->chunks[i].hash,
+				  tbl->chunks[i].size);
+		*slot = tbl->chunks[i];
+	}
+
+	free(tbl->chunks);
+	tbl->chunks = new;
+	tbl->chunk_capacity = capacity;
+	return 0;
 }
 
 static void frag_table_destroy(sqfs_object_t *obj)
 {
 	sqfs_frag_table_t *tbl = (sqfs_frag_table_t *)obj;
 
-	hash_table_destroy(tbl->ht, delete_function);
+	free(tbl->chunks);
 	free(tbl->table);
 	free(tbl);
 }
@@ -76,9 +116,34 @@ static sqfs_object_t *frag_table_copy(const sqfs_object_t *obj)
 		return NULL;
 
 	memcpy(copy, tbl, sizeof(*tbl));
+	copy->table = NULL;
+	copy->chunks = NULL;
+
+	if (tbl->capacity > 0) {
+		copy->table = alloc_array(sizeof(tbl->table[0]),
+					  tbl->capacity);
+		if (copy->table == NULL)
+			goto fail;
+
+		memcpy(copy->table, tbl->table,
+		       sizeof(tbl->table[0]) * tbl->used);
+	}
+
+	if (tbl->chunk_capacity > 0) {
+		copy->chunks = alloc_array(sizeof(tbl->chunks[0]),
+					   tbl->chunk_capacity);
+		if (copy->chunks == NULL)
+			goto fail;
+
+		memcpy(copy->chunks, tbl->chunks,
+		       sizeof(tbl->chunks[0]) * tbl->chunk_capacity);
+	}
 
-	copy->ht = hash_table_clone(tbl->ht);
 	return (sqfs_object_t *)copy;
+fail:
+	free(copy->table);
+	free(copy);
+	return NULL;
 }
 
 sqfs_frag_table_t *sqfs_frag_table_create(sqfs_u32 flags)
@@ -92,8 +157,6 @@ sqfs_frag_table_t *sqfs_frag_table_create(sqfs_u32 flags)
 	if (tbl == NULL)
 		return NULL;
 
-	tbl->ht = hash_table_create(chunk_info_hash, chunk_info_equals);
-
 	((sqfs_object_t *)tbl)->copy = frag_table_copy;
 	((sqfs_object_t *)tbl)->destroy = frag_table_destroy;
 	return tbl;
@@ -250,21 +313,45 @@ size_t sqfs_frag_table_get_size(sqfs_frag_table_t *tbl)
 	return tbl->used;
 }
 
+int sqfs_frag_table_reserve(sqfs_frag_table_t *tbl, size_t count)
+{
+	size_t capacity = CHUNK_INDEX_MIN_SIZE;
+
+	while ((capacity / 4) * 3 < count) {
+		if (SZ_MUL_OV(capacity, 2, &capacity))
+			return SQFS_ERROR_OVERFLOW;
+	}
+
+	if (capacity <= tbl->chunk_capacity)
+		return 0;
+
+	return grow_chunk_index(tbl, capacity);
+}
+
 int sqfs_frag_table_add_tail_end(sqfs_frag_table_t *tbl,
 				 sqfs_u32 index, sqfs_u32 offset,
 				 sqfs_u32 size, sqfs_u32 hash)
 {
-	chunk_info_t *new = calloc(1, sizeof(*new));
-	if (new == NULL)
-		return SQFS_ERROR_ALLOC;
+	chunk_info_t *slot;
+	int err;
 
-	new->index = index;
-	new->offset = offset;
-	new->size = size;
-	new->hash = hash;
+	if (size == 0)
+		return SQFS_ERROR_ARG_INVALID;
+
+	if (tbl->chunk_count >= (tbl->chunk_capacity / 4) * 3) {
+		err = sqfs_frag_table_reserve(tbl, tbl->chunk_count + 1);
+		if (err)
+			return err;
+	}
 
-	hash_table_insert_pre_hashed(tbl->ht, new->hash, new, new);
+	slot = chunk_slot(tbl->chunks, tbl->chunk_capacity, hash, size);
+	if (slot->size == 0)
+		tbl->chunk_count += 1;
 
+	slot->hash = hash;
+	slot->size = size;
+	slot->index = index;
+	slot->offset = offset;
 	return 0;
 }
 
@@ -272,18 +359,128 @@ int sqfs_frag_table_find_tail_end(sqfs_frag_table_t *tbl,
 				  sqfs_u32 hash, sqfs_u32 size,
 				  sqfs_u32 *index, sqfs_u32 *offset)
 {
-	struct hash_entry *entry;
-	chunk_info_t *chunk, search;
+	chunk_info_t *slot;
 
-	search.hash = hash;
-	search.size = size;
+	if (tbl->chunk_count == 0 || size == 0)
+		return SQFS_ERROR_NO_ENTRY;
 
-	entry = hash_table_search_pre_hashed(tbl->ht, hash, &search);
-	if (!entry)
+	slot = chunk_slot(tbl->chunks, tbl->chunk_capacity, hash, size);
+	if (slot->size == 0)
 		return SQFS_ERROR_NO_ENTRY;
 
-	chunk = entry->data;
-	*index = chunk->index;
-	*offset = chunk->offset;
+	*index = slot->index;
+	*offset = slot->offset;
+	return 0;
+}
+
+int sqfs_frag_table_save_state(const sqfs_frag_table_t *tbl,
+			       void **out, size_t *size)
+{
+	size_t i, table_size, chunk_size;
+	state_header_t hdr;
+	sqfs_u32 *chunk;
+	sqfs_u8 *state;
+
+	if (SZ_MUL_OV(tbl->used, sizeof(tbl->table[0]), &table_size) ||
+	    SZ_MUL_OV(tbl->chunk_count, sizeof(tbl->chunks[0]), &chunk_size) ||
+	    SZ_ADD_OV(table_size, chunk_size, size) ||
+	    SZ_ADD_OV(*size, sizeof(hdr), size)) {
+		return SQFS_ERROR_OVERFLOW;
+	}
+
+	state = malloc(*size);
+	if (state == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	hdr.used = htole64(tbl->used);
+	hdr.chunk_count = htole64(tbl->chunk_count);
+	memcpy(state, &hdr, sizeof(hdr));
+
+	if (table_size > 0)
+		memcpy(state + sizeof(hdr), tbl->table, table_size);
+
+	chunk = (sqfs_u32 *)(state + sizeof(hdr) + table_size);
+
+	for (i = 0; i < tbl->chunk_capacity; ++i) {
+		if (tbl->chunks[i].size == 0)
+			continue;
+
+		*(chunk++) = htole32(tbl->chunks[i].hash);
+		*(chunk++) = htole32(tbl->chunks[i].size);
+		*(chunk++) = htole32(tbl->chunks[i].index);
+		*(chunk++) = htole32(tbl->chunks[i].offset);
+	}
+
+	*out = state;
+	return 0;
+}
+
+int sqfs_frag_table_restore_state(sqfs_frag_table_t *tbl,
+				  const void *data, size_t size)
+{
+	const sqfs_u8 *raw = data;
+	size_t i, table_size;
+	chunk_info_t chunk;
+	state_header_t hdr;
+	void *table = NULL;
+	int err;
+
+	if (size < sizeof(hdr))
+		return SQFS_ERROR_CORRUPTED;
+
+	memcpy(&hdr, raw, sizeof(hdr));
+	hdr.used = le64toh(hdr.used);
+	hdr.chunk_count = le64toh(hdr.chunk_count);
+
+	if (hdr.used > (size - sizeof(hdr)) / sizeof(tbl->table[0]))
+		return SQFS_ERROR_CORRUPTED;
+
+	table_size = hdr.used * sizeof(tbl->table[0]);
+
+	if (hdr.chunk_count != (size - sizeof(hdr) - table_size) /
+	    sizeof(chunk) ||
+	    (size - sizeof(hdr) - table_size) % sizeof(chunk) != 0) {
+		return SQFS_ERROR_CORRUPTED;
+	}
+
+	if (hdr.used > 0) {
+		table = malloc(table_size);
+		if (table == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		memcpy(table, raw + sizeof(hdr), table_size);
+	}
+
+	free(tbl->table);
+	tbl->table = table;
+	tbl->capacity = hdr.used;
+	tbl->used = hdr.used;
+
+	free(tbl->chunks);
+	tbl->chunks = NULL;
+	tbl->chunk_capacity = 0;
+	tbl->chunk_count = 0;
+
+	err = sqfs_frag_table_reserve(tbl, hdr.chunk_count);
+	if (err)
+		return err;
+
+	raw += sizeof(hdr) + table_size;
+
+	for (i = 0; i < hdr.chunk_count; ++i) {
+		memcpy(&chunk, raw, sizeof(chunk));
+		raw += sizeof(chunk);
+
+		if (le32toh(chunk.index) >= tbl->used)
+			return SQFS_ERROR_CORRUPTED;
+
+		err = sqfs_frag_table_add_tail_end(tbl, le32toh(chunk.index),
+						   le32toh(chunk.offset),
+						   le32toh(chunk.size),
+						   le32toh(chunk.hash));
+		if (err)
+			return err;
+	}
+
 	return 0;
 }
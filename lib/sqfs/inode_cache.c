@@ -0,0 +1,268 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * inode_cache.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "inode_cache.h"
+
+#include "sqfs/error.h"
+#include "sqfs/inode.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(WITH_PTHREAD) || defined(_WIN32) || defined(__WINDOWS__)
+#	include "threading.h"
+#else
+#	define LOCK(mtx)
+#	define UNLOCK(mtx)
+#	define MUTEX_INIT(mtx)
+#	define MUTEX_DESTROY(mtx)
+#	define MUTEX_TYPE int
+#endif
+
+typedef struct cache_entry_t {
+	struct cache_entry_t *hash_next;
+	struct cache_entry_t *lru_prev;
+	struct cache_entry_t *lru_next;
+
+	sqfs_u64 ref;
+	sqfs_inode_generic_t *inode;
+} cache_entry_t;
+
+struct sqfs_inode_cache_t {
+	sqfs_object_t obj;
+
+	MUTEX_TYPE mtx;
+
+	/* hash table of entries, the number of buckets is a power of two */
+	cache_entry_t **buckets;
+	size_t num_buckets;
+
+	/* all entries, the most recently used one first */
+	cache_entry_t *lru_head;
+	cache_entry_t *lru_tail;
+
+	sqfs_inode_cache_stats_t stats;
+};
+
+static size_t hash_ref(const sqfs_inode_cache_t *cache, sqfs_u64 ref)
+{
+	return (size_t)((ref * 0x9E3779B97F4A7C15ULL) >> 32) &
+		(cache->num_buckets - 1);
+}
+
+/* symlink targets are followed by a null terminator */
+static size_t payload_size(const sqfs_inode_generic_t *inode)
+{
+	if (inode->base.type == SQFS_INODE_SLINK ||
+	    inode->base.type == SQFS_INODE_EXT_SLINK) {
+		return inode->payload_bytes_used + 1;
+	}
+
+	return inode->payload_bytes_used;
+}
+
+static cache_entry_t *find_entry(sqfs_inode_cache_t *cache, sqfs_u64 ref)
+{
+	cache_entry_t *ent = cache->buckets[hash_ref(cache, ref)];
+
+	while (ent != NULL && ent->ref != ref)
+		ent = ent->hash_next;
+
+	return ent;
+}
+
+static void hash_remove(sqfs_inode_cache_t *cache, cache_entry_t *ent)
+{
+	cache_entry_t **it = cache->buckets + hash_ref(cache, ent->ref);
+
+	while (*it != ent)
+		it = &(*it)->hash_next;
+
+	*it = ent->hash_next;
+}
+
+static void lru_unlink(sqfs_inode_cache_t *cache, cache_entry_t *ent)
+{
+	if (ent->lru_prev == NULL) {
+		cache->lru_head = ent->lru_next;
+	} else {
+		ent->lru_prev->lru_next = ent->lru_next;
+	}
+
+	if (ent->lru_next == NULL) {
+		cache->lru_tail = ent->lru_prev;
+	} else {
+		ent->lru_next->lru_prev = ent->lru_prev;
+	}
+}
+
+static void lru_push_front(sqfs_inode_cache_t *cache, cache_entry_t *ent)
+{
+	ent->lru_prev = NULL;
+	ent->lru_next = cache->lru_head;
+
+	if (cache->lru_head == NULL) {
+		cache->lru_tail = ent;
+	} else {
+		cache->lru_head->lru_prev = ent;
+	}
+
+	cache->lru_head = ent;
+}
+
+static void inode_cache_destroy(sqfs_object_t *obj)
+{
+	sqfs_inode_cache_t *cache = (sqfs_inode_cache_t *)obj;
+	cache_entry_t *ent;
+
+	while (cache->lru_head != NULL) {
+		ent = cache->lru_head;
+		cache->lru_head = ent->lru_next;
+
+		free(ent->inode);
+		free(ent);
+	}
+
+	MUTEX_DESTROY(&cache->mtx);
+	free(cache->buckets);
+	free(cache);
+}
+
+sqfs_inode_cache_t *sqfs_inode_cache_create(size_t max_inodes)
+{
+	sqfs_inode_cache_t *cache;
+	size_t count = 16;
+
+	if (max_inodes == 0)
+		return NULL;
+
+	while (count < max_inodes) {
+		if (SZ_MUL_OV(count, 2, &count))
+			return NULL;
+	}
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL)
+		return NULL;
+
+	cache->buckets = alloc_array(sizeof(cache->buckets[0]), count);
+	if (cache->buckets == NULL) {
+		free(cache);
+		return NULL;
+	}
+
+	memset(cache->buckets, 0, sizeof(cache->buckets[0]) * count);
+	cache->num_buckets = count;
+
+	cache->stats.size = sizeof(cache->stats);
+	cache->stats.max_inodes = max_inodes;
+
+	MUTEX_INIT(&cache->mtx);
+	((sqfs_object_t *)cache)->destroy = inode_cache_destroy;
+	return cache;
+}
+
+void sqfs_inode_cache_get_stats(sqfs_inode_cache_t *cache,
+				sqfs_inode_cache_stats_t *out)
+{
+	LOCK(&cache->mtx);
+	*out = cache->stats;
+	UNLOCK(&cache->mtx);
+}
+
+int inode_cache_get(sqfs_inode_cache_t *cache, sqfs_u64 ref,
+		    sqfs_inode_generic_t **out)
+{
+	sqfs_inode_generic_t *new;
+	size_t payload, avail;
+	cache_entry_t *ent;
+	int ret = 1;
+
+	LOCK(&cache->mtx);
+	ent = find_entry(cache, ref);
+
+	if (ent == NULL) {
+		cache->stats.miss_count += 1;
+		goto out;
+	}
+
+	cache->stats.hit_count += 1;
+	lru_unlink(cache, ent);
+	lru_push_front(cache, ent);
+
+	payload = payload_size(ent->inode);
+
+	if (*out != NULL && (*out)->payload_bytes_available >= payload) {
+		avail = (*out)->payload_bytes_available;
+	} else {
+		new = realloc(*out, sizeof(*new) + payload);
+		if (new == NULL) {
+			ret = SQFS_ERROR_ALLOC;
+			goto out;
+		}
+
+		*out = new;
+		avail = payload;
+	}
+
+	memcpy(*out, ent->inode, sizeof(**out) + payload);
+	(*out)->payload_bytes_available = avail;
+	ret = 0;
+out:
+	UNLOCK(&cache->mtx);
+	return ret;
+}
+
+void inode_cache_put(sqfs_inode_cache_t *cache, sqfs_u64 ref,
+		     const sqfs_inode_generic_t *inode)
+{
+	size_t payload = payload_size(inode);
+	sqfs_inode_generic_t *copy;
+	cache_entry_t *ent = NULL;
+
+	copy = malloc(sizeof(*copy) + payload);
+	if (copy == NULL)
+		return;
+
+	memcpy(copy, inode, sizeof(*copy) + payload);
+	copy->payload_bytes_available = payload;
+
+	LOCK(&cache->mtx);
+
+	/* another reader sharing the cache may have been faster */
+	if (find_entry(cache, ref) != NULL)
+		goto out;
+
+	if (cache->stats.inode_count >= cache->stats.max_inodes) {
+		ent = cache->lru_tail;
+
+		lru_unlink(cache, ent);
+		hash_remove(cache, ent);
+		free(ent->inode);
+
+		cache->stats.inode_count -= 1;
+		cache->stats.evict_count += 1;
+	} else {
+		ent = malloc(sizeof(*ent));
+		if (ent == NULL)
+			goto out;
+	}
+
+	ent->ref = ref;
+	ent->inode = copy;
+	copy = NULL;
+
+	ent->hash_next = cache->buckets[hash_ref(cache, ref)];
+	cache->buckets[hash_ref(cache, ref)] = ent;
+	lru_push_front(cache, ent);
+
+	cache->stats.inode_count += 1;
+out:
+	UNLOCK(&cache->mtx);
+	free(copy);
+}
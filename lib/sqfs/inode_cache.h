@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * inode_cache.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef INODE_CACHE_H
+#define INODE_CACHE_H
+
+#include "config.h"
+
+#include "sqfs/inode_cache.h"
+
+/*
+  Copy the inode with the given reference out of the cache, growing the
+  target inode like sqfs_meta_reader_read_inode_into if necessary. Returns
+  zero on a hit, a positive number on a miss and an SQFS_ERROR value if
+  growing the inode failed.
+ */
+SQFS_INTERNAL int inode_cache_get(sqfs_inode_cache_t *cache, sqfs_u64 ref,
+				  sqfs_inode_generic_t **out);
+
+/*
+  Add a copy of an inode to the cache. If the cache is full, the least
+  recently used inode is dropped. Failing to allocate the copy is not an
+  error, the inode is simply not cached.
+ */
+SQFS_INTERNAL void inode_cache_put(sqfs_inode_cache_t *cache, sqfs_u64 ref,
+				   const sqfs_inode_generic_t *inode);
+
+#endif /* INODE_CACHE_H */
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * io.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "config.h"
+
+#include "sqfs/io.h"
+
+int sqfs_file_read_at_v(sqfs_file_t *file, sqfs_u64 offset,
+			const sqfs_iovec_t *vec, size_t count)
+{
+	size_t i;
+	int err;
+
+	if (file->read_at_v != NULL)
+		return file->read_at_v(file, offset, vec, count);
+
+	for (i = 0; i < count; ++i) {
+		err = file->read_at(file, offset, vec[i].data, vec[i].size);
+		if (err)
+			return err;
+
+		offset += vec[i].size;
+	}
+
+	return 0;
+}
+
+int sqfs_file_write_at_v(sqfs_file_t *file, sqfs_u64 offset,
+			 const sqfs_iovec_t *vec, size_t count)
+{
+	size_t i;
+	int err;
+
+	if (file->write_at_v != NULL)
+		return file->write_at_v(file, offset, vec, count);
+
+	for (i = 0; i < count; ++i) {
+		err = file->write_at(file, offset, vec[i].data, vec[i].size);
+		if (err)
+			return err;
+
+		offset += vec[i].size;
+	}
+
+	return 0;
+}
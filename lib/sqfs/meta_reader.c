@@ -86,6 +86,8 @@ sqfs_meta_reader_t *sqfs_meta_reader_create(sqfs_file_t *file,
 int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 			  size_t offset)
 {
+	sqfs_u64 avail, file_size;
+	sqfs_iovec_t vec[2];
 	bool compressed;
 	sqfs_u16 header;
 	sqfs_u32 size;
@@ -103,7 +105,28 @@ int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 		return 0;
 	}
 
-	err = m->file->read_at(m->file, block_start, &header, 2);
+	/*
+	  The size of the block is not known before reading the header, so
+	  read the header and as much as the largest possible block in one go.
+	 */
+	avail = m->limit;
+	file_size = m->file->get_size(m->file);
+	if (file_size < avail)
+		avail = file_size;
+
+	if (avail < block_start + 2)
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	avail -= block_start + 2;
+	if (avail > sizeof(m->data))
+		avail = sizeof(m->data);
+
+	vec[0].data = &header;
+	vec[0].size = 2;
+	vec[1].data = m->data;
+	vec[1].size = avail;
+
+	err = sqfs_file_read_at_v(m->file, block_start, vec, 2);
 	if (err)
 		return err;
 
@@ -114,13 +137,9 @@ int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 	if (size > sizeof(m->data))
 		return SQFS_ERROR_CORRUPTED;
 
-	if ((block_start + 2 + size) > m->limit)
+	if (size > avail)
 		return SQFS_ERROR_OUT_OF_BOUNDS;
 
-	err = m->file->read_at(m->file, block_start + 2, m->data, size);
-	if (err)
-		return err;
-
 	if (compressed) {
 		ret = m->cmp->do_block(m->cmp, m->data, size,
 				       m->scratch, sizeof(m->scratch));
@@ -16,7 +16,6 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
 
 #define SWAB16(x) x = le16toh(x)
 #define SWAB32(x) x = le32toh(x)
@@ -75,12 +74,61 @@ static sqfs_u64 get_block_count(sqfs_u64 size, sqfs_u64 block_size,
 	return count;
 }
 
+/*
+  Make sure the inode has room for at least the given number of payload bytes
+  and reset everything but the payload. An existing inode that is already
+  large enough is reused as is.
+ */
+static int prepare_inode(sqfs_inode_generic_t **inode, const sqfs_inode_t *base,
+			 sqfs_u64 payload)
+{
+	sqfs_inode_generic_t *new;
+	size_t size, avail;
+
+	if (*inode != NULL && (*inode)->payload_bytes_available >= payload) {
+		avail = (*inode)->payload_bytes_available;
+	} else {
+		if (payload > 0x0FFFFFFFFUL ||
+		    SZ_ADD_OV(sizeof(**inode), payload, &size)) {
+			return SQFS_ERROR_OVERFLOW;
+		}
+
+		new = realloc(*inode, size);
+		if (new == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		*inode = new;
+		avail = payload;
+	}
+
+	memset(*inode, 0, sizeof(**inode));
+	(*inode)->base = *base;
+	(*inode)->payload_bytes_available = avail;
+	(*inode)->payload_bytes_used = payload;
+	return 0;
+}
+
+static int read_block_sizes(sqfs_meta_reader_t *ir, sqfs_inode_generic_t *out,
+			    sqfs_u64 count)
+{
+	sqfs_u64 i;
+	int err;
+
+	err = sqfs_meta_reader_read(ir, out->extra, count * sizeof(sqfs_u32));
+	if (err)
+		return err;
+
+	for (i = 0; i < count; ++i)
+		SWAB32(out->extra[i]);
+
+	return 0;
+}
+
 static int read_inode_file(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 			   size_t block_size, sqfs_inode_generic_t **result)
 {
-	sqfs_inode_generic_t *out;
 	sqfs_inode_file_t file;
-	sqfs_u64 i, count;
+	sqfs_u64 count;
 	int err;
 
 	err = sqfs_meta_reader_read(ir, &file, sizeof(file));
@@ -95,34 +143,19 @@ static int read_inode_file(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 	count = get_block_count(file.file_size, block_size,
 				file.fragment_index, file.fragment_offset);
 
-	out = alloc_flex(sizeof(*out), sizeof(sqfs_u32), count);
-	if (out == NULL)
-		return SQFS_ERROR_ALLOC;
-
-	out->base = *base;
-	out->data.file = file;
-	out->payload_bytes_available = count * sizeof(sqfs_u32);
-	out->payload_bytes_used = count * sizeof(sqfs_u32);
-
-	err = sqfs_meta_reader_read(ir, out->extra, count * sizeof(sqfs_u32));
-	if (err) {
-		free(out);
+	err = prepare_inode(result, base, count * sizeof(sqfs_u32));
+	if (err)
 		return err;
-	}
-
-	for (i = 0; i < count; ++i)
-		SWAB32(out->extra[i]);
 
-	*result = out;
-	return 0;
+	(*result)->data.file = file;
+	return read_block_sizes(ir, *result, count);
 }
 
 static int read_inode_file_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 			       size_t block_size, sqfs_inode_generic_t **result)
 {
 	sqfs_inode_file_ext_t file;
-	sqfs_inode_generic_t *out;
-	sqfs_u64 i, count;
+	sqfs_u64 count;
 	int err;
 
 	err = sqfs_meta_reader_read(ir, &file, sizeof(file));
@@ -140,36 +173,18 @@ static int read_inode_file_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 	count = get_block_count(file.file_size, block_size,
 				file.fragment_idx, file.fragment_offset);
 
-	out = alloc_flex(sizeof(*out), sizeof(sqfs_u32), count);
-	if (out == NULL) {
-		return errno == EOVERFLOW ? SQFS_ERROR_OVERFLOW :
-			SQFS_ERROR_ALLOC;
-	}
-
-	out->base = *base;
-	out->data.file_ext = file;
-	out->payload_bytes_available = count * sizeof(sqfs_u32);
-	out->payload_bytes_used = count * sizeof(sqfs_u32);
-
-	err = sqfs_meta_reader_read(ir, out->extra, count * sizeof(sqfs_u32));
-	if (err) {
-		free(out);
+	err = prepare_inode(result, base, count * sizeof(sqfs_u32));
+	if (err)
 		return err;
-	}
 
-	for (i = 0; i < count; ++i)
-		SWAB32(out->extra[i]);
-
-	*result = out;
-	return 0;
+	(*result)->data.file_ext = file;
+	return read_block_sizes(ir, *result, count);
 }
 
 static int read_inode_slink(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 			    sqfs_inode_generic_t **result)
 {
-	sqfs_inode_generic_t *out;
 	sqfs_inode_slink_t slink;
-	size_t size;
 	int err;
 
 	err = sqfs_meta_reader_read(ir, &slink, sizeof(slink));
@@ -179,28 +194,16 @@ static int read_inode_slink(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 	SWAB32(slink.nlink);
 	SWAB32(slink.target_size);
 
-	if (SZ_ADD_OV(slink.target_size, 1, &size) ||
-	    SZ_ADD_OV(sizeof(*out), size, &size)) {
-		return SQFS_ERROR_OVERFLOW;
-	}
-
-	out = calloc(1, size);
-	if (out == NULL)
-		return SQFS_ERROR_ALLOC;
-
-	out->payload_bytes_available = size - sizeof(*out);
-	out->payload_bytes_used = size - sizeof(*out) - 1;
-	out->base = *base;
-	out->data.slink = slink;
-
-	err = sqfs_meta_reader_read(ir, (void *)out->extra, slink.target_size);
-	if (err) {
-		free(out);
+	err = prepare_inode(result, base, (sqfs_u64)slink.target_size + 1);
+	if (err)
 		return err;
-	}
 
-	*result = out;
-	return 0;
+	(*result)->payload_bytes_used = slink.target_size;
+	(*result)->data.slink = slink;
+	((char *)(*result)->extra)[slink.target_size] = '\0';
+
+	return sqfs_meta_reader_read(ir, (void *)(*result)->extra,
+				     slink.target_size);
 }
 
 static int read_inode_slink_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
@@ -214,10 +217,8 @@ static int read_inode_slink_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 		return err;
 
 	err = sqfs_meta_reader_read(ir, &xattr, sizeof(xattr));
-	if (err) {
-		free(*result);
+	if (err)
 		return err;
-	}
 
 	(*result)->data.slink_ext.xattr_idx = le32toh(xattr);
 	return 0;
@@ -245,47 +246,44 @@ static int read_inode_dir_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 	SWAB16(dir.offset);
 	SWAB32(dir.xattr_idx);
 
-	index_max = dir.size ? 128 : 0;
-	index_used = 0;
-
-	out = alloc_flex(sizeof(*out), 1, index_max);
-	if (out == NULL)
-		return SQFS_ERROR_ALLOC;
+	err = prepare_inode(result, base, 0);
+	if (err)
+		return err;
 
-	out->base = *base;
+	out = *result;
 	out->data.dir_ext = dir;
 
-	if (dir.size == 0) {
-		*result = out;
+	if (dir.size == 0)
 		return 0;
-	}
+
+	index_max = out->payload_bytes_available;
+	index_used = 0;
 
 	for (i = 0; i < dir.inodex_count; ++i) {
 		err = sqfs_meta_reader_read(ir, &ent, sizeof(ent));
-		if (err) {
-			free(out);
+		if (err)
 			return err;
-		}
 
 		SWAB32(ent.start_block);
 		SWAB32(ent.index);
 		SWAB32(ent.size);
 
-		new_sz = index_max;
+		new_sz = index_max ? index_max : 128;
 		while (sizeof(ent) + ent.size + 1 > new_sz - index_used) {
-			if (SZ_MUL_OV(new_sz, 2, &new_sz)) {
-				free(out);
+			if (SZ_MUL_OV(new_sz, 2, &new_sz))
 				return SQFS_ERROR_OVERFLOW;
-			}
 		}
 
 		if (new_sz > index_max) {
+			if (new_sz > 0x0FFFFFFFFUL)
+				return SQFS_ERROR_OVERFLOW;
+
 			new = realloc(out, sizeof(*out) + new_sz);
-			if (new == NULL) {
-				free(out);
+			if (new == NULL)
 				return SQFS_ERROR_ALLOC;
-			}
-			out = new;
+
+			*result = out = new;
+			out->payload_bytes_available = new_sz;
 			index_max = new_sz;
 		}
 
@@ -294,24 +292,20 @@ static int read_inode_dir_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 
 		err = sqfs_meta_reader_read(ir, (char *)out->extra + index_used,
 					    ent.size + 1);
-		if (err) {
-			free(out);
+		if (err)
 			return err;
-		}
 
 		index_used += ent.size + 1;
+		out->payload_bytes_used = index_used;
 	}
 
-	out->payload_bytes_used = index_used;
-	out->payload_bytes_available = index_used;
-	*result = out;
 	return 0;
 }
 
-int sqfs_meta_reader_read_inode(sqfs_meta_reader_t *ir,
-				const sqfs_super_t *super,
-				sqfs_u64 block_start, size_t offset,
-				sqfs_inode_generic_t **result)
+int sqfs_meta_reader_read_inode_into(sqfs_meta_reader_t *ir,
+				     const sqfs_super_t *super,
+				     sqfs_u64 block_start, size_t offset,
+				     sqfs_inode_generic_t **result)
 {
 	sqfs_inode_generic_t *out;
 	sqfs_inode_t inode;
@@ -357,18 +351,18 @@ int sqfs_meta_reader_read_inode(sqfs_meta_reader_t *ir,
 	}
 
 	/* everything else */
-	out = calloc(1, sizeof(*out));
-	if (out == NULL)
-		return SQFS_ERROR_ALLOC;
+	err = prepare_inode(result, &inode, 0);
+	if (err)
+		return err;
 
-	out->base = inode;
+	out = *result;
 
 	switch (inode.type) {
 	case SQFS_INODE_DIR:
 		err = sqfs_meta_reader_read(ir, &out->data.dir,
 					    sizeof(out->data.dir));
 		if (err)
-			goto fail_free;
+			return err;
 
 		SWAB32(out->data.dir.start_block);
 		SWAB32(out->data.dir.nlink);
@@ -381,7 +375,7 @@ int sqfs_meta_reader_read_inode(sqfs_meta_reader_t *ir,
 		err = sqfs_meta_reader_read(ir, &out->data.dev,
 					    sizeof(out->data.dev));
 		if (err)
-			goto fail_free;
+			return err;
 		SWAB32(out->data.dev.nlink);
 		SWAB32(out->data.dev.devno);
 		break;
@@ -390,7 +384,7 @@ int sqfs_meta_reader_read_inode(sqfs_meta_reader_t *ir,
 		err = sqfs_meta_reader_read(ir, &out->data.ipc,
 					    sizeof(out->data.ipc));
 		if (err)
-			goto fail_free;
+			return err;
 		SWAB32(out->data.ipc.nlink);
 		break;
 	case SQFS_INODE_EXT_BDEV:
@@ -398,7 +392,7 @@ int sqfs_meta_reader_read_inode(sqfs_meta_reader_t *ir,
 		err = sqfs_meta_reader_read(ir, &out->data.dev_ext,
 					    sizeof(out->data.dev_ext));
 		if (err)
-			goto fail_free;
+			return err;
 		SWAB32(out->data.dev_ext.nlink);
 		SWAB32(out->data.dev_ext.devno);
 		SWAB32(out->data.dev_ext.xattr_idx);
@@ -408,18 +402,32 @@ int sqfs_meta_reader_read_inode(sqfs_meta_reader_t *ir,
 		err = sqfs_meta_reader_read(ir, &out->data.ipc_ext,
 					    sizeof(out->data.ipc_ext));
 		if (err)
-			goto fail_free;
+			return err;
 		SWAB32(out->data.ipc_ext.nlink);
 		SWAB32(out->data.ipc_ext.xattr_idx);
 		break;
 	default:
-		err = SQFS_ERROR_UNSUPPORTED;
-		goto fail_free;
+		return SQFS_ERROR_UNSUPPORTED;
+	}
+
+	return 0;
+}
+
+int sqfs_meta_reader_read_inode(sqfs_meta_reader_t *ir,
+				const sqfs_super_t *super,
+				sqfs_u64 block_start, size_t offset,
+				sqfs_inode_generic_t **result)
+{
+	sqfs_inode_generic_t *out = NULL;
+	int err;
+
+	err = sqfs_meta_reader_read_inode_into(ir, super, block_start,
+					       offset, &out);
+	if (err) {
+		free(out);
+		return err;
 	}
 
 	*result = out;
 	return 0;
-fail_free:
-	free(out);
-	return err;
 }
@@ -8,6 +8,8 @@
 #include "config.h"
 
 #include "sqfs/meta_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/executor.h"
 #include "sqfs/error.h"
 #include "sqfs/table.h"
 #include "sqfs/block.h"
@@ -15,17 +17,342 @@
 #include "util.h"
 
 #include <stdlib.h>
+#include <string.h>
 
-int sqfs_read_table(sqfs_file_t *file, sqfs_compressor_t *cmp,
-		    size_t table_size, sqfs_u64 location, sqfs_u64 lower_limit,
-		    sqfs_u64 upper_limit, void **out)
+#if defined(WITH_PTHREAD) || defined(_WIN32) || defined(__WINDOWS__)
+#	define WITH_THREADS
+#	include "threading.h"
+#endif
+
+/* minimum number of meta data blocks worth handing to another thread */
+#define MIN_BLOCKS_PER_TASK (8)
+
+/*
+  Returned by unpack_block if a block does not decode to the expected size,
+  in which case the table is read again through a meta data reader.
+ */
+#define UNPACK_IRREGULAR (1)
+
+typedef struct {
+	const sqfs_u8 *raw;
+	size_t raw_size;
+	const sqfs_u64 *offsets;
+	sqfs_u8 *data;
+	size_t table_size;
+
+#ifdef WITH_THREADS
+	MUTEX_TYPE mtx;
+	CONDITION_TYPE done;
+	size_t pending;
+#endif
+} table_loader_t;
+
+typedef struct {
+	table_loader_t *ld;
+	sqfs_compressor_t *cmp;
+	size_t first;
+	size_t count;
+	int status;
+} unpack_task_t;
+
+static int unpack_block(const table_loader_t *ld, sqfs_compressor_t *cmp,
+			size_t index, sqfs_u8 *scratch)
+{
+	size_t offset = ld->offsets[index], want;
+	sqfs_u8 *out, *dst;
+	bool compressed;
+	sqfs_u16 header;
+	sqfs_u32 size;
+	sqfs_s32 ret;
+
+	if (offset > ld->raw_size || (ld->raw_size - offset) < 2)
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(&header, ld->raw + offset, 2);
+	header = le16toh(header);
+	compressed = (header & 0x8000) == 0;
+	size = header & 0x7FFF;
+
+	if (size > SQFS_META_BLOCK_SIZE)
+		return SQFS_ERROR_CORRUPTED;
+
+	if ((ld->raw_size - offset - 2) < size)
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	out = ld->data + index * SQFS_META_BLOCK_SIZE;
+	want = ld->table_size - index * SQFS_META_BLOCK_SIZE;
+	if (want > SQFS_META_BLOCK_SIZE)
+		want = SQFS_META_BLOCK_SIZE;
+
+	if (!compressed) {
+		if (size < want)
+			return UNPACK_IRREGULAR;
+
+		memcpy(out, ld->raw + offset + 2, want);
+		return 0;
+	}
+
+	/* only the last block can be shorter than the output buffer */
+	dst = want == SQFS_META_BLOCK_SIZE ? out : scratch;
+
+	ret = cmp->do_block(cmp, ld->raw + offset + 2, size,
+			    dst, SQFS_META_BLOCK_SIZE);
+	if (ret < 0)
+		return ret;
+
+	if ((size_t)ret < want)
+		return UNPACK_IRREGULAR;
+
+	if (dst != out)
+		memcpy(out, dst, want);
+
+	return 0;
+}
+
+static void unpack_task(void *arg)
+{
+	sqfs_u8 scratch[SQFS_META_BLOCK_SIZE];
+	unpack_task_t *task = arg;
+	size_t i;
+
+	for (i = 0; i < task->count && task->status == 0; ++i) {
+		task->status = unpack_block(task->ld, task->cmp,
+					    task->first + i, scratch);
+	}
+}
+
+#ifdef WITH_THREADS
+static void executor_task(void *arg)
+{
+	unpack_task_t *task = arg;
+	table_loader_t *ld = task->ld;
+
+	unpack_task(task);
+
+	LOCK(&ld->mtx);
+	ld->pending -= 1;
+	if (ld->pending == 0)
+		SIGNAL_ALL(&ld->done);
+	UNLOCK(&ld->mtx);
+}
+
+static int unpack_parallel(table_loader_t *ld, sqfs_compressor_t *cmp,
+			   size_t block_count, size_t num_tasks,
+			   sqfs_executor_t *exec)
+{
+	bool irregular = false;
+	unpack_task_t *tasks;
+	size_t i, per_task;
+	sqfs_object_t *copy;
+	int err = 0;
+
+	tasks = alloc_array(sizeof(tasks[0]), num_tasks);
+	if (tasks == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	per_task = (block_count + num_tasks - 1) / num_tasks;
+
+	for (i = 0; i < num_tasks; ++i) {
+		tasks[i].ld = ld;
+		tasks[i].status = 0;
+		tasks[i].first = i * per_task;
+		tasks[i].count = per_task;
+
+		if (tasks[i].first >= block_count) {
+			tasks[i].count = 0;
+		} else if (tasks[i].count > block_count - tasks[i].first) {
+			tasks[i].count = block_count - tasks[i].first;
+		}
+
+		if (i == 0) {
+			tasks[i].cmp = cmp;
+			continue;
+		}
+
+		copy = sqfs_copy((sqfs_object_t *)cmp);
+		tasks[i].cmp = (sqfs_compressor_t *)copy;
+
+		if (copy == NULL) {
+			while (--i > 0)
+				sqfs_destroy(tasks[i].cmp);
+			free(tasks);
+			return SQFS_ERROR_ALLOC;
+		}
+	}
+
+	MUTEX_INIT(&ld->mtx);
+	CONDITION_INIT(&ld->done);
+	ld->pending = num_tasks - 1;
+
+	for (i = 1; i < num_tasks; ++i) {
+		if (exec->submit(exec, executor_task, tasks + i))
+			executor_task(tasks + i);
+	}
+
+	unpack_task(tasks);
+
+	LOCK(&ld->mtx);
+	while (ld->pending > 0)
+		AWAIT(&ld->done, &ld->mtx);
+	UNLOCK(&ld->mtx);
+
+	CONDITION_DESTROY(&ld->done);
+	MUTEX_DESTROY(&ld->mtx);
+
+	for (i = 0; i < num_tasks; ++i) {
+		if (tasks[i].status < 0 && err == 0)
+			err = tasks[i].status;
+
+		if (tasks[i].status == UNPACK_IRREGULAR)
+			irregular = true;
+
+		if (i > 0)
+			sqfs_destroy(tasks[i].cmp);
+	}
+
+	free(tasks);
+
+	if (err == 0 && irregular)
+		err = UNPACK_IRREGULAR;
+
+	return err;
+}
+#endif
+
+/*
+  The blocks of a table written by sqfs_write_table are stored back to back,
+  directly followed by the location list. If that is the case, read all of
+  them at once and unpack them straight into the output buffer.
+ */
+static int unpack_span(sqfs_file_t *file, sqfs_compressor_t *cmp,
+		       sqfs_u8 *data, size_t table_size,
+		       const sqfs_u64 *locations, size_t block_count,
+		       sqfs_u64 location, sqfs_u64 lower_limit,
+		       sqfs_u64 upper_limit, sqfs_executor_t *exec)
+{
+	table_loader_t ld;
+	unpack_task_t task;
+	sqfs_u64 *offsets;
+	size_t i, max;
+	sqfs_u8 *raw;
+	int err;
+
+	if (locations[0] < lower_limit || location > upper_limit ||
+	    locations[block_count - 1] >= location) {
+		return UNPACK_IRREGULAR;
+	}
+
+	for (i = 1; i < block_count; ++i) {
+		if (locations[i] <= locations[i - 1])
+			return UNPACK_IRREGULAR;
+	}
+
+	if (SZ_MUL_OV(block_count, SQFS_META_BLOCK_SIZE + 2, &max))
+		return SQFS_ERROR_OVERFLOW;
+
+	if ((location - locations[0]) > max)
+		return UNPACK_IRREGULAR;
+
+	memset(&ld, 0, sizeof(ld));
+	ld.raw_size = location - locations[0];
+	ld.data = data;
+	ld.table_size = table_size;
+
+	offsets = alloc_array(sizeof(offsets[0]), block_count);
+	raw = malloc(ld.raw_size);
+
+	if (offsets == NULL || raw == NULL) {
+		err = SQFS_ERROR_ALLOC;
+		goto out;
+	}
+
+	for (i = 0; i < block_count; ++i)
+		offsets[i] = locations[i] - locations[0];
+
+	err = file->read_at(file, locations[0], raw, ld.raw_size);
+	if (err)
+		goto out;
+
+	ld.raw = raw;
+	ld.offsets = offsets;
+
+#ifdef WITH_THREADS
+	if (exec != NULL) {
+		i = exec->concurrency;
+		if (i > block_count / MIN_BLOCKS_PER_TASK)
+			i = block_count / MIN_BLOCKS_PER_TASK;
+
+		if (i > 1) {
+			err = unpack_parallel(&ld, cmp, block_count, i, exec);
+			goto out;
+		}
+	}
+#else
+	(void)exec;
+#endif
+	task.ld = &ld;
+	task.cmp = cmp;
+	task.first = 0;
+	task.count = block_count;
+	task.status = 0;
+
+	unpack_task(&task);
+	err = task.status;
+out:
+	free(raw);
+	free(offsets);
+	return err;
+}
+
+static int read_blocks(sqfs_file_t *file, sqfs_compressor_t *cmp,
+		       sqfs_u8 *data, size_t table_size,
+		       const sqfs_u64 *locations, sqfs_u64 lower_limit,
+		       sqfs_u64 upper_limit)
 {
-	size_t diff, block_count, blk_idx = 0;
-	sqfs_u64 start, *locations;
+	size_t diff, blk_idx = 0;
 	sqfs_meta_reader_t *m;
-	void *data, *ptr;
+	int err = 0;
+
+	m = sqfs_meta_reader_create(file, cmp, lower_limit, upper_limit);
+	if (m == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	while (table_size > 0) {
+		err = sqfs_meta_reader_seek(m, locations[blk_idx++], 0);
+		if (err)
+			break;
+
+		diff = SQFS_META_BLOCK_SIZE;
+		if (diff > table_size)
+			diff = table_size;
+
+		err = sqfs_meta_reader_read(m, data, diff);
+		if (err)
+			break;
+
+		data += diff;
+		table_size -= diff;
+	}
+
+	sqfs_destroy(m);
+	return err;
+}
+
+int sqfs_read_table_exec(sqfs_file_t *file, sqfs_compressor_t *cmp,
+			 size_t table_size, sqfs_u64 location,
+			 sqfs_u64 lower_limit, sqfs_u64 upper_limit,
+			 sqfs_executor_t *exec, void **out)
+{
+	size_t i, block_count;
+	sqfs_u64 *locations;
+	void *data;
 	int err;
 
+	if (exec != NULL && (exec->size != sizeof(*exec) ||
+			     exec->submit == NULL)) {
+		return SQFS_ERROR_ARG_INVALID;
+	}
+
 	data = malloc(table_size);
 	if (data == NULL)
 		return SQFS_ERROR_ALLOC;
@@ -48,40 +375,27 @@ int sqfs_read_table(sqfs_file_t *file, sqfs_compressor_t *cmp,
 	if (err)
 		goto fail_idx;
 
-	/* Read the actual data */
-	m = sqfs_meta_reader_create(file, cmp, lower_limit, upper_limit);
-	if (m == NULL) {
-		err = SQFS_ERROR_ALLOC;
-		goto fail_idx;
-	}
-
-	ptr = data;
+	for (i = 0; i < block_count; ++i)
+		locations[i] = le64toh(locations[i]);
 
-	while (table_size > 0) {
-		start = le64toh(locations[blk_idx++]);
+	/* Read the actual data */
+	if (block_count > 0) {
+		err = unpack_span(file, cmp, data, table_size, locations,
+				  block_count, location, lower_limit,
+				  upper_limit, exec);
 
-		err = sqfs_meta_reader_seek(m, start, 0);
-		if (err)
-			goto fail;
+		if (err == UNPACK_IRREGULAR) {
+			err = read_blocks(file, cmp, data, table_size,
+					  locations, lower_limit, upper_limit);
+		}
 
-		diff = SQFS_META_BLOCK_SIZE;
-		if (diff > table_size)
-			diff = table_size;
-
-		err = sqfs_meta_reader_read(m, ptr, diff);
 		if (err)
-			goto fail;
-
-		ptr = (char *)ptr + diff;
-		table_size -= diff;
+			goto fail_idx;
 	}
 
-	sqfs_destroy(m);
 	free(locations);
 	*out = data;
 	return 0;
-fail:
-	sqfs_destroy(m);
 fail_idx:
 	free(locations);
 fail_data:
@@ -89,3 +403,11 @@ fail_data:
 	*out = NULL;
 	return err;
 }
+
+int sqfs_read_table(sqfs_file_t *file, sqfs_compressor_t *cmp,
+		    size_t table_size, sqfs_u64 location, sqfs_u64 lower_limit,
+		    sqfs_u64 upper_limit, void **out)
+{
+	return sqfs_read_table_exec(file, cmp, table_size, location,
+				    lower_limit, upper_limit, NULL, out);
+}
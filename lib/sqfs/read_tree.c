@@ -74,32 +74,27 @@ static int fill_dir(sqfs_dir_reader_t *dr, sqfs_tree_node_t *root,
 		    unsigned int flags)
 {
 	sqfs_tree_node_t *n, *prev, **tail;
+	const sqfs_dir_entry_t *ent;
 	sqfs_inode_generic_t *inode;
-	sqfs_dir_entry_t *ent;
 	int err;
 
 	tail = &root->children;
 
 	for (;;) {
-		err = sqfs_dir_reader_read(dr, &ent);
+		err = sqfs_dir_reader_next(dr, &ent);
 		if (err > 0)
 			break;
 		if (err < 0)
 			return err;
 
-		if (should_skip(ent->type, flags)) {
-			free(ent);
+		if (should_skip(ent->type, flags))
 			continue;
-		}
 
 		err = sqfs_dir_reader_get_inode(dr, &inode);
-		if (err) {
-			free(ent);
+		if (err)
 			return err;
-		}
 
 		n = create_node(inode, (const char *)ent->name);
-		free(ent);
 
 		if (n == NULL) {
 			free(inode);
@@ -194,8 +189,8 @@ int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 				       sqfs_tree_node_t **out)
 {
 	sqfs_tree_node_t *root, *tail, *new;
+	const sqfs_dir_entry_t *ent;
 	sqfs_inode_generic_t *inode;
-	sqfs_dir_entry_t *ent;
 	const char *ptr;
 	int ret;
 
@@ -235,7 +230,7 @@ int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 		}
 
 		for (;;) {
-			ret = sqfs_dir_reader_read(rd, &ent);
+			ret = sqfs_dir_reader_next(rd, &ent);
 			if (ret < 0)
 				goto fail;
 			if (ret > 0) {
@@ -247,17 +242,13 @@ int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 				      path, ptr - path);
 			if (ret == 0 && ent->name[ptr - path] == '\0')
 				break;
-			free(ent);
 		}
 
 		ret = sqfs_dir_reader_get_inode(rd, &inode);
-		if (ret) {
-			free(ent);
+		if (ret)
 			goto fail;
-		}
 
 		new = create_node(inode, (const char *)ent->name);
-		free(ent);
 
 		if (new == NULL) {
 			free(inode);
@@ -32,30 +32,51 @@ int sqfs_meta_reader_read_dir_header(sqfs_meta_reader_t *m,
 	return 0;
 }
 
-int sqfs_meta_reader_read_dir_ent(sqfs_meta_reader_t *m,
-				  sqfs_dir_entry_t **result)
+int sqfs_meta_reader_read_dir_ent_into(sqfs_meta_reader_t *m,
+				       sqfs_dir_entry_t **ent, size_t *max)
 {
-	sqfs_dir_entry_t ent, *out;
+	sqfs_dir_entry_t hdr, *out;
 	sqfs_u16 *diff_u16;
+	size_t size;
 	int err;
 
-	err = sqfs_meta_reader_read(m, &ent, sizeof(ent));
+	err = sqfs_meta_reader_read(m, &hdr, sizeof(hdr));
 	if (err)
 		return err;
 
-	diff_u16 = (sqfs_u16 *)&ent.inode_diff;
+	diff_u16 = (sqfs_u16 *)&hdr.inode_diff;
 	*diff_u16 = le16toh(*diff_u16);
 
-	ent.offset = le16toh(ent.offset);
-	ent.type = le16toh(ent.type);
-	ent.size = le16toh(ent.size);
+	hdr.offset = le16toh(hdr.offset);
+	hdr.type = le16toh(hdr.type);
+	hdr.size = le16toh(hdr.size);
+
+	size = sizeof(hdr) + hdr.size + 2;
+
+	if (*ent == NULL || *max < size) {
+		out = realloc(*ent, size);
+		if (out == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		*ent = out;
+		*max = size;
+	}
+
+	out = *ent;
+	*out = hdr;
+	out->name[hdr.size + 1] = '\0';
 
-	out = calloc(1, sizeof(*out) + ent.size + 2);
-	if (out == NULL)
-		return SQFS_ERROR_ALLOC;
+	return sqfs_meta_reader_read(m, out->name, hdr.size + 1);
+}
+
+int sqfs_meta_reader_read_dir_ent(sqfs_meta_reader_t *m,
+				  sqfs_dir_entry_t **result)
+{
+	sqfs_dir_entry_t *out = NULL;
+	size_t max = 0;
+	int err;
 
-	*out = ent;
-	err = sqfs_meta_reader_read(m, out->name, ent.size + 1);
+	err = sqfs_meta_reader_read_dir_ent_into(m, &out, &max);
 	if (err) {
 		free(out);
 		return err;
@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * threading.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef THREADING_H
+#define THREADING_H
+
+#include "config.h"
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+#	define WIN32_LEAN_AND_MEAN
+#	include <windows.h>
+#	include <limits.h>
+#	define LOCK(mtx) EnterCriticalSection(mtx)
+#	define UNLOCK(mtx) LeaveCriticalSection(mtx)
+#	define AWAIT(cond, mtx) SleepConditionVariableCS(cond, mtx, INFINITE)
+#	define SIGNAL_ALL(cond) WakeAllConditionVariable(cond)
+#	define THREAD_JOIN(t) \
+		if (t != NULL) { \
+			WaitForSingleObject(t, INFINITE); \
+			CloseHandle(t); \
+		}
+#	define MUTEX_INIT(mtx) InitializeCriticalSection(mtx)
+#	define CONDITION_INIT(cond) InitializeConditionVariable(cond)
+#	define MUTEX_DESTROY(mtx) DeleteCriticalSection(mtx)
+#	define CONDITION_DESTROY(cond)
+#	define THREAD_EXIT_SUCCESS 0
+#	define THREAD_TYPE DWORD WINAPI
+#	define THREAD_ARG LPVOID
+#	define THREAD_HANDLE HANDLE
+#	define MUTEX_TYPE CRITICAL_SECTION
+#	define CONDITION_TYPE CONDITION_VARIABLE
+#else
+#	include <pthread.h>
+#	include <signal.h>
+#	ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#		include <sched.h>
+#	endif
+#	define LOCK(mtx) pthread_mutex_lock(mtx)
+#	define UNLOCK(mtx) pthread_mutex_unlock(mtx)
+#	define AWAIT(cond, mtx) pthread_cond_wait(cond, mtx)
+#	define SIGNAL_ALL(cond) pthread_cond_broadcast(cond)
+#	define THREAD_JOIN(t) if (t != (pthread_t)0) { pthread_join(t, NULL); }
+#	define MUTEX_INIT(mtx) pthread_mutex_init(mtx, NULL)
+#	define CONDITION_INIT(cond) pthread_cond_init(cond, NULL)
+#	define MUTEX_DESTROY(mtx) pthread_mutex_destroy(mtx)
+#	define CONDITION_DESTROY(cond) pthread_cond_destroy(cond)
+#	define THREAD_EXIT_SUCCESS NULL
+#	define THREAD_TYPE void *
+#	define THREAD_ARG void *
+#	define THREAD_HANDLE pthread_t
+#	define MUTEX_TYPE pthread_mutex_t
+#	define CONDITION_TYPE pthread_cond_t
+#endif
+
+#endif /* THREADING_H */
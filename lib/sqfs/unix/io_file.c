@@ -17,6 +17,12 @@
 #include <errno.h>
 #include <fcntl.h>
 
+#if defined(HAVE_PREADV) && defined(HAVE_PWRITEV)
+#include <sys/uio.h>
+
+/* the number of buffers passed to the kernel in one go */
+#define STDIO_IOV_COUNT (64)
+#endif
 
 typedef struct {
 	sqfs_file_t base;
@@ -118,6 +124,85 @@ static int stdio_write_at(sqfs_file_t *base, sqfs_u64 offset,
 	return 0;
 }
 
+#if defined(HAVE_PREADV) && defined(HAVE_PWRITEV)
+static int stdio_transfer_v(sqfs_file_t *base, sqfs_u64 offset,
+			    const sqfs_iovec_t *vec, size_t count, bool writing)
+{
+	sqfs_file_stdio_t *file = (sqfs_file_stdio_t *)base;
+	struct iovec iov[STDIO_IOV_COUNT];
+	size_t i = 0, j, n, skip = 0;
+	ssize_t ret;
+
+	for (;;) {
+		while (i < count && vec[i].size == skip) {
+			++i;
+			skip = 0;
+		}
+
+		if (i == count)
+			break;
+
+		iov[0].iov_base = (char *)vec[i].data + skip;
+		iov[0].iov_len = vec[i].size - skip;
+		n = 1;
+
+		for (j = i + 1; j < count && n < STDIO_IOV_COUNT; ++j) {
+			if (vec[j].size == 0)
+				continue;
+
+			iov[n].iov_base = vec[j].data;
+			iov[n].iov_len = vec[j].size;
+			++n;
+		}
+
+		if (writing) {
+			ret = pwritev(file->fd, iov, n, offset);
+		} else {
+			ret = preadv(file->fd, iov, n, offset);
+		}
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return SQFS_ERROR_IO;
+		}
+
+		if (ret == 0)
+			return SQFS_ERROR_OUT_OF_BOUNDS;
+
+		offset += ret;
+
+		while (ret > 0) {
+			if ((size_t)ret >= vec[i].size - skip) {
+				ret -= vec[i].size - skip;
+				skip = 0;
+				++i;
+			} else {
+				skip += ret;
+				ret = 0;
+			}
+		}
+	}
+
+	if (writing && offset >= file->size)
+		file->size = offset;
+
+	return 0;
+}
+
+static int stdio_read_at_v(sqfs_file_t *base, sqfs_u64 offset,
+			   const sqfs_iovec_t *vec, size_t count)
+{
+	return stdio_transfer_v(base, offset, vec, count, false);
+}
+
+static int stdio_write_at_v(sqfs_file_t *base, sqfs_u64 offset,
+			    const sqfs_iovec_t *vec, size_t count)
+{
+	return stdio_transfer_v(base, offset, vec, count, true);
+}
+#endif
+
 static sqfs_u64 stdio_get_size(const sqfs_file_t *base)
 {
 	const sqfs_file_stdio_t *file = (const sqfs_file_stdio_t *)base;
@@ -144,7 +229,9 @@ sqfs_file_t *sqfs_open_file(const char *filename, sqfs_u32 flags)
 	sqfs_file_t *base;
 	struct stat sb;
 
-	if (flags & ~SQFS_FILE_OPEN_ALL_FLAGS) {
+	if ((flags & ~SQFS_FILE_OPEN_ALL_FLAGS) ||
+	    ((flags & SQFS_FILE_OPEN_EXISTING) &&
+	     (flags & SQFS_FILE_OPEN_OVERWRITE))) {
 		errno = EINVAL;
 		return NULL;
 	}
@@ -159,12 +246,14 @@ sqfs_file_t *sqfs_open_file(const char *filename, sqfs_u32 flags)
 		open_mode = O_RDONLY;
 	} else {
 		file->readonly = false;
-		open_mode = O_CREAT | O_RDWR;
+		open_mode = O_RDWR;
 
-		if (flags & SQFS_FILE_OPEN_OVERWRITE) {
-			open_mode |= O_TRUNC;
+		if (flags & SQFS_FILE_OPEN_EXISTING) {
+			/* keep the contents */
+		} else if (flags & SQFS_FILE_OPEN_OVERWRITE) {
+			open_mode |= O_CREAT | O_TRUNC;
 		} else {
-			open_mode |= O_EXCL;
+			open_mode |= O_CREAT | O_EXCL;
 		}
 	}
 
@@ -190,6 +279,10 @@ sqfs_file_t *sqfs_open_file(const char *filename, sqfs_u32 flags)
 	base->write_at = stdio_write_at;
 	base->get_size = stdio_get_size;
 	base->truncate = stdio_truncate;
+#if defined(HAVE_PREADV) && defined(HAVE_PWRITEV)
+	base->read_at_v = stdio_read_at_v;
+	base->write_at_v = stdio_write_at_v;
+#endif
 	((sqfs_object_t *)base)->copy = stdio_copy;
 	((sqfs_object_t *)base)->destroy = stdio_destroy;
 	return base;
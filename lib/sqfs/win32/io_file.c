@@ -159,6 +159,11 @@ sqfs_file_t *sqfs_open_file(const char *filename, sqfs_u32 flags)
 	if (flags & ~SQFS_FILE_OPEN_ALL_FLAGS)
 		return NULL;
 
+	if ((flags & SQFS_FILE_OPEN_EXISTING) &&
+	    (flags & SQFS_FILE_OPEN_OVERWRITE)) {
+		return NULL;
+	}
+
 	file = calloc(1, sizeof(*file));
 	base = (sqfs_file_t *)file;
 	if (file == NULL)
@@ -172,7 +177,9 @@ sqfs_file_t *sqfs_open_file(const char *filename, sqfs_u32 flags)
 		file->readonly = false;
 		access_flags = GENERIC_READ | GENERIC_WRITE;
 
-		if (flags & SQFS_FILE_OPEN_OVERWRITE) {
+		if (flags & SQFS_FILE_OPEN_EXISTING) {
+			creation_mode = OPEN_EXISTING;
+		} else if (flags & SQFS_FILE_OPEN_OVERWRITE) {
 			creation_mode = CREATE_ALWAYS;
 		} else {
 			creation_mode = CREATE_NEW;
@@ -20,6 +20,13 @@
 #include <string.h>
 #include <errno.h>
 
+#define XATTR_CACHE_SIZE (32)
+
+typedef struct {
+	sqfs_xattr_set_t *set;
+	sqfs_u64 last_use;
+} xattr_cache_ent_t;
+
 struct sqfs_xattr_reader_t {
 	sqfs_object_t base;
 
@@ -33,8 +40,24 @@ struct sqfs_xattr_reader_t {
 
 	sqfs_meta_reader_t *idrd;
 	sqfs_meta_reader_t *kvrd;
+
+	xattr_cache_ent_t cache[XATTR_CACHE_SIZE];
+	sqfs_u64 cache_clock;
 };
 
+static void xattr_cache_flush(sqfs_xattr_reader_t *xr)
+{
+	size_t i;
+
+	for (i = 0; i < XATTR_CACHE_SIZE; ++i) {
+		free(xr->cache[i].set);
+		xr->cache[i].set = NULL;
+		xr->cache[i].last_use = 0;
+	}
+
+	xr->cache_clock = 0;
+}
+
 static sqfs_object_t *xattr_reader_copy(const sqfs_object_t *obj)
 {
 	const sqfs_xattr_reader_t *xr = (const sqfs_xattr_reader_t *)obj;
@@ -44,6 +67,8 @@ static sqfs_object_t *xattr_reader_copy(const sqfs_object_t *obj)
 		return NULL;
 
 	memcpy(copy, xr, sizeof(*xr));
+	memset(copy->cache, 0, sizeof(copy->cache));
+	copy->cache_clock = 0;
 
 	if (xr->kvrd != NULL) {
 		copy->kvrd = sqfs_copy(xr->kvrd);
@@ -89,6 +114,7 @@ static void xattr_reader_destroy(sqfs_object_t *obj)
 	if (xr->idrd != NULL)
 		sqfs_destroy(xr->idrd);
 
+	xattr_cache_flush(xr);
 	free(xr->id_block_starts);
 	free(xr);
 }
@@ -124,6 +150,8 @@ int sqfs_xattr_reader_load(sqfs_xattr_reader_t *xr, const sqfs_super_t *super,
 	free(xr->id_block_starts);
 	xr->id_block_starts = NULL;
 
+	xattr_cache_flush(xr);
+
 	/* read the locations table */
 	err = file->read_at(file, super->xattr_id_table_start,
 			    &idtbl, sizeof(idtbl));
@@ -256,6 +284,10 @@ int sqfs_xattr_reader_read_value(sqfs_xattr_reader_t *xr,
 		ret = sqfs_meta_reader_seek(xr->kvrd, new_start, new_offset);
 		if (ret)
 			return ret;
+
+		ret = sqfs_meta_reader_read(xr->kvrd, &value, sizeof(value));
+		if (ret)
+			return ret;
 	}
 
 	value.size = le32toh(value.size);
@@ -332,6 +364,139 @@ int sqfs_xattr_reader_get_desc(sqfs_xattr_reader_t *xr, sqfs_u32 idx,
 	return 0;
 }
 
+static int read_set(sqfs_xattr_reader_t *xr, sqfs_u32 idx,
+		    sqfs_xattr_set_t **out)
+{
+	sqfs_xattr_value_t **values = NULL;
+	sqfs_xattr_entry_t **keys = NULL;
+	size_t i, len, total, num = 0;
+	sqfs_xattr_set_t *set;
+	sqfs_xattr_id_t desc;
+	char *ptr;
+	int ret;
+
+	ret = sqfs_xattr_reader_get_desc(xr, idx, &desc);
+	if (ret)
+		return ret;
+
+	if (desc.count > 0) {
+		ret = sqfs_xattr_reader_seek_kv(xr, &desc);
+		if (ret)
+			return ret;
+
+		keys = alloc_array(sizeof(keys[0]), desc.count);
+		values = alloc_array(sizeof(values[0]), desc.count);
+
+		if (keys == NULL || values == NULL) {
+			ret = errno == EOVERFLOW ? SQFS_ERROR_OVERFLOW :
+						   SQFS_ERROR_ALLOC;
+			goto out;
+		}
+	}
+
+	total = 0;
+
+	for (num = 0; num < desc.count; ++num) {
+		ret = sqfs_xattr_reader_read_key(xr, keys + num);
+		if (ret)
+			goto out;
+
+		ret = sqfs_xattr_reader_read_value(xr, keys[num],
+						   values + num);
+		if (ret) {
+			free(keys[num]);
+			goto out;
+		}
+
+		len = strlen((const char *)keys[num]->key) + 1;
+
+		if (SZ_ADD_OV(total, len, &total) ||
+		    SZ_ADD_OV(total, values[num]->size, &total) ||
+		    SZ_ADD_OV(total, 1, &total)) {
+			free(keys[num]);
+			free(values[num]);
+			ret = SQFS_ERROR_OVERFLOW;
+			goto out;
+		}
+	}
+
+	if (SZ_MUL_OV(sizeof(set->pairs[0]), desc.count, &len) ||
+	    SZ_ADD_OV(sizeof(*set), len, &len) ||
+	    SZ_ADD_OV(len, total, &total)) {
+		ret = SQFS_ERROR_OVERFLOW;
+		goto out;
+	}
+
+	set = calloc(1, total);
+	if (set == NULL) {
+		ret = SQFS_ERROR_ALLOC;
+		goto out;
+	}
+
+	set->index = idx;
+	set->count = desc.count;
+	ptr = (char *)set + len;
+
+	for (i = 0; i < desc.count; ++i) {
+		len = strlen((const char *)keys[i]->key) + 1;
+		memcpy(ptr, keys[i]->key, len);
+		set->pairs[i].key = ptr;
+		ptr += len;
+
+		memcpy(ptr, values[i]->value, values[i]->size + 1);
+		set->pairs[i].value = (const sqfs_u8 *)ptr;
+		set->pairs[i].value_size = values[i]->size;
+		set->pairs[i].type = keys[i]->type & SQFS_XATTR_PREFIX_MASK;
+		ptr += values[i]->size + 1;
+	}
+
+	*out = set;
+	ret = 0;
+out:
+	for (i = 0; i < num; ++i) {
+		free(keys[i]);
+		free(values[i]);
+	}
+	free(keys);
+	free(values);
+	return ret;
+}
+
+int sqfs_xattr_reader_get_set(sqfs_xattr_reader_t *xr, sqfs_u32 idx,
+			      const sqfs_xattr_set_t **out)
+{
+	xattr_cache_ent_t *victim = xr->cache;
+	sqfs_xattr_set_t *set;
+	size_t i;
+	int ret;
+
+	*out = NULL;
+
+	if (idx == 0xFFFFFFFF)
+		return 0;
+
+	for (i = 0; i < XATTR_CACHE_SIZE; ++i) {
+		if (xr->cache[i].set != NULL && xr->cache[i].set->index == idx) {
+			xr->cache[i].last_use = ++xr->cache_clock;
+			*out = xr->cache[i].set;
+			return 0;
+		}
+
+		if (xr->cache[i].last_use < victim->last_use)
+			victim = xr->cache + i;
+	}
+
+	ret = read_set(xr, idx, &set);
+	if (ret)
+		return ret;
+
+	free(victim->set);
+	victim->set = set;
+	victim->last_use = ++xr->cache_clock;
+	*out = set;
+	return 0;
+}
+
 sqfs_xattr_reader_t *sqfs_xattr_reader_create(sqfs_u32 flags)
 {
 	sqfs_xattr_reader_t *xr;
@@ -10,20 +10,19 @@
 
 static unsigned int get_checksum(const tar_header_t *hdr)
 {
-	const unsigned char *header_start = (const unsigned char *)hdr;
-	const unsigned char *chksum_start = (const unsigned char *)hdr->chksum;
-	const unsigned char *header_end = header_start + sizeof(*hdr);
-	const unsigned char *chksum_end = chksum_start + sizeof(hdr->chksum);
-	const unsigned char *p;
+	const unsigned char *ptr = (const unsigned char *)hdr;
 	unsigned int chksum = 0;
+	size_t i;
 
-	for (p = header_start; p < chksum_start; p++)
-		chksum += *p;
-	for (; p < chksum_end; p++)
-		chksum += ' ';
-	for (; p < header_end; p++)
-		chksum += *p;
-	return chksum;
+	/* Sum up the entire header in one straight loop (which the compiler
+	   can vectorize) and then replace the checksum field with spaces. */
+	for (i = 0; i < sizeof(*hdr); ++i)
+		chksum += ptr[i];
+
+	for (i = 0; i < sizeof(hdr->chksum); ++i)
+		chksum -= (unsigned char)hdr->chksum[i];
+
+	return chksum + sizeof(hdr->chksum) * ' ';
 }
 
 void update_checksum(tar_header_t *hdr)
@@ -8,33 +8,18 @@
 
 #include "internal.h"
 
-void free_sparse_list(sparse_map_t *sparse)
-{
-	sparse_map_t *old;
-
-	while (sparse != NULL) {
-		old = sparse;
-		sparse = sparse->next;
-		free(old);
-	}
-}
+#include <stddef.h>
 
-void free_xattr_list(tar_xattr_t *list)
+void clear_header(tar_header_decoded_t *hdr)
 {
-	tar_xattr_t *old;
+	tar_storage_block_t *blk;
 
-	while (list != NULL) {
-		old = list;
-		list = list->next;
-		free(old);
+	while (hdr->storage != NULL) {
+		blk = hdr->storage;
+		hdr->storage = blk->next;
+		free(blk);
 	}
-}
 
-void clear_header(tar_header_decoded_t *hdr)
-{
-	free_xattr_list(hdr->xattr);
-	free_sparse_list(hdr->sparse);
-	free(hdr->name);
-	free(hdr->link_target);
-	memset(hdr, 0, sizeof(*hdr));
+	/* the inline storage is simply reused, no need to clear it */
+	memset(hdr, 0, offsetof(tar_header_decoded_t, inline_storage));
 }
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * header_alloc.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "internal.h"
+
+#define STORAGE_ALIGN (sizeof(sqfs_u64))
+
+void *header_alloc(tar_header_decoded_t *out, size_t size)
+{
+	tar_storage_block_t *blk;
+	size_t avail, total;
+	void *ptr;
+
+	if (SZ_ADD_OV(size, STORAGE_ALIGN - 1, &size))
+		goto fail_ov;
+
+	size -= size % STORAGE_ALIGN;
+
+	avail = sizeof(out->inline_storage) - out->inline_used;
+
+	if (size <= avail) {
+		ptr = (char *)out->inline_storage + out->inline_used;
+		out->inline_used += size;
+		return ptr;
+	}
+
+	blk = out->storage;
+
+	if (blk == NULL || size > (blk->size - blk->used)) {
+		/* grow geometrically, e.g. for huge sparse maps */
+		avail = blk == NULL ? TAR_HEADER_INLINE_STORAGE : blk->size;
+		if (avail < (SIZE_MAX / 4))
+			avail *= 2;
+		if (avail < size)
+			avail = size;
+
+		if (SZ_ADD_OV(sizeof(*blk), avail, &total))
+			goto fail_ov;
+
+		blk = malloc(total);
+		if (blk == NULL) {
+			perror("allocating tar header data");
+			return NULL;
+		}
+
+		blk->next = out->storage;
+		blk->size = avail;
+		blk->used = 0;
+		out->storage = blk;
+	}
+
+	ptr = (char *)blk->data + blk->used;
+	blk->used += size;
+	return ptr;
+fail_ov:
+	fputs("allocating tar header data: numeric overflow\n", stderr);
+	return NULL;
+}
+
+char *header_strndup(tar_header_decoded_t *out, const char *str, size_t len)
+{
+	char *copy;
+
+	len = strnlen(str, len);
+
+	copy = header_alloc(out, len + 1);
+	if (copy != NULL) {
+		memcpy(copy, str, len);
+		copy[len] = '\0';
+	}
+
+	return copy;
+}
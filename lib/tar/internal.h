@@ -54,19 +54,29 @@ void update_checksum(tar_header_t *hdr);
 
 bool is_checksum_valid(const tar_header_t *hdr);
 
-sparse_map_t *read_sparse_map(const char *line);
+sparse_map_t *read_sparse_map(const char *line, tar_header_decoded_t *out);
 
-sparse_map_t *read_gnu_old_sparse(FILE *fp, tar_header_t *hdr);
+sparse_map_t *read_gnu_old_sparse(FILE *fp, tar_header_t *hdr,
+				  tar_header_decoded_t *out);
 
-void free_sparse_list(sparse_map_t *sparse);
+/*
+  Allocate memory from the storage area of a decoded header. The memory
+  is suitably aligned for any of the tar data structures and is released
+  by clear_header. Prints an error message to stderr on failure.
+ */
+void *header_alloc(tar_header_decoded_t *out, size_t size);
 
-void free_xattr_list(tar_xattr_t *list);
+char *header_strndup(tar_header_decoded_t *out, const char *str, size_t len);
 
 size_t base64_decode(sqfs_u8 *out, const char *in, size_t len);
 
 void urldecode(char *str);
 
-char *record_to_memory(FILE *fp, sqfs_u64 size);
+/*
+  Read a tar record into the storage area of a decoded header, skip the
+  padding and null-terminate it.
+ */
+char *record_to_memory(FILE *fp, sqfs_u64 size, tar_header_decoded_t *out);
 
 int read_pax_header(FILE *fp, sqfs_u64 entsize, unsigned int *set_by_pax,
 		    tar_header_decoded_t *out);
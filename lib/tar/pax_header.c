@@ -8,20 +8,24 @@
 
 #include "internal.h"
 
-static tar_xattr_t *mkxattr(const char *key, size_t keylen,
-			    const char *value, size_t valuelen)
+static tar_xattr_t *mkxattr(tar_header_decoded_t *out, char *key,
+			    size_t keylen, char *value, size_t valuelen)
 {
 	tar_xattr_t *xattr;
 
-	xattr = calloc(1, sizeof(*xattr) + keylen + 1 + valuelen + 1);
+	xattr = header_alloc(out, sizeof(*xattr));
 	if (xattr == NULL)
 		return NULL;
 
-	xattr->key = xattr->data;
-	xattr->value = (sqfs_u8 *)xattr->data + keylen + 1;
+	/* key and value are terminated in place inside the PAX record */
+	key[keylen] = '\0';
+	value[valuelen] = '\0';
+
+	xattr->key = key;
+	xattr->value = (sqfs_u8 *)value;
 	xattr->value_len = valuelen;
-	memcpy(xattr->key, key, keylen);
-	memcpy(xattr->value, value, valuelen);
+	xattr->next = out->xattr;
+	out->xattr = xattr;
 	return xattr;
 }
 
@@ -34,7 +38,9 @@ int read_pax_header(FILE *fp, sqfs_u64 entsize, unsigned int *set_by_pax,
 	tar_xattr_t *xattr;
 	long len;
 
-	buffer = record_to_memory(fp, entsize);
+	/* the record lives in the header storage and is parsed in place,
+	   strings are directly referenced instead of being copied */
+	buffer = record_to_memory(fp, entsize, out);
 	if (buffer == NULL)
 		return -1;
 
@@ -67,20 +73,14 @@ int read_pax_header(FILE *fp, sqfs_u64 entsize, unsigned int *set_by_pax,
 			out->sb.st_gid = field;
 			*set_by_pax |= PAX_GID;
 		} else if (!strncmp(ptr, "path=", 5)) {
-			free(out->name);
-			out->name = strdup(ptr + 5);
-			if (out->name == NULL)
-				goto fail_errno;
+			out->name = ptr + 5;
 			*set_by_pax |= PAX_NAME;
 		} else if (!strncmp(ptr, "size=", 5)) {
 			if (pax_read_decimal(ptr + 5, &out->record_size))
 				goto fail;
 			*set_by_pax |= PAX_SIZE;
 		} else if (!strncmp(ptr, "linkpath=", 9)) {
-			free(out->link_target);
-			out->link_target = strdup(ptr + 9);
-			if (out->link_target == NULL)
-				goto fail_errno;
+			out->link_target = ptr + 9;
 			*set_by_pax |= PAX_SLINK_TARGET;
 		} else if (!strncmp(ptr, "mtime=", 6)) {
 			if (ptr[6] == '-') {
@@ -94,16 +94,12 @@ int read_pax_header(FILE *fp, sqfs_u64 entsize, unsigned int *set_by_pax,
 			}
 			*set_by_pax |= PAX_MTIME;
 		} else if (!strncmp(ptr, "GNU.sparse.name=", 16)) {
-			free(out->name);
-			out->name = strdup(ptr + 16);
-			if (out->name == NULL)
-				goto fail_errno;
+			out->name = ptr + 16;
 			*set_by_pax |= PAX_NAME;
 		} else if (!strncmp(ptr, "GNU.sparse.map=", 15)) {
-			free_sparse_list(out->sparse);
 			sparse_last = NULL;
 
-			out->sparse = read_sparse_map(ptr + 15);
+			out->sparse = read_sparse_map(ptr + 15, out);
 			if (out->sparse == NULL)
 				goto fail;
 		} else if (!strncmp(ptr, "GNU.sparse.size=", 16)) {
@@ -116,13 +112,13 @@ int read_pax_header(FILE *fp, sqfs_u64 entsize, unsigned int *set_by_pax,
 		} else if (!strncmp(ptr, "GNU.sparse.numbytes=", 20)) {
 			if (pax_read_decimal(ptr + 20, &num_bytes))
 				goto fail;
-			sparse = calloc(1, sizeof(*sparse));
+			sparse = header_alloc(out, sizeof(*sparse));
 			if (sparse == NULL)
-				goto fail_errno;
+				goto fail;
+			sparse->next = NULL;
 			sparse->offset = offset;
 			sparse->count = num_bytes;
 			if (sparse_last == NULL) {
-				free_sparse_list(out->sparse);
 				out->sparse = sparse_last = sparse;
 			} else {
 				sparse_last->next = sparse;
@@ -137,13 +133,10 @@ int read_pax_header(FILE *fp, sqfs_u64 entsize, unsigned int *set_by_pax,
 
 			value = ptr + 1;
 
-			xattr = mkxattr(key, ptr - key,
+			xattr = mkxattr(out, key, ptr - key,
 					value, len - (value - line) - 1);
 			if (xattr == NULL)
-				goto fail_errno;
-
-			xattr->next = out->xattr;
-			out->xattr = xattr;
+				goto fail;
 		} else if (!strncmp(ptr, "LIBARCHIVE.xattr.", 17)) {
 			key = ptr + 17;
 
@@ -153,20 +146,18 @@ int read_pax_header(FILE *fp, sqfs_u64 entsize, unsigned int *set_by_pax,
 
 			value = ptr + 1;
 
-			xattr = mkxattr(key, ptr - key, value, strlen(value));
+			xattr = mkxattr(out, key, ptr - key,
+					value, strlen(value));
 			if (xattr == NULL)
-				goto fail_errno;
+				goto fail;
 
+			/* both decoders can safely work in place */
 			urldecode(xattr->key);
 			xattr->value_len = base64_decode(xattr->value, value,
 							 xattr->value_len);
-
-			xattr->next = out->xattr;
-			out->xattr = xattr;
 		}
 	}
 
-	free(buffer);
 	return 0;
 fail_malformed:
 	fputs("Found a malformed PAX header.\n", stderr);
@@ -174,10 +165,6 @@ fail_malformed:
 fail_ov:
 	fputs("Numeric overflow in PAX header.\n", stderr);
 	goto fail;
-fail_errno:
-	perror("reading pax header");
-	goto fail;
 fail:
-	free(buffer);
 	return -1;
 }
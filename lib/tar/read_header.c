@@ -8,6 +8,8 @@
 
 #include "internal.h"
 
+#include <stddef.h>
+
 static bool is_zero_block(const tar_header_t *hdr)
 {
 	const unsigned char *ptr = (const unsigned char *)hdr;
@@ -48,7 +50,7 @@ static int decode_header(const tar_header_t *hdr, unsigned int set_by_pax,
 			len2 = strnlen(hdr->tail.posix.prefix,
 				       sizeof(hdr->tail.posix.prefix));
 
-			out->name = malloc(len1 + 1 + len2 + 1);
+			out->name = header_alloc(out, len1 + 1 + len2 + 1);
 
 			if (out->name != NULL) {
 				memcpy(out->name, hdr->tail.posix.prefix, len2);
@@ -57,13 +59,12 @@ static int decode_header(const tar_header_t *hdr, unsigned int set_by_pax,
 				out->name[len1 + 1 + len2] = '\0';
 			}
 		} else {
-			out->name = strndup(hdr->name, sizeof(hdr->name));
+			out->name = header_strndup(out, hdr->name,
+						   sizeof(hdr->name));
 		}
 
-		if (out->name == NULL) {
-			perror("decoding filename");
+		if (out->name == NULL)
 			return -1;
-		}
 	}
 
 	if (!(set_by_pax & PAX_SIZE)) {
@@ -116,11 +117,10 @@ static int decode_header(const tar_header_t *hdr, unsigned int set_by_pax,
 	if (hdr->typeflag == TAR_TYPE_LINK ||
 	    hdr->typeflag == TAR_TYPE_SLINK) {
 		if (!(set_by_pax & PAX_SLINK_TARGET)) {
-			out->link_target = strdup(hdr->linkname);
-			if (out->link_target == NULL) {
-				perror("decoding symlink target");
+			out->link_target = header_strndup(out, hdr->linkname,
+							sizeof(hdr->linkname));
+			if (out->link_target == NULL)
 				return -1;
-			}
 		}
 	}
 
@@ -177,7 +177,8 @@ int read_header(FILE *fp, tar_header_decoded_t *out)
 	tar_header_t hdr;
 	int version;
 
-	memset(out, 0, sizeof(*out));
+	/* the inline storage does not need to be cleared */
+	memset(out, 0, offsetof(tar_header_decoded_t, inline_storage));
 
 	for (;;) {
 		if (read_retry("reading tar header", fp, &hdr, sizeof(hdr)))
@@ -205,8 +206,7 @@ int read_header(FILE *fp, tar_header_decoded_t *out)
 				goto fail;
 			if (pax_size < 1 || pax_size > TAR_MAX_SYMLINK_LEN)
 				goto fail_slink_len;
-			free(out->link_target);
-			out->link_target = record_to_memory(fp, pax_size);
+			out->link_target = record_to_memory(fp, pax_size, out);
 			if (out->link_target == NULL)
 				goto fail;
 			set_by_pax |= PAX_SLINK_TARGET;
@@ -216,8 +216,7 @@ int read_header(FILE *fp, tar_header_decoded_t *out)
 				goto fail;
 			if (pax_size < 1 || pax_size > TAR_MAX_PATH_LEN)
 				goto fail_path_len;
-			free(out->name);
-			out->name = record_to_memory(fp, pax_size);
+			out->name = record_to_memory(fp, pax_size, out);
 			if (out->name == NULL)
 				goto fail;
 			set_by_pax |= PAX_NAME;
@@ -238,8 +237,7 @@ int read_header(FILE *fp, tar_header_decoded_t *out)
 				goto fail;
 			continue;
 		case TAR_TYPE_GNU_SPARSE:
-			free_sparse_list(out->sparse);
-			out->sparse = read_gnu_old_sparse(fp, &hdr);
+			out->sparse = read_gnu_old_sparse(fp, &hdr, out);
 			if (out->sparse == NULL)
 				goto fail;
 			if (read_number(hdr.tail.gnu.realsize,
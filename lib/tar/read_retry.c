@@ -33,25 +33,25 @@ int read_retry(const char *errstr, FILE *fp, void *buffer, size_t size)
 	return 0;
 }
 
-char *record_to_memory(FILE *fp, sqfs_u64 size)
+char *record_to_memory(FILE *fp, sqfs_u64 size, tar_header_decoded_t *out)
 {
-	char *buffer = malloc(size + 1);
+	char *buffer;
 
+	if (size >= SIZE_MAX) {
+		fputs("reading tar record: numeric overflow\n", stderr);
+		return NULL;
+	}
+
+	buffer = header_alloc(out, size + 1);
 	if (buffer == NULL)
-		goto fail_errno;
+		return NULL;
 
 	if (read_retry("reading tar record", fp, buffer, size))
-		goto fail;
+		return NULL;
 
 	if (skip_padding(fp, size))
-		goto fail;
+		return NULL;
 
 	buffer[size] = '\0';
 	return buffer;
-fail_errno:
-	perror("reading tar record");
-	goto fail;
-fail:
-	free(buffer);
-	return NULL;
 }
@@ -8,14 +8,16 @@
 
 #include "internal.h"
 
-sparse_map_t *read_sparse_map(const char *line)
+sparse_map_t *read_sparse_map(const char *line, tar_header_decoded_t *out)
 {
 	sparse_map_t *last = NULL, *list = NULL, *ent = NULL;
 
 	do {
-		ent = calloc(1, sizeof(*ent));
+		ent = header_alloc(out, sizeof(*ent));
 		if (ent == NULL)
-			goto fail_errno;
+			return NULL;
+
+		ent->next = NULL;
 
 		if (pax_read_decimal(line, &ent->offset))
 			goto fail_format;
@@ -41,14 +43,7 @@ sparse_map_t *read_sparse_map(const char *line)
 	} while (*(line++) == ',');
 
 	return list;
-fail_errno:
-	perror("parsing GNU pax sparse file record");
-	goto fail;
 fail_format:
 	fputs("malformed GNU pax sparse file record\n", stderr);
-	goto fail;
-fail:
-	free_sparse_list(list);
-	free(ent);
 	return NULL;
 }
@@ -8,7 +8,8 @@
 
 #include "internal.h"
 
-sparse_map_t *read_gnu_old_sparse(FILE *fp, tar_header_t *hdr)
+sparse_map_t *read_gnu_old_sparse(FILE *fp, tar_header_t *hdr,
+				  tar_header_decoded_t *out)
 {
 	sparse_map_t *list = NULL, *end = NULL, *node;
 	gnu_sparse_t sph;
@@ -23,15 +24,16 @@ sparse_map_t *read_gnu_old_sparse(FILE *fp, tar_header_t *hdr)
 
 		if (read_octal(hdr->tail.gnu.sparse[i].offset,
 			       sizeof(hdr->tail.gnu.sparse[i].offset), &off))
-			goto fail;
+			return NULL;
 		if (read_octal(hdr->tail.gnu.sparse[i].numbytes,
 			       sizeof(hdr->tail.gnu.sparse[i].numbytes), &sz))
-			goto fail;
+			return NULL;
 
-		node = calloc(1, sizeof(*node));
+		node = header_alloc(out, sizeof(*node));
 		if (node == NULL)
-			goto fail_errno;
+			return NULL;
 
+		node->next = NULL;
 		node->offset = off;
 		node->count = sz;
 
@@ -49,7 +51,7 @@ sparse_map_t *read_gnu_old_sparse(FILE *fp, tar_header_t *hdr)
 	do {
 		if (read_retry("reading GNU sparse header",
 			       fp, &sph, sizeof(sph))) {
-			goto fail;
+			return NULL;
 		}
 
 		for (i = 0; i < 21; ++i) {
@@ -60,15 +62,16 @@ sparse_map_t *read_gnu_old_sparse(FILE *fp, tar_header_t *hdr)
 
 			if (read_octal(sph.sparse[i].offset,
 				       sizeof(sph.sparse[i].offset), &off))
-				goto fail;
+				return NULL;
 			if (read_octal(sph.sparse[i].numbytes,
 				       sizeof(sph.sparse[i].numbytes), &sz))
-				goto fail;
+				return NULL;
 
-			node = calloc(1, sizeof(*node));
+			node = header_alloc(out, sizeof(*node));
 			if (node == NULL)
-				goto fail_errno;
+				return NULL;
 
+			node->next = NULL;
 			node->offset = off;
 			node->count = sz;
 
@@ -82,10 +85,4 @@ sparse_map_t *read_gnu_old_sparse(FILE *fp, tar_header_t *hdr)
 	} while (sph.isextended != 0);
 
 	return list;
-fail_errno:
-	perror("parsing GNU sparse header");
-	goto fail;
-fail:
-	free_sparse_list(list);
-	return NULL;
 }
@@ -0,0 +1,229 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_proc_bench.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#define FILE_SIZE (1024 * 1024)
+
+typedef struct {
+	sqfs_file_t base;
+	sqfs_u64 size;
+} null_file_t;
+
+static int null_read_at(sqfs_file_t *file, sqfs_u64 offset,
+			void *buffer, size_t size)
+{
+	(void)file; (void)offset; (void)buffer; (void)size;
+	return SQFS_ERROR_IO;
+}
+
+static int null_write_at(sqfs_file_t *file, sqfs_u64 offset,
+			 const void *buffer, size_t size)
+{
+	null_file_t *null = (null_file_t *)file;
+	(void)buffer;
+
+	if (offset + size > null->size)
+		null->size = offset + size;
+
+	return 0;
+}
+
+static sqfs_u64 null_get_size(const sqfs_file_t *file)
+{
+	return ((const null_file_t *)file)->size;
+}
+
+static int null_truncate(sqfs_file_t *file, sqfs_u64 size)
+{
+	((null_file_t *)file)->size = size;
+	return 0;
+}
+
+static void null_destroy(sqfs_object_t *obj)
+{
+	(void)obj;
+}
+
+/* half random, half repetitive, so every compressor has something to do */
+static void fill_buffer(sqfs_u8 *data, size_t size, sqfs_u32 *state)
+{
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		if ((i / 64) % 2) {
+			data[i] = "squashfs"[i % 8];
+		} else {
+			*state ^= *state << 13;
+			*state ^= *state >> 17;
+			*state ^= *state << 5;
+			data[i] = *state & 0xFF;
+		}
+	}
+}
+
+static int file_done(void *user, sqfs_inode_generic_t **inode)
+{
+	(void)inode;
+	*((unsigned long *)user) += 1;
+	return 0;
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char **argv)
+{
+	const sqfs_block_processor_stats_t *stats;
+	null_file_t outfile = { .base = { .base = { .destroy = null_destroy },
+					  .read_at = null_read_at,
+					  .write_at = null_write_at,
+					  .get_size = null_get_size,
+					  .truncate = null_truncate } };
+	unsigned long i, num_jobs, megs = 256, files_done = 0;
+	int ret, status = EXIT_FAILURE;
+	sqfs_inode_generic_t **inodes;
+	sqfs_compressor_config_t cfg;
+	sqfs_block_processor_t *proc;
+	unsigned int *cpus = NULL;
+	sqfs_block_writer_t *wr;
+	sqfs_frag_table_t *tbl;
+	sqfs_compressor_t *cmp;
+	sqfs_u32 state = 42;
+	size_t num_cpus = 0;
+	double seconds;
+	sqfs_u8 *data;
+
+	if (argc < 2 || argc > 4) {
+		fputs("usage: block_proc_bench <jobs> [<cpu-list>] [<MiB>]\n",
+		      stderr);
+		return EXIT_FAILURE;
+	}
+
+	num_jobs = strtoul(argv[1], NULL, 10);
+
+	if (argc >= 3 && strcmp(argv[2], "-") != 0) {
+		if (parse_cpu_list(argv[2], &cpus, &num_cpus))
+			return EXIT_FAILURE;
+	}
+
+	if (argc == 4)
+		megs = strtoul(argv[3], NULL, 10);
+
+	inodes = calloc(megs, sizeof(inodes[0]));
+	data = malloc(FILE_SIZE);
+
+	if (inodes == NULL || data == NULL) {
+		perror("allocating buffers");
+		goto out_buffers;
+	}
+
+	sqfs_compressor_config_init(&cfg, compressor_get_default(),
+				    SQFS_DEFAULT_BLOCK_SIZE, 0);
+
+	ret = sqfs_compressor_create(&cfg, &cmp);
+	if (ret) {
+		sqfs_perror("block_proc_bench", "creating compressor", ret);
+		goto out_buffers;
+	}
+
+	wr = sqfs_block_writer_create((sqfs_file_t *)&outfile, 0, 0);
+	tbl = sqfs_frag_table_create(0);
+	proc = NULL;
+
+	if (wr != NULL && tbl != NULL) {
+		proc = sqfs_block_processor_create(SQFS_DEFAULT_BLOCK_SIZE,
+						   cmp, num_jobs,
+						   10 * num_jobs, wr, tbl);
+	}
+
+	if (proc == NULL) {
+		perror("creating block processor");
+		goto out;
+	}
+
+	if (cpus != NULL) {
+		ret = sqfs_block_processor_set_cpu_affinity(proc, cpus,
+							    num_cpus);
+		if (ret) {
+			sqfs_perror("block_proc_bench", "pinning workers", ret);
+			goto out;
+		}
+	}
+
+	sqfs_block_processor_set_file_done_callback(proc, &files_done,
+						    file_done);
+
+	seconds = get_time();
+
+	for (i = 0; i < megs; ++i) {
+		fill_buffer(data, FILE_SIZE, &state);
+
+		ret = sqfs_block_processor_begin_file(proc, inodes + i, 0);
+		if (ret == 0)
+			ret = sqfs_block_processor_append(proc, data, FILE_SIZE);
+		if (ret == 0)
+			ret = sqfs_block_processor_end_file(proc);
+
+		if (ret) {
+			sqfs_perror("block_proc_bench", "packing data", ret);
+			goto out;
+		}
+	}
+
+	ret = sqfs_block_processor_finish(proc);
+	if (ret) {
+		sqfs_perror("block_proc_bench", "finishing data", ret);
+		goto out;
+	}
+
+	seconds = get_time() - seconds;
+	stats = sqfs_block_processor_get_stats(proc);
+
+	printf("%lu MiB with %lu jobs in %.3f seconds", megs, num_jobs,
+	       seconds);
+	if (seconds > 0.0)
+		printf(", %.1f MiB/second", (double)megs / seconds);
+	fputc('\n', stdout);
+
+	printf("worker idle: " PRI_U64 ", packer stalled: " PRI_U64 "\n",
+	       stats->worker_idle_count, stats->frontend_stall_count);
+
+	if (files_done != megs) {
+		fprintf(stderr, "only %lu of %lu files reported as done\n",
+			files_done, megs);
+		goto out;
+	}
+
+	status = EXIT_SUCCESS;
+out:
+	if (proc != NULL)
+		sqfs_destroy(proc);
+	if (tbl != NULL)
+		sqfs_destroy(tbl);
+	if (wr != NULL)
+		sqfs_destroy(wr);
+	sqfs_destroy(cmp);
+out_buffers:
+	for (i = 0; inodes != NULL && i < megs; ++i)
+		free(inodes[i]);
+	free(inodes);
+	free(data);
+	free(cpus);
+	return status;
+}
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_writer_align.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/block_writer.h"
+#include "sqfs/block.h"
+#include "mem_file.h"
+
+#define DEVBLK_SIZE (512)
+#define BLOCK_SIZE (300)
+#define HEADER_SIZE (96)
+
+static sqfs_u8 image[HEADER_SIZE + 16 * DEVBLK_SIZE];
+
+static sqfs_u64 write_file(sqfs_block_writer_t *wr, sqfs_u8 fill,
+			   size_t count, sqfs_u32 flags)
+{
+	sqfs_u8 data[BLOCK_SIZE];
+	sqfs_u64 location;
+	sqfs_u32 blkflags;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < count; ++i) {
+		memset(data, fill + i, sizeof(data));
+
+		blkflags = flags;
+		if (i == 0)
+			blkflags |= SQFS_BLK_FIRST_BLOCK;
+		if (i == count - 1)
+			blkflags |= SQFS_BLK_LAST_BLOCK;
+
+		ret = sqfs_block_writer_write(wr, sizeof(data), fill + i,
+					      blkflags, data, &location);
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	return location;
+}
+
+int main(void)
+{
+	sqfs_u64 unaligned, aligned, loc, size;
+	sqfs_block_writer_t *wr;
+	mem_file_t file;
+
+	mem_file_init(&file, image, sizeof(image), HEADER_SIZE);
+
+	wr = sqfs_block_writer_create(&file.base, DEVBLK_SIZE, 0);
+	TEST_NOT_NULL(wr);
+
+	/* an unaligned copy of the data */
+	unaligned = write_file(wr, 0x10, 2, 0);
+	TEST_EQUAL_UI(unaligned, HEADER_SIZE);
+	TEST_EQUAL_UI(file.size, HEADER_SIZE + 2 * BLOCK_SIZE);
+
+	/* an aligned file must not be deduplicated against it */
+	aligned = write_file(wr, 0x10, 2, SQFS_BLK_ALIGN);
+	TEST_EQUAL_UI(aligned, 2 * DEVBLK_SIZE);
+	TEST_EQUAL_UI(file.size, 4 * DEVBLK_SIZE);
+	TEST_ASSERT(memcmp(image + aligned, image + unaligned,
+			   2 * BLOCK_SIZE) == 0);
+
+	/* but it can reuse an aligned copy, the padding is dropped again */
+	size = file.size;
+	loc = write_file(wr, 0x10, 2, SQFS_BLK_ALIGN);
+	TEST_EQUAL_UI(loc, aligned);
+	TEST_EQUAL_UI(file.size, size);
+
+	/* unaligned files still use the first copy */
+	loc = write_file(wr, 0x10, 2, 0);
+	TEST_EQUAL_UI(loc, unaligned);
+	TEST_EQUAL_UI(file.size, size);
+
+	/* a match that does not start on a device block is not used */
+	loc = write_file(wr, 0x11, 1, SQFS_BLK_ALIGN);
+	TEST_EQUAL_UI(loc, size);
+	TEST_EQUAL_UI(file.size, size + DEVBLK_SIZE);
+
+	sqfs_destroy(wr);
+	return EXIT_SUCCESS;
+}
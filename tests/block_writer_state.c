@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_writer_state.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/block_writer.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "sqfs/io.h"
+#include "mem_file.h"
+
+#include <stdlib.h>
+
+#define BLOCK_SIZE (512)
+#define HEADER_SIZE (96)
+#define MAX_SIZE (HEADER_SIZE + 16 * BLOCK_SIZE)
+
+static sqfs_u8 image[MAX_SIZE];
+
+static void write_file(sqfs_block_writer_t *wr, sqfs_u8 fill,
+		       size_t count, sqfs_u64 *location)
+{
+	sqfs_u8 data[BLOCK_SIZE];
+	sqfs_u32 flags;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < count; ++i) {
+		memset(data, fill + i, sizeof(data));
+
+		flags = 0;
+		if (i == 0)
+			flags |= SQFS_BLK_FIRST_BLOCK;
+		if (i == count - 1)
+			flags |= SQFS_BLK_LAST_BLOCK;
+
+		ret = sqfs_block_writer_write(wr, sizeof(data), fill + i,
+					      flags, data, location);
+		TEST_EQUAL_I(ret, 0);
+	}
+}
+
+static void check_stats(const sqfs_block_writer_stats_t *a,
+			const sqfs_block_writer_stats_t *b)
+{
+	TEST_EQUAL_UI(a->bytes_submitted, b->bytes_submitted);
+	TEST_EQUAL_UI(a->bytes_written, b->bytes_written);
+	TEST_EQUAL_UI(a->blocks_submitted, b->blocks_submitted);
+	TEST_EQUAL_UI(a->blocks_written, b->blocks_written);
+}
+
+int main(void)
+{
+	sqfs_block_writer_stats_t saved_stats;
+	sqfs_u64 loc_a, loc_b, loc, saved_size;
+	sqfs_block_writer_t *wr;
+	size_t state_size;
+	mem_file_t file;
+	void *state;
+	int ret;
+
+	mem_file_init(&file, image, sizeof(image), HEADER_SIZE);
+
+	/* write two files and take a snapshot */
+	wr = sqfs_block_writer_create(&file.base, 0, 0);
+	TEST_NOT_NULL(wr);
+
+	write_file(wr, 0x10, 3, &loc_a);
+	write_file(wr, 0x20, 2, &loc_b);
+	TEST_EQUAL_UI(loc_a, HEADER_SIZE);
+	TEST_EQUAL_UI(loc_b, HEADER_SIZE + 3 * BLOCK_SIZE);
+	TEST_EQUAL_UI(file.size, HEADER_SIZE + 5 * BLOCK_SIZE);
+
+	ret = sqfs_block_writer_save_state(wr, &state, &state_size);
+	TEST_EQUAL_I(ret, 0);
+	TEST_NOT_NULL(state);
+
+	saved_size = file.size;
+	saved_stats = *sqfs_block_writer_get_stats(wr);
+
+	/* a writer that already wrote something refuses to be restored */
+	ret = sqfs_block_writer_restore_state(wr, state, state_size);
+	TEST_EQUAL_I(ret, SQFS_ERROR_SEQUENCE);
+
+	/* keep writing after the snapshot, as if interrupted later on */
+	write_file(wr, 0x30, 4, &loc);
+	TEST_EQUAL_UI(file.size, saved_size + 4 * BLOCK_SIZE);
+	sqfs_destroy(wr);
+
+	/* restoring throws away everything after the snapshot */
+	wr = sqfs_block_writer_create(&file.base, 0, 0);
+	TEST_NOT_NULL(wr);
+
+	ret = sqfs_block_writer_restore_state(wr, state, state_size - 1);
+	TEST_EQUAL_I(ret, SQFS_ERROR_CORRUPTED);
+
+	ret = sqfs_block_writer_restore_state(wr, state,
+					      state_size - sizeof(sqfs_u64));
+	TEST_EQUAL_I(ret, SQFS_ERROR_CORRUPTED);
+
+	ret = sqfs_block_writer_restore_state(wr, state, state_size);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(file.size, saved_size);
+	check_stats(sqfs_block_writer_get_stats(wr), &saved_stats);
+
+	/* blocks from before the snapshot are still deduplicated */
+	write_file(wr, 0x20, 2, &loc);
+	TEST_EQUAL_UI(loc, loc_b);
+	TEST_EQUAL_UI(file.size, saved_size);
+
+	write_file(wr, 0x10, 3, &loc);
+	TEST_EQUAL_UI(loc, loc_a);
+	TEST_EQUAL_UI(file.size, saved_size);
+
+	/* new data is appended where the snapshot left off */
+	write_file(wr, 0x40, 1, &loc);
+	TEST_EQUAL_UI(loc, saved_size);
+	TEST_EQUAL_UI(file.size, saved_size + BLOCK_SIZE);
+	sqfs_destroy(wr);
+
+	/* the output must not be shorter than the snapshot */
+	file.size = saved_size - 1;
+
+	wr = sqfs_block_writer_create(&file.base, 0, 0);
+	TEST_NOT_NULL(wr);
+
+	ret = sqfs_block_writer_restore_state(wr, state, state_size);
+	TEST_EQUAL_I(ret, SQFS_ERROR_OUT_OF_BOUNDS);
+	sqfs_destroy(wr);
+
+	free(state);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * data_reader.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/data_reader.h"
+#include "sqfs/error.h"
+#include "sqfs/inode.h"
+#include "sqfs/block.h"
+#include "sqfs/io.h"
+#include "mem_file.h"
+
+#define BLOCK_SIZE (4096)
+#define BLOCK_COUNT (3)
+#define DATA_START (96)
+#define FILE_SIZE (BLOCK_SIZE * BLOCK_COUNT)
+
+/* an image with one file, stored as uncompressed blocks back to back */
+static sqfs_u8 image[DATA_START + FILE_SIZE];
+
+static sqfs_u8 get_byte(size_t offset)
+{
+	return (offset * 7 + offset / BLOCK_SIZE) & 0xFF;
+}
+
+static void check_read(sqfs_data_reader_t *rd,
+		       const sqfs_inode_generic_t *inode,
+		       sqfs_u64 offset, sqfs_u32 size)
+{
+	static sqfs_u8 buffer[FILE_SIZE + BLOCK_SIZE];
+	sqfs_u32 expected = 0;
+	sqfs_s32 ret;
+	size_t i;
+
+	if (offset < FILE_SIZE)
+		expected = size < FILE_SIZE - offset ? size :
+			(FILE_SIZE - offset);
+
+	ret = sqfs_data_reader_read(rd, inode, offset, buffer, size);
+	TEST_EQUAL_I(ret, (long)expected);
+
+	for (i = 0; i < expected; ++i)
+		TEST_EQUAL_UI(buffer[i], get_byte(offset + i));
+}
+
+int main(void)
+{
+	sqfs_inode_generic_t *inode;
+	sqfs_data_reader_t *rd;
+	sqfs_u32 *sizes;
+	mem_file_t file;
+	size_t i;
+
+	for (i = 0; i < FILE_SIZE; ++i)
+		image[DATA_START + i] = get_byte(i);
+
+	mem_file_init(&file, image, sizeof(image), sizeof(image));
+
+	inode = calloc(1, sizeof(*inode) + BLOCK_COUNT * sizeof(sqfs_u32));
+	TEST_NOT_NULL(inode);
+
+	inode->base.type = SQFS_INODE_FILE;
+	inode->payload_bytes_available = BLOCK_COUNT * sizeof(sqfs_u32);
+	inode->payload_bytes_used = BLOCK_COUNT * sizeof(sqfs_u32);
+	inode->data.file.blocks_start = DATA_START;
+	inode->data.file.fragment_index = 0xFFFFFFFF;
+	inode->data.file.fragment_offset = 0xFFFFFFFF;
+	inode->data.file.file_size = FILE_SIZE;
+
+	sizes = (sqfs_u32 *)inode->extra;
+	for (i = 0; i < BLOCK_COUNT; ++i)
+		sizes[i] = BLOCK_SIZE | (1 << 24);
+
+	/* overlapping reads through the same reader and its staging buffer */
+	rd = sqfs_data_reader_create(&file.base, BLOCK_SIZE, NULL);
+	TEST_NOT_NULL(rd);
+
+	check_read(rd, inode, 0, 2 * BLOCK_SIZE);
+	check_read(rd, inode, BLOCK_SIZE, 2 * BLOCK_SIZE);
+	check_read(rd, inode, BLOCK_SIZE / 2, 2 * BLOCK_SIZE);
+	check_read(rd, inode, 0, FILE_SIZE);
+	check_read(rd, inode, 100, FILE_SIZE);
+	check_read(rd, inode, 2 * BLOCK_SIZE, 2 * BLOCK_SIZE);
+	check_read(rd, inode, BLOCK_SIZE + 10, 100);
+	check_read(rd, inode, 0, 3 * BLOCK_SIZE / 2);
+	check_read(rd, inode, BLOCK_SIZE / 2, FILE_SIZE);
+	check_read(rd, inode, FILE_SIZE - 50, 1000);
+
+	sqfs_destroy(rd);
+	free(inode);
+	return EXIT_SUCCESS;
+}
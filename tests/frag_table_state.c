@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * frag_table_state.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/frag_table.h"
+#include "sqfs/block.h"
+#include "sqfs/error.h"
+#include "test.h"
+
+#include <stdlib.h>
+
+#define NUM_FRAGMENTS (300)
+#define NUM_TAIL_ENDS (200)
+
+static sqfs_u64 frag_location(sqfs_u32 i)
+{
+	return 96 + (sqfs_u64)i * 8192;
+}
+
+static sqfs_u32 frag_size(sqfs_u32 i)
+{
+	return 1000 + i;
+}
+
+static sqfs_u32 tail_hash(sqfs_u32 i)
+{
+	return i * 0x9E3779B1;
+}
+
+static void check_table(sqfs_frag_table_t *tbl)
+{
+	sqfs_u32 i, index, offset;
+	sqfs_fragment_t frag;
+	int ret;
+
+	TEST_EQUAL_UI(sqfs_frag_table_get_size(tbl), NUM_FRAGMENTS);
+
+	for (i = 0; i < NUM_FRAGMENTS; ++i) {
+		ret = sqfs_frag_table_lookup(tbl, i, &frag);
+		TEST_EQUAL_I(ret, 0);
+		TEST_EQUAL_UI(frag.start_offset, frag_location(i));
+		TEST_EQUAL_UI(frag.size, frag_size(i));
+	}
+
+	ret = sqfs_frag_table_lookup(tbl, NUM_FRAGMENTS, &frag);
+	TEST_EQUAL_I(ret, SQFS_ERROR_OUT_OF_BOUNDS);
+
+	for (i = 0; i < NUM_TAIL_ENDS; ++i) {
+		ret = sqfs_frag_table_find_tail_end(tbl, tail_hash(i), i + 1,
+						    &index, &offset);
+		TEST_EQUAL_I(ret, 0);
+		TEST_EQUAL_UI(index, i % NUM_FRAGMENTS);
+		TEST_EQUAL_UI(offset, i * 3);
+	}
+
+	ret = sqfs_frag_table_find_tail_end(tbl, tail_hash(0), 2,
+					    &index, &offset);
+	TEST_ASSERT(ret != 0);
+}
+
+int main(void)
+{
+	sqfs_frag_table_t *tbl, *copy;
+	size_t size, empty_size;
+	void *state, *empty;
+	sqfs_u32 i, index;
+	int ret;
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+
+	/* an empty table round trips into an empty table */
+	ret = sqfs_frag_table_save_state(tbl, &empty, &empty_size);
+	TEST_EQUAL_I(ret, 0);
+
+	/* fill a table past its initial capacities */
+	for (i = 0; i < NUM_FRAGMENTS; ++i) {
+		ret = sqfs_frag_table_append(tbl, 0, 0, &index);
+		TEST_EQUAL_I(ret, 0);
+		TEST_EQUAL_UI(index, i);
+
+		ret = sqfs_frag_table_set(tbl, i, frag_location(i),
+					  frag_size(i));
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	for (i = 0; i < NUM_TAIL_ENDS; ++i) {
+		ret = sqfs_frag_table_add_tail_end(tbl, i % NUM_FRAGMENTS,
+						   i * 3, i + 1, tail_hash(i));
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	check_table(tbl);
+
+	ret = sqfs_frag_table_save_state(tbl, &state, &size);
+	TEST_EQUAL_I(ret, 0);
+	TEST_NOT_NULL(state);
+
+	/* restore replaces whatever a table contained before */
+	copy = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(copy);
+
+	ret = sqfs_frag_table_append(copy, 1234, 5678, NULL);
+	TEST_EQUAL_I(ret, 0);
+	ret = sqfs_frag_table_add_tail_end(copy, 0, 0, 42, 42);
+	TEST_EQUAL_I(ret, 0);
+
+	ret = sqfs_frag_table_restore_state(copy, state, size);
+	TEST_EQUAL_I(ret, 0);
+	check_table(copy);
+
+	ret = sqfs_frag_table_find_tail_end(copy, 42, 42, &index, &i);
+	TEST_ASSERT(ret != 0);
+
+	/* a restored table can be extended further */
+	ret = sqfs_frag_table_append(copy, 42, 43, &index);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(index, NUM_FRAGMENTS);
+	TEST_EQUAL_UI(sqfs_frag_table_get_size(copy), NUM_FRAGMENTS + 1);
+
+	/* malformed states are rejected */
+	ret = sqfs_frag_table_restore_state(copy, state, 0);
+	TEST_EQUAL_I(ret, SQFS_ERROR_CORRUPTED);
+
+	ret = sqfs_frag_table_restore_state(copy, state, size - 1);
+	TEST_EQUAL_I(ret, SQFS_ERROR_CORRUPTED);
+
+	ret = sqfs_frag_table_restore_state(copy, empty, empty_size);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(sqfs_frag_table_get_size(copy), 0);
+
+	ret = sqfs_frag_table_find_tail_end(copy, tail_hash(1), 2,
+					    &index, &i);
+	TEST_ASSERT(ret != 0);
+
+	sqfs_destroy(copy);
+	sqfs_destroy(tbl);
+	free(state);
+	free(empty);
+	return EXIT_SUCCESS;
+}
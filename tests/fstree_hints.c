@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * fstree_hints.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/block.h"
+#include "fstree.h"
+#include "test.h"
+
+#define STR(x) #x
+#define STRVALUE(x) STR(x)
+
+#define TEST_PATH STRVALUE(TESTPATH)
+
+static tree_node_t *check_file(tree_node_t *n, const char *name,
+			       unsigned int uid, const char *input,
+			       int flags)
+{
+	TEST_NOT_NULL(n);
+	TEST_EQUAL_UI(n->mode, S_IFREG | 0644);
+	TEST_EQUAL_UI(n->uid, uid);
+	TEST_EQUAL_UI(n->gid, uid + 1);
+	TEST_STR_EQUAL(n->name, name);
+	TEST_STR_EQUAL(n->data.file.input_file, input);
+	TEST_EQUAL_I(n->data.file.flags, flags);
+	return n->next;
+}
+
+static int parse_line(const char *line)
+{
+	fstree_t fs;
+	FILE *fp;
+	int ret;
+
+	fp = tmpfile();
+	TEST_NOT_NULL(fp);
+	TEST_ASSERT(fputs(line, fp) >= 0);
+	TEST_ASSERT(fflush(fp) == 0);
+	rewind(fp);
+
+	TEST_ASSERT(fstree_init(&fs, NULL) == 0);
+	ret = fstree_from_file(&fs, "testfile", fp);
+
+	fstree_cleanup(&fs);
+	fclose(fp);
+	return ret;
+}
+
+int main(void)
+{
+	tree_node_t *n;
+	fstree_t fs;
+	FILE *fp;
+
+	fp = test_open_read(TEST_PATH);
+
+	TEST_ASSERT(fstree_init(&fs, NULL) == 0);
+	TEST_ASSERT(fstree_from_file(&fs, "testfile", fp) == 0);
+
+	fstree_post_process(&fs);
+	n = fs.root->data.dir.children;
+
+	n = check_file(n, "afile", 1, "afile", 0);
+	n = check_file(n, "bhint", 3, "../data/bhint",
+		       SQFS_BLK_DONT_COMPRESS | SQFS_BLK_ALIGN);
+
+	/* a location starting with a bracket is still a location */
+	n = check_file(n, "cbracket", 5, "[nocompress] data", 0);
+	n = check_file(n, "dboth", 7, "[odd]name", SQFS_BLK_DONT_DEDUPLICATE);
+	n = check_file(n, "e quoted", 9, "e quoted", SQFS_BLK_DONT_FRAGMENT);
+	TEST_NULL(n);
+
+	fclose(fp);
+	fstree_cleanup(&fs);
+
+	/* malformed or misplaced hints are rejected */
+	TEST_ASSERT(parse_line("file[nocompress] /a 0644 0 0\n") == 0);
+	TEST_ASSERT(parse_line("file[bogus] /a 0644 0 0\n") != 0);
+	TEST_ASSERT(parse_line("file[nocompress /a 0644 0 0\n") != 0);
+	TEST_ASSERT(parse_line("file[nocompress]/a 0644 0 0\n") != 0);
+	TEST_ASSERT(parse_line("dir[align] /a 0755 0 0\n") != 0);
+	TEST_ASSERT(parse_line("slink[align] /a 0777 0 0 b\n") != 0);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,355 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * inode_cache.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "inode_cache.h"
+#include "sqfs/error.h"
+#include "sqfs/inode.h"
+#include "test.h"
+
+#include <stdlib.h>
+
+#ifdef WITH_PTHREAD
+#include "threading.h"
+
+#define NUM_THREADS (4)
+#define NUM_LOOKUPS (20000)
+#define NUM_REFS (16)
+#endif
+
+#define TARGET "some/symlink/target"
+
+static sqfs_inode_generic_t *mk_file(sqfs_u32 num_blocks, sqfs_u32 inode_num)
+{
+	sqfs_inode_generic_t *inode;
+	sqfs_u32 i;
+
+	inode = calloc(1, sizeof(*inode) + num_blocks * sizeof(sqfs_u32));
+	TEST_NOT_NULL(inode);
+
+	inode->base.type = SQFS_INODE_FILE;
+	inode->base.inode_number = inode_num;
+	inode->payload_bytes_available = num_blocks * sizeof(sqfs_u32);
+	inode->payload_bytes_used = num_blocks * sizeof(sqfs_u32);
+	inode->data.file.fragment_index = 0xFFFFFFFF;
+
+	for (i = 0; i < num_blocks; ++i)
+		inode->extra[i] = inode_num * 1000 + i;
+
+	return inode;
+}
+
+/* like sqfs_meta_reader_read_inode, the target is null terminated */
+static sqfs_inode_generic_t *mk_slink(sqfs_u32 inode_num)
+{
+	size_t len = strlen(TARGET);
+	sqfs_inode_generic_t *inode;
+
+	inode = calloc(1, sizeof(*inode) + len + 1);
+	TEST_NOT_NULL(inode);
+
+	inode->base.type = SQFS_INODE_SLINK;
+	inode->base.inode_number = inode_num;
+	inode->payload_bytes_available = len + 1;
+	inode->payload_bytes_used = len;
+	inode->data.slink.target_size = len;
+	memcpy(inode->extra, TARGET, len + 1);
+	return inode;
+}
+
+static void check_stats(sqfs_inode_cache_t *cache, sqfs_u64 count,
+			sqfs_u64 hits, sqfs_u64 misses, sqfs_u64 evicted)
+{
+	sqfs_inode_cache_stats_t stats;
+
+	memset(&stats, 0, sizeof(stats));
+	sqfs_inode_cache_get_stats(cache, &stats);
+	TEST_EQUAL_UI(stats.size, sizeof(stats));
+	TEST_EQUAL_UI(stats.inode_count, count);
+	TEST_EQUAL_UI(stats.hit_count, hits);
+	TEST_EQUAL_UI(stats.miss_count, misses);
+	TEST_EQUAL_UI(stats.evict_count, evicted);
+}
+
+static bool is_cached(sqfs_inode_cache_t *cache, sqfs_u64 ref,
+		      sqfs_inode_generic_t *expect)
+{
+	sqfs_inode_generic_t *out = NULL;
+	int ret;
+
+	ret = inode_cache_get(cache, ref, &out);
+	TEST_ASSERT(ret >= 0);
+
+	if (ret > 0) {
+		TEST_NULL(out);
+		return false;
+	}
+
+	TEST_NOT_NULL(out);
+	TEST_EQUAL_UI(out->payload_bytes_used, expect->payload_bytes_used);
+	TEST_EQUAL_UI(out->payload_bytes_available,
+		      expect->payload_bytes_used);
+	TEST_ASSERT(memcmp(&out->base, &expect->base,
+			   sizeof(out->base)) == 0);
+	TEST_ASSERT(memcmp(out->extra, expect->extra,
+			   expect->payload_bytes_used) == 0);
+	free(out);
+	return true;
+}
+
+static void test_lru(void)
+{
+	sqfs_inode_generic_t *inodes[4];
+	sqfs_inode_cache_t *cache;
+	size_t i;
+
+	cache = sqfs_inode_cache_create(3);
+	TEST_NOT_NULL(cache);
+	check_stats(cache, 0, 0, 0, 0);
+
+	for (i = 0; i < 4; ++i)
+		inodes[i] = mk_file(i + 1, i + 1);
+
+	/* lookups on an empty cache miss */
+	TEST_ASSERT(!is_cached(cache, 0x1000, inodes[0]));
+	check_stats(cache, 0, 0, 1, 0);
+
+	for (i = 0; i < 3; ++i)
+		inode_cache_put(cache, 0x1000 * (i + 1), inodes[i]);
+
+	check_stats(cache, 3, 0, 1, 0);
+
+	/* adding an inode that is already cached does nothing */
+	inode_cache_put(cache, 0x2000, inodes[1]);
+	check_stats(cache, 3, 0, 1, 0);
+
+	/* use the oldest one, so the second one becomes least recently used */
+	TEST_ASSERT(is_cached(cache, 0x1000, inodes[0]));
+	check_stats(cache, 3, 1, 1, 0);
+
+	inode_cache_put(cache, 0x4000, inodes[3]);
+	check_stats(cache, 3, 1, 1, 1);
+
+	TEST_ASSERT(!is_cached(cache, 0x2000, inodes[1]));
+	TEST_ASSERT(is_cached(cache, 0x4000, inodes[3]));
+	TEST_ASSERT(is_cached(cache, 0x3000, inodes[2]));
+	TEST_ASSERT(is_cached(cache, 0x1000, inodes[0]));
+	check_stats(cache, 3, 4, 2, 1);
+
+	/* the fourth one is now least recently used */
+	inode_cache_put(cache, 0x2000, inodes[1]);
+	check_stats(cache, 3, 4, 2, 2);
+
+	TEST_ASSERT(!is_cached(cache, 0x4000, inodes[3]));
+	TEST_ASSERT(is_cached(cache, 0x2000, inodes[1]));
+	TEST_ASSERT(is_cached(cache, 0x3000, inodes[2]));
+	TEST_ASSERT(is_cached(cache, 0x1000, inodes[0]));
+	check_stats(cache, 3, 7, 3, 2);
+
+	sqfs_destroy(cache);
+
+	for (i = 0; i < 4; ++i)
+		free(inodes[i]);
+}
+
+static void test_get_into(void)
+{
+	sqfs_inode_generic_t *inode, *out, *old;
+	sqfs_inode_cache_t *cache;
+	int ret;
+
+	cache = sqfs_inode_cache_create(16);
+	TEST_NOT_NULL(cache);
+
+	inode = mk_file(4, 42);
+	inode_cache_put(cache, 0x1234, inode);
+
+	/* a big enough buffer is reused and keeps its capacity */
+	out = mk_file(10, 7);
+	old = out;
+
+	ret = inode_cache_get(cache, 0x1234, &out);
+	TEST_EQUAL_I(ret, 0);
+	TEST_ASSERT(out == old);
+	TEST_EQUAL_UI(out->payload_bytes_available, 10 * sizeof(sqfs_u32));
+	TEST_EQUAL_UI(out->payload_bytes_used, 4 * sizeof(sqfs_u32));
+	TEST_EQUAL_UI(out->base.inode_number, 42);
+	TEST_ASSERT(memcmp(out->extra, inode->extra,
+			   4 * sizeof(sqfs_u32)) == 0);
+
+	/* a miss leaves the buffer alone */
+	ret = inode_cache_get(cache, 0x4321, &out);
+	TEST_ASSERT(ret > 0);
+	TEST_ASSERT(out == old);
+	TEST_EQUAL_UI(out->base.inode_number, 42);
+	free(out);
+
+	/* a buffer that is too small is grown */
+	out = mk_file(1, 7);
+
+	ret = inode_cache_get(cache, 0x1234, &out);
+	TEST_EQUAL_I(ret, 0);
+	TEST_NOT_NULL(out);
+	TEST_EQUAL_UI(out->payload_bytes_available, 4 * sizeof(sqfs_u32));
+	TEST_EQUAL_UI(out->payload_bytes_used, 4 * sizeof(sqfs_u32));
+	TEST_ASSERT(memcmp(out->extra, inode->extra,
+			   4 * sizeof(sqfs_u32)) == 0);
+	free(out);
+
+	check_stats(cache, 1, 2, 1, 0);
+	sqfs_destroy(cache);
+	free(inode);
+}
+
+static void test_slink(void)
+{
+	sqfs_inode_generic_t *inode, *out;
+	sqfs_inode_cache_t *cache;
+	size_t len = strlen(TARGET);
+	int ret;
+
+	cache = sqfs_inode_cache_create(16);
+	TEST_NOT_NULL(cache);
+
+	inode = mk_slink(3);
+	inode_cache_put(cache, 0x20, inode);
+
+	/* the cached copy is not affected by changes to the original */
+	memset(inode->extra, 'X', len + 1);
+
+	/* a fresh copy */
+	out = NULL;
+	ret = inode_cache_get(cache, 0x20, &out);
+	TEST_EQUAL_I(ret, 0);
+	TEST_NOT_NULL(out);
+	TEST_EQUAL_UI(out->payload_bytes_used, len);
+	TEST_EQUAL_UI(out->payload_bytes_available, len + 1);
+	TEST_STR_EQUAL((const char *)out->extra, TARGET);
+	free(out);
+
+	/* room for the target but not the terminator, must be grown */
+	out = calloc(1, sizeof(*out) + len);
+	TEST_NOT_NULL(out);
+	out->payload_bytes_available = len;
+	memset(out->extra, 'X', len);
+
+	ret = inode_cache_get(cache, 0x20, &out);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(out->payload_bytes_available, len + 1);
+	TEST_STR_EQUAL((const char *)out->extra, TARGET);
+	free(out);
+
+	/* a reused buffer gets the terminator as well */
+	out = calloc(1, sizeof(*out) + 2 * len);
+	TEST_NOT_NULL(out);
+	out->payload_bytes_available = 2 * len;
+	memset(out->extra, 'X', 2 * len);
+
+	ret = inode_cache_get(cache, 0x20, &out);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(out->payload_bytes_available, 2 * len);
+	TEST_STR_EQUAL((const char *)out->extra, TARGET);
+	free(out);
+
+	sqfs_destroy(cache);
+	free(inode);
+}
+
+#ifdef WITH_PTHREAD
+typedef struct {
+	sqfs_inode_cache_t *cache;
+	const sqfs_inode_generic_t *inode;
+	sqfs_u32 seed;
+} worker_t;
+
+/* look up inodes in a random order, add them to the cache on a miss */
+static void *lookup_worker(void *arg)
+{
+	sqfs_inode_generic_t *out = NULL;
+	worker_t *w = arg;
+	sqfs_u64 ref;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < NUM_LOOKUPS; ++i) {
+		w->seed = w->seed * 1103515245 + 12345;
+		ref = (((w->seed >> 16) % NUM_REFS) + 1) * 0x100;
+
+		ret = inode_cache_get(w->cache, ref, &out);
+		TEST_ASSERT(ret >= 0);
+
+		if (ret > 0)
+			inode_cache_put(w->cache, ref, w->inode);
+	}
+
+	free(out);
+	return NULL;
+}
+
+/* statistics taken while other threads use the cache are consistent */
+static void test_threads(void)
+{
+	sqfs_inode_cache_stats_t stats;
+	pthread_t threads[NUM_THREADS];
+	worker_t workers[NUM_THREADS];
+	sqfs_inode_cache_t *cache;
+	sqfs_inode_generic_t *inode;
+	sqfs_u64 lookups = 0;
+	size_t i;
+	int ret;
+
+	cache = sqfs_inode_cache_create(NUM_REFS / 2);
+	TEST_NOT_NULL(cache);
+	inode = mk_file(8, 1);
+
+	for (i = 0; i < NUM_THREADS; ++i) {
+		workers[i].cache = cache;
+		workers[i].inode = inode;
+		workers[i].seed = i + 1;
+
+		ret = pthread_create(threads + i, NULL, lookup_worker,
+				     workers + i);
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	do {
+		sqfs_inode_cache_get_stats(cache, &stats);
+		TEST_EQUAL_UI(stats.size, sizeof(stats));
+		TEST_EQUAL_UI(stats.max_inodes, NUM_REFS / 2);
+		TEST_ASSERT(stats.inode_count <= stats.max_inodes);
+		TEST_ASSERT(stats.hit_count + stats.miss_count >= lookups);
+		TEST_ASSERT(stats.inode_count + stats.evict_count <=
+			    stats.miss_count);
+
+		lookups = stats.hit_count + stats.miss_count;
+	} while (lookups < NUM_THREADS * NUM_LOOKUPS);
+
+	for (i = 0; i < NUM_THREADS; ++i)
+		THREAD_JOIN(threads[i]);
+
+	sqfs_inode_cache_get_stats(cache, &stats);
+	TEST_EQUAL_UI(stats.hit_count + stats.miss_count,
+		      NUM_THREADS * NUM_LOOKUPS);
+	TEST_EQUAL_UI(stats.inode_count, NUM_REFS / 2);
+
+	sqfs_destroy(cache);
+	free(inode);
+}
+#endif
+
+int main(void)
+{
+	TEST_NULL(sqfs_inode_cache_create(0));
+
+	test_lru();
+	test_get_into();
+	test_slink();
+#ifdef WITH_PTHREAD
+	test_threads();
+#endif
+	return EXIT_SUCCESS;
+}
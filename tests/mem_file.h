@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * mem_file.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef MEM_FILE_H
+#define MEM_FILE_H
+
+#include "sqfs/error.h"
+#include "sqfs/io.h"
+#include "test.h"
+
+/*
+  A file backed by a fixed size buffer. Reads are bounded by the current
+  size, writes by the buffer capacity. Gaps from writing or truncating past
+  the end are filled with zeros.
+ */
+typedef struct {
+	sqfs_file_t base;
+	sqfs_u8 *data;
+	size_t capacity;
+	sqfs_u64 size;
+} mem_file_t;
+
+static ATTRIB_UNUSED int mem_file_read_at(sqfs_file_t *base, sqfs_u64 offset,
+					  void *buffer, size_t size)
+{
+	mem_file_t *file = (mem_file_t *)base;
+
+	if (offset > file->size || size > (file->size - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(buffer, file->data + offset, size);
+	return 0;
+}
+
+static ATTRIB_UNUSED int mem_file_write_at(sqfs_file_t *base, sqfs_u64 offset,
+					   const void *buffer, size_t size)
+{
+	mem_file_t *file = (mem_file_t *)base;
+
+	if (offset > file->capacity || size > (file->capacity - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if (offset > file->size)
+		memset(file->data + file->size, 0, offset - file->size);
+
+	memcpy(file->data + offset, buffer, size);
+
+	if (offset + size > file->size)
+		file->size = offset + size;
+	return 0;
+}
+
+static ATTRIB_UNUSED sqfs_u64 mem_file_get_size(const sqfs_file_t *base)
+{
+	return ((const mem_file_t *)base)->size;
+}
+
+static ATTRIB_UNUSED int mem_file_truncate(sqfs_file_t *base, sqfs_u64 size)
+{
+	mem_file_t *file = (mem_file_t *)base;
+
+	if (size > file->capacity)
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if (size > file->size)
+		memset(file->data + file->size, 0, size - file->size);
+
+	file->size = size;
+	return 0;
+}
+
+static ATTRIB_UNUSED void mem_file_init(mem_file_t *file, void *data,
+					size_t capacity, sqfs_u64 size)
+{
+	memset(file, 0, sizeof(*file));
+	file->base.read_at = mem_file_read_at;
+	file->base.write_at = mem_file_write_at;
+	file->base.get_size = mem_file_get_size;
+	file->base.truncate = mem_file_truncate;
+	file->data = data;
+	file->capacity = capacity;
+	file->size = size;
+}
+
+#endif /* MEM_FILE_H */
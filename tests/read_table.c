@@ -0,0 +1,236 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * read_table.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "common.h"
+#include "mem_file.h"
+
+/* many more blocks than needed to split the table up into tasks */
+#define TABLE_SIZE (100 * SQFS_META_BLOCK_SIZE + 1000)
+#define BLOCK_COUNT (TABLE_SIZE / SQFS_META_BLOCK_SIZE + 1)
+#define MAX_IMAGE_SIZE (4 * TABLE_SIZE)
+
+/* junk between scattered blocks */
+#define GAP_SIZE (13)
+
+static sqfs_u8 image[MAX_IMAGE_SIZE];
+
+/*
+  Runs tasks right away, on the calling thread. If refuse is set, the
+  caller has to run them itself.
+ */
+typedef struct {
+	sqfs_executor_t base;
+	bool refuse;
+	size_t submitted;
+} inline_executor_t;
+
+static int inline_submit(sqfs_executor_t *base, void (*task)(void *arg),
+			 void *arg)
+{
+	inline_executor_t *exec = (inline_executor_t *)base;
+
+	exec->submitted += 1;
+	if (exec->refuse)
+		return -1;
+
+	task(arg);
+	return 0;
+}
+
+/* every third block is noise that does not compress */
+static void fill_table(sqfs_u8 *data)
+{
+	sqfs_u32 state = 0xDEADBEEF;
+	size_t i;
+
+	for (i = 0; i < TABLE_SIZE; ++i) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+
+		if ((i / SQFS_META_BLOCK_SIZE) % 3 == 0) {
+			data[i] = state & 0xFF;
+		} else {
+			data[i] = 'A' + (state % 4);
+		}
+	}
+}
+
+static sqfs_compressor_t *create_compressor(sqfs_u16 flags)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp;
+	int id;
+
+	for (id = SQFS_COMP_MIN; id <= SQFS_COMP_MAX; ++id) {
+		if (sqfs_compressor_config_init(&cfg, id,
+						SQFS_META_BLOCK_SIZE, flags)) {
+			continue;
+		}
+
+		if (sqfs_compressor_create(&cfg, &cmp) == 0)
+			return cmp;
+	}
+
+	return NULL;
+}
+
+/*
+  Copy the meta data blocks of a table to the end of the file, with junk in
+  between, either in reverse order or in order with the location list in
+  front of them. Neither is a single span that can be read at once.
+ */
+static sqfs_u64 scatter_table(mem_file_t *file, sqfs_u64 location,
+			      bool reverse)
+{
+	sqfs_u64 locations[BLOCK_COUNT], list, old;
+	sqfs_u8 junk[GAP_SIZE];
+	size_t i, idx, size;
+	sqfs_u16 header;
+	int ret;
+
+	memset(junk, 0xA5, sizeof(junk));
+	list = file->size;
+
+	if (!reverse)
+		file->size += sizeof(locations);
+
+	for (i = 0; i < BLOCK_COUNT; ++i) {
+		idx = reverse ? (BLOCK_COUNT - 1 - i) : i;
+
+		memcpy(&old, file->data + location + idx * sizeof(old),
+		       sizeof(old));
+		memcpy(&header, file->data + le64toh(old), sizeof(header));
+		size = (le16toh(header) & 0x7FFF) + 2;
+
+		ret = mem_file_write_at(&file->base, file->size, junk,
+					sizeof(junk));
+		TEST_EQUAL_I(ret, 0);
+
+		locations[idx] = htole64(file->size);
+
+		ret = mem_file_write_at(&file->base, file->size,
+					file->data + le64toh(old), size);
+		TEST_EQUAL_I(ret, 0);
+	}
+
+	if (reverse)
+		list = file->size;
+
+	ret = mem_file_write_at(&file->base, list, locations,
+				sizeof(locations));
+	TEST_EQUAL_I(ret, 0);
+	return list;
+}
+
+static void check_read(mem_file_t *file, sqfs_compressor_t *cmp,
+		       sqfs_u64 location, sqfs_executor_t *exec,
+		       const sqfs_u8 *expect)
+{
+	void *data;
+	int ret;
+
+	ret = sqfs_read_table_exec(&file->base, cmp, TABLE_SIZE, location, 0,
+				   file->size, exec, &data);
+	TEST_EQUAL_I(ret, 0);
+	TEST_NOT_NULL(data);
+	TEST_ASSERT(memcmp(data, expect, TABLE_SIZE) == 0);
+	free(data);
+}
+
+int main(void)
+{
+	sqfs_compressor_t *cmp, *uncmp;
+	sqfs_u8 *table, *reference;
+	inline_executor_t exec;
+	sqfs_executor_t *pool;
+	sqfs_u64 location;
+	mem_file_t file;
+	void *data;
+	int ret;
+
+	table = malloc(TABLE_SIZE);
+	TEST_NOT_NULL(table);
+	fill_table(table);
+
+	cmp = create_compressor(0);
+	TEST_NOT_NULL(cmp);
+	uncmp = create_compressor(SQFS_COMP_FLAG_UNCOMPRESS);
+	TEST_NOT_NULL(uncmp);
+
+	/* write the table behind some junk, like a real image would */
+	mem_file_init(&file, image, sizeof(image), 96);
+
+	ret = sqfs_write_table(&file.base, cmp, table, TABLE_SIZE, &location);
+	TEST_EQUAL_I(ret, 0);
+	TEST_LESS_THAN_UI(file.size, TABLE_SIZE);
+
+	/* the reference, read sequentially */
+	ret = sqfs_read_table(&file.base, uncmp, TABLE_SIZE, location, 0,
+			      file.size, (void **)&reference);
+	TEST_EQUAL_I(ret, 0);
+	TEST_NOT_NULL(reference);
+	TEST_ASSERT(memcmp(reference, table, TABLE_SIZE) == 0);
+
+	check_read(&file, uncmp, location, NULL, reference);
+
+	/* split up into tasks that run on the calling thread */
+	memset(&exec, 0, sizeof(exec));
+	exec.base.size = sizeof(exec.base);
+	exec.base.concurrency = 4;
+	exec.base.submit = inline_submit;
+
+	check_read(&file, uncmp, location, &exec.base, reference);
+#ifdef WITH_PTHREAD
+	TEST_EQUAL_UI(exec.submitted, 3);
+#endif
+
+	/* tasks that cannot be submitted are run by the caller */
+	exec.refuse = true;
+	exec.submitted = 0;
+
+	check_read(&file, uncmp, location, &exec.base, reference);
+#ifdef WITH_PTHREAD
+	TEST_EQUAL_UI(exec.submitted, 3);
+#endif
+
+	/* an actual thread pool */
+	pool = thread_pool_create(4);
+	TEST_NOT_NULL(pool);
+
+	check_read(&file, uncmp, location, pool, reference);
+	check_read(&file, uncmp, location, pool, reference);
+	thread_pool_destroy(pool);
+
+	/* blocks that are not stored back to back go through a meta reader */
+	location = scatter_table(&file, location, true);
+
+	exec.refuse = false;
+	exec.submitted = 0;
+	check_read(&file, uncmp, location, &exec.base, reference);
+	TEST_EQUAL_UI(exec.submitted, 0);
+	check_read(&file, uncmp, location, NULL, reference);
+
+	location = scatter_table(&file, location, false);
+
+	check_read(&file, uncmp, location, &exec.base, reference);
+	TEST_EQUAL_UI(exec.submitted, 0);
+	check_read(&file, uncmp, location, NULL, reference);
+
+	/* invalid executors are rejected */
+	exec.base.size = 0;
+	ret = sqfs_read_table_exec(&file.base, uncmp, TABLE_SIZE, location, 0,
+				   file.size, &exec.base, &data);
+	TEST_EQUAL_I(ret, SQFS_ERROR_ARG_INVALID);
+
+	sqfs_destroy(uncmp);
+	sqfs_destroy(cmp);
+	free(reference);
+	free(table);
+	return EXIT_SUCCESS;
+}
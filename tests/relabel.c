@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * relabel.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "mkfs.h"
+#include "test.h"
+
+/* more nodes than fit into a single batch */
+#define NUM_DIRS (10)
+#define FILES_PER_DIR (600)
+
+static const char *fail_path = NULL;
+
+/*
+  Every directory gets a label of its own, files share the label of the top
+  level directory they are in.
+ */
+static void get_label(char *buffer, const char *path, unsigned int mode)
+{
+	const char *end;
+
+	if (S_ISDIR(mode)) {
+		sprintf(buffer, "system_u:object_r:dir_t:%s", path);
+		return;
+	}
+
+	end = strchr(path + 1, '/');
+	sprintf(buffer, "system_u:object_r:file_t:%.*s",
+		(int)(end - path), path);
+}
+
+/* replacements for the libselinux wrappers, called from worker threads */
+char *selinux_get_context(void *sehnd, const char *path, unsigned int mode)
+{
+	char buffer[128];
+	(void)sehnd;
+
+	if (fail_path != NULL && strcmp(path, fail_path) == 0) {
+		errno = EACCES;
+		return NULL;
+	}
+
+	get_label(buffer, path, mode);
+	return strdup(buffer);
+}
+
+int selinux_add_context(sqfs_xattr_writer_t *xwr, const tree_node_t *node,
+			const char *context)
+{
+	(void)node;
+	return sqfs_xattr_writer_add(xwr, "security.selinux",
+				     context, strlen(context));
+}
+
+static void build_tree(fstree_t *fs)
+{
+	char path[64];
+	struct stat sb;
+	size_t i, j;
+
+	TEST_ASSERT(fstree_init(fs, NULL) == 0);
+	memset(&sb, 0, sizeof(sb));
+
+	for (i = 0; i < NUM_DIRS; ++i) {
+		sprintf(path, "d%u", (unsigned int)i);
+		sb.st_mode = S_IFDIR | 0755;
+		TEST_NOT_NULL(fstree_add_generic(fs, path, &sb, NULL));
+
+		for (j = 0; j < FILES_PER_DIR; ++j) {
+			sprintf(path, "d%u/f%u", (unsigned int)i,
+				(unsigned int)j);
+			sb.st_mode = S_IFREG | 0644;
+			TEST_NOT_NULL(fstree_add_generic(fs, path, &sb, NULL));
+		}
+	}
+}
+
+/* nodes with the same label share an xattr block, all others do not */
+static size_t check_labels(tree_node_t *n, tree_node_t **first, size_t count)
+{
+	char label[128], other[128], *path, *opath;
+	size_t i;
+
+	path = fstree_get_path(n);
+	TEST_NOT_NULL(path);
+	get_label(label, path, n->mode);
+
+	for (i = 0; i < count; ++i) {
+		opath = fstree_get_path(first[i]);
+		TEST_NOT_NULL(opath);
+		get_label(other, opath, first[i]->mode);
+		free(opath);
+
+		if (strcmp(label, other) == 0) {
+			TEST_EQUAL_UI(n->xattr_idx, first[i]->xattr_idx);
+			break;
+		}
+
+		TEST_ASSERT(n->xattr_idx != first[i]->xattr_idx);
+	}
+
+	free(path);
+
+	if (i == count)
+		first[count++] = n;
+
+	if (S_ISDIR(n->mode)) {
+		for (n = n->data.dir.children; n != NULL; n = n->next)
+			count = check_labels(n, first, count);
+	}
+
+	return count;
+}
+
+static void compare_trees(const tree_node_t *a, const tree_node_t *b)
+{
+	TEST_STR_EQUAL(a->name, b->name);
+	TEST_EQUAL_UI(a->xattr_idx, b->xattr_idx);
+
+	if (S_ISDIR(a->mode)) {
+		a = a->data.dir.children;
+		b = b->data.dir.children;
+
+		while (a != NULL && b != NULL) {
+			compare_trees(a, b);
+			a = a->next;
+			b = b->next;
+		}
+
+		TEST_NULL(a);
+		TEST_NULL(b);
+	}
+}
+
+int main(void)
+{
+	tree_node_t *first[2 * NUM_DIRS + 1];
+	sqfs_xattr_writer_t *xwr, *xwr_par;
+	sqfs_executor_t *pool;
+	fstree_t fs, fs_par;
+	int ret;
+
+	pool = thread_pool_create(4);
+	TEST_NOT_NULL(pool);
+
+	/* labeling in parallel gives the same result */
+	build_tree(&fs);
+	xwr = sqfs_xattr_writer_create();
+	TEST_NOT_NULL(xwr);
+
+	ret = relabel_tree("test", xwr, fs.root, NULL, NULL);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(check_labels(fs.root, first, 0), 2 * NUM_DIRS + 1);
+
+	build_tree(&fs_par);
+	xwr_par = sqfs_xattr_writer_create();
+	TEST_NOT_NULL(xwr_par);
+
+	ret = relabel_tree("test", xwr_par, fs_par.root, NULL, pool);
+	TEST_EQUAL_I(ret, 0);
+	compare_trees(fs.root, fs_par.root);
+
+	sqfs_destroy(xwr_par);
+	fstree_cleanup(&fs_par);
+
+	/* a failed lookup in a worker is reported */
+	fail_path = "/d7/f123";
+
+	build_tree(&fs_par);
+	xwr_par = sqfs_xattr_writer_create();
+	TEST_NOT_NULL(xwr_par);
+
+	ret = relabel_tree("test", xwr_par, fs_par.root, NULL, pool);
+	TEST_EQUAL_I(ret, -1);
+	ret = relabel_tree("test", xwr_par, fs_par.root, NULL, NULL);
+	TEST_EQUAL_I(ret, -1);
+
+	sqfs_destroy(xwr_par);
+	fstree_cleanup(&fs_par);
+
+	thread_pool_destroy(pool);
+	sqfs_destroy(xwr);
+	fstree_cleanup(&fs);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,245 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * sparse_file.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "common.h"
+#include "mem_file.h"
+
+#define BLOCK_SIZE (4096)
+#define BLOCK_COUNT (11)
+#define FILE_SIZE (10 * BLOCK_SIZE + 123)
+
+/*
+  Data in the middle of a block, across a block boundary, covering an
+  entire block and near the end. Blocks 1, 4 to 6, 8 and the tail end are
+  holes.
+ */
+static sparse_map_t map[] = {
+	{ map + 1, 100, 50 },
+	{ map + 2, 3 * BLOCK_SIZE - 10, 30 },
+	{ map + 3, 7 * BLOCK_SIZE, BLOCK_SIZE },
+	{ NULL, 9 * BLOCK_SIZE + 5, 20 },
+};
+
+static sqfs_u8 expanded[FILE_SIZE];
+static sqfs_u8 image[2 * FILE_SIZE];
+
+static FILE *create_condensed(void)
+{
+	const sparse_map_t *it;
+	sqfs_u64 i;
+	FILE *fp;
+
+	memset(expanded, 0, sizeof(expanded));
+
+	fp = tmpfile();
+	TEST_NOT_NULL(fp);
+
+	for (it = map; it != NULL; it = it->next) {
+		for (i = it->offset; i < it->offset + it->count; ++i) {
+			expanded[i] = (i * 13) % 251 + 1;
+			TEST_ASSERT(fputc(expanded[i], fp) != EOF);
+		}
+	}
+
+	TEST_ASSERT(fflush(fp) == 0);
+	rewind(fp);
+	return fp;
+}
+
+static void check_range(sqfs_file_t *file, sqfs_u64 offset, size_t size)
+{
+	static sqfs_u8 buffer[FILE_SIZE];
+	int ret;
+
+	memset(buffer, 0xAA, size);
+
+	ret = file->read_at(file, offset, buffer, size);
+	TEST_EQUAL_I(ret, 0);
+	TEST_ASSERT(memcmp(buffer, expanded + offset, size) == 0);
+}
+
+static void test_reader(void)
+{
+	sqfs_file_t *file;
+	sqfs_u64 offset;
+	size_t diff;
+	FILE *fp;
+
+	/* sequential reads that do not line up with the map */
+	fp = create_condensed();
+	file = sqfs_get_stdin_file(fp, map, FILE_SIZE);
+	TEST_NOT_NULL(file);
+	TEST_EQUAL_UI(file->get_size(file), FILE_SIZE);
+
+	for (offset = 0; offset < FILE_SIZE; offset += diff) {
+		diff = 1000;
+		if (diff > FILE_SIZE - offset)
+			diff = FILE_SIZE - offset;
+
+		check_range(file, offset, diff);
+	}
+
+	sqfs_destroy(file);
+	fclose(fp);
+
+	/* skipping ahead, the input has to be consumed up to the target */
+	fp = create_condensed();
+	file = sqfs_get_stdin_file(fp, map, FILE_SIZE);
+	TEST_NOT_NULL(file);
+
+	check_range(file, 7 * BLOCK_SIZE + 100, 200);
+	check_range(file, 9 * BLOCK_SIZE, BLOCK_SIZE);
+	check_range(file, 10 * BLOCK_SIZE, 123);
+
+	sqfs_destroy(file);
+	fclose(fp);
+}
+
+static sqfs_compressor_t *create_compressor(void)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp;
+	int id;
+
+	for (id = SQFS_COMP_MIN; id <= SQFS_COMP_MAX; ++id) {
+		if (sqfs_compressor_config_init(&cfg, id, BLOCK_SIZE, 0))
+			continue;
+
+		if (sqfs_compressor_create(&cfg, &cmp) == 0)
+			return cmp;
+	}
+
+	return NULL;
+}
+
+static int pack_file(const sparse_map_t *smap, sqfs_u64 size,
+		     sqfs_inode_generic_t **inode)
+{
+	sqfs_block_processor_t *proc;
+	sqfs_block_writer_t *wr;
+	sqfs_frag_table_t *tbl;
+	sqfs_compressor_t *cmp;
+	sqfs_file_t *file;
+	mem_file_t out;
+	int ret, err;
+	FILE *fp;
+
+	mem_file_init(&out, image, sizeof(image), 96);
+
+	cmp = create_compressor();
+	TEST_NOT_NULL(cmp);
+	wr = sqfs_block_writer_create(&out.base, 0, 0);
+	TEST_NOT_NULL(wr);
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+	proc = sqfs_block_processor_create(BLOCK_SIZE, cmp, 1, 10, wr, tbl);
+	TEST_NOT_NULL(proc);
+
+	fp = create_condensed();
+	file = sqfs_get_stdin_file(fp, smap, size);
+	TEST_NOT_NULL(file);
+
+	ret = write_data_from_file_condensed("sparse", proc, inode, file, smap,
+					     SQFS_BLK_DONT_COMPRESS |
+					     SQFS_BLK_DONT_FRAGMENT);
+	if (ret == 0) {
+		err = sqfs_block_processor_finish(proc);
+		TEST_EQUAL_I(err, 0);
+	}
+
+	sqfs_destroy(file);
+	fclose(fp);
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+	sqfs_destroy(wr);
+	sqfs_destroy(cmp);
+	return ret;
+}
+
+static void test_packing(void)
+{
+	static sqfs_u8 buffer[FILE_SIZE];
+	sqfs_inode_generic_t *inode = NULL;
+	sqfs_data_reader_t *rd;
+	sqfs_u64 size;
+	mem_file_t in;
+	size_t i;
+	int ret;
+
+	ret = pack_file(map, FILE_SIZE, &inode);
+	TEST_EQUAL_I(ret, 0);
+	TEST_NOT_NULL(inode);
+
+	sqfs_inode_get_file_size(inode, &size);
+	TEST_EQUAL_UI(size, FILE_SIZE);
+	TEST_EQUAL_UI(sqfs_inode_get_file_block_count(inode), BLOCK_COUNT);
+
+	/* holes are never stored, not even the partial tail end block */
+	for (i = 0; i < BLOCK_COUNT; ++i) {
+		if (i == 0 || i == 2 || i == 3 || i == 7 || i == 9) {
+			TEST_EQUAL_UI(inode->extra[i], BLOCK_SIZE | (1 << 24));
+		} else {
+			TEST_EQUAL_UI(inode->extra[i], 0);
+		}
+	}
+
+	TEST_EQUAL_UI(inode->base.type, SQFS_INODE_EXT_FILE);
+	TEST_EQUAL_UI(inode->data.file_ext.sparse,
+		      5 * BLOCK_SIZE + (FILE_SIZE - 10 * BLOCK_SIZE));
+
+	/* read the packed data back */
+	mem_file_init(&in, image, sizeof(image), sizeof(image));
+	rd = sqfs_data_reader_create(&in.base, BLOCK_SIZE, NULL);
+	TEST_NOT_NULL(rd);
+
+	memset(buffer, 0xAA, sizeof(buffer));
+	TEST_EQUAL_I(sqfs_data_reader_read(rd, inode, 0, buffer, FILE_SIZE),
+		     FILE_SIZE);
+	TEST_ASSERT(memcmp(buffer, expanded, FILE_SIZE) == 0);
+
+	sqfs_destroy(rd);
+	free(inode);
+}
+
+static void test_broken_map(const sparse_map_t *smap)
+{
+	sqfs_inode_generic_t *inode = NULL;
+
+	TEST_ASSERT(pack_file(smap, FILE_SIZE, &inode) != 0);
+	free(inode);
+}
+
+int main(void)
+{
+	sparse_map_t broken[2];
+
+	test_reader();
+	test_packing();
+
+	/* an empty entry past the end of the file */
+	broken[0].next = NULL;
+	broken[0].offset = FILE_SIZE + 1;
+	broken[0].count = 0;
+	test_broken_map(broken);
+
+	/* data past the end of the file */
+	broken[0].offset = FILE_SIZE - 10;
+	broken[0].count = 20;
+	test_broken_map(broken);
+
+	/* overlapping entries */
+	broken[0].next = broken + 1;
+	broken[0].offset = 100;
+	broken[0].count = 50;
+	broken[1].next = NULL;
+	broken[1].offset = 120;
+	broken[1].count = 50;
+	test_broken_map(broken);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * tar_bench.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "tar.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+int main(int argc, char **argv)
+{
+	unsigned long i, iterations = 1, count = 0;
+	tar_header_decoded_t hdr;
+	sqfs_u64 size;
+	double seconds;
+	clock_t start;
+	FILE *fp;
+	int ret;
+
+	if (argc != 2 && argc != 3) {
+		fputs("usage: tar_bench <tarball> [iterations]\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (argc == 3) {
+		iterations = strtoul(argv[2], NULL, 10);
+		if (iterations == 0)
+			iterations = 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	setvbuf(fp, NULL, _IOFBF, 1024 * 1024);
+
+	start = clock();
+
+	for (i = 0; i < iterations; ++i) {
+		if (fseek(fp, 0, SEEK_SET) != 0) {
+			perror(argv[1]);
+			goto fail;
+		}
+
+		for (;;) {
+			ret = read_header(fp, &hdr);
+			if (ret > 0)
+				break;
+			if (ret < 0)
+				goto fail;
+
+			size = hdr.record_size;
+			if (size % 512)
+				size += 512 - size % 512;
+
+			ret = fseek(fp, size, SEEK_CUR);
+
+			clear_header(&hdr);
+			if (ret < 0)
+				goto fail;
+
+			++count;
+		}
+	}
+
+	seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	printf("%lu headers in %.3f seconds", count, seconds);
+	if (seconds > 0.0)
+		printf(", %.0f headers/second", (double)count / seconds);
+	fputc('\n', stdout);
+
+	fclose(fp);
+	return EXIT_SUCCESS;
+fail:
+	fclose(fp);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,211 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * xattr_reader.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/xattr_reader.h"
+#include "sqfs/xattr_writer.h"
+#include "sqfs/compressor.h"
+#include "sqfs/block.h"
+#include "sqfs/super.h"
+#include "sqfs/xattr.h"
+#include "mem_file.h"
+
+/* more sets than the reader caches */
+#define NUM_SETS (40)
+#define MAX_IMAGE_SIZE (64 * 1024)
+
+/* shared by all sets, so the writer stores it out of line */
+#define LABEL "system_u:object_r:some_rather_long_file_label_t:s0"
+
+static const sqfs_u8 binary[] = { 0x00, 'a', 0x00, 'b' };
+
+static sqfs_u8 image[MAX_IMAGE_SIZE];
+
+static sqfs_compressor_t *create_compressor(sqfs_u16 flags)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp;
+	int id;
+
+	for (id = SQFS_COMP_MIN; id <= SQFS_COMP_MAX; ++id) {
+		if (sqfs_compressor_config_init(&cfg, id,
+						SQFS_META_BLOCK_SIZE, flags)) {
+			continue;
+		}
+
+		if (sqfs_compressor_create(&cfg, &cmp) == 0)
+			return cmp;
+	}
+
+	return NULL;
+}
+
+static void add_pair(sqfs_xattr_writer_t *xwr, const char *key,
+		     const void *value, size_t size)
+{
+	int ret = sqfs_xattr_writer_add(xwr, key, value, size);
+	TEST_EQUAL_I(ret, 0);
+}
+
+/* every set has a unique index key, odd ones also a binary value */
+static sqfs_u32 write_set(sqfs_xattr_writer_t *xwr, unsigned int i)
+{
+	char number[16];
+	sqfs_u32 idx;
+	int ret;
+
+	sprintf(number, "%u", i);
+
+	ret = sqfs_xattr_writer_begin(xwr);
+	TEST_EQUAL_I(ret, 0);
+
+	add_pair(xwr, "user.index", number, strlen(number));
+	add_pair(xwr, "security.selinux", LABEL, strlen(LABEL));
+
+	if (i % 2)
+		add_pair(xwr, "trusted.binary", binary, sizeof(binary));
+
+	ret = sqfs_xattr_writer_end(xwr, &idx);
+	TEST_EQUAL_I(ret, 0);
+	return idx;
+}
+
+static const sqfs_xattr_pair_t *find_pair(const sqfs_xattr_set_t *set,
+					  const char *key)
+{
+	sqfs_u32 i;
+
+	for (i = 0; i < set->count; ++i) {
+		if (strcmp(set->pairs[i].key, key) == 0)
+			return set->pairs + i;
+	}
+
+	return NULL;
+}
+
+static void check_pair(const sqfs_xattr_set_t *set, const char *key,
+		       sqfs_u16 type, const void *value, size_t size)
+{
+	const sqfs_xattr_pair_t *pair = find_pair(set, key);
+
+	TEST_NOT_NULL(pair);
+	TEST_EQUAL_UI(pair->type, type);
+	TEST_EQUAL_UI(pair->value_size, size);
+	TEST_ASSERT(memcmp(pair->value, value, size) == 0);
+	TEST_EQUAL_UI(pair->value[size], 0);
+}
+
+static void check_set(sqfs_xattr_reader_t *xr, sqfs_u32 idx, unsigned int i)
+{
+	const sqfs_xattr_set_t *set, *again;
+	char number[16];
+	int ret;
+
+	ret = sqfs_xattr_reader_get_set(xr, idx, &set);
+	TEST_EQUAL_I(ret, 0);
+	TEST_NOT_NULL(set);
+	TEST_EQUAL_UI(set->index, idx);
+	TEST_EQUAL_UI(set->count, (i % 2) ? 3 : 2);
+
+	sprintf(number, "%u", i);
+	check_pair(set, "user.index", SQFS_XATTR_USER, number, strlen(number));
+	check_pair(set, "security.selinux", SQFS_XATTR_SECURITY,
+		   LABEL, strlen(LABEL));
+
+	if (i % 2) {
+		check_pair(set, "trusted.binary", SQFS_XATTR_TRUSTED,
+			   binary, sizeof(binary));
+	} else {
+		TEST_NULL(find_pair(set, "trusted.binary"));
+	}
+
+	/* a second lookup is served from the cache */
+	ret = sqfs_xattr_reader_get_set(xr, idx, &again);
+	TEST_EQUAL_I(ret, 0);
+	TEST_ASSERT(again == set);
+}
+
+int main(void)
+{
+	sqfs_u32 idx[NUM_SETS];
+	const sqfs_xattr_set_t *set;
+	sqfs_xattr_reader_t *xr, *copy;
+	sqfs_xattr_writer_t *xwr;
+	sqfs_compressor_t *cmp, *uncmp;
+	sqfs_super_t super;
+	mem_file_t file;
+	unsigned int i;
+	int ret;
+
+	cmp = create_compressor(0);
+	TEST_NOT_NULL(cmp);
+
+	uncmp = create_compressor(SQFS_COMP_FLAG_UNCOMPRESS);
+	TEST_NOT_NULL(uncmp);
+
+	/* write the xattr tables behind some junk, like a real image would */
+	mem_file_init(&file, image, sizeof(image), 96);
+	memset(&super, 0, sizeof(super));
+
+	xwr = sqfs_xattr_writer_create();
+	TEST_NOT_NULL(xwr);
+
+	for (i = 0; i < NUM_SETS; ++i)
+		idx[i] = write_set(xwr, i);
+
+	/* identical sets are stored only once */
+	TEST_EQUAL_UI(write_set(xwr, 5), idx[5]);
+
+	ret = sqfs_xattr_writer_flush(xwr, &file.base, &super, cmp);
+	TEST_EQUAL_I(ret, 0);
+	sqfs_destroy(xwr);
+
+	super.bytes_used = file.size;
+
+	/* read them back */
+	xr = sqfs_xattr_reader_create(0);
+	TEST_NOT_NULL(xr);
+
+	ret = sqfs_xattr_reader_load(xr, &super, &file.base, uncmp);
+	TEST_EQUAL_I(ret, 0);
+
+	for (i = 0; i < NUM_SETS; ++i)
+		check_set(xr, idx[i], i);
+
+	/* the first sets have been evicted by now and are decoded again */
+	for (i = 0; i < NUM_SETS; ++i)
+		check_set(xr, idx[i], i);
+
+	/* no extended attributes */
+	ret = sqfs_xattr_reader_get_set(xr, 0xFFFFFFFF, &set);
+	TEST_EQUAL_I(ret, 0);
+	TEST_NULL(set);
+
+	ret = sqfs_xattr_reader_get_set(xr, NUM_SETS, &set);
+	TEST_EQUAL_I(ret, SQFS_ERROR_OUT_OF_BOUNDS);
+	TEST_NULL(set);
+
+	/* a copy has a cache of its own */
+	copy = (sqfs_xattr_reader_t *)sqfs_copy((sqfs_object_t *)xr);
+	TEST_NOT_NULL(copy);
+
+	check_set(copy, idx[3], 3);
+	check_set(xr, idx[3], 3);
+	sqfs_destroy(copy);
+
+	/* re-loading drops the cached sets */
+	ret = sqfs_xattr_reader_load(xr, &super, &file.base, uncmp);
+	TEST_EQUAL_I(ret, 0);
+
+	for (i = 0; i < NUM_SETS; ++i)
+		check_set(xr, idx[i], i);
+
+	sqfs_destroy(xr);
+	sqfs_destroy(uncmp);
+	sqfs_destroy(cmp);
+	return EXIT_SUCCESS;
+}